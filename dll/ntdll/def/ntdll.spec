@@ -776,8 +776,8 @@
 771 stdcall RtlMultiAppendUnicodeStringBuffer(ptr long ptr)
 772 stdcall RtlMultiByteToUnicodeN(ptr long ptr ptr long)
 773 stdcall RtlMultiByteToUnicodeSize(ptr str long)
-# RtlMultipleAllocateHeap
-# RtlMultipleFreeHeap
+774 stdcall RtlMultipleAllocateHeap(ptr long long long ptr)
+775 stdcall RtlMultipleFreeHeap(ptr long long ptr)
 776 stdcall RtlNewInstanceSecurityObject(long long ptr ptr ptr ptr ptr long ptr ptr)
 777 stdcall RtlNewSecurityGrantedAccess(long ptr ptr ptr ptr ptr)
 778 stdcall RtlNewSecurityObject(ptr ptr ptr long ptr ptr)
@@ -2464,7 +2464,24 @@ WSPIoctl(IN  SOCKET Handle,
             Ret = NO_ERROR;
             break;
         case SIO_GET_EXTENSION_FUNCTION_POINTER:
-            Errno = WSAEINVAL;
+            if (cbInBuffer < sizeof(GUID) || IS_INTRESOURCE(lpvInBuffer) ||
+                IS_INTRESOURCE(lpvOutBuffer))
+            {
+                Errno = WSAEFAULT;
+                break;
+            }
+            if (cbOutBuffer < sizeof(PVOID))
+            {
+                cbRet = sizeof(PVOID);
+                Errno = WSAEFAULT;
+                break;
+            }
+            Errno = SockGetExtensionFunctionPointer((LPGUID)lpvInBuffer, (PVOID*)lpvOutBuffer);
+            if (Errno == NO_ERROR)
+            {
+                cbRet = sizeof(PVOID);
+                Ret = NO_ERROR;
+            }
             break;
         case SIO_ADDRESS_LIST_QUERY:
             if (IS_INTRESOURCE(lpvOutBuffer) || cbOutBuffer == 0)
@@ -2734,7 +2751,8 @@ WSPSetSockOpt(
         if (lpErrno) *lpErrno = WSAENOTSOCK;
         return SOCKET_ERROR;
     }
-    if (!optval)
+    /* SO_UPDATE_CONNECT_CONTEXT takes no value */
+    if (!optval && !(level == SOL_SOCKET && optname == SO_UPDATE_CONNECT_CONTEXT))
     {
         if (lpErrno) *lpErrno = WSAEFAULT;
         return SOCKET_ERROR;
@@ -2854,6 +2872,13 @@ WSPSetSockOpt(
               /* These go directly to the helper dll */
               goto SendToHelper;
 
+           case SO_UPDATE_ACCEPT_CONTEXT:
+           case SO_UPDATE_CONNECT_CONTEXT:
+              /* AcceptEx and ConnectEx leave the socket state to the caller */
+              Socket->SharedData->State = SocketConnected;
+              Socket->SharedData->ConnectTime = GetCurrentTimeInSeconds();
+              return NO_ERROR;
+
            default:
               /* Obviously this is a hack */
               ERR("MSAFD: Set unknown optname %x\n", optname);
@@ -0,0 +1,451 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS Ancillary Function Driver DLL
+ * FILE:        dll/win32/msafd/misc/extensions.c
+ * PURPOSE:     Microsoft Winsock extension functions
+ *              (AcceptEx, ConnectEx, DisconnectEx, TransmitFile)
+ */
+
+#include <msafd.h>
+
+/*
+ * Sends one of the extension requests to AFD. Overlapped requests complete
+ * through the I/O manager like any other socket I/O, so the event, APC and
+ * completion port notifications all work; the others are waited for here.
+ */
+static
+BOOL
+SockExtensionIoControl(PSOCKET_INFORMATION Socket,
+                       ULONG IoControlCode,
+                       PVOID InputBuffer,
+                       ULONG InputBufferLength,
+                       PVOID OutputBuffer,
+                       ULONG OutputBufferLength,
+                       LPOVERLAPPED lpOverlapped,
+                       LPDWORD BytesTransferred)
+{
+    IO_STATUS_BLOCK DummyIOSB;
+    PIO_STATUS_BLOCK IOSB;
+    PVOID APCContext;
+    HANDLE Event, SockEvent = NULL;
+    NTSTATUS Status;
+    INT Errno;
+
+    if (lpOverlapped)
+    {
+        /* A set low bit in hEvent suppresses the completion port notification */
+        APCContext = ((ULONG_PTR)lpOverlapped->hEvent & 0x1) ? NULL : lpOverlapped;
+        Event = lpOverlapped->hEvent;
+        IOSB = (PIO_STATUS_BLOCK)&lpOverlapped->Internal;
+    }
+    else
+    {
+        Status = NtCreateEvent(&SockEvent,
+                               EVENT_ALL_ACCESS,
+                               NULL,
+                               SynchronizationEvent,
+                               FALSE);
+        if (!NT_SUCCESS(Status))
+        {
+            SetLastError(WSAENOBUFS);
+            return FALSE;
+        }
+
+        APCContext = NULL;
+        Event = SockEvent;
+        IOSB = &DummyIOSB;
+    }
+
+    IOSB->Status = STATUS_PENDING;
+    IOSB->Information = 0;
+
+    /* Send IOCTL */
+    Status = NtDeviceIoControlFile((HANDLE)Socket->Handle,
+                                   Event,
+                                   NULL,
+                                   APCContext,
+                                   IOSB,
+                                   IoControlCode,
+                                   InputBuffer,
+                                   InputBufferLength,
+                                   OutputBuffer,
+                                   OutputBufferLength);
+
+    /* Wait for return */
+    if (SockEvent)
+    {
+        if (Status == STATUS_PENDING)
+        {
+            WaitForSingleObject(SockEvent, INFINITE);
+            Status = IOSB->Status;
+        }
+
+        NtClose(SockEvent);
+    }
+
+    if (BytesTransferred && Status != STATUS_PENDING && NT_SUCCESS(Status))
+        *BytesTransferred = (DWORD)IOSB->Information;
+
+    /* STATUS_PENDING turns into WSA_IO_PENDING */
+    Errno = TranslateNtStatusError(Status);
+    SetLastError(Errno);
+
+    return (Errno == NO_ERROR);
+}
+
+BOOL
+PASCAL
+WSPAcceptEx(SOCKET sListenSocket,
+            SOCKET sAcceptSocket,
+            PVOID lpOutputBuffer,
+            DWORD dwReceiveDataLength,
+            DWORD dwLocalAddressLength,
+            DWORD dwRemoteAddressLength,
+            LPDWORD lpdwBytesReceived,
+            LPOVERLAPPED lpOverlapped)
+{
+    AFD_SUPER_ACCEPT_INFO AcceptInfo;
+    PSOCKET_INFORMATION Socket, AcceptSocket;
+    DWORD BytesReceived = 0;
+    BOOL Result;
+
+    TRACE("Called (%x, %x)\n", sListenSocket, sAcceptSocket);
+
+    Socket = GetSocketStructure(sListenSocket);
+    AcceptSocket = GetSocketStructure(sAcceptSocket);
+    if (!Socket || !AcceptSocket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    if (!Socket->SharedData->Listening ||
+        AcceptSocket == Socket ||
+        AcceptSocket->SharedData->State != SocketOpen)
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    if (!lpOutputBuffer ||
+        dwLocalAddressLength < sizeof(INT) + sizeof(SOCKADDR) ||
+        dwRemoteAddressLength < sizeof(INT) + sizeof(SOCKADDR) ||
+        dwLocalAddressLength > MAXULONG - dwRemoteAddressLength ||
+        dwReceiveDataLength > MAXULONG - dwLocalAddressLength - dwRemoteAddressLength)
+    {
+        SetLastError(WSAEFAULT);
+        return FALSE;
+    }
+
+    /* AFD accepts into the given socket and waits for the first data itself */
+    AcceptInfo.AcceptHandle = (HANDLE)sAcceptSocket;
+    AcceptInfo.ReceiveDataLength = dwReceiveDataLength;
+    AcceptInfo.LocalAddressLength = dwLocalAddressLength;
+    AcceptInfo.RemoteAddressLength = dwRemoteAddressLength;
+
+    Result = SockExtensionIoControl(Socket,
+                                    IOCTL_AFD_SUPER_ACCEPT,
+                                    &AcceptInfo,
+                                    sizeof(AcceptInfo),
+                                    lpOutputBuffer,
+                                    dwReceiveDataLength +
+                                    dwLocalAddressLength +
+                                    dwRemoteAddressLength,
+                                    lpOverlapped,
+                                    &BytesReceived);
+
+    if (Result || GetLastError() == WSA_IO_PENDING)
+    {
+        /* Re-enable Async Event */
+        SockReenableAsyncSelectEvent(Socket, FD_ACCEPT);
+    }
+
+    if (!Result)
+        return FALSE;
+
+    /* Overlapped callers update the state with SO_UPDATE_ACCEPT_CONTEXT */
+    AcceptSocket->SharedData->State = SocketConnected;
+    AcceptSocket->SharedData->ConnectTime = GetCurrentTimeInSeconds();
+
+    if (lpdwBytesReceived)
+        *lpdwBytesReceived = BytesReceived;
+
+    return TRUE;
+}
+
+VOID
+PASCAL
+WSPGetAcceptExSockaddrs(PVOID lpOutputBuffer,
+                        DWORD dwReceiveDataLength,
+                        DWORD dwLocalAddressLength,
+                        DWORD dwRemoteAddressLength,
+                        struct sockaddr **LocalSockaddr,
+                        LPINT LocalSockaddrLength,
+                        struct sockaddr **RemoteSockaddr,
+                        LPINT RemoteSockaddrLength)
+{
+    PUCHAR Slot = (PUCHAR)lpOutputBuffer + dwReceiveDataLength;
+
+    UNREFERENCED_PARAMETER(dwRemoteAddressLength);
+
+    /* AFD writes each slot as the address length followed by the address */
+    *LocalSockaddrLength = *(PINT)Slot;
+    *LocalSockaddr = (struct sockaddr *)(Slot + sizeof(INT));
+
+    Slot += dwLocalAddressLength;
+
+    *RemoteSockaddrLength = *(PINT)Slot;
+    *RemoteSockaddr = (struct sockaddr *)(Slot + sizeof(INT));
+}
+
+BOOL
+PASCAL
+WSPConnectEx(SOCKET s,
+             const struct sockaddr *name,
+             int namelen,
+             PVOID lpSendBuffer,
+             DWORD dwSendDataLength,
+             LPDWORD lpdwBytesSent,
+             LPOVERLAPPED lpOverlapped)
+{
+    PAFD_CONNECT_INFO ConnectInfo;
+    PSOCKET_INFORMATION Socket;
+    DWORD BytesSent = 0;
+    INT SocketDataLength;
+    ULONG ConnectDataLength;
+    BOOL Result;
+
+    TRACE("Called (%x)\n", s);
+
+    Socket = GetSocketStructure(s);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    /* ConnectEx requires an explicitly bound, unconnected socket */
+    if (Socket->SharedData->SocketType != SOCK_STREAM ||
+        Socket->SharedData->State != SocketBound)
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    if (!name || namelen < (int)sizeof(SOCKADDR))
+    {
+        SetLastError(WSAEFAULT);
+        return FALSE;
+    }
+
+    /* Calculate the size of SocketAddress->sa_data */
+    SocketDataLength = namelen - FIELD_OFFSET(struct sockaddr, sa_data);
+
+    ConnectDataLength = FIELD_OFFSET(AFD_CONNECT_INFO,
+                                     RemoteAddress.Address[0].Address[SocketDataLength]);
+
+    ConnectInfo = HeapAlloc(GlobalHeap, 0, ConnectDataLength);
+    if (!ConnectInfo)
+    {
+        SetLastError(WSAENOBUFS);
+        return FALSE;
+    }
+
+    /* Set up Address in TDI Format */
+    ConnectInfo->RemoteAddress.TAAddressCount = 1;
+    ConnectInfo->RemoteAddress.Address[0].AddressLength = SocketDataLength;
+    ConnectInfo->RemoteAddress.Address[0].AddressType = name->sa_family;
+    RtlCopyMemory(ConnectInfo->RemoteAddress.Address[0].Address,
+                  name->sa_data,
+                  SocketDataLength);
+
+    ConnectInfo->Root = 0;
+    ConnectInfo->UseSAN = FALSE;
+    ConnectInfo->Unknown = 0;
+
+    /* AFD sends the data as soon as the connection is up */
+    Result = SockExtensionIoControl(Socket,
+                                    IOCTL_AFD_SUPER_CONNECT,
+                                    ConnectInfo,
+                                    ConnectDataLength,
+                                    lpSendBuffer,
+                                    lpSendBuffer ? dwSendDataLength : 0,
+                                    lpOverlapped,
+                                    &BytesSent);
+
+    HeapFree(GlobalHeap, 0, ConnectInfo);
+
+    if (!Result)
+        return FALSE;
+
+    /* Overlapped callers update the state with SO_UPDATE_CONNECT_CONTEXT */
+    Socket->SharedData->State = SocketConnected;
+    Socket->SharedData->ConnectTime = GetCurrentTimeInSeconds();
+
+    if (lpdwBytesSent)
+        *lpdwBytesSent = BytesSent;
+
+    return TRUE;
+}
+
+BOOL
+PASCAL
+WSPDisconnectEx(SOCKET s,
+                LPOVERLAPPED lpOverlapped,
+                DWORD dwFlags,
+                DWORD dwReserved)
+{
+    AFD_DISCONNECT_INFO DisconnectInfo;
+    PSOCKET_INFORMATION Socket;
+
+    TRACE("Called (%x)\n", s);
+
+    Socket = GetSocketStructure(s);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    if (dwReserved != 0 || (dwFlags & ~TF_REUSE_SOCKET))
+    {
+        SetLastError(WSAEINVAL);
+        return FALSE;
+    }
+
+    if (Socket->SharedData->State != SocketConnected)
+    {
+        SetLastError(WSAENOTCONN);
+        return FALSE;
+    }
+
+    /* FIXME: AFD can't rewind a connected endpoint yet, so a socket passed
+     * with TF_REUSE_SOCKET is disconnected but won't accept a new connection */
+    if (dwFlags & TF_REUSE_SOCKET)
+        WARN("Socket reuse is not supported by AFD yet\n");
+
+    /* Graceful close of the send direction, like Windows does */
+    DisconnectInfo.DisconnectType = AFD_DISCONNECT_SEND;
+    DisconnectInfo.Timeout.QuadPart = -1;
+
+    if (!SockExtensionIoControl(Socket,
+                                IOCTL_AFD_DISCONNECT,
+                                &DisconnectInfo,
+                                sizeof(DisconnectInfo),
+                                NULL,
+                                0,
+                                lpOverlapped,
+                                NULL))
+        return FALSE;
+
+    Socket->SharedData->SendShutdown = TRUE;
+
+    return TRUE;
+}
+
+BOOL
+PASCAL
+WSPTransmitFile(SOCKET hSocket,
+                HANDLE hFile,
+                DWORD nNumberOfBytesToWrite,
+                DWORD nNumberOfBytesPerSend,
+                LPOVERLAPPED lpOverlapped,
+                LPTRANSMIT_FILE_BUFFERS lpTransmitBuffers,
+                DWORD dwFlags)
+{
+    AFD_TRANSMIT_FILE_INFO TransmitInfo;
+    PSOCKET_INFORMATION Socket;
+
+    TRACE("Called (%x)\n", hSocket);
+
+    Socket = GetSocketStructure(hSocket);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return FALSE;
+    }
+
+    if (Socket->SharedData->SocketType != SOCK_STREAM ||
+        Socket->SharedData->State != SocketConnected)
+    {
+        SetLastError(WSAENOTCONN);
+        return FALSE;
+    }
+
+    RtlZeroMemory(&TransmitInfo, sizeof(TransmitInfo));
+
+    /* AFD reads the file from the cache and sends head, file and tail itself */
+    TransmitInfo.FileHandle = hFile;
+    TransmitInfo.WriteLength = nNumberOfBytesToWrite;
+    TransmitInfo.SendPacketLength = nNumberOfBytesPerSend;
+
+    /* Overlapped requests carry the file offset, others use the file pointer */
+    if (lpOverlapped)
+    {
+        TransmitInfo.Offset.LowPart = lpOverlapped->Offset;
+        TransmitInfo.Offset.HighPart = lpOverlapped->OffsetHigh;
+    }
+
+    if (lpTransmitBuffers)
+    {
+        if (lpTransmitBuffers->Head)
+        {
+            TransmitInfo.Head = lpTransmitBuffers->Head;
+            TransmitInfo.HeadLength = lpTransmitBuffers->HeadLength;
+        }
+
+        if (lpTransmitBuffers->Tail)
+        {
+            TransmitInfo.Tail = lpTransmitBuffers->Tail;
+            TransmitInfo.TailLength = lpTransmitBuffers->TailLength;
+        }
+    }
+
+    if (dwFlags & TF_DISCONNECT)
+        TransmitInfo.Flags |= AFD_TF_DISCONNECT;
+    if (dwFlags & TF_REUSE_SOCKET)
+        TransmitInfo.Flags |= AFD_TF_REUSE_SOCKET;
+
+    if (!SockExtensionIoControl(Socket,
+                                IOCTL_AFD_TRANSMIT_FILE,
+                                &TransmitInfo,
+                                sizeof(TransmitInfo),
+                                NULL,
+                                0,
+                                lpOverlapped,
+                                NULL))
+        return FALSE;
+
+    if (TransmitInfo.Flags)
+        Socket->SharedData->SendShutdown = TRUE;
+
+    return TRUE;
+}
+
+INT
+SockGetExtensionFunctionPointer(IN  LPGUID Guid,
+                                OUT PVOID *FunctionPointer)
+{
+    static const GUID AcceptExGuid = WSAID_ACCEPTEX;
+    static const GUID GetAcceptExSockaddrsGuid = WSAID_GETACCEPTEXSOCKADDRS;
+    static const GUID ConnectExGuid = WSAID_CONNECTEX;
+    static const GUID DisconnectExGuid = WSAID_DISCONNECTEX;
+    static const GUID TransmitFileGuid = WSAID_TRANSMITFILE;
+
+    if (IsEqualGUID(Guid, &AcceptExGuid))
+        *FunctionPointer = (PVOID)WSPAcceptEx;
+    else if (IsEqualGUID(Guid, &GetAcceptExSockaddrsGuid))
+        *FunctionPointer = (PVOID)WSPGetAcceptExSockaddrs;
+    else if (IsEqualGUID(Guid, &ConnectExGuid))
+        *FunctionPointer = (PVOID)WSPConnectEx;
+    else if (IsEqualGUID(Guid, &DisconnectExGuid))
+        *FunctionPointer = (PVOID)WSPDisconnectEx;
+    else if (IsEqualGUID(Guid, &TransmitFileGuid))
+        *FunctionPointer = (PVOID)WSPTransmitFile;
+    else
+        return WSAEINVAL;
+
+    return NO_ERROR;
+}
+
+/* EOF */
@@ -496,6 +496,14 @@ SockReenableAsyncSelectEvent (
     IN ULONG Event
     );
 
+DWORD
+GetCurrentTimeInSeconds(VOID);
+
+INT
+SockGetExtensionFunctionPointer(
+    IN  LPGUID Guid,
+    OUT PVOID *FunctionPointer);
+
 typedef VOID (*PASYNC_COMPLETION_ROUTINE)(PVOID Context, PIO_STATUS_BLOCK IoStatusBlock);
 
 FORCEINLINE
@@ -267,6 +267,25 @@ FindFile(
     return Status;
 }
 
+/*
+ * FUNCTION: Turns an FCB into the one of a paging file. Paging I/O can't
+ *           fault, so the extent cache moves to nonpaged pool.
+ */
+static
+VOID
+VfatMakePagingFileFcb(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb)
+{
+    ExAcquireFastMutex(&Fcb->LastMutex);
+    FsRtlUninitializeLargeMcb(&Fcb->Mcb);
+    FsRtlInitializeLargeMcb(&Fcb->Mcb, NonPagedPool);
+    ExReleaseFastMutex(&Fcb->LastMutex);
+
+    Fcb->Flags |= FCB_IS_PAGE_FILE;
+    SetFlag(DeviceExt->Flags, VCB_IS_SYS_OR_HAS_PAGE);
+}
+
 /*
  * FUNCTION: Opens a file
  */
@@ -777,8 +796,7 @@ VfatCreateFile(
 
                 if (PagingFileCreate)
                 {
-                    pFcb->Flags |= FCB_IS_PAGE_FILE;
-                    SetFlag(DeviceExt->Flags, VCB_IS_SYS_OR_HAS_PAGE);
+                    VfatMakePagingFileFcb(DeviceExt, pFcb);
                 }
             }
             else
@@ -897,8 +915,7 @@ VfatCreateFile(
             }
             else
             {
-                pFcb->Flags |= FCB_IS_PAGE_FILE;
-                SetFlag(DeviceExt->Flags, VCB_IS_SYS_OR_HAS_PAGE);
+                VfatMakePagingFileFcb(DeviceExt, pFcb);
             }
         }
         else
@@ -0,0 +1,450 @@
+/*
+ * COPYRIGHT:        See COPYING in the top level directory
+ * PROJECT:          ReactOS kernel
+ * FILE:             drivers/filesystems/fastfat/dirindex.c
+ * PURPOSE:          VFAT Filesystem : name index for large directories
+ *
+ */
+
+/*
+ * Looking up a name in a FAT directory means walking all of its entries
+ * until one matches, which gets slow for directories holding thousands of
+ * files. For such directories we keep a hash table mapping the hash of the
+ * upcased long and 8.3 names to the index of the short entry. The table
+ * only stores hashes, every candidate is read back from the directory and
+ * compared, so a collision costs one extra entry read, never a wrong match.
+ *
+ * The table is built by the first lookup in the directory, updated by
+ * dirwr.c when entries are added or deleted and freed with the directory
+ * FCB. All of this happens with the VCB DirResource held exclusively.
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "vfat.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* DEFINES ******************************************************************/
+
+#define NAME_INDEX_FREE     0xFFFFFFFF
+#define NAME_INDEX_DELETED  0xFFFFFFFE
+
+#define NAME_INDEX_MIN_SIZE 64
+
+/* FUNCTIONS ****************************************************************/
+
+static
+ULONG
+vfatNameIndexHash(
+    PUNICODE_STRING NameU)
+{
+    PWCHAR curr;
+    PWCHAR last;
+    ULONG hash = 0;
+    WCHAR c;
+
+    curr = NameU->Buffer;
+    last = NameU->Buffer + NameU->Length / sizeof(WCHAR);
+
+    while (curr < last)
+    {
+        c = RtlUpcaseUnicodeChar(*curr++);
+        hash = (hash + (c << 4) + (c >> 4)) * 11;
+    }
+    return hash ^ (hash >> 16);
+}
+
+static
+ULONG
+vfatNameIndexBytes(
+    ULONG Size)
+{
+    return FIELD_OFFSET(VFAT_NAME_INDEX, Slots) + Size * sizeof(VFAT_NAME_INDEX_SLOT);
+}
+
+static
+PVFAT_NAME_INDEX
+vfatAllocateNameIndex(
+    ULONG Size)
+{
+    PVFAT_NAME_INDEX Index;
+    LONG Bytes = vfatNameIndexBytes(Size);
+
+    if (InterlockedExchangeAdd(&VfatGlobalData->NameIndexBytes, Bytes) + Bytes > VFAT_NAME_INDEX_BUDGET)
+    {
+        DPRINT("Name index budget exhausted (%d bytes requested)\n", Bytes);
+        InterlockedExchangeAdd(&VfatGlobalData->NameIndexBytes, -Bytes);
+        return NULL;
+    }
+
+    Index = ExAllocatePoolWithTag(PagedPool, Bytes, TAG_NAME_INDEX);
+    if (Index == NULL)
+    {
+        InterlockedExchangeAdd(&VfatGlobalData->NameIndexBytes, -Bytes);
+        return NULL;
+    }
+
+    /* Both fields of a free slot are NAME_INDEX_FREE */
+    RtlFillMemory(Index->Slots, Size * sizeof(VFAT_NAME_INDEX_SLOT), 0xFF);
+    Index->Size = Size;
+    Index->Live = 0;
+    Index->Used = 0;
+    return Index;
+}
+
+static
+VOID
+vfatFreeNameIndex(
+    PVFAT_NAME_INDEX Index)
+{
+    LONG Bytes = vfatNameIndexBytes(Index->Size);
+
+    ExFreePoolWithTag(Index, TAG_NAME_INDEX);
+    InterlockedExchangeAdd(&VfatGlobalData->NameIndexBytes, -Bytes);
+}
+
+static
+VOID
+vfatNameIndexStore(
+    PVFAT_NAME_INDEX Index,
+    ULONG Hash,
+    ULONG DirIndex)
+{
+    ULONG Mask = Index->Size - 1;
+    ULONG i = Hash & Mask;
+    ULONG Target = NAME_INDEX_FREE;
+
+    while (Index->Slots[i].DirIndex != NAME_INDEX_FREE)
+    {
+        if (Index->Slots[i].DirIndex == NAME_INDEX_DELETED)
+        {
+            if (Target == NAME_INDEX_FREE)
+                Target = i;
+        }
+        else if (Index->Slots[i].Hash == Hash && Index->Slots[i].DirIndex == DirIndex)
+        {
+            /* Already there */
+            return;
+        }
+        i = (i + 1) & Mask;
+    }
+
+    if (Target == NAME_INDEX_FREE)
+    {
+        Target = i;
+        Index->Used++;
+    }
+    Index->Slots[Target].Hash = Hash;
+    Index->Slots[Target].DirIndex = DirIndex;
+    Index->Live++;
+}
+
+/*
+ * Make room for one more name, rehashing into a larger table when the
+ * load factor (deleted slots included) would go above 3/4. Returns FALSE
+ * when the memory budget doesn't allow it.
+ */
+static
+BOOLEAN
+vfatNameIndexReserve(
+    PVFAT_NAME_INDEX *pIndex)
+{
+    PVFAT_NAME_INDEX Index = *pIndex;
+    PVFAT_NAME_INDEX NewIndex;
+    ULONG Size, i;
+
+    if ((Index->Used + 1) * 4 <= Index->Size * 3)
+    {
+        return TRUE;
+    }
+
+    /* Only grow if the table is really full, not just full of deleted slots */
+    Size = Index->Size;
+    if ((Index->Live + 1) * 2 > Size)
+    {
+        Size *= 2;
+    }
+
+    NewIndex = vfatAllocateNameIndex(Size);
+    if (NewIndex == NULL)
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < Index->Size; i++)
+    {
+        if (Index->Slots[i].DirIndex < NAME_INDEX_DELETED)
+        {
+            vfatNameIndexStore(NewIndex, Index->Slots[i].Hash, Index->Slots[i].DirIndex);
+        }
+    }
+
+    vfatFreeNameIndex(Index);
+    *pIndex = NewIndex;
+    return TRUE;
+}
+
+static
+BOOLEAN
+vfatNameIndexAdd(
+    PVFAT_NAME_INDEX *pIndex,
+    PUNICODE_STRING LongNameU,
+    PUNICODE_STRING ShortNameU,
+    ULONG DirIndex)
+{
+    if (!vfatNameIndexReserve(pIndex))
+    {
+        return FALSE;
+    }
+    vfatNameIndexStore(*pIndex, vfatNameIndexHash(LongNameU), DirIndex);
+
+    /* Most short names only differ from the long one by case */
+    if (ShortNameU->Length != 0 && !RtlEqualUnicodeString(LongNameU, ShortNameU, TRUE))
+    {
+        if (!vfatNameIndexReserve(pIndex))
+        {
+            return FALSE;
+        }
+        vfatNameIndexStore(*pIndex, vfatNameIndexHash(ShortNameU), DirIndex);
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+vfatNameIndexDelete(
+    PVFAT_NAME_INDEX Index,
+    ULONG Hash,
+    ULONG DirIndex)
+{
+    ULONG Mask = Index->Size - 1;
+    ULONG i = Hash & Mask;
+
+    while (Index->Slots[i].DirIndex != NAME_INDEX_FREE)
+    {
+        if (Index->Slots[i].Hash == Hash && Index->Slots[i].DirIndex == DirIndex)
+        {
+            Index->Slots[i].DirIndex = NAME_INDEX_DELETED;
+            Index->Live--;
+            return;
+        }
+        i = (i + 1) & Mask;
+    }
+}
+
+static
+BOOLEAN
+vfatNameIndexWanted(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb)
+{
+    /* FATX directories are small and their entry indexes are shifted by
+     * the emulated '.' and '..', keep the linear scan for them */
+    if (vfatVolumeIsFatX(DeviceExt))
+    {
+        return FALSE;
+    }
+
+    if (BooleanFlagOn(DirFcb->Flags, FCB_NO_NAME_INDEX))
+    {
+        return FALSE;
+    }
+
+    return DirFcb->RFCB.FileSize.QuadPart >= VFAT_NAME_INDEX_MIN_SIZE;
+}
+
+/*
+ * Walk the whole directory and hash every name. On failure the directory
+ * is flagged so that later lookups go straight to the linear scan.
+ */
+static
+NTSTATUS
+vfatBuildNameIndex(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PVFAT_DIRENTRY_CONTEXT DirContext)
+{
+    NTSTATUS Status;
+    PVOID Context = NULL;
+    PVOID Page = NULL;
+    BOOLEAN First = TRUE;
+    PVFAT_NAME_INDEX Index;
+    ULONG Size = NAME_INDEX_MIN_SIZE;
+
+    while (Size < DirFcb->RFCB.FileSize.u.LowPart / sizeof(FAT_DIR_ENTRY))
+    {
+        Size *= 2;
+    }
+
+    Index = vfatAllocateNameIndex(Size);
+    if (Index == NULL)
+    {
+        DirFcb->Flags |= FCB_NO_NAME_INDEX;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    DirContext->DirIndex = 0;
+    while (TRUE)
+    {
+        Status = VfatGetNextDirEntry(DeviceExt, &Context, &Page, DirFcb, DirContext, First);
+        First = FALSE;
+        if (Status == STATUS_NO_MORE_ENTRIES)
+        {
+            break;
+        }
+        if (!NT_SUCCESS(Status))
+        {
+            vfatFreeNameIndex(Index);
+            return Status;
+        }
+
+        /* Skip what vfatDirFindFile() would never match */
+        if (!ENTRY_VOLUME(FALSE, &DirContext->DirEntry) &&
+            DirContext->LongNameU.Length != 0 &&
+            DirContext->ShortNameU.Length != 0)
+        {
+            if (!vfatNameIndexAdd(&Index, &DirContext->LongNameU, &DirContext->ShortNameU, DirContext->DirIndex))
+            {
+                if (Context != NULL)
+                {
+                    CcUnpinData(Context);
+                }
+                vfatFreeNameIndex(Index);
+                DirFcb->Flags |= FCB_NO_NAME_INDEX;
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+        }
+        DirContext->DirIndex++;
+    }
+
+    DPRINT("Indexed %u names of %wZ\n", Index->Live, &DirFcb->PathNameU);
+    DirFcb->NameIndex = Index;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Look FileToFindU up through the name index of DirFcb, building it first
+ * if needed. On success, DirContext describes the entry and *pContext is
+ * the pinned directory page the caller must unpin. Returns
+ * STATUS_NOT_IMPLEMENTED if the directory isn't indexed, in which case the
+ * caller has to scan it.
+ */
+NTSTATUS
+vfatNameIndexFindFile(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext,
+    PVOID *pContext)
+{
+    NTSTATUS Status;
+    PVFAT_NAME_INDEX Index;
+    PVOID Page;
+    ULONG Hash, Mask, i, DirIndex;
+
+    ASSERT(ExIsResourceAcquiredExclusive(&DeviceExt->DirResource));
+
+    if (DirFcb->NameIndex == NULL)
+    {
+        if (!vfatNameIndexWanted(DeviceExt, DirFcb))
+        {
+            return STATUS_NOT_IMPLEMENTED;
+        }
+
+        Status = vfatBuildNameIndex(DeviceExt, DirFcb, DirContext);
+        if (!NT_SUCCESS(Status))
+        {
+            return STATUS_NOT_IMPLEMENTED;
+        }
+    }
+
+    Index = DirFcb->NameIndex;
+    Hash = vfatNameIndexHash(FileToFindU);
+    Mask = Index->Size - 1;
+
+    for (i = Hash & Mask; Index->Slots[i].DirIndex != NAME_INDEX_FREE; i = (i + 1) & Mask)
+    {
+        DirIndex = Index->Slots[i].DirIndex;
+        if (DirIndex == NAME_INDEX_DELETED || Index->Slots[i].Hash != Hash)
+        {
+            continue;
+        }
+
+        /* Re-read the entry, starting from its long name */
+        *pContext = NULL;
+        DirContext->DirIndex = DirIndex;
+        Status = VfatGetNextDirEntry(DeviceExt, pContext, &Page, DirFcb, DirContext, TRUE);
+        if (Status == STATUS_NO_MORE_ENTRIES)
+        {
+            continue;
+        }
+        if (!NT_SUCCESS(Status))
+        {
+            return Status;
+        }
+
+        if (DirContext->DirIndex == DirIndex &&
+            (RtlEqualUnicodeString(FileToFindU, &DirContext->LongNameU, TRUE) ||
+             RtlEqualUnicodeString(FileToFindU, &DirContext->ShortNameU, TRUE)))
+        {
+            return STATUS_SUCCESS;
+        }
+
+        CcUnpinData(*pContext);
+        *pContext = NULL;
+    }
+
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+VOID
+vfatNameIndexInsert(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PVFATFCB Fcb)
+{
+    ASSERT(ExIsResourceAcquiredExclusive(&DeviceExt->DirResource));
+
+    if (DirFcb->NameIndex == NULL)
+    {
+        return;
+    }
+
+    if (!vfatNameIndexAdd(&DirFcb->NameIndex, &Fcb->LongNameU, &Fcb->ShortNameU, Fcb->dirIndex))
+    {
+        /* Out of budget: an incomplete index would hide files, drop it */
+        vfatDestroyNameIndex(DirFcb);
+        DirFcb->Flags |= FCB_NO_NAME_INDEX;
+    }
+}
+
+VOID
+vfatNameIndexRemove(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PVFATFCB Fcb)
+{
+    ASSERT(ExIsResourceAcquiredExclusive(&DeviceExt->DirResource));
+
+    if (DirFcb->NameIndex == NULL)
+    {
+        return;
+    }
+
+    vfatNameIndexDelete(DirFcb->NameIndex, vfatNameIndexHash(&Fcb->LongNameU), Fcb->dirIndex);
+    vfatNameIndexDelete(DirFcb->NameIndex, vfatNameIndexHash(&Fcb->ShortNameU), Fcb->dirIndex);
+}
+
+VOID
+vfatDestroyNameIndex(
+    PVFATFCB DirFcb)
+{
+    if (DirFcb->NameIndex != NULL)
+    {
+        vfatFreeNameIndex(DirFcb->NameIndex);
+        DirFcb->NameIndex = NULL;
+    }
+}
@@ -778,6 +778,8 @@ FATAddEntry(
         return Status;
     }
 
+    vfatNameIndexInsert(DeviceExt, ParentFcb, *Fcb);
+
     DPRINT("new : entry=%11.11s\n", (*Fcb)->entry.Fat.Filename);
     DPRINT("new : entry=%11.11s\n", DirContext.DirEntry.Fat.Filename);
 
@@ -1007,6 +1009,8 @@ FATDelEntry(
         }
     }
 
+    vfatNameIndexRemove(DeviceExt, pFcb->parentFcb, pFcb);
+
     /* In case of moving, save properties */
     if (MoveContext != NULL)
     {
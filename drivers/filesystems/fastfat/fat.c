@@ -26,6 +26,13 @@
  */
 #define VOLUME_IS_NOT_CACHED_WORK_AROUND_IT
 
+/* Volumes with more clusters than this keep scanning the FAT for free
+ * clusters instead of tracking them in memory (2MB of bitmap) */
+#define MAX_BITMAP_CLUSTERS 0x1000000
+
+/* Length of the free run we look for when a chain can't grow in place */
+#define EXTENT_CLUSTERS 16
+
 /* FUNCTIONS ****************************************************************/
 
 /*
@@ -377,6 +384,143 @@ FAT32FindAndMarkAvailableCluster(
     return STATUS_DISK_FULL;
 }
 
+/*
+ * FUNCTION: Returns the in-memory free cluster bitmap of the volume, if any.
+ *           A set bit is a cluster in use.
+ */
+static
+PRTL_BITMAP
+FreeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    return DeviceExt->FreeClusterBitmap.Buffer != NULL ? &DeviceExt->FreeClusterBitmap : NULL;
+}
+
+/*
+ * FUNCTION: Allocates the free cluster bitmap, filled by the next count
+ */
+static
+VOID
+InitializeFreeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    ULONG Clusters = DeviceExt->FatInfo.NumberOfClusters + 2;
+    PULONG Buffer;
+
+    if (DeviceExt->FreeClusterBitmap.Buffer != NULL || Clusters > MAX_BITMAP_CLUSTERS)
+    {
+        return;
+    }
+
+    Buffer = ExAllocatePoolWithTag(PagedPool, ROUND_UP(Clusters, 32) / 8, TAG_VFAT);
+    if (Buffer == NULL)
+    {
+        DPRINT1("No memory for the free cluster bitmap of %u clusters\n", Clusters);
+        return;
+    }
+
+    RtlInitializeBitMap(&DeviceExt->FreeClusterBitmap, Buffer, Clusters);
+    RtlClearAllBits(&DeviceExt->FreeClusterBitmap);
+    /* Clusters 0 and 1 don't exist */
+    RtlSetBits(&DeviceExt->FreeClusterBitmap, 0, 2);
+}
+
+VOID
+ReleaseFreeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    if (DeviceExt->FreeClusterBitmap.Buffer != NULL)
+    {
+        ExFreePoolWithTag(DeviceExt->FreeClusterBitmap.Buffer, TAG_VFAT);
+        DeviceExt->FreeClusterBitmap.Buffer = NULL;
+    }
+}
+
+/*
+ * FUNCTION: Finds an available cluster using the free cluster bitmap and
+ *           marks it as end of chain. A cluster following PreviousCluster
+ *           is preferred so that files stay contiguous, then the start of
+ *           a free run large enough for the file to keep growing in place.
+ */
+static
+NTSTATUS
+FindAndMarkAvailableClusterFromBitmap(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG PreviousCluster,
+    PULONG Cluster)
+{
+    PRTL_BITMAP Bitmap = FreeClusterBitmap(DeviceExt);
+    ULONG Hint = DeviceExt->LastAvailableCluster;
+    ULONG NewCluster, OldValue;
+    NTSTATUS Status;
+
+    while (TRUE)
+    {
+        NewCluster = 0xffffffff;
+        if (PreviousCluster != 0 && PreviousCluster + 1 < Bitmap->SizeOfBitMap &&
+            !RtlTestBit(Bitmap, PreviousCluster + 1))
+        {
+            NewCluster = PreviousCluster + 1;
+        }
+        if (NewCluster == 0xffffffff)
+        {
+            NewCluster = RtlFindClearBits(Bitmap, EXTENT_CLUSTERS, Hint);
+        }
+        if (NewCluster == 0xffffffff)
+        {
+            NewCluster = RtlFindClearBits(Bitmap, 1, Hint);
+        }
+        if (NewCluster == 0xffffffff)
+        {
+            return STATUS_DISK_FULL;
+        }
+
+        RtlSetBit(Bitmap, NewCluster);
+        Status = DeviceExt->WriteCluster(DeviceExt, NewCluster, 0xffffffff, &OldValue);
+        if (!NT_SUCCESS(Status))
+        {
+            RtlClearBit(Bitmap, NewCluster);
+            return Status;
+        }
+
+        if (OldValue == 0)
+        {
+            break;
+        }
+
+        /* The bitmap was wrong, put the entry back and look further */
+        DPRINT1("Cluster 0x%x is marked free but used (0x%x)\n", NewCluster, OldValue);
+        DeviceExt->WriteCluster(DeviceExt, NewCluster, OldValue, &OldValue);
+        PreviousCluster = 0;
+        Hint = NewCluster + 1;
+    }
+
+    DPRINT("Found available cluster 0x%x\n", NewCluster);
+    DeviceExt->LastAvailableCluster = *Cluster = NewCluster;
+    if (DeviceExt->AvailableClustersValid)
+        InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * FUNCTION: Finds the available cluster to append to a chain ending with
+ *           PreviousCluster (0 for a new chain) and marks it as end of chain
+ */
+static
+NTSTATUS
+FindAndMarkAvailableCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG PreviousCluster,
+    PULONG Cluster)
+{
+    if (FreeClusterBitmap(DeviceExt) != NULL)
+    {
+        return FindAndMarkAvailableClusterFromBitmap(DeviceExt, PreviousCluster, Cluster);
+    }
+
+    return DeviceExt->FindAndMarkAvailableCluster(DeviceExt, Cluster);
+}
+
 /*
  * FUNCTION: Counts free cluster in a FAT12 table
  */
@@ -385,6 +529,7 @@ NTSTATUS
 FAT12CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt)
 {
+    PRTL_BITMAP Bitmap = FreeClusterBitmap(DeviceExt);
     ULONG Entry;
     PVOID BaseAddress;
     ULONG ulCount = 0;
@@ -421,6 +566,8 @@ FAT12CountAvailableClusters(
 
         if (Entry == 0)
             ulCount++;
+        else if (Bitmap != NULL)
+            RtlSetBit(Bitmap, i);
     }
 
     CcUnpinData(Context);
@@ -439,6 +586,7 @@ NTSTATUS
 FAT16CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt)
 {
+    PRTL_BITMAP Bitmap = FreeClusterBitmap(DeviceExt);
     PUSHORT Block;
     PUSHORT BlockEnd;
     PVOID BaseAddress = NULL;
@@ -472,6 +620,8 @@ FAT16CountAvailableClusters(
         {
             if (*Block == 0)
                 ulCount++;
+            else if (Bitmap != NULL)
+                RtlSetBit(Bitmap, i);
             Block++;
             i++;
         }
@@ -494,6 +644,7 @@ NTSTATUS
 FAT32CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt)
 {
+    PRTL_BITMAP Bitmap = FreeClusterBitmap(DeviceExt);
     PULONG Block;
     PULONG BlockEnd;
     PVOID BaseAddress = NULL;
@@ -528,6 +679,8 @@ FAT32CountAvailableClusters(
         {
             if ((*Block & 0x0fffffff) == 0)
                 ulCount++;
+            else if (Bitmap != NULL)
+                RtlSetBit(Bitmap, i);
             Block++;
             i++;
         }
@@ -550,12 +703,20 @@ CountAvailableClusters(
     ExAcquireResourceExclusiveLite (&DeviceExt->FatResource, TRUE);
     if (!DeviceExt->AvailableClustersValid)
     {
+        /* The first count is done at mount time, load the bitmap with it */
+        InitializeFreeClusterBitmap(DeviceExt);
+
         if (DeviceExt->FatInfo.FatType == FAT12)
             Status = FAT12CountAvailableClusters(DeviceExt);
         else if (DeviceExt->FatInfo.FatType == FAT16 || DeviceExt->FatInfo.FatType == FATX16)
             Status = FAT16CountAvailableClusters(DeviceExt);
         else
             Status = FAT32CountAvailableClusters(DeviceExt);
+
+        if (!NT_SUCCESS(Status))
+        {
+            ReleaseFreeClusterBitmap(DeviceExt);
+        }
     }
     if (Clusters != NULL)
     {
@@ -716,6 +877,13 @@ WriteCluster(
 
     ExAcquireResourceExclusiveLite (&DeviceExt->FatResource, TRUE);
     Status = DeviceExt->WriteCluster(DeviceExt, ClusterToWrite, NewValue, &OldValue);
+    if (NT_SUCCESS(Status) && FreeClusterBitmap(DeviceExt) != NULL)
+    {
+        if (NewValue == 0)
+            RtlClearBit(&DeviceExt->FreeClusterBitmap, ClusterToWrite);
+        else
+            RtlSetBit(&DeviceExt->FreeClusterBitmap, ClusterToWrite);
+    }
     if (DeviceExt->AvailableClustersValid)
     {
         if (OldValue && NewValue == 0)
@@ -792,7 +960,7 @@ GetNextClusterExtend(
      */
     if (CurrentCluster == 0)
     {
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = FindAndMarkAvailableCluster(DeviceExt, 0, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
@@ -811,7 +979,7 @@ GetNextClusterExtend(
         /* We are after last existing cluster, we must add one to file */
         /* Firstly, find the next available open allocation unit and
            mark it as end of file */
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = FindAndMarkAvailableCluster(DeviceExt, CurrentCluster, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
@@ -828,6 +996,135 @@ GetNextClusterExtend(
     return Status;
 }
 
+/*
+ * FUNCTION: Takes Count free clusters as one contiguous run from the free
+ *           cluster bitmap and chains them, preferring the clusters right
+ *           after LastCluster. Returns the first cluster of the run, or
+ *           0xffffffff if no such run is free. FatResource must be held
+ *           exclusively.
+ */
+static
+ULONG
+AllocateClusterRun(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG Count)
+{
+    PRTL_BITMAP Bitmap = FreeClusterBitmap(DeviceExt);
+    ULONG RunStart, OldValue, Failed, i;
+    NTSTATUS Status;
+
+    if (Bitmap == NULL)
+    {
+        return 0xffffffff;
+    }
+
+    if (LastCluster != 0 && Count < Bitmap->SizeOfBitMap - LastCluster &&
+        RtlAreBitsClear(Bitmap, LastCluster + 1, Count))
+    {
+        RunStart = LastCluster + 1;
+    }
+    else
+    {
+        RunStart = RtlFindClearBits(Bitmap, Count, DeviceExt->LastAvailableCluster);
+        if (RunStart == 0xffffffff)
+        {
+            return 0xffffffff;
+        }
+    }
+
+    /* Chain the run from its end, so that it is never linked half written */
+    RtlSetBits(Bitmap, RunStart, Count);
+    for (i = Count; i-- > 0; )
+    {
+        Status = DeviceExt->WriteCluster(DeviceExt, RunStart + i,
+                                         i == Count - 1 ? 0xffffffff : RunStart + i + 1,
+                                         &OldValue);
+        if (NT_SUCCESS(Status) && OldValue == 0)
+        {
+            continue;
+        }
+
+        if (NT_SUCCESS(Status))
+        {
+            /* The bitmap was wrong, put the entry back */
+            DPRINT1("Cluster 0x%x is marked free but used (0x%x)\n", RunStart + i, OldValue);
+            DeviceExt->WriteCluster(DeviceExt, RunStart + i, OldValue, &OldValue);
+        }
+
+        /* Release the part of the run written so far */
+        Failed = i;
+        while (++i < Count)
+        {
+            DeviceExt->WriteCluster(DeviceExt, RunStart + i, 0, &OldValue);
+        }
+        RtlClearBits(Bitmap, RunStart, Count);
+        if (NT_SUCCESS(Status))
+        {
+            RtlSetBit(Bitmap, RunStart + Failed);
+        }
+        return 0xffffffff;
+    }
+
+    DeviceExt->LastAvailableCluster = RunStart + Count - 1;
+    if (DeviceExt->AvailableClustersValid)
+        InterlockedExchangeAdd((PLONG)&DeviceExt->AvailableClusters, -(LONG)Count);
+    return RunStart;
+}
+
+/*
+ * FUNCTION: Appends Count clusters to the chain ending with LastCluster and
+ *           returns the new last cluster. The clusters are allocated as one
+ *           extent when the free cluster bitmap has a large enough run,
+ *           otherwise one after the other.
+ */
+NTSTATUS
+ExtendClusterChain(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG Count,
+    PULONG NewLastCluster)
+{
+    ULONG NewCluster;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    DPRINT("ExtendClusterChain(DeviceExt %p, LastCluster %x, Count %u)\n",
+           DeviceExt, LastCluster, Count);
+
+    ASSERT(LastCluster != 0);
+
+    ExAcquireResourceExclusiveLite(&DeviceExt->FatResource, TRUE);
+
+    if (Count > 1)
+    {
+        NewCluster = AllocateClusterRun(DeviceExt, LastCluster, Count);
+        if (NewCluster != 0xffffffff)
+        {
+            WriteCluster(DeviceExt, LastCluster, NewCluster);
+            LastCluster = NewCluster + Count - 1;
+            Count = 0;
+        }
+    }
+
+    while (Count > 0)
+    {
+        Status = FindAndMarkAvailableCluster(DeviceExt, LastCluster, &NewCluster);
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+
+        WriteCluster(DeviceExt, LastCluster, NewCluster);
+        LastCluster = NewCluster;
+        Count--;
+    }
+
+    ExReleaseResourceLite(&DeviceExt->FatResource);
+
+    *NewLastCluster = LastCluster;
+    return Status;
+}
+
 /*
  * FUNCTION: Retrieve the dirty status
  */
@@ -154,6 +154,7 @@ vfatNewFCB(
     ExInitializeResourceLite(&rcFCB->MainResource);
     FsRtlInitializeFileLock(&rcFCB->FileLock, NULL, NULL);
     ExInitializeFastMutex(&rcFCB->LastMutex);
+    FsRtlInitializeLargeMcb(&rcFCB->Mcb, PagedPool);
     rcFCB->RFCB.PagingIoResource = &rcFCB->PagingIoResource;
     rcFCB->RFCB.Resource = &rcFCB->MainResource;
     rcFCB->RFCB.IsFastIoPossible = FastIoIsNotPossible;
@@ -279,11 +280,13 @@ vfatDestroyFCB(
 #endif
 
     FsRtlUninitializeFileLock(&pFCB->FileLock);
+    FsRtlUninitializeLargeMcb(&pFCB->Mcb);
     if (!vfatFCBIsRoot(pFCB) &&
         !BooleanFlagOn(pFCB->Flags, FCB_IS_FAT) && !BooleanFlagOn(pFCB->Flags, FCB_IS_VOLUME))
     {
         RemoveEntryList(&pFCB->ParentListEntry);
     }
+    vfatDestroyNameIndex(pFCB);
     ExFreePool(pFCB->PathNameBuffer);
     ExDeleteResourceLite(&pFCB->PagingIoResource);
     ExDeleteResourceLite(&pFCB->MainResource);
@@ -816,6 +819,22 @@ vfatDirFindFile(
     DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
     DirContext.DeviceExt = pDeviceExt;
 
+    /* Large directories get a name index, try it first */
+    status = vfatNameIndexFindFile(pDeviceExt, pDirectoryFCB, FileToFindU, &DirContext, &Context);
+    if (status != STATUS_NOT_IMPLEMENTED)
+    {
+        if (NT_SUCCESS(status))
+        {
+            status = vfatMakeFCBFromDirEntry(pDeviceExt,
+                pDirectoryFCB,
+                &DirContext,
+                pFoundFCB);
+            CcUnpinData(Context);
+        }
+        return status;
+    }
+
+    DirContext.DirIndex = 0;
     while (TRUE)
     {
         status = VfatGetNextDirEntry(pDeviceExt,
@@ -1245,6 +1245,9 @@ VfatSetAllocationSizeInformation(
         if (FirstCluster == 0)
         {
             Fcb->LastCluster = Fcb->LastOffset = 0;
+            ExAcquireFastMutex(&Fcb->LastMutex);
+            FsRtlTruncateLargeMcb(&Fcb->Mcb, 0);
+            ExReleaseFastMutex(&Fcb->LastMutex);
             Status = NextCluster(DeviceExt, FirstCluster, &FirstCluster, TRUE);
             if (!NT_SUCCESS(Status))
             {
@@ -1360,6 +1363,9 @@ VfatSetAllocationSizeInformation(
         AllocSizeChanged = TRUE;
         /* FIXME: Use the cached cluster/offset better way. */
         Fcb->LastCluster = Fcb->LastOffset = 0;
+        ExAcquireFastMutex(&Fcb->LastMutex);
+        FsRtlTruncateLargeMcb(&Fcb->Mcb, ROUND_UP_64(NewSize, ClusterSize) / ClusterSize);
+        ExReleaseFastMutex(&Fcb->LastMutex);
         UpdateFileSize(FileObject, Fcb, NewSize, ClusterSize, vfatVolumeIsFatX(DeviceExt));
         if (NewSize > 0)
         {
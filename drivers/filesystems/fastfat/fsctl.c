@@ -810,6 +810,8 @@ ByeBye:
             ExFreePoolWithTag(DeviceExt->SpareVPB, TAG_VFAT);
         if (DeviceExt && DeviceExt->Statistics)
             ExFreePoolWithTag(DeviceExt->Statistics, TAG_VFAT);
+        if (DeviceExt)
+            ReleaseFreeClusterBitmap(DeviceExt);
         if (Fcb)
             vfatDestroyFCB(Fcb);
         if (Ccb)
@@ -1302,6 +1304,7 @@ VfatDismountVolume(
     ExDeleteResourceLite(&DeviceExt->DirResource);
     ExDeleteResourceLite(&DeviceExt->FatResource);
     ObDereferenceObject(DeviceExt->FATFileObject);
+    ReleaseFreeClusterBitmap(DeviceExt);
 
     return STATUS_SUCCESS;
 }
@@ -65,7 +65,8 @@ OffsetToCluster(
     PULONG Cluster,
     BOOLEAN Extend)
 {
-    ULONG CurrentCluster;
+    ULONG CurrentCluster, NextCluster;
+    ULONG Count;
     ULONG i;
     NTSTATUS Status;
 /*
@@ -91,9 +92,20 @@ OffsetToCluster(
         CurrentCluster = FirstCluster;
         if (Extend)
         {
-            for (i = 0; i < FileOffset / DeviceExt->FatInfo.BytesPerCluster; i++)
+            Count = FileOffset / DeviceExt->FatInfo.BytesPerCluster;
+            for (i = 0; i < Count; i++)
+            {
+                Status = GetNextCluster (DeviceExt, CurrentCluster, &NextCluster);
+                if (!NT_SUCCESS(Status))
+                    return Status;
+                if (NextCluster == 0xffffffff)
+                    break;
+                CurrentCluster = NextCluster;
+            }
+            /* Allocate whatever is missing past the end of the chain as one extent */
+            if (i < Count)
             {
-                Status = GetNextClusterExtend (DeviceExt, CurrentCluster, &CurrentCluster);
+                Status = ExtendClusterChain (DeviceExt, CurrentCluster, Count - i, &CurrentCluster);
                 if (!NT_SUCCESS(Status))
                     return Status;
             }
@@ -113,6 +125,114 @@ OffsetToCluster(
    }
 }
 
+/*
+ * Return the cluster holding FileOffset. The clusters already walked are
+ * kept as extents in the MCB of the FCB, so only the part of the chain
+ * nobody looked at yet is read from the FAT.
+ */
+static
+NTSTATUS
+VfatFcbOffsetToCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG FileOffset,
+    PULONG Cluster)
+{
+    LONGLONG TargetVcn, Vcn = -1, Lcn;
+    LONGLONG RunVcn, RunLcn, RunLength;
+    ULONG CurrentCluster;
+    NTSTATUS Status = STATUS_SUCCESS;
+    BOOLEAN Mapped;
+
+    TargetVcn = FileOffset / DeviceExt->FatInfo.BytesPerCluster;
+
+    /* The MCB always maps a prefix of the chain, so either the target is in
+     * it or we have to continue from its last extent */
+    ExAcquireFastMutex(&Fcb->LastMutex);
+    Mapped = FsRtlLookupLargeMcbEntry(&Fcb->Mcb, TargetVcn, &Lcn, NULL, NULL, NULL, NULL) && Lcn != -1;
+    if (!Mapped && !FsRtlLookupLastLargeMcbEntry(&Fcb->Mcb, &Vcn, &Lcn))
+    {
+        Vcn = -1;
+    }
+    ExReleaseFastMutex(&Fcb->LastMutex);
+
+    if (Mapped)
+    {
+        *Cluster = (ULONG)Lcn;
+        goto Done;
+    }
+
+    if (Vcn == -1)
+    {
+        Vcn = 0;
+        CurrentCluster = FirstCluster;
+        RunVcn = 0;
+        RunLcn = FirstCluster;
+        RunLength = 1;
+    }
+    else
+    {
+        CurrentCluster = (ULONG)Lcn;
+        RunVcn = Vcn + 1;
+        RunLcn = 0;
+        RunLength = 0;
+    }
+
+    while (Vcn < TargetVcn)
+    {
+        Status = GetNextCluster(DeviceExt, CurrentCluster, &CurrentCluster);
+        if (!NT_SUCCESS(Status) || CurrentCluster == 0xffffffff)
+        {
+            break;
+        }
+        Vcn++;
+
+        if (RunLength != 0 && RunLcn + RunLength == CurrentCluster)
+        {
+            RunLength++;
+            continue;
+        }
+
+        if (RunLength != 0)
+        {
+            ExAcquireFastMutex(&Fcb->LastMutex);
+            FsRtlAddLargeMcbEntry(&Fcb->Mcb, RunVcn, RunLcn, RunLength);
+            ExReleaseFastMutex(&Fcb->LastMutex);
+        }
+        RunVcn = Vcn;
+        RunLcn = CurrentCluster;
+        RunLength = 1;
+    }
+
+    if (RunLength != 0)
+    {
+        ExAcquireFastMutex(&Fcb->LastMutex);
+        FsRtlAddLargeMcbEntry(&Fcb->Mcb, RunVcn, RunLcn, RunLength);
+        ExReleaseFastMutex(&Fcb->LastMutex);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+    *Cluster = CurrentCluster;
+
+Done:
+#ifdef DEBUG_VERIFY_OFFSET_CACHING
+    /* DEBUG VERIFICATION */
+    {
+        ULONG CorrectCluster;
+        OffsetToCluster(DeviceExt, FirstCluster,
+                        ROUND_DOWN(FileOffset, DeviceExt->FatInfo.BytesPerCluster),
+                        &CorrectCluster, FALSE);
+        if (CorrectCluster != *Cluster)
+            KeBugCheck(FAT_FILE_SYSTEM);
+    }
+#endif
+    return STATUS_SUCCESS;
+}
+
 /*
  * FUNCTION: Reads data from a file
  */
@@ -136,8 +256,6 @@ VfatReadFileData(
     ULONG BytesDone;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -215,36 +333,10 @@ VfatReadFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     /* Find the cluster to start the read from */
-    if (LastCluster > 0 && ReadOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
-#ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
+    Status = VfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                    ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
+                                    &CurrentCluster);
 
     if (!NT_SUCCESS(Status))
     {
@@ -349,8 +441,6 @@ VfatWriteFileData(
     ULONG BytesPerCluster;
     LARGE_INTEGER StartOffset;
     ULONG BufferOffset;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -428,38 +518,12 @@ VfatWriteFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     /*
      * Find the cluster to start the write from
      */
-    if (LastCluster > 0 && WriteOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
-#ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
+    Status = VfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                    ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
+                                    &CurrentCluster);
 
     if (!NT_SUCCESS(Status))
     {
@@ -601,12 +665,27 @@ VfatCommonRead(
                                      Fcb);
             }
 
-            if (!CcCopyRead(IrpContext->FileObject,
-                            &ByteOffset,
-                            Length,
-                            CanWait,
-                            Buffer,
-                            &IrpContext->Irp->IoStatus))
+            if (BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_MDL))
+            {
+                /* Hand out the cache pages themselves, no copy */
+                if (!CanWait)
+                {
+                    Status = STATUS_PENDING;
+                    goto ByeBye;
+                }
+
+                CcMdlRead(IrpContext->FileObject,
+                          &ByteOffset,
+                          Length,
+                          &IrpContext->Irp->MdlAddress,
+                          &IrpContext->Irp->IoStatus);
+            }
+            else if (!CcCopyRead(IrpContext->FileObject,
+                                 &ByteOffset,
+                                 Length,
+                                 CanWait,
+                                 Buffer,
+                                 &IrpContext->Irp->IoStatus))
             {
                 ASSERT(!CanWait);
                 Status = STATUS_PENDING;
@@ -767,6 +846,15 @@ VfatRead(
         goto ByeBye;
     }
 
+    /* MDL read completion: give back the cache pages handed out by CcMdlRead */
+    if (BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_COMPLETE))
+    {
+        CcMdlReadComplete(IrpContext->FileObject, IrpContext->Irp->MdlAddress);
+        IrpContext->Irp->MdlAddress = NULL;
+        IrpContext->Irp->IoStatus.Information = 0;
+        return STATUS_SUCCESS;
+    }
+
     DPRINT("'%wZ', Offset: %u, Length %u\n", &Fcb->PathNameU, ByteOffset.u.LowPart, Length);
 
     if (ByteOffset.u.HighPart && !IsVolume)
@@ -847,7 +935,16 @@ ByeBye:
 
     if (Status == STATUS_PENDING)
     {
-        Status = VfatLockUserBuffer(IrpContext->Irp, Length, IoWriteAccess);
+        /* MDL reads have no user buffer, the MDL is built when we run again */
+        if (!BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_MDL))
+        {
+            Status = VfatLockUserBuffer(IrpContext->Irp, Length, IoWriteAccess);
+        }
+        else
+        {
+            Status = STATUS_SUCCESS;
+        }
+
         if (NT_SUCCESS(Status))
         {
             Status = VfatMarkIrpContextForQueue(IrpContext);
@@ -323,6 +323,8 @@ typedef struct DEVICE_EXTENSION
     ULONG LastAvailableCluster;
     ULONG AvailableClusters;
     BOOLEAN AvailableClustersValid;
+    /* Clusters in use, loaded at mount time, protected by FatResource */
+    RTL_BITMAP FreeClusterBitmap;
     ULONG Flags;
     struct _VFATFCB *VolumeFcb;
     PSTATISTICS Statistics;
@@ -410,6 +412,8 @@ typedef struct
     NPAGED_LOOKASIDE_LIST IrpContextLookasideList;
     FAST_IO_DISPATCH FastIoDispatch;
     CACHE_MANAGER_CALLBACKS CacheMgrCallbacks;
+    /* Bytes currently allocated for directory name indexes */
+    LONG NameIndexBytes;
 } VFAT_GLOBAL_DATA, *PVFAT_GLOBAL_DATA;
 
 extern PVFAT_GLOBAL_DATA VfatGlobalData;
@@ -420,6 +424,7 @@ extern PVFAT_GLOBAL_DATA VfatGlobalData;
 #define FCB_IS_PAGE_FILE        0x0008
 #define FCB_IS_VOLUME           0x0010
 #define FCB_IS_DIRTY            0x0020
+#define FCB_NO_NAME_INDEX       0x0100
 #ifdef KDBG
 #define FCB_CLEANED_UP          0x0040
 #define FCB_CLOSED              0x0080
@@ -427,6 +432,26 @@ extern PVFAT_GLOBAL_DATA VfatGlobalData;
 
 #define NODE_TYPE_FCB ((CSHORT)0x0502)
 
+/* Directories smaller than this are always scanned linearly */
+#define VFAT_NAME_INDEX_MIN_SIZE    (16 * 1024)
+/* Upper bound for the memory used by all the name indexes together */
+#define VFAT_NAME_INDEX_BUDGET      (4 * 1024 * 1024)
+
+typedef struct _VFAT_NAME_INDEX_SLOT
+{
+    ULONG Hash;
+    ULONG DirIndex;
+} VFAT_NAME_INDEX_SLOT, *PVFAT_NAME_INDEX_SLOT;
+
+/* Open addressed hash table of the upcased long and 8.3 names of a directory */
+typedef struct _VFAT_NAME_INDEX
+{
+    ULONG Size;
+    ULONG Live;
+    ULONG Used;
+    VFAT_NAME_INDEX_SLOT Slots[1];
+} VFAT_NAME_INDEX, *PVFAT_NAME_INDEX;
+
 typedef struct _VFATFCB
 {
     /* FCB header required by ROS/NT */
@@ -510,6 +535,14 @@ typedef struct _VFATFCB
     FAST_MUTEX LastMutex;
     ULONG LastCluster;
     ULONG LastOffset;
+
+    /* Extents of the cluster chain walked so far (cluster index in the file
+     * to cluster number), protected by LastMutex. Must be truncated when
+     * the chain is */
+    LARGE_MCB Mcb;
+
+    /* Name index for large directories, protected by the VCB DirResource */
+    PVFAT_NAME_INDEX NameIndex;
 } VFATFCB, *PVFATFCB;
 
 #define CCB_DELETE_ON_CLOSE     0x0001
@@ -528,6 +561,7 @@ typedef struct _VFATCCB
 #define TAG_FCB  'BCFV'
 #define TAG_IRP  'PRIV'
 #define TAG_VFAT 'TAFV'
+#define TAG_NAME_INDEX 'XDIV'
 
 #define ENTRIES_PER_SECTOR (BLOCKSIZE / sizeof(FATDirEntry))
 
@@ -742,6 +776,32 @@ FsdSystemTimeToDosDateTime(
     USHORT *pDosDate,
     USHORT *pDosTime);
 
+/* dirindex.c */
+
+NTSTATUS
+vfatNameIndexFindFile(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext,
+    PVOID *pContext);
+
+VOID
+vfatNameIndexInsert(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PVFATFCB Fcb);
+
+VOID
+vfatNameIndexRemove(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PVFATFCB Fcb);
+
+VOID
+vfatDestroyNameIndex(
+    PVFATFCB DirFcb);
+
 /* direntry.c */
 
 ULONG
@@ -888,6 +948,13 @@ GetNextClusterExtend(
     ULONG CurrentCluster,
     PULONG NextCluster);
 
+NTSTATUS
+ExtendClusterChain(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG Count,
+    PULONG NewLastCluster);
+
 NTSTATUS
 CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
@@ -899,6 +966,10 @@ WriteCluster(
     ULONG ClusterToWrite,
     ULONG NewValue);
 
+VOID
+ReleaseFreeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt);
+
 NTSTATUS
 GetDirtyStatus(
     PDEVICE_EXTENSION DeviceExt,
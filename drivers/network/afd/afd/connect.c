@@ -317,6 +317,111 @@ MakeSocketIntoConnection(PAFD_FCB FCB) {
    return Status;
 }
 
+static VOID
+CompleteSuperConnect(PAFD_FCB FCB, PIRP Irp, NTSTATUS Status, ULONG_PTR Information) {
+    CleanupPendingIrp(FCB, Irp, IoGetCurrentIrpStackLocation(Irp), NULL);
+
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = Information;
+    if( Irp->MdlAddress ) UnlockRequest( Irp, IoGetCurrentIrpStackLocation( Irp ) );
+    (void)IoSetCancelRoutine(Irp, NULL);
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+}
+
+static IO_COMPLETION_ROUTINE SuperConnectSendComplete;
+static
+NTSTATUS
+NTAPI
+SuperConnectSendComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                         PVOID Context) {
+    PIRP ConnectIrp = (PIRP)Context;
+    PAFD_FCB FCB = IoGetCurrentIrpStackLocation(ConnectIrp)->FileObject->FsContext;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    AFD_DbgPrint(MID_TRACE,("Called, status %x, %u bytes used\n",
+                            Irp->IoStatus.Status,
+                            Irp->IoStatus.Information));
+
+    /* The MDL belongs to the ConnectEx request */
+    Irp->MdlAddress = NULL;
+
+    if( !SocketAcquireStateLock( FCB ) )
+        return STATUS_FILE_CLOSED;
+
+    ASSERT(FCB->SendIrp.InFlightRequest == Irp);
+    FCB->SendIrp.InFlightRequest = NULL;
+
+    RemoveEntryList(&ConnectIrp->Tail.Overlay.ListEntry);
+    CompleteSuperConnect(FCB,
+                         ConnectIrp,
+                         Irp->IoStatus.Status,
+                         NT_SUCCESS(Irp->IoStatus.Status) ? Irp->IoStatus.Information : 0);
+
+    /* Writes issued meanwhile have waited in the send window */
+    RetrySendWindow(FCB);
+
+    SocketStateUnlock( FCB );
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Sends the ConnectEx data straight from the caller's buffer. It can't
+ * go through the send window, which only holds data owned by send IRPs.
+ */
+static VOID
+SatisfySuperConnect(PAFD_FCB FCB, PIRP Irp) {
+    PMDL Mdl = Irp->Tail.Overlay.DriverContext[2];
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    if( Mdl ) {
+        Status = TdiSendMdl(&FCB->SendIrp.InFlightRequest,
+                            FCB->Connection.Object,
+                            0,
+                            Mdl,
+                            MmGetMdlByteCount(Mdl),
+                            SuperConnectSendComplete,
+                            Irp);
+        if( Status == STATUS_PENDING )
+            return;
+    }
+
+    RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
+    CompleteSuperConnect(FCB, Irp, Status, 0);
+}
+
+static NTSTATUS
+LockSuperConnectData(PIRP Irp, PIO_STACK_LOCATION IrpSp) {
+    ULONG Length = IrpSp->Parameters.DeviceIoControl.OutputBufferLength;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PMDL Mdl;
+
+    if( !Length || !Irp->UserBuffer )
+        return STATUS_SUCCESS;
+
+    Mdl = IoAllocateMdl(Irp->UserBuffer, Length, FALSE, FALSE, NULL);
+    if( !Mdl )
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    _SEH2_TRY {
+        MmProbeAndLockPages(Mdl, Irp->RequestorMode, IoReadAccess);
+    } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+        AFD_DbgPrint(MIN_TRACE, ("MmProbeAndLockPages() failed.\n"));
+        Status = _SEH2_GetExceptionCode();
+    } _SEH2_END;
+
+    if( !NT_SUCCESS(Status) ) {
+        IoFreeMdl(Mdl);
+        return Status;
+    }
+
+    /* CleanupPendingIrp releases it */
+    Irp->Tail.Overlay.DriverContext[2] = Mdl;
+
+    return STATUS_SUCCESS;
+}
+
 static IO_COMPLETION_ROUTINE StreamSocketConnectComplete;
 static
 NTSTATUS
@@ -326,7 +431,7 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     NTSTATUS Status = Irp->IoStatus.Status;
     PAFD_FCB FCB = (PAFD_FCB)Context;
     PLIST_ENTRY NextIrpEntry;
-    PIRP NextIrp;
+    PIRP NextIrp, SuperConnectIrp = NULL;
 
     AFD_DbgPrint(MID_TRACE,("Called: FCB %p, FO %p\n",
                             Context, FCB->FileObject));
@@ -349,6 +454,7 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
                NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
                NextIrp->IoStatus.Status = STATUS_FILE_CLOSED;
                NextIrp->IoStatus.Information = 0;
+               CleanupPendingIrp(FCB, NextIrp, IoGetCurrentIrpStackLocation(NextIrp), NULL);
                if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, IoGetCurrentIrpStackLocation( NextIrp ) );
                (void)IoSetCancelRoutine(NextIrp, NULL);
                IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
@@ -366,12 +472,24 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     }
 
     /* Succeed pending irps on the FUNCTION_CONNECT list */
-    while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_CONNECT] ) ) {
-        NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_CONNECT]);
+    NextIrpEntry = FCB->PendingIrpList[FUNCTION_CONNECT].Flink;
+    while( NextIrpEntry != &FCB->PendingIrpList[FUNCTION_CONNECT] ) {
         NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+        NextIrpEntry = NextIrpEntry->Flink;
+
+        /* ConnectEx stays queued until its data is sent */
+        if( NT_SUCCESS(Status) && !SuperConnectIrp &&
+            IoGetCurrentIrpStackLocation(NextIrp)->Parameters.DeviceIoControl.IoControlCode ==
+                IOCTL_AFD_SUPER_CONNECT ) {
+            SuperConnectIrp = NextIrp;
+            continue;
+        }
+
+        RemoveEntryList(&NextIrp->Tail.Overlay.ListEntry);
         AFD_DbgPrint(MID_TRACE,("Completing connect %p\n", NextIrp));
         NextIrp->IoStatus.Status = Status;
         NextIrp->IoStatus.Information = NT_SUCCESS(Status) ? ((ULONG_PTR)FCB->Connection.Handle) : 0;
+        CleanupPendingIrp(FCB, NextIrp, IoGetCurrentIrpStackLocation(NextIrp), NULL);
         if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, IoGetCurrentIrpStackLocation( NextIrp ) );
         (void)IoSetCancelRoutine(NextIrp, NULL);
         IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
@@ -381,6 +499,11 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         Status = MakeSocketIntoConnection( FCB );
 
         if( !NT_SUCCESS(Status) ) {
+            if( SuperConnectIrp ) {
+                RemoveEntryList(&SuperConnectIrp->Tail.Overlay.ListEntry);
+                CompleteSuperConnect(FCB, SuperConnectIrp, Status, 0);
+            }
+
             SocketStateUnlock( FCB );
             return Status;
         }
@@ -401,6 +524,10 @@ StreamSocketConnectComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,
                           FCB->FilledConnectOptions);
         }
 
+        /* The ConnectEx data goes out ahead of any queued writes */
+        if( SuperConnectIrp )
+            SatisfySuperConnect(FCB, SuperConnectIrp);
+
         if( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_SEND] ) ) {
             NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_SEND]);
             NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP,
@@ -443,6 +570,20 @@ AfdStreamSocketConnect(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp,
                                        0 );
 
+    if( IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_CONNECT ) {
+        /* ConnectEx needs a bound stream socket */
+        if( (FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) ||
+            FCB->State != SOCKET_STATE_BOUND ) {
+            AFD_DbgPrint(MIN_TRACE,("Inappropriate socket state %u for ConnectEx\n",
+                                    FCB->State));
+            return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+        }
+
+        Status = LockSuperConnectData( Irp, IrpSp );
+        if( !NT_SUCCESS(Status) )
+            return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
     AFD_DbgPrint(MID_TRACE,("Connect request:\n"));
 #if 0
     OskitDumpBuffer
@@ -574,5 +715,7 @@ AfdStreamSocketConnect(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         break;
     }
 
+    CleanupPendingIrp( FCB, Irp, IrpSp, NULL );
+
     return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
 }
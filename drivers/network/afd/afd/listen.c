@@ -10,20 +10,23 @@
 
 #include "afd.h"
 
-static NTSTATUS SatisfyAccept( PAFD_DEVICE_EXTENSION DeviceExt,
-                               PIRP Irp,
-                               PFILE_OBJECT NewFileObject,
-                               PAFD_TDI_OBJECT_QELT Qelt ) {
-    PAFD_FCB FCB = NewFileObject->FsContext;
-    NTSTATUS Status;
-
-    UNREFERENCED_PARAMETER(DeviceExt);
-
-    if( !SocketAcquireStateLock( FCB ) )
-        return LostSocket( Irp );
+/* Hangs off DriverContext[2] of the IOCTL_AFD_SUPER_ACCEPT IRP */
+typedef struct _AFD_SUPER_ACCEPT_CONTEXT {
+    PAFD_FCB FCB;
+    PIRP Irp;
+    PFILE_OBJECT AcceptFileObject;
+    PMDL OutputMdl;
+    PCHAR Output;
+    AFD_SUPER_ACCEPT_INFO Info;
+    PAFD_TDI_OBJECT_QELT Qelt;
+    PIRP ReceiveIrp;
+    BOOLEAN Receiving;
+} AFD_SUPER_ACCEPT_CONTEXT, *PAFD_SUPER_ACCEPT_CONTEXT;
 
-    /* Transfer the connection to the new socket, launch the opening read */
-    AFD_DbgPrint(MID_TRACE,("Completing a real accept (FCB %p)\n", FCB));
+/* Called with the new socket locked; it owns the connection afterwards */
+static NTSTATUS AcceptConnection( PAFD_FCB FCB,
+                                  PAFD_TDI_OBJECT_QELT Qelt ) {
+    NTSTATUS Status;
 
     FCB->Connection = Qelt->Object;
 
@@ -46,6 +49,26 @@ static NTSTATUS SatisfyAccept( PAFD_DEVICE_EXTENSION DeviceExt,
     if (NT_SUCCESS(Status))
         Status = TdiBuildConnectionInfo(&FCB->ConnectReturnInfo, FCB->RemoteAddress);
 
+    return Status;
+}
+
+static NTSTATUS SatisfyAccept( PAFD_DEVICE_EXTENSION DeviceExt,
+                               PIRP Irp,
+                               PFILE_OBJECT NewFileObject,
+                               PAFD_TDI_OBJECT_QELT Qelt ) {
+    PAFD_FCB FCB = NewFileObject->FsContext;
+    NTSTATUS Status;
+
+    UNREFERENCED_PARAMETER(DeviceExt);
+
+    if( !SocketAcquireStateLock( FCB ) )
+        return LostSocket( Irp );
+
+    /* Transfer the connection to the new socket, launch the opening read */
+    AFD_DbgPrint(MID_TRACE,("Completing a real accept (FCB %p)\n", FCB));
+
+    Status = AcceptConnection( FCB, Qelt );
+
     return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
 }
 
@@ -86,6 +109,225 @@ static NTSTATUS SatisfyPreAccept( PIRP Irp, PAFD_TDI_OBJECT_QELT Qelt ) {
     return STATUS_SUCCESS;
 }
 
+static VOID WriteAcceptAddress( PCHAR Slot,
+                                ULONG SlotLength,
+                                PTA_ADDRESS Address ) {
+    INT Length = Address->AddressLength + sizeof(USHORT);
+
+    /* Each slot holds the address length followed by the sockaddr */
+    if( (ULONG)Length > SlotLength - sizeof(INT) )
+        Length = SlotLength - sizeof(INT);
+
+    /* The slots can be unaligned */
+    RtlCopyMemory( Slot, &Length, sizeof(INT) );
+    RtlCopyMemory( Slot + sizeof(INT), &Address->AddressType, Length );
+}
+
+static VOID WriteLocalAcceptAddress( PAFD_SUPER_ACCEPT_CONTEXT AcceptContext,
+                                     PCHAR Slot ) {
+    PAFD_FCB FCB = AcceptContext->FCB;
+    PTDI_ADDRESS_INFO AddressInfo;
+    UINT Length;
+    PMDL Mdl;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    /* The listener may be bound to any address, ask the connection */
+    Length = FIELD_OFFSET(TDI_ADDRESS_INFO, Address) +
+             TaLengthOfTransportAddress( FCB->LocalAddress );
+
+    AddressInfo = ExAllocatePoolWithTag( NonPagedPool, Length,
+                                         TAG_AFD_TRANSPORT_ADDRESS );
+    Mdl = AddressInfo ? IoAllocateMdl( AddressInfo, Length,
+                                       FALSE, FALSE, NULL ) : NULL;
+
+    if( Mdl ) {
+        _SEH2_TRY {
+            MmProbeAndLockPages( Mdl, KernelMode, IoModifyAccess );
+        } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+            Status = _SEH2_GetExceptionCode();
+        } _SEH2_END;
+
+        /* The MDL goes away with the query IRP */
+        if( NT_SUCCESS(Status) )
+            Status = TdiQueryInformation( AcceptContext->Qelt->Object.Object,
+                                          TDI_QUERY_ADDRESS_INFO,
+                                          Mdl );
+        else
+            IoFreeMdl( Mdl );
+    } else
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+
+    WriteAcceptAddress( Slot,
+                        AcceptContext->Info.LocalAddressLength,
+                        NT_SUCCESS(Status) ?
+                            &AddressInfo->Address.Address[0] :
+                            &FCB->LocalAddress->Address[0] );
+
+    if( AddressInfo )
+        ExFreePoolWithTag( AddressInfo, TAG_AFD_TRANSPORT_ADDRESS );
+}
+
+VOID FreeSuperAccept( PIRP Irp ) {
+    PAFD_SUPER_ACCEPT_CONTEXT AcceptContext = Irp->Tail.Overlay.DriverContext[2];
+
+    if( !AcceptContext ) return;
+
+    if( AcceptContext->OutputMdl ) {
+        MmUnlockPages( AcceptContext->OutputMdl );
+        IoFreeMdl( AcceptContext->OutputMdl );
+    }
+
+    if( AcceptContext->AcceptFileObject )
+        ObDereferenceObject( AcceptContext->AcceptFileObject );
+
+    ExFreePoolWithTag( AcceptContext, TAG_AFD_ACCEPT_CONTEXT );
+    Irp->Tail.Overlay.DriverContext[2] = NULL;
+}
+
+/* Called with the listening socket locked */
+static VOID FinishSuperAccept( PAFD_SUPER_ACCEPT_CONTEXT AcceptContext,
+                               NTSTATUS Status,
+                               ULONG_PTR Received ) {
+    PIRP Irp = AcceptContext->Irp;
+    PAFD_TDI_OBJECT_QELT Qelt = AcceptContext->Qelt;
+    PAFD_FCB NewFCB = AcceptContext->AcceptFileObject->FsContext;
+    BOOLEAN Accepted = FALSE;
+    PCHAR Slot;
+
+    if( AcceptContext->Receiving ) {
+        RemoveEntryList( &Irp->Tail.Overlay.ListEntry );
+        AcceptContext->Receiving = FALSE;
+    }
+
+    if( NT_SUCCESS(Status) ) {
+        if( !SocketAcquireStateLock( NewFCB ) ) {
+            Status = STATUS_FILE_CLOSED;
+        } else {
+            /* The accept socket may have been used meanwhile */
+            if( NewFCB->State != SOCKET_STATE_CREATED ) {
+                Status = STATUS_INVALID_PARAMETER;
+            } else {
+                Status = AcceptConnection( NewFCB, Qelt );
+                Accepted = TRUE;
+            }
+            SocketStateUnlock( NewFCB );
+        }
+    }
+
+    if( !Accepted ) {
+        TdiDisassociateAddressFile( Qelt->Object.Object );
+        ObDereferenceObject( Qelt->Object.Object );
+        ZwClose( Qelt->Object.Handle );
+    }
+
+    if( NT_SUCCESS(Status) ) {
+        Slot = AcceptContext->Output + AcceptContext->Info.ReceiveDataLength;
+        WriteLocalAcceptAddress( AcceptContext, Slot );
+
+        Slot += AcceptContext->Info.LocalAddressLength;
+        WriteAcceptAddress( Slot,
+                            AcceptContext->Info.RemoteAddressLength,
+                            &((PTRANSPORT_ADDRESS)Qelt->ConnInfo->RemoteAddress)->Address[0] );
+    } else
+        Received = 0;
+
+    ExFreePoolWithTag( Qelt->ConnInfo, TAG_AFD_TDI_CONNECTION_INFORMATION );
+    ExFreePoolWithTag( Qelt, TAG_AFD_ACCEPT_QUEUE );
+
+    FreeSuperAccept( Irp );
+
+    AFD_DbgPrint(MID_TRACE,("Completed a super accept (%x, %Iu bytes)\n",
+                            Status, Received));
+
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = Received;
+    (void)IoSetCancelRoutine(Irp, NULL);
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+}
+
+static IO_COMPLETION_ROUTINE SuperAcceptReceiveComplete;
+static NTSTATUS NTAPI SuperAcceptReceiveComplete( PDEVICE_OBJECT DeviceObject,
+                                                  PIRP Irp,
+                                                  PVOID Context ) {
+    PAFD_SUPER_ACCEPT_CONTEXT AcceptContext = Context;
+    PAFD_FCB FCB = AcceptContext->FCB;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    if( !SocketAcquireStateLock( FCB ) )
+        return STATUS_FILE_CLOSED;
+
+    ASSERT(AcceptContext->ReceiveIrp == Irp);
+    AcceptContext->ReceiveIrp = NULL;
+
+    FinishSuperAccept( AcceptContext,
+                       Irp->IoStatus.Status,
+                       Irp->IoStatus.Information );
+
+    SocketStateUnlock( FCB );
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Starts the first receive on a connection taken by AcceptEx. The
+ * connection only moves to the accept socket once it has completed, so
+ * that the socket's own reads can't overtake it. Called locked.
+ */
+static VOID StartSuperAccept( PAFD_SUPER_ACCEPT_CONTEXT AcceptContext,
+                              PAFD_TDI_OBJECT_QELT Qelt ) {
+    PAFD_FCB FCB = AcceptContext->FCB;
+    PIRP Irp = AcceptContext->Irp;
+    NTSTATUS Status;
+
+    AcceptContext->Qelt = Qelt;
+
+    if( Irp->Cancel ) {
+        FinishSuperAccept( AcceptContext, STATUS_CANCELLED, 0 );
+        return;
+    }
+
+    if( !AcceptContext->Info.ReceiveDataLength ) {
+        FinishSuperAccept( AcceptContext, STATUS_SUCCESS, 0 );
+        return;
+    }
+
+    /* Cancelling the request cancels the receive while it is on this list */
+    InsertTailList( &FCB->PendingIrpList[FUNCTION_ACCEPT],
+                    &Irp->Tail.Overlay.ListEntry );
+    AcceptContext->Receiving = TRUE;
+
+    Status = TdiReceive( &AcceptContext->ReceiveIrp,
+                         Qelt->Object.Object,
+                         TDI_RECEIVE_NORMAL,
+                         AcceptContext->Output,
+                         AcceptContext->Info.ReceiveDataLength,
+                         SuperAcceptReceiveComplete,
+                         AcceptContext );
+
+    /* The context may be gone already if the receive was pending */
+    if( Status != STATUS_PENDING )
+        FinishSuperAccept( AcceptContext, Status, 0 );
+}
+
+BOOLEAN CancelSuperAccept( PAFD_FCB FCB, PIRP Irp ) {
+    PAFD_SUPER_ACCEPT_CONTEXT AcceptContext = Irp->Tail.Overlay.DriverContext[2];
+    PLIST_ENTRY CurrentEntry;
+
+    for( CurrentEntry = FCB->PendingIrpList[FUNCTION_ACCEPT].Flink;
+         CurrentEntry != &FCB->PendingIrpList[FUNCTION_ACCEPT];
+         CurrentEntry = CurrentEntry->Flink ) {
+        if( CONTAINING_RECORD( CurrentEntry, IRP, Tail.Overlay.ListEntry ) == Irp ) {
+            /* The receive completion finishes the request */
+            if( AcceptContext->ReceiveIrp )
+                IoCancelIrp( AcceptContext->ReceiveIrp );
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
 static IO_COMPLETION_ROUTINE ListenComplete;
 static NTSTATUS NTAPI ListenComplete( PDEVICE_OBJECT DeviceObject,
                                       PIRP Irp,
@@ -111,6 +353,7 @@ static NTSTATUS NTAPI ListenComplete( PDEVICE_OBJECT DeviceObject,
            NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
            NextIrp->IoStatus.Status = STATUS_FILE_CLOSED;
            NextIrp->IoStatus.Information = 0;
+           CleanupPendingIrp(FCB, NextIrp, IoGetCurrentIrpStackLocation(NextIrp), NULL);
            if( NextIrp->MdlAddress ) UnlockRequest( NextIrp, IoGetCurrentIrpStackLocation( NextIrp ) );
            (void)IoSetCancelRoutine(NextIrp, NULL);
            IoCompleteRequest( NextIrp, IO_NETWORK_INCREMENT );
@@ -178,11 +421,23 @@ static NTSTATUS NTAPI ListenComplete( PDEVICE_OBJECT DeviceObject,
         PLIST_ENTRY PendingIrp  =
             RemoveHeadList( &FCB->PendingIrpList[FUNCTION_PREACCEPT] );
         PLIST_ENTRY PendingConn = FCB->PendingConnections.Flink;
-        SatisfyPreAccept
-            ( CONTAINING_RECORD( PendingIrp, IRP,
-                                 Tail.Overlay.ListEntry ),
-              CONTAINING_RECORD( PendingConn, AFD_TDI_OBJECT_QELT,
-                                 ListEntry ) );
+        PIRP PreAcceptIrp =
+            CONTAINING_RECORD( PendingIrp, IRP, Tail.Overlay.ListEntry );
+
+        if( IoGetCurrentIrpStackLocation( PreAcceptIrp )->
+                Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_ACCEPT ) {
+            /* AcceptEx takes the connection itself */
+            RemoveEntryList( PendingConn );
+            StartSuperAccept
+                ( PreAcceptIrp->Tail.Overlay.DriverContext[2],
+                  CONTAINING_RECORD( PendingConn, AFD_TDI_OBJECT_QELT,
+                                     ListEntry ) );
+        } else {
+            SatisfyPreAccept
+                ( PreAcceptIrp,
+                  CONTAINING_RECORD( PendingConn, AFD_TDI_OBJECT_QELT,
+                                     ListEntry ) );
+        }
     }
 
     /* Launch new accept socket */
@@ -404,3 +659,150 @@ NTSTATUS AfdAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 
     return UnlockAndMaybeComplete( FCB, STATUS_UNSUCCESSFUL, Irp, 0 );
 }
+
+/*
+ * AcceptEx: waits for a connection, hands it to the given socket and
+ * receives the first data into the output buffer, all in one request.
+ * The local and remote addresses follow the data in the output buffer.
+ */
+NTSTATUS AfdSuperAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                         PIO_STACK_LOCATION IrpSp ) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext, NewFCB;
+    PAFD_SUPER_ACCEPT_INFO AcceptReq;
+    PAFD_SUPER_ACCEPT_CONTEXT AcceptContext;
+    PFILE_OBJECT NewFileObject;
+    PLIST_ENTRY PendingConn;
+    KPROCESSOR_MODE LockMode;
+    ULONGLONG OutputLength;
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    if( FCB->State != SOCKET_STATE_LISTENING ) {
+        AFD_DbgPrint(MIN_TRACE,("Socket is not listening\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
+    if( !(AcceptReq = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    AcceptContext = ExAllocatePoolWithTag( NonPagedPool,
+                                           sizeof(*AcceptContext),
+                                           TAG_AFD_ACCEPT_CONTEXT );
+    if( !AcceptContext )
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    RtlZeroMemory( AcceptContext, sizeof(*AcceptContext) );
+    AcceptContext->FCB = FCB;
+    AcceptContext->Irp = Irp;
+    AcceptContext->Info = *AcceptReq;
+
+    UnlockRequest( Irp, IrpSp );
+
+    /* From here on CleanupPendingIrp frees the context */
+    Irp->Tail.Overlay.DriverContext[2] = AcceptContext;
+
+    OutputLength = (ULONGLONG)AcceptContext->Info.ReceiveDataLength +
+                   AcceptContext->Info.LocalAddressLength +
+                   AcceptContext->Info.RemoteAddressLength;
+
+    if( AcceptContext->Info.LocalAddressLength < sizeof(INT) ||
+        AcceptContext->Info.RemoteAddressLength < sizeof(INT) ||
+        OutputLength > IrpSp->Parameters.DeviceIoControl.OutputBufferLength ) {
+        Status = STATUS_INVALID_PARAMETER;
+    }
+
+    if( NT_SUCCESS(Status) ) {
+        Status = ObReferenceObjectByHandle( AcceptContext->Info.AcceptHandle,
+                                            FILE_ALL_ACCESS,
+                                            *IoFileObjectType,
+                                            LockMode,
+                                            (PVOID *)&NewFileObject,
+                                            NULL );
+    }
+
+    if( NT_SUCCESS(Status) ) {
+        AcceptContext->AcceptFileObject = NewFileObject;
+
+        if( NewFileObject->DeviceObject != DeviceObject ||
+            NewFileObject == FileObject ) {
+            Status = STATUS_INVALID_PARAMETER;
+        } else {
+            NewFCB = NewFileObject->FsContext;
+
+            if( !SocketAcquireStateLock( NewFCB ) ) {
+                Status = STATUS_FILE_CLOSED;
+            } else {
+                if( NewFCB->State != SOCKET_STATE_CREATED )
+                    Status = STATUS_INVALID_PARAMETER;
+                SocketStateUnlock( NewFCB );
+            }
+        }
+    }
+
+    if( NT_SUCCESS(Status) ) {
+        AcceptContext->OutputMdl = IoAllocateMdl( Irp->UserBuffer,
+                                                  (ULONG)OutputLength,
+                                                  FALSE,
+                                                  FALSE,
+                                                  NULL );
+        if( !AcceptContext->OutputMdl )
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if( NT_SUCCESS(Status) ) {
+        _SEH2_TRY {
+            MmProbeAndLockPages( AcceptContext->OutputMdl, Irp->RequestorMode, IoWriteAccess );
+        } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+            AFD_DbgPrint(MIN_TRACE, ("MmProbeAndLockPages() failed.\n"));
+            Status = _SEH2_GetExceptionCode();
+        } _SEH2_END;
+
+        if( !NT_SUCCESS(Status) ) {
+            IoFreeMdl( AcceptContext->OutputMdl );
+            AcceptContext->OutputMdl = NULL;
+        }
+    }
+
+    if( NT_SUCCESS(Status) ) {
+        AcceptContext->Output = MmGetSystemAddressForMdlSafe( AcceptContext->OutputMdl,
+                                                              NormalPagePriority );
+        if( !AcceptContext->Output )
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if( !NT_SUCCESS(Status) ) {
+        FreeSuperAccept( Irp );
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    FCB->EventSelectDisabled &= ~AFD_EVENT_ACCEPT;
+
+    if( IsListEmpty( &FCB->PendingConnections ) ) {
+        AFD_DbgPrint(MID_TRACE,("Holding\n"));
+
+        return LeaveIrpUntilLater( FCB, Irp, FUNCTION_PREACCEPT );
+    }
+
+    PendingConn = RemoveHeadList( &FCB->PendingConnections );
+
+    if( !IsListEmpty( &FCB->PendingConnections ) ) {
+        FCB->PollState |= AFD_EVENT_ACCEPT;
+        FCB->PollStatus[FD_ACCEPT_BIT] = STATUS_SUCCESS;
+        PollReeval( FCB->DeviceExt, FCB->FileObject );
+    } else
+        FCB->PollState &= ~AFD_EVENT_ACCEPT;
+
+    IoMarkIrpPending( Irp );
+    (void)IoSetCancelRoutine( Irp, AfdCancelHandler );
+
+    StartSuperAccept( AcceptContext,
+                      CONTAINING_RECORD( PendingConn, AFD_TDI_OBJECT_QELT, ListEntry ) );
+
+    SocketStateUnlock( FCB );
+
+    return STATUS_PENDING;
+}
@@ -445,6 +445,10 @@ AfdCleanupSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         }
     }
 
+    /* A TransmitFile in progress isn't on any of the lists */
+    if (FCB->TransmitIrp)
+        IoCancelIrp(FCB->TransmitIrp);
+
     KillSelectsForFCB( FCB->DeviceExt, FileObject, FALSE );
 
     return UnlockAndMaybeComplete(FCB, STATUS_SUCCESS, Irp, 0);
@@ -947,6 +951,7 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
             return AfdBindSocket( DeviceObject, Irp, IrpSp );
 
         case IOCTL_AFD_CONNECT:
+        case IOCTL_AFD_SUPER_CONNECT:
             return AfdStreamSocketConnect( DeviceObject, Irp, IrpSp );
 
         case IOCTL_AFD_START_LISTEN:
@@ -975,6 +980,9 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
         case IOCTL_AFD_SEND_DATAGRAM:
             return AfdPacketSocketWriteData( DeviceObject, Irp, IrpSp );
 
+        case IOCTL_AFD_TRANSMIT_FILE:
+            return AfdTransmitFile( DeviceObject, Irp, IrpSp );
+
         case IOCTL_AFD_GET_INFO:
             return AfdGetInfo( DeviceObject, Irp, IrpSp );
 
@@ -996,6 +1004,9 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
         case IOCTL_AFD_ACCEPT:
             return AfdAccept( DeviceObject, Irp, IrpSp );
 
+        case IOCTL_AFD_SUPER_ACCEPT:
+            return AfdSuperAccept( DeviceObject, Irp, IrpSp );
+
         case IOCTL_AFD_DISCONNECT:
             return AfdDisconnect( DeviceObject, Irp, IrpSp );
 
@@ -1137,6 +1148,7 @@ CleanupPendingIrp(PAFD_FCB FCB, PIRP Irp, PIO_STACK_LOCATION IrpSp, PAFD_ACTIVE_
     PAFD_RECV_INFO RecvReq;
     PAFD_SEND_INFO SendReq;
     PAFD_POLL_INFO PollReq;
+    PMDL Mdl;
 
     if (IrpSp->MajorFunction == IRP_MJ_READ)
     {
@@ -1170,6 +1182,21 @@ CleanupPendingIrp(PAFD_FCB FCB, PIRP Irp, PIO_STACK_LOCATION IrpSp, PAFD_ACTIVE_
             ZeroEvents(PollReq->Handles, PollReq->HandleCount);
             SignalSocket(Poll, NULL, PollReq, STATUS_CANCELLED);
         }
+        else if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_CONNECT)
+        {
+            /* The ConnectEx send data */
+            Mdl = Irp->Tail.Overlay.DriverContext[2];
+            if (Mdl)
+            {
+                MmUnlockPages(Mdl);
+                IoFreeMdl(Mdl);
+                Irp->Tail.Overlay.DriverContext[2] = NULL;
+            }
+        }
+        else if (IrpSp->Parameters.DeviceIoControl.IoControlCode == IOCTL_AFD_SUPER_ACCEPT)
+        {
+            FreeSuperAccept(Irp);
+        }
     }
 }
 
@@ -1229,10 +1256,33 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
             Function = FUNCTION_CONNECT;
             break;
 
+        case IOCTL_AFD_SUPER_CONNECT:
+            /* Once connected, the request waits for its data to be sent */
+            if (FCB->State == SOCKET_STATE_CONNECTED)
+            {
+                if (FCB->SendIrp.InFlightRequest)
+                    IoCancelIrp(FCB->SendIrp.InFlightRequest);
+
+                SocketStateUnlock(FCB);
+                return;
+            }
+            Function = FUNCTION_CONNECT;
+            break;
+
         case IOCTL_AFD_WAIT_FOR_LISTEN:
             Function = FUNCTION_PREACCEPT;
             break;
 
+        case IOCTL_AFD_SUPER_ACCEPT:
+            /* Once it has a connection, the first receive completes it */
+            if (CancelSuperAccept(FCB, Irp))
+            {
+                SocketStateUnlock(FCB);
+                return;
+            }
+            Function = FUNCTION_PREACCEPT;
+            break;
+
         case IOCTL_AFD_SELECT:
             KeAcquireSpinLock(&DeviceExt->Lock, &OldIrql);
 
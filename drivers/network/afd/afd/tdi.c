@@ -973,6 +973,61 @@ NTSTATUS TdiSend(
     return STATUS_PENDING;
 }
 
+NTSTATUS TdiSendMdl(
+    PIRP *Irp,
+    PFILE_OBJECT TransportObject,
+    USHORT Flags,
+    PMDL Mdl,
+    UINT BufferLength,
+    PIO_COMPLETION_ROUTINE CompletionRoutine,
+    PVOID CompletionContext)
+/*
+ * FUNCTION: Sends from an MDL that is already locked
+ * NOTES:
+ *     The caller keeps ownership of the MDL and must take it back
+ *     (Irp->MdlAddress = NULL) in its completion routine
+ */
+{
+    PDEVICE_OBJECT DeviceObject;
+
+    ASSERT(*Irp == NULL);
+
+    if (!TransportObject) {
+        AFD_DbgPrint(MIN_TRACE, ("Bad transport object.\n"));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    DeviceObject = IoGetRelatedDeviceObject(TransportObject);
+    if (!DeviceObject) {
+        AFD_DbgPrint(MIN_TRACE, ("Bad device object.\n"));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *Irp = TdiBuildInternalDeviceControlIrp(TDI_SEND,                /* Sub function */
+                                            DeviceObject,            /* Device object */
+                                            TransportObject,         /* File object */
+                                            NULL,                    /* Event */
+                                            NULL);                   /* Status */
+
+    if (!*Irp) {
+        AFD_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    TdiBuildSend(*Irp,                   /* I/O Request Packet */
+                 DeviceObject,           /* Device object */
+                 TransportObject,        /* File object */
+                 CompletionRoutine,      /* Completion routine */
+                 CompletionContext,      /* Completion context */
+                 Mdl,                    /* Data buffer */
+                 Flags,                  /* Flags */
+                 BufferLength);          /* Length of data */
+
+    TdiCall(*Irp, DeviceObject, NULL, NULL);
+
+    return STATUS_PENDING;
+}
+
 NTSTATUS TdiReceive(
     PIRP *Irp,
     PFILE_OBJECT TransportObject,
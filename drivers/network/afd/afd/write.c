@@ -10,6 +10,79 @@
 
 #include "afd.h"
 
+#define TRANSMIT_SOURCE_NONE    0
+#define TRANSMIT_SOURCE_HEAD    1
+#define TRANSMIT_SOURCE_FILE    2
+#define TRANSMIT_SOURCE_TAIL    3
+
+/* Hangs off DriverContext[2] of the IOCTL_AFD_TRANSMIT_FILE IRP */
+typedef struct _AFD_TRANSMIT_CONTEXT {
+    PAFD_FCB FCB;
+    PIRP Irp;
+    PIO_WORKITEM WorkItem;
+    PFILE_OBJECT FileObject;
+    LARGE_INTEGER Offset;
+    ULONGLONG Remaining;
+    ULONGLONG TotalBytesSent;
+    ULONG ChunkSize;
+    ULONG Flags;
+    BOOLEAN UseFilePointer;
+    BOOLEAN Started;
+    BOOLEAN NoMdlRead;
+    PCHAR Buffers;
+    ULONG HeadLength, HeadSent;
+    ULONG TailLength, TailSent;
+    PCHAR ReadBuffer;
+    PMDL ReadMdl;
+    PMDL MdlChain;
+    ULONG SendSource;
+    UINT SendAhead;
+    IO_STATUS_BLOCK SendIosb;
+} AFD_TRANSMIT_CONTEXT, *PAFD_TRANSMIT_CONTEXT;
+
+static IO_WORKITEM_ROUTINE TransmitWorker;
+
+/*
+ * Returns how much of the send window may go out now. While a
+ * TransmitFile is pending, only the data queued ahead of it is sent;
+ * whatever other writers add meanwhile waits until it has finished.
+ */
+static UINT
+SendWindowAvailable(PAFD_FCB FCB, UINT BytesSent) {
+    PAFD_TRANSMIT_CONTEXT TransmitContext;
+
+    if (!FCB->TransmitIrp)
+        return FCB->Send.BytesUsed;
+
+    TransmitContext = FCB->TransmitIrp->Tail.Overlay.DriverContext[2];
+    if (TransmitContext->Started)
+        return 0;
+
+    TransmitContext->SendAhead -= MIN(BytesSent, TransmitContext->SendAhead);
+    if (FCB->TransmitIrp->Cancel)
+        TransmitContext->SendAhead = 0;
+
+    return TransmitContext->SendAhead;
+}
+
+static VOID
+ResumeTransmit(PAFD_FCB FCB) {
+    PAFD_TRANSMIT_CONTEXT TransmitContext;
+
+    if (!FCB->TransmitIrp)
+        return;
+
+    TransmitContext = FCB->TransmitIrp->Tail.Overlay.DriverContext[2];
+    if (!TransmitContext->Started)
+    {
+        TransmitContext->Started = TRUE;
+        IoQueueWorkItem(TransmitContext->WorkItem,
+                        TransmitWorker,
+                        DelayedWorkQueue,
+                        TransmitContext);
+    }
+}
+
 static IO_COMPLETION_ROUTINE SendComplete;
 static NTSTATUS NTAPI SendComplete
 ( PDEVICE_OBJECT DeviceObject,
@@ -23,7 +96,7 @@ static NTSTATUS NTAPI SendComplete
     PAFD_SEND_INFO SendReq = NULL;
     PAFD_MAPBUF Map;
     UINT TotalBytesCopied = 0, TotalBytesProcessed = 0, SpaceAvail, i;
-    UINT SendLength, BytesCopied;
+    UINT SendLength, BytesCopied, Available;
     BOOLEAN HaltSendQueue;
 
     UNREFERENCED_PARAMETER(DeviceObject);
@@ -94,6 +167,9 @@ static NTSTATUS NTAPI SendComplete
 
         RetryDisconnectCompletion(FCB);
 
+        /* Let a waiting TransmitFile run into the error itself */
+        ResumeTransmit(FCB);
+
         SocketStateUnlock( FCB );
 
         return STATUS_SUCCESS;
@@ -236,13 +312,14 @@ static NTSTATUS NTAPI SendComplete
 
 
     /* Some data is still waiting */
-    if( FCB->Send.BytesUsed )
+    Available = SendWindowAvailable(FCB, Irp->IoStatus.Information);
+    if( Available )
     {
         Status = TdiSend( &FCB->SendIrp.InFlightRequest,
                           FCB->Connection.Object,
                           0,
                           FCB->Send.Window,
-                          FCB->Send.BytesUsed,
+                          Available,
                           SendComplete,
                           FCB );
     }
@@ -250,6 +327,9 @@ static NTSTATUS NTAPI SendComplete
     {
         /* Nothing is waiting so try to complete a pending disconnect */
         RetryDisconnectCompletion(FCB);
+
+        /* The data ahead of a pending TransmitFile is out, let it go on */
+        ResumeTransmit(FCB);
     }
 
     SocketStateUnlock( FCB );
@@ -544,7 +624,8 @@ AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
     Irp->Tail.Overlay.DriverContext[3] = (PVOID)Irp->IoStatus.Information;
 
     Status = QueueUserModeIrp(FCB, Irp, FUNCTION_SEND);
-    if (Status == STATUS_PENDING && !FCB->SendIrp.InFlightRequest)
+    if (Status == STATUS_PENDING && !FCB->SendIrp.InFlightRequest &&
+        !FCB->TransmitIrp)
     {
         TdiSend(&FCB->SendIrp.InFlightRequest,
                 FCB->Connection.Object,
@@ -676,3 +757,642 @@ AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
     }
 }
+
+/* Restarts the send window once the send IRP is free again */
+VOID
+RetrySendWindow(PAFD_FCB FCB) {
+    UINT Available;
+
+    if (FCB->State == SOCKET_STATE_CLOSED || FCB->SendIrp.InFlightRequest)
+        return;
+
+    Available = SendWindowAvailable(FCB, 0);
+    if (Available)
+    {
+        TdiSend(&FCB->SendIrp.InFlightRequest,
+                FCB->Connection.Object,
+                0,
+                FCB->Send.Window,
+                Available,
+                SendComplete,
+                FCB);
+    }
+    else
+    {
+        RetryDisconnectCompletion(FCB);
+        ResumeTransmit(FCB);
+    }
+}
+
+static IO_COMPLETION_ROUTINE TransmitReadComplete;
+static NTSTATUS NTAPI TransmitReadComplete
+( PDEVICE_OBJECT DeviceObject,
+  PIRP Irp,
+  PVOID Context ) {
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    if (Irp->PendingReturned)
+        KeSetEvent((PKEVENT)Context, IO_NO_INCREMENT, FALSE);
+
+    /* We free the IRP ourselves */
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+/* Sends a read IRP to the file system for the cases fast I/O didn't take */
+static NTSTATUS
+TransmitReadIrp(PAFD_TRANSMIT_CONTEXT TransmitContext,
+                UCHAR MinorFunction,
+                ULONG Length,
+                PIO_STATUS_BLOCK Iosb) {
+    PFILE_OBJECT FileObject = TransmitContext->FileObject;
+    PDEVICE_OBJECT DeviceObject = IoGetRelatedDeviceObject(FileObject);
+    PIO_STACK_LOCATION IrpSp;
+    KEVENT Event;
+    PIRP Irp;
+
+    Irp = IoAllocateIrp(DeviceObject->StackSize, FALSE);
+    if (!Irp)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    KeInitializeEvent(&Event, NotificationEvent, FALSE);
+
+    Irp->Tail.Overlay.OriginalFileObject = FileObject;
+    Irp->Tail.Overlay.Thread = PsGetCurrentThread();
+    Irp->RequestorMode = KernelMode;
+    /* MDL reads need a request that may block in the file system */
+    Irp->Flags = IRP_READ_OPERATION | IRP_SYNCHRONOUS_API;
+
+    if (MinorFunction == IRP_MN_NORMAL)
+    {
+        Irp->UserBuffer = TransmitContext->ReadBuffer;
+        Irp->MdlAddress = TransmitContext->ReadMdl;
+    }
+    else if (MinorFunction == IRP_MN_COMPLETE_MDL)
+    {
+        Irp->MdlAddress = TransmitContext->MdlChain;
+    }
+
+    IrpSp = IoGetNextIrpStackLocation(Irp);
+    IrpSp->MajorFunction = IRP_MJ_READ;
+    IrpSp->MinorFunction = MinorFunction;
+    IrpSp->FileObject = FileObject;
+    IrpSp->Parameters.Read.Length = Length;
+    IrpSp->Parameters.Read.ByteOffset = TransmitContext->Offset;
+
+    IoSetCompletionRoutine(Irp, TransmitReadComplete, &Event, TRUE, TRUE, TRUE);
+
+    if (IoCallDriver(DeviceObject, Irp) == STATUS_PENDING)
+    {
+        KeWaitForSingleObject(&Event,
+                              Executive,
+                              KernelMode,
+                              FALSE,
+                              NULL);
+    }
+
+    *Iosb = Irp->IoStatus;
+
+    if (MinorFunction == IRP_MN_MDL)
+        TransmitContext->MdlChain = Irp->MdlAddress;
+
+    Irp->MdlAddress = NULL;
+    IoFreeIrp(Irp);
+
+    return Iosb->Status;
+}
+
+/* Hands the cache pages of the last MDL read back to the file system */
+static VOID
+TransmitMdlReadComplete(PAFD_TRANSMIT_CONTEXT TransmitContext) {
+    IO_STATUS_BLOCK Iosb;
+
+    if (!FsRtlMdlReadComplete(TransmitContext->FileObject,
+                              TransmitContext->MdlChain))
+    {
+        TransmitReadIrp(TransmitContext, IRP_MN_COMPLETE_MDL, 0, &Iosb);
+    }
+
+    TransmitContext->MdlChain = NULL;
+}
+
+/*
+ * Reads the next piece of the file. The data is normally sent straight
+ * out of the cache with an MDL read; file systems that don't do MDL
+ * reads get a copy into our own nonpaged buffer instead.
+ * A zero length means the end of the file was reached.
+ */
+static NTSTATUS
+TransmitReadFile(PAFD_TRANSMIT_CONTEXT TransmitContext,
+                 PCHAR *Buffer,
+                 PULONG Length) {
+    IO_STATUS_BLOCK Iosb;
+    ULONG ReadLength;
+    NTSTATUS Status;
+
+    *Buffer = NULL;
+    *Length = 0;
+
+    ReadLength = (ULONG)MIN(TransmitContext->ChunkSize, TransmitContext->Remaining);
+
+    if (!TransmitContext->NoMdlRead)
+    {
+        if (FsRtlMdlRead(TransmitContext->FileObject,
+                         &TransmitContext->Offset,
+                         ReadLength,
+                         0,
+                         &TransmitContext->MdlChain,
+                         &Iosb))
+        {
+            Status = Iosb.Status;
+        }
+        else
+        {
+            Status = TransmitReadIrp(TransmitContext, IRP_MN_MDL, ReadLength, &Iosb);
+        }
+
+        if (Status == STATUS_END_OF_FILE)
+            Status = STATUS_SUCCESS;
+
+        if (NT_SUCCESS(Status))
+        {
+            if (TransmitContext->MdlChain)
+            {
+                /* The transport only sends from the first MDL of a chain */
+                *Length = MIN((ULONG)Iosb.Information,
+                              MmGetMdlByteCount(TransmitContext->MdlChain));
+                if (*Length == 0)
+                    TransmitMdlReadComplete(TransmitContext);
+            }
+
+            return STATUS_SUCCESS;
+        }
+
+        AFD_DbgPrint(MID_TRACE,("MDL read failed (%x), copying instead\n", Status));
+
+        if (TransmitContext->MdlChain)
+            TransmitMdlReadComplete(TransmitContext);
+
+        TransmitContext->NoMdlRead = TRUE;
+    }
+
+    if (!TransmitContext->ReadBuffer)
+    {
+        TransmitContext->ReadBuffer = ExAllocatePoolWithTag(NonPagedPool,
+                                                            TransmitContext->ChunkSize,
+                                                            TAG_AFD_TRANSMIT_BUFFER);
+        if (!TransmitContext->ReadBuffer)
+            return STATUS_NO_MEMORY;
+
+        TransmitContext->ReadMdl = IoAllocateMdl(TransmitContext->ReadBuffer,
+                                                 TransmitContext->ChunkSize,
+                                                 FALSE,
+                                                 FALSE,
+                                                 NULL);
+        if (!TransmitContext->ReadMdl)
+            return STATUS_NO_MEMORY;
+
+        MmBuildMdlForNonPagedPool(TransmitContext->ReadMdl);
+    }
+
+    Status = TransmitReadIrp(TransmitContext, IRP_MN_NORMAL, ReadLength, &Iosb);
+    if (Status == STATUS_END_OF_FILE)
+        return STATUS_SUCCESS;
+
+    if (NT_SUCCESS(Status))
+    {
+        *Buffer = TransmitContext->ReadBuffer;
+        *Length = (ULONG)Iosb.Information;
+    }
+
+    return Status;
+}
+
+static VOID
+FreeTransmitContext(PAFD_TRANSMIT_CONTEXT TransmitContext) {
+    if (TransmitContext->FileObject)
+        ObDereferenceObject(TransmitContext->FileObject);
+    if (TransmitContext->WorkItem)
+        IoFreeWorkItem(TransmitContext->WorkItem);
+    if (TransmitContext->Buffers)
+        ExFreePoolWithTag(TransmitContext->Buffers, TAG_AFD_TRANSMIT_BUFFER);
+    if (TransmitContext->ReadMdl)
+        IoFreeMdl(TransmitContext->ReadMdl);
+    if (TransmitContext->ReadBuffer)
+        ExFreePoolWithTag(TransmitContext->ReadBuffer, TAG_AFD_TRANSMIT_BUFFER);
+
+    ExFreePoolWithTag(TransmitContext, TAG_AFD_TRANSMIT_CONTEXT);
+}
+
+static VOID
+TransmitFinish(PAFD_TRANSMIT_CONTEXT TransmitContext, NTSTATUS Status) {
+    PAFD_FCB FCB = TransmitContext->FCB;
+    PIRP Irp = TransmitContext->Irp;
+    UINT Information;
+
+    AFD_DbgPrint(MID_TRACE,("Transmitted %I64u bytes, status %x\n",
+                            TransmitContext->TotalBytesSent, Status));
+
+    if (TransmitContext->UseFilePointer)
+        TransmitContext->FileObject->CurrentByteOffset = TransmitContext->Offset;
+
+    Information = (UINT)MIN(TransmitContext->TotalBytesSent, MAXULONG);
+
+    if( !SocketAcquireStateLock( FCB ) ) {
+        Irp->Tail.Overlay.DriverContext[2] = NULL;
+        FreeTransmitContext(TransmitContext);
+        LostSocket( Irp );
+        return;
+    }
+
+    FCB->TransmitIrp = NULL;
+
+    if (NT_SUCCESS(Status) &&
+        (TransmitContext->Flags & (AFD_TF_DISCONNECT | AFD_TF_REUSE_SOCKET)) &&
+        FCB->State == SOCKET_STATE_CONNECTED && !FCB->DisconnectPending)
+    {
+        /* Graceful close once the data queued behind us is out too */
+        FCB->DisconnectFlags = TDI_DISCONNECT_RELEASE;
+        FCB->DisconnectTimeout = RtlConvertLongToLargeInteger(-1000000);
+        FCB->DisconnectPending = TRUE;
+        FCB->SendClosed = TRUE;
+        FCB->PollState &= ~AFD_EVENT_SEND;
+    }
+
+    /* Send what other writers queued while we had the connection */
+    RetrySendWindow(FCB);
+
+    Irp->Tail.Overlay.DriverContext[2] = NULL;
+    FreeTransmitContext(TransmitContext);
+
+    UnlockAndMaybeComplete( FCB, Status, Irp, Information );
+}
+
+static IO_COMPLETION_ROUTINE TransmitComplete;
+static NTSTATUS NTAPI TransmitComplete
+( PDEVICE_OBJECT DeviceObject,
+  PIRP Irp,
+  PVOID Context ) {
+    PAFD_TRANSMIT_CONTEXT TransmitContext = (PAFD_TRANSMIT_CONTEXT)Context;
+    PAFD_FCB FCB = TransmitContext->FCB;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    AFD_DbgPrint(MID_TRACE,("Called, status %x, %u bytes used\n",
+                            Irp->IoStatus.Status,
+                            Irp->IoStatus.Information));
+
+    TransmitContext->SendIosb = Irp->IoStatus;
+
+    /* The cache pages go back to the file system in the worker */
+    if (TransmitContext->MdlChain)
+        Irp->MdlAddress = NULL;
+
+    if( SocketAcquireStateLock( FCB ) ) {
+        ASSERT(FCB->SendIrp.InFlightRequest == Irp);
+        FCB->SendIrp.InFlightRequest = NULL;
+        SocketStateUnlock( FCB );
+    }
+
+    /* File reads may block, so they are done by the worker */
+    IoQueueWorkItem(TransmitContext->WorkItem,
+                    TransmitWorker,
+                    DelayedWorkQueue,
+                    TransmitContext);
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Sends the head, the file and the tail one piece at a time. Each run
+ * accounts for the send that completed before it and starts the next.
+ */
+static VOID NTAPI
+TransmitWorker(PDEVICE_OBJECT DeviceObject, PVOID Context) {
+    PAFD_TRANSMIT_CONTEXT TransmitContext = (PAFD_TRANSMIT_CONTEXT)Context;
+    PAFD_FCB FCB = TransmitContext->FCB;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PCHAR Buffer = NULL;
+    ULONG Length = 0, BytesSent;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    if (TransmitContext->SendSource != TRANSMIT_SOURCE_NONE)
+    {
+        Status = TransmitContext->SendIosb.Status;
+        BytesSent = (ULONG)TransmitContext->SendIosb.Information;
+
+        if (NT_SUCCESS(Status) && BytesSent == 0)
+            Status = STATUS_CONNECTION_ABORTED;
+
+        if (NT_SUCCESS(Status))
+        {
+            switch (TransmitContext->SendSource)
+            {
+                case TRANSMIT_SOURCE_HEAD:
+                    TransmitContext->HeadSent += BytesSent;
+                    break;
+
+                case TRANSMIT_SOURCE_FILE:
+                    TransmitContext->Offset.QuadPart += BytesSent;
+                    TransmitContext->Remaining -= MIN(BytesSent, TransmitContext->Remaining);
+                    break;
+
+                case TRANSMIT_SOURCE_TAIL:
+                    TransmitContext->TailSent += BytesSent;
+                    break;
+            }
+
+            TransmitContext->TotalBytesSent += BytesSent;
+        }
+
+        TransmitContext->SendSource = TRANSMIT_SOURCE_NONE;
+    }
+
+    if (TransmitContext->MdlChain)
+        TransmitMdlReadComplete(TransmitContext);
+
+    if (NT_SUCCESS(Status) && TransmitContext->Irp->Cancel)
+        Status = STATUS_CANCELLED;
+
+    if (NT_SUCCESS(Status) && TransmitContext->HeadSent < TransmitContext->HeadLength)
+    {
+        TransmitContext->SendSource = TRANSMIT_SOURCE_HEAD;
+        Buffer = TransmitContext->Buffers + TransmitContext->HeadSent;
+        Length = TransmitContext->HeadLength - TransmitContext->HeadSent;
+    }
+
+    if (NT_SUCCESS(Status) && TransmitContext->SendSource == TRANSMIT_SOURCE_NONE &&
+        TransmitContext->Remaining)
+    {
+        Status = TransmitReadFile(TransmitContext, &Buffer, &Length);
+        if (NT_SUCCESS(Status))
+        {
+            if (Length)
+                TransmitContext->SendSource = TRANSMIT_SOURCE_FILE;
+            else
+                TransmitContext->Remaining = 0;
+        }
+    }
+
+    if (NT_SUCCESS(Status) && TransmitContext->SendSource == TRANSMIT_SOURCE_NONE &&
+        TransmitContext->TailSent < TransmitContext->TailLength)
+    {
+        TransmitContext->SendSource = TRANSMIT_SOURCE_TAIL;
+        Buffer = TransmitContext->Buffers + TransmitContext->HeadLength + TransmitContext->TailSent;
+        Length = TransmitContext->TailLength - TransmitContext->TailSent;
+    }
+
+    if (NT_SUCCESS(Status) && TransmitContext->SendSource != TRANSMIT_SOURCE_NONE)
+    {
+        if( !SocketAcquireStateLock( FCB ) ) {
+            Status = STATUS_FILE_CLOSED;
+        } else {
+            if (FCB->State == SOCKET_STATE_CLOSED ||
+                (FCB->PollState & (AFD_EVENT_CLOSE | AFD_EVENT_ABORT)))
+            {
+                Status = STATUS_CONNECTION_RESET;
+            }
+            else if (FCB->SendClosed)
+            {
+                Status = STATUS_FILE_CLOSED;
+            }
+            else if (TransmitContext->MdlChain)
+            {
+                Status = TdiSendMdl(&FCB->SendIrp.InFlightRequest,
+                                    FCB->Connection.Object,
+                                    0,
+                                    TransmitContext->MdlChain,
+                                    Length,
+                                    TransmitComplete,
+                                    TransmitContext);
+            }
+            else
+            {
+                Status = TdiSend(&FCB->SendIrp.InFlightRequest,
+                                 FCB->Connection.Object,
+                                 0,
+                                 Buffer,
+                                 Length,
+                                 TransmitComplete,
+                                 TransmitContext);
+            }
+
+            SocketStateUnlock( FCB );
+        }
+
+        /* TransmitComplete queues us again */
+        if (Status == STATUS_PENDING)
+            return;
+
+        TransmitContext->SendSource = TRANSMIT_SOURCE_NONE;
+        if (TransmitContext->MdlChain)
+            TransmitMdlReadComplete(TransmitContext);
+    }
+
+    TransmitFinish(TransmitContext, Status);
+}
+
+static DRIVER_CANCEL TransmitCancel;
+static VOID NTAPI
+TransmitCancel(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation(Irp);
+    PAFD_FCB FCB = IrpSp->FileObject->FsContext;
+    PAFD_TRANSMIT_CONTEXT TransmitContext;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    IoReleaseCancelSpinLock(Irp->CancelIrql);
+
+    if (!SocketAcquireStateLock(FCB))
+        return;
+
+    /* The worker notices Irp->Cancel and completes the request */
+    if (FCB->TransmitIrp == Irp)
+    {
+        TransmitContext = Irp->Tail.Overlay.DriverContext[2];
+        if (TransmitContext->Started)
+        {
+            if (FCB->SendIrp.InFlightRequest)
+                IoCancelIrp(FCB->SendIrp.InFlightRequest);
+        }
+        else if (!FCB->SendIrp.InFlightRequest)
+        {
+            ResumeTransmit(FCB);
+        }
+    }
+
+    SocketStateUnlock(FCB);
+}
+
+/*
+ * Sends a file, with optional head and tail buffers, without bouncing
+ * the data through user mode. The request pends right away; a worker
+ * sends the pieces one after another, mostly straight from the cache.
+ */
+NTSTATUS NTAPI
+AfdTransmitFile(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                PIO_STACK_LOCATION IrpSp) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_TRANSMIT_FILE_INFO TransmitReq;
+    AFD_TRANSMIT_FILE_INFO TransmitInfo;
+    PAFD_TRANSMIT_CONTEXT TransmitContext;
+    PFILE_OBJECT TransmitFileObject;
+    LARGE_INTEGER FileSize;
+    KPROCESSOR_MODE LockMode;
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    if( FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS ||
+        FCB->State != SOCKET_STATE_CONNECTED )
+    {
+        AFD_DbgPrint(MIN_TRACE,("Socket not connected\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_CONNECTION, Irp, 0 );
+    }
+
+    if (FCB->TransmitIrp)
+    {
+        AFD_DbgPrint(MIN_TRACE,("TransmitFile already in progress\n"));
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
+    if (FCB->SendClosed)
+        return UnlockAndMaybeComplete( FCB, STATUS_FILE_CLOSED, Irp, 0 );
+
+    if( !(TransmitReq = LockRequest( Irp, IrpSp, FALSE, &LockMode )) )
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    TransmitInfo = *TransmitReq;
+
+    UnlockRequest( Irp, IrpSp );
+
+    if (TransmitInfo.HeadLength > MAXULONG - TransmitInfo.TailLength)
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+
+    TransmitContext = ExAllocatePoolWithTag(NonPagedPool,
+                                            sizeof(*TransmitContext),
+                                            TAG_AFD_TRANSMIT_CONTEXT);
+    if (!TransmitContext)
+        return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+
+    RtlZeroMemory(TransmitContext, sizeof(*TransmitContext));
+    TransmitContext->FCB = FCB;
+    TransmitContext->Irp = Irp;
+    TransmitContext->Flags = TransmitInfo.Flags;
+    TransmitContext->HeadLength = TransmitInfo.HeadLength;
+    TransmitContext->TailLength = TransmitInfo.TailLength;
+
+    TransmitContext->ChunkSize = TransmitInfo.SendPacketLength;
+    if (TransmitContext->ChunkSize == 0 || TransmitContext->ChunkSize > AFD_TRANSMIT_CHUNK_SIZE)
+        TransmitContext->ChunkSize = AFD_TRANSMIT_CHUNK_SIZE;
+
+    /* The caller's head and tail buffers may go away, keep a copy */
+    if (TransmitInfo.HeadLength + TransmitInfo.TailLength)
+    {
+        TransmitContext->Buffers = ExAllocatePoolWithTag(PagedPool,
+                                                         TransmitInfo.HeadLength +
+                                                         TransmitInfo.TailLength,
+                                                         TAG_AFD_TRANSMIT_BUFFER);
+        if (!TransmitContext->Buffers)
+            Status = STATUS_NO_MEMORY;
+    }
+
+    if (NT_SUCCESS(Status) && TransmitContext->Buffers)
+    {
+        _SEH2_TRY {
+            if (LockMode != KernelMode)
+            {
+                ProbeForRead(TransmitInfo.Head, TransmitInfo.HeadLength, 1);
+                ProbeForRead(TransmitInfo.Tail, TransmitInfo.TailLength, 1);
+            }
+
+            RtlCopyMemory(TransmitContext->Buffers,
+                          TransmitInfo.Head,
+                          TransmitInfo.HeadLength);
+            RtlCopyMemory(TransmitContext->Buffers + TransmitInfo.HeadLength,
+                          TransmitInfo.Tail,
+                          TransmitInfo.TailLength);
+        } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+            Status = _SEH2_GetExceptionCode();
+        } _SEH2_END;
+    }
+
+    if (NT_SUCCESS(Status) && TransmitInfo.FileHandle)
+    {
+        Status = ObReferenceObjectByHandle(TransmitInfo.FileHandle,
+                                           FILE_READ_DATA,
+                                           *IoFileObjectType,
+                                           LockMode,
+                                           (PVOID*)&TransmitFileObject,
+                                           NULL);
+        if (NT_SUCCESS(Status))
+        {
+            TransmitContext->FileObject = TransmitFileObject;
+
+            /* A zero offset with a synchronous file means "current position" */
+            if (TransmitInfo.Offset.QuadPart == 0 &&
+                (TransmitFileObject->Flags & FO_SYNCHRONOUS_IO))
+            {
+                TransmitContext->Offset = TransmitFileObject->CurrentByteOffset;
+                TransmitContext->UseFilePointer = TRUE;
+            }
+            else
+            {
+                TransmitContext->Offset = TransmitInfo.Offset;
+            }
+
+            if (TransmitContext->Offset.QuadPart < 0)
+                Status = STATUS_INVALID_PARAMETER;
+        }
+
+        if (NT_SUCCESS(Status))
+        {
+            /* Without a size we read until the file system reports the end */
+            if (NT_SUCCESS(FsRtlGetFileSize(TransmitFileObject, &FileSize)))
+            {
+                if (FileSize.QuadPart > TransmitContext->Offset.QuadPart)
+                    TransmitContext->Remaining = FileSize.QuadPart - TransmitContext->Offset.QuadPart;
+            }
+            else
+            {
+                TransmitContext->Remaining = MAXULONGLONG;
+            }
+
+            /* A zero length means "up to the end of the file" */
+            if (TransmitInfo.WriteLength)
+                TransmitContext->Remaining = MIN(TransmitContext->Remaining, TransmitInfo.WriteLength);
+        }
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        TransmitContext->WorkItem = IoAllocateWorkItem(DeviceObject);
+        if (!TransmitContext->WorkItem)
+            Status = STATUS_NO_MEMORY;
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        FreeTransmitContext(TransmitContext);
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    /* Whatever is being sent already goes out before the file */
+    TransmitContext->SendAhead = FCB->SendIrp.InFlightRequest ? FCB->Send.BytesUsed : 0;
+
+    Irp->Tail.Overlay.DriverContext[2] = TransmitContext;
+    FCB->TransmitIrp = Irp;
+
+    IoMarkIrpPending(Irp);
+    (void)IoSetCancelRoutine(Irp, TransmitCancel);
+
+    if (!TransmitContext->SendAhead)
+        ResumeTransmit(FCB);
+
+    SocketStateUnlock( FCB );
+
+    return STATUS_PENDING;
+}
@@ -52,6 +52,9 @@
 #define TAG_AFD_SNMP_ADDRESS_INFO          'asfA'
 #define TAG_AFD_TDI_CONNECTION_INFORMATION 'cTfA'
 #define TAG_AFD_WSA_BUFFER                 'bWfA'
+#define TAG_AFD_TRANSMIT_BUFFER            'fTfA'
+#define TAG_AFD_TRANSMIT_CONTEXT           'xTfA'
+#define TAG_AFD_ACCEPT_CONTEXT             'cAfA'
 
 typedef struct IPADDR_ENTRY {
 	ULONG  Addr;
@@ -92,6 +95,9 @@ typedef struct IPADDR_ENTRY {
 
 #define IN_FLIGHT_REQUESTS              5
 
+#define AFD_TRANSMIT_CHUNK_SIZE         0x10000 /* Largest file read issued
+                                                 * per TransmitFile send */
+
 #define EXTRA_LOCK_BUFFERS              2 /* Number of extra buffers needed
 					   * for ancillary data on packet
 					   * requests. */
@@ -177,6 +183,7 @@ typedef struct _AFD_FCB {
     AFD_IN_FLIGHT_REQUEST ConnectIrp, ListenIrp, ReceiveIrp, SendIrp, DisconnectIrp;
     AFD_DATA_WINDOW Send, Recv;
     KMUTEX Mutex;
+    PIRP TransmitIrp;
     PKEVENT EventSelect;
     DWORD EventSelectTriggers;
     DWORD EventSelectDisabled;
@@ -276,6 +283,11 @@ NTSTATUS AfdListenSocket(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 NTSTATUS AfdAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
 		    PIO_STACK_LOCATION IrpSp );
 
+NTSTATUS AfdSuperAccept( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+			 PIO_STACK_LOCATION IrpSp );
+BOOLEAN CancelSuperAccept( PAFD_FCB FCB, PIRP Irp );
+VOID FreeSuperAccept( PIRP Irp );
+
 /* lock.c */
 
 PAFD_WSABUF LockBuffers( PAFD_WSABUF Buf, UINT Count,
@@ -304,6 +316,7 @@ VOID DestroySocket( PAFD_FCB FCB );
 DRIVER_CANCEL AfdCancelHandler;
 VOID RetryDisconnectCompletion(PAFD_FCB FCB);
 BOOLEAN CheckUnlockExtraBuffers(PAFD_FCB FCB, PIO_STACK_LOCATION IrpSp);
+VOID CleanupPendingIrp(PAFD_FCB FCB, PIRP Irp, PIO_STACK_LOCATION IrpSp, PAFD_ACTIVE_POLL Poll);
 
 /* read.c */
 
@@ -379,6 +392,15 @@ NTSTATUS TdiSend
   PIO_COMPLETION_ROUTINE  CompletionRoutine,
   PVOID CompletionContext);
 
+NTSTATUS TdiSendMdl
+( PIRP *Irp,
+  PFILE_OBJECT ConnectionObject,
+  USHORT Flags,
+  PMDL Mdl,
+  UINT BufferLength,
+  PIO_COMPLETION_ROUTINE  CompletionRoutine,
+  PVOID CompletionContext);
+
 NTSTATUS TdiReceiveDatagram(
     PIRP *Irp,
     PFILE_OBJECT TransportObject,
@@ -410,5 +432,9 @@ AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 NTSTATUS NTAPI
 AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 			 PIO_STACK_LOCATION IrpSp);
+NTSTATUS NTAPI
+AfdTransmitFile(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+		PIO_STACK_LOCATION IrpSp);
+VOID RetrySendWindow(PAFD_FCB FCB);
 
 #endif /* _AFD_H */
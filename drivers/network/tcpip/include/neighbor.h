@@ -7,7 +7,9 @@
 
 #pragma once
 
-#define NB_HASHMASK 0xF /* Hash mask for neighbor cache */
+#define NB_INITIAL_HASH_SIZE 16   /* Initial number of neighbor cache buckets */
+#define NB_MAXIMUM_HASH_SIZE 4096 /* The neighbor cache stops growing here */
+#define NB_TIMER_WHEEL_SIZE 64    /* Slots in the aging timer wheel, one per tick */
 
 typedef VOID (*PNEIGHBOR_PACKET_COMPLETE)
     ( PVOID Context, PNDIS_PACKET Packet, NDIS_STATUS Status );
@@ -21,19 +23,22 @@ typedef struct _NEIGHBOR_PACKET {
 
 typedef struct NEIGHBOR_CACHE_TABLE {
     struct NEIGHBOR_CACHE_ENTRY *Cache; /* Pointer to cache */
-    KSPIN_LOCK Lock;                    /* Protecting lock */
+    LONG Lock;                          /* Protecting reader/writer lock */
 } NEIGHBOR_CACHE_TABLE, *PNEIGHBOR_CACHE_TABLE;
 
 /* Information about a neighbor */
 typedef struct NEIGHBOR_CACHE_ENTRY {
     struct NEIGHBOR_CACHE_ENTRY *Next;  /* Pointer to next entry */
+    LIST_ENTRY TimerEntry;              /* Entry in the aging timer wheel */
+    ULONG DueTick;                      /* Tick of the next aging event */
     UCHAR State;                        /* State of NCE */
-    UINT EventTimer;                    /* Ticks since last event */
-    UINT EventCount;                    /* Number of events */
+    UINT EventTimer;                    /* Ticks before the NCE times out */
+    ULONG EventTick;                    /* Tick of the last event */
     PIP_INTERFACE Interface;            /* Pointer to interface */
     UINT LinkAddressLength;             /* Length of link address */
     PVOID LinkAddress;                  /* Pointer to link address */
     IP_ADDRESS Address;                 /* IP address of neighbor */
+    KSPIN_LOCK PacketQueueLock;         /* Protects the packet queue */
     LIST_ENTRY PacketQueue;             /* Packet queue */
 } NEIGHBOR_CACHE_ENTRY, *PNEIGHBOR_CACHE_ENTRY;
 
@@ -54,8 +59,6 @@ typedef struct NEIGHBOR_CACHE_ENTRY {
 /* Number of seconds before retransmission */
 #define ARP_TIMEOUT_RETRANSMISSION 3
 
-extern NEIGHBOR_CACHE_TABLE NeighborCache[NB_HASHMASK + 1];
-
 
 VOID NBTimeout(
     VOID);
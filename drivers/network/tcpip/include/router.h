@@ -20,6 +20,27 @@ typedef struct _FIB_ENTRY {
     UINT Metric;                  /* Cost of this route */
 } FIB_ENTRY, *PFIB_ENTRY;
 
+/* Route to a prefix in the IPv4 route table, copied from its FIB entry */
+typedef struct _ROUTE_TRIE_ROUTE {
+    struct _ROUTE_TRIE_ROUTE *Next; /* Next route to the same prefix */
+    PNEIGHBOR_CACHE_ENTRY Router;   /* Pointer to NCE of router to use */
+    UINT Metric;                    /* Cost of this route */
+} ROUTE_TRIE_ROUTE, *PROUTE_TRIE_ROUTE;
+
+/* Node of the path compressed binary trie used for IPv4 longest prefix match */
+typedef struct _ROUTE_TRIE_NODE {
+    struct _ROUTE_TRIE_NODE *Child[2]; /* Children, by the bit after the prefix */
+    ULONG Prefix;                      /* Prefix in host order, host bits clear */
+    UINT PrefixLength;                 /* Number of significant bits in Prefix */
+    PROUTE_TRIE_ROUTE Routes;          /* Routes sorted by metric, or NULL */
+} ROUTE_TRIE_NODE, *PROUTE_TRIE_NODE;
+
+/* Read-only snapshot of the IPv4 routes, rebuilt whenever the FIB changes */
+typedef struct _ROUTE_TABLE {
+    PROUTE_TRIE_NODE Root;     /* Root of the trie, NULL if there are no routes */
+    PROUTE_TRIE_NODE NextNode; /* Next free node while building */
+} ROUTE_TABLE, *PROUTE_TABLE;
+
 PFIB_ENTRY RouterAddRoute(
     PIP_ADDRESS NetworkAddress,
     PIP_ADDRESS Netmask,
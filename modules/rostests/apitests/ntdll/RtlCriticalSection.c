@@ -0,0 +1,173 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for contended critical sections with and without spin counts
+ */
+
+#include "precomp.h"
+
+#define CS_THREADS  4
+#define CS_ROUNDS   50000
+
+/* Newer Windows versions do not allocate debug data by default */
+#define HasDebugInfo(cs) \
+    (((cs)->DebugInfo != NULL) && ((cs)->DebugInfo != (PRTL_CRITICAL_SECTION_DEBUG)-1))
+
+typedef struct _CS_TEST_CONTEXT
+{
+    RTL_CRITICAL_SECTION CriticalSection;
+    HANDLE StartEvent;
+    volatile LONG Counter;
+    LONG Inside;
+    BOOLEAN Overlapped;
+} CS_TEST_CONTEXT, *PCS_TEST_CONTEXT;
+
+static
+DWORD
+WINAPI
+ContendThread(LPVOID Parameter)
+{
+    PCS_TEST_CONTEXT Context = Parameter;
+    ULONG i;
+
+    WaitForSingleObject(Context->StartEvent, INFINITE);
+
+    for (i = 0; i < CS_ROUNDS; i++)
+    {
+        RtlEnterCriticalSection(&Context->CriticalSection);
+
+        /* Nobody else may be in here */
+        if (InterlockedIncrement(&Context->Inside) != 1)
+            Context->Overlapped = TRUE;
+
+        /* Take it recursively once in a while */
+        if ((i % 16) == 0)
+        {
+            RtlEnterCriticalSection(&Context->CriticalSection);
+            Context->Counter++;
+            RtlLeaveCriticalSection(&Context->CriticalSection);
+        }
+        else
+        {
+            Context->Counter++;
+        }
+
+        InterlockedDecrement(&Context->Inside);
+        RtlLeaveCriticalSection(&Context->CriticalSection);
+    }
+
+    return 0;
+}
+
+static
+VOID
+TestContention(ULONG SpinCount)
+{
+    CS_TEST_CONTEXT Context;
+    HANDLE Threads[CS_THREADS];
+    ULONG i;
+    DWORD StartTime;
+    NTSTATUS Status;
+
+    RtlZeroMemory(&Context, sizeof(Context));
+    Status = RtlInitializeCriticalSectionAndSpinCount(&Context.CriticalSection, SpinCount);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok(Context.CriticalSection.LockSemaphore == NULL, "Event was created up front\n");
+
+    Context.StartEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    ok(Context.StartEvent != NULL, "CreateEventW failed\n");
+    if (!Context.StartEvent)
+    {
+        RtlDeleteCriticalSection(&Context.CriticalSection);
+        return;
+    }
+
+    for (i = 0; i < CS_THREADS; i++)
+    {
+        Threads[i] = CreateThread(NULL, 0, ContendThread, &Context, 0, NULL);
+        ok(Threads[i] != NULL, "CreateThread failed\n");
+    }
+
+    StartTime = GetTickCount();
+    SetEvent(Context.StartEvent);
+
+    for (i = 0; i < CS_THREADS; i++)
+    {
+        if (!Threads[i])
+            continue;
+        WaitForSingleObject(Threads[i], INFINITE);
+        CloseHandle(Threads[i]);
+        Threads[i] = NULL;
+    }
+
+    ok(!Context.Overlapped, "Two threads owned the critical section at once\n");
+    ok_long(Context.Counter, CS_THREADS * CS_ROUNDS);
+    ok_long(Context.CriticalSection.LockCount, -1);
+    ok_long(Context.CriticalSection.RecursionCount, 0);
+
+    if (HasDebugInfo(&Context.CriticalSection))
+    {
+        trace("Spin count %lu: %lu ms, %lu waits, %lu contentions\n",
+              SpinCount,
+              GetTickCount() - StartTime,
+              Context.CriticalSection.DebugInfo->EntryCount,
+              Context.CriticalSection.DebugInfo->ContentionCount);
+
+        /* Every wait counts as a contention at least once */
+        ok(Context.CriticalSection.DebugInfo->ContentionCount >= Context.CriticalSection.DebugInfo->EntryCount,
+           "ContentionCount %lu, EntryCount %lu\n",
+           Context.CriticalSection.DebugInfo->ContentionCount,
+           Context.CriticalSection.DebugInfo->EntryCount);
+    }
+    else
+    {
+        trace("Spin count %lu: %lu ms\n", SpinCount, GetTickCount() - StartTime);
+    }
+
+    CloseHandle(Context.StartEvent);
+    Status = RtlDeleteCriticalSection(&Context.CriticalSection);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+}
+
+static
+VOID
+TestSpinCount(VOID)
+{
+    RTL_CRITICAL_SECTION CriticalSection;
+    ULONG OldCount;
+    NTSTATUS Status;
+
+    Status = RtlInitializeCriticalSectionAndSpinCount(&CriticalSection, 1000);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+
+    OldCount = RtlSetCriticalSectionSpinCount(&CriticalSection, 4000);
+    if (NtCurrentPeb()->NumberOfProcessors > 1)
+    {
+        ok_long(OldCount & 0x00FFFFFF, 1000);
+        ok_long((ULONG)CriticalSection.SpinCount & 0x00FFFFFF, 4000);
+    }
+    else
+    {
+        /* Spinning is useless with a single processor */
+        ok_long(OldCount, 0);
+        ok_long((ULONG)CriticalSection.SpinCount, 0);
+    }
+
+    /* Uncontended, so no event is needed */
+    RtlEnterCriticalSection(&CriticalSection);
+    ok(RtlTryEnterCriticalSection(&CriticalSection), "RtlTryEnterCriticalSection failed\n");
+    RtlLeaveCriticalSection(&CriticalSection);
+    RtlLeaveCriticalSection(&CriticalSection);
+    ok(CriticalSection.LockSemaphore == NULL, "Event was created without contention\n");
+    if (HasDebugInfo(&CriticalSection))
+        ok_long(CriticalSection.DebugInfo->ContentionCount, 0);
+
+    RtlDeleteCriticalSection(&CriticalSection);
+}
+
+START_TEST(RtlCriticalSection)
+{
+    TestSpinCount();
+    TestContention(0);
+    TestContention(4000);
+}
@@ -0,0 +1,145 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for RtlMultipleAllocateHeap and RtlMultipleFreeHeap
+ */
+
+#include "precomp.h"
+
+#define BATCH_COUNT   256
+#define BENCH_ROUNDS  200
+
+static PVOID Blocks[BATCH_COUNT];
+
+static
+VOID
+TestBatch(HANDLE hHeap, SIZE_T Size)
+{
+    ULONG Count, i;
+    PUCHAR Block;
+
+    RtlFillMemory(Blocks, sizeof(Blocks), 0xcc);
+    Count = RtlMultipleAllocateHeap(hHeap, HEAP_ZERO_MEMORY, Size, BATCH_COUNT, Blocks);
+    ok(Count == BATCH_COUNT, "Size %lu: got %lu blocks\n", (ULONG)Size, Count);
+
+    for (i = 0; i < Count; i++)
+    {
+        Block = Blocks[i];
+        ok(Block != NULL, "Size %lu: block %lu is NULL\n", (ULONG)Size, i);
+        if (!Block)
+            continue;
+        ok(((ULONG_PTR)Block & 0x7) == 0, "Size %lu: block %lu is misaligned\n", (ULONG)Size, i);
+        ok(RtlSizeHeap(hHeap, 0, Block) == Size, "Size %lu: block %lu has size %lu\n",
+           (ULONG)Size, i, (ULONG)RtlSizeHeap(hHeap, 0, Block));
+        if (Size)
+        {
+            ok(Block[0] == 0 && Block[Size - 1] == 0, "Size %lu: block %lu not zeroed\n", (ULONG)Size, i);
+            memset(Block, (UCHAR)i, Size);
+        }
+    }
+
+    /* Nobody overlaps */
+    for (i = 0; i < Count && Size; i++)
+    {
+        Block = Blocks[i];
+        ok(Block[0] == (UCHAR)i && Block[Size - 1] == (UCHAR)i, "Size %lu: block %lu was overwritten\n", (ULONG)Size, i);
+    }
+
+    ok(RtlValidateHeap(hHeap, 0, NULL), "Size %lu: heap is not valid\n", (ULONG)Size);
+    if (Count)
+        ok(RtlValidateHeap(hHeap, 0, Blocks[Count - 1]), "Size %lu: last block is not valid\n", (ULONG)Size);
+
+    /* A single block can still be freed on its own */
+    if (Count > 2)
+    {
+        ok(RtlFreeHeap(hHeap, 0, Blocks[1]), "Size %lu: freeing a block failed\n", (ULONG)Size);
+        Blocks[1] = NULL;
+    }
+
+    ok(RtlMultipleFreeHeap(hHeap, 0, Count, Blocks) == Count, "Size %lu: not everything was freed\n", (ULONG)Size);
+    ok(RtlValidateHeap(hHeap, 0, NULL), "Size %lu: heap is not valid after freeing\n", (ULONG)Size);
+}
+
+static
+VOID
+Benchmark(HANDLE hHeap, SIZE_T Size)
+{
+    LARGE_INTEGER Frequency, Start, Loop, Batch;
+    ULONG Round, i, Count;
+
+    QueryPerformanceFrequency(&Frequency);
+    if (!Frequency.QuadPart)
+        return;
+
+    QueryPerformanceCounter(&Start);
+    for (Round = 0; Round < BENCH_ROUNDS; Round++)
+    {
+        for (i = 0; i < BATCH_COUNT; i++)
+            Blocks[i] = RtlAllocateHeap(hHeap, 0, Size);
+        for (i = 0; i < BATCH_COUNT; i++)
+            RtlFreeHeap(hHeap, 0, Blocks[i]);
+    }
+    QueryPerformanceCounter(&Loop);
+    Loop.QuadPart -= Start.QuadPart;
+
+    QueryPerformanceCounter(&Start);
+    for (Round = 0; Round < BENCH_ROUNDS; Round++)
+    {
+        Count = RtlMultipleAllocateHeap(hHeap, 0, Size, BATCH_COUNT, Blocks);
+        RtlMultipleFreeHeap(hHeap, 0, Count, Blocks);
+    }
+    QueryPerformanceCounter(&Batch);
+    Batch.QuadPart -= Start.QuadPart;
+
+    trace("Size %lu, %u x %u blocks: loop %lu us, batch %lu us\n",
+          (ULONG)Size, BENCH_ROUNDS, BATCH_COUNT,
+          (ULONG)(Loop.QuadPart * 1000000 / Frequency.QuadPart),
+          (ULONG)(Batch.QuadPart * 1000000 / Frequency.QuadPart));
+}
+
+START_TEST(RtlMultipleAllocateHeap)
+{
+    static const SIZE_T Sizes[] = { 0, 1, 16, 100, 1000, 4000, 20000 };
+    HANDLE hHeap;
+    ULONG FrontEnd, i;
+    NTSTATUS Status;
+
+    hHeap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    ok(hHeap != NULL, "RtlCreateHeap failed\n");
+    if (!hHeap)
+        return;
+
+    ok(RtlMultipleAllocateHeap(hHeap, 0, 16, 0, Blocks) == 0, "Nothing should be allocated\n");
+    ok(RtlMultipleFreeHeap(hHeap, 0, 0, Blocks) == 0, "Nothing should be freed\n");
+
+    for (i = 0; i < RTL_NUMBER_OF(Sizes); i++)
+        TestBatch(hHeap, Sizes[i]);
+
+    /* NULL entries are fine, but aren't counted */
+    RtlZeroMemory(Blocks, sizeof(Blocks));
+    ok(RtlMultipleFreeHeap(hHeap, 0, 4, Blocks) == 0, "NULL entries should be skipped\n");
+
+    for (i = 0; i < RTL_NUMBER_OF(Sizes); i++)
+        Benchmark(hHeap, Sizes[i]);
+
+    /* The same with the low fragmentation front end */
+    FrontEnd = 2;
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd));
+    ok(Status == STATUS_SUCCESS, "Enabling LFH failed: 0x%lx\n", Status);
+
+    for (i = 0; i < RTL_NUMBER_OF(Sizes); i++)
+        TestBatch(hHeap, Sizes[i]);
+
+    RtlDestroyHeap(hHeap);
+
+    /* And without serialization */
+    hHeap = RtlCreateHeap(HEAP_GROWABLE | HEAP_NO_SERIALIZE, NULL, 0, 0, NULL, NULL);
+    ok(hHeap != NULL, "RtlCreateHeap failed\n");
+    if (!hHeap)
+        return;
+
+    for (i = 0; i < RTL_NUMBER_OF(Sizes); i++)
+        TestBatch(hHeap, Sizes[i]);
+
+    RtlDestroyHeap(hHeap);
+}
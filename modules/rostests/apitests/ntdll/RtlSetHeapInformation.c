@@ -0,0 +1,170 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for RtlSetHeapInformation and the low fragmentation heap
+ */
+
+#include "precomp.h"
+
+#define LFH_THREADS 4
+#define LFH_ROUNDS  2000
+#define LFH_SLOTS   64
+
+static
+ULONG
+QueryFrontEnd(HANDLE hHeap)
+{
+    NTSTATUS Status;
+    ULONG FrontEnd = 0xdeadbeef;
+    SIZE_T ReturnLength = 0;
+
+    Status = RtlQueryHeapInformation(hHeap,
+                                     HeapCompatibilityInformation,
+                                     &FrontEnd,
+                                     sizeof(FrontEnd),
+                                     &ReturnLength);
+    ok(Status == STATUS_SUCCESS, "RtlQueryHeapInformation failed: 0x%lx\n", Status);
+    ok(ReturnLength == sizeof(ULONG), "Unexpected length %lu\n", (ULONG)ReturnLength);
+    return FrontEnd;
+}
+
+static
+DWORD
+WINAPI
+ChurnThread(LPVOID Parameter)
+{
+    HANDLE hHeap = Parameter;
+    PUCHAR Blocks[LFH_SLOTS] = { NULL };
+    ULONG Round, Slot, Seed;
+    SIZE_T Size;
+    BOOLEAN Good = TRUE;
+
+    Seed = GetCurrentThreadId();
+    for (Round = 0; Round < LFH_ROUNDS; Round++)
+    {
+        Slot = RtlRandom(&Seed) % LFH_SLOTS;
+        if (Blocks[Slot])
+        {
+            /* Make sure nobody else scribbled over our block */
+            Size = RtlSizeHeap(hHeap, 0, Blocks[Slot]);
+            if (Size == 0 || Size == (SIZE_T)-1 || Blocks[Slot][0] != (UCHAR)Slot || Blocks[Slot][Size - 1] != (UCHAR)Slot)
+                Good = FALSE;
+            RtlFreeHeap(hHeap, 0, Blocks[Slot]);
+            Blocks[Slot] = NULL;
+        }
+        else
+        {
+            Size = 1 + RtlRandom(&Seed) % 700;
+            Blocks[Slot] = RtlAllocateHeap(hHeap, 0, Size);
+            if (!Blocks[Slot])
+            {
+                Good = FALSE;
+                continue;
+            }
+            memset(Blocks[Slot], Slot, Size);
+        }
+    }
+
+    for (Slot = 0; Slot < LFH_SLOTS; Slot++)
+        RtlFreeHeap(hHeap, 0, Blocks[Slot]);
+
+    return Good;
+}
+
+START_TEST(RtlSetHeapInformation)
+{
+    NTSTATUS Status;
+    HANDLE hHeap, Threads[LFH_THREADS];
+    ULONG FrontEnd, i;
+    DWORD ExitCode;
+    PUCHAR Block, Block2;
+    PVOID Blocks[0x100];
+
+    /* Serialized heap: LFH can be enabled */
+    hHeap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    ok(hHeap != NULL, "RtlCreateHeap failed\n");
+    if (!hHeap)
+        return;
+
+    ok(QueryFrontEnd(hHeap) == 0, "Front end should be off by default\n");
+
+    FrontEnd = 1;
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd));
+    ok(Status == STATUS_UNSUCCESSFUL, "Unexpected status 0x%lx\n", Status);
+
+    FrontEnd = 2;
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, 1);
+    ok(Status == STATUS_BUFFER_TOO_SMALL, "Unexpected status 0x%lx\n", Status);
+
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd));
+    ok(Status == STATUS_SUCCESS, "Enabling LFH failed: 0x%lx\n", Status);
+    ok(QueryFrontEnd(hHeap) == 2, "LFH should be reported\n");
+
+    /* Enabling it twice is fine */
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd));
+    ok(Status == STATUS_SUCCESS, "Enabling LFH twice failed: 0x%lx\n", Status);
+
+    /* Sizes are kept exact */
+    for (i = 0; i < 0x100; i++)
+    {
+        Blocks[i] = RtlAllocateHeap(hHeap, HEAP_ZERO_MEMORY, i + 1);
+        ok(Blocks[i] != NULL, "Allocation %lu failed\n", i);
+        if (!Blocks[i])
+            continue;
+        ok(RtlSizeHeap(hHeap, 0, Blocks[i]) == i + 1, "Size of block %lu is %lu\n", i, (ULONG)RtlSizeHeap(hHeap, 0, Blocks[i]));
+        ok(((PUCHAR)Blocks[i])[i] == 0, "Block %lu not zeroed\n", i);
+    }
+    ok(RtlValidateHeap(hHeap, 0, NULL), "Heap is not valid\n");
+    ok(RtlValidateHeap(hHeap, 0, Blocks[0x10]), "Block is not valid\n");
+    for (i = 0; i < 0x100; i++)
+        ok(RtlFreeHeap(hHeap, 0, Blocks[i]), "Freeing block %lu failed\n", i);
+
+    /* Growing keeps the content, in place or not */
+    Block = RtlAllocateHeap(hHeap, 0, 20);
+    ok(Block != NULL, "Allocation failed\n");
+    if (Block)
+    {
+        memset(Block, 0x5a, 20);
+        Block2 = RtlReAllocateHeap(hHeap, HEAP_ZERO_MEMORY, Block, 22);
+        ok(Block2 == Block, "Small growth should happen in place\n");
+        ok(RtlSizeHeap(hHeap, 0, Block2) == 22, "Wrong size %lu\n", (ULONG)RtlSizeHeap(hHeap, 0, Block2));
+        ok(Block2[19] == 0x5a && Block2[21] == 0, "Wrong content\n");
+
+        Block = RtlReAllocateHeap(hHeap, HEAP_ZERO_MEMORY, Block2, 4000);
+        ok(Block != NULL, "Reallocation failed\n");
+        if (Block)
+        {
+            ok(Block[0] == 0x5a && Block[19] == 0x5a && Block[3999] == 0, "Wrong content\n");
+            RtlFreeHeap(hHeap, 0, Block);
+        }
+    }
+
+    /* Several threads churning on the same heap */
+    for (i = 0; i < LFH_THREADS; i++)
+        Threads[i] = CreateThread(NULL, 0, ChurnThread, hHeap, 0, NULL);
+    for (i = 0; i < LFH_THREADS; i++)
+    {
+        ok(Threads[i] != NULL, "CreateThread failed\n");
+        if (!Threads[i])
+            continue;
+        WaitForSingleObject(Threads[i], INFINITE);
+        ok(GetExitCodeThread(Threads[i], &ExitCode) && ExitCode, "Thread %lu found corrupted blocks\n", i);
+        CloseHandle(Threads[i]);
+    }
+    ok(RtlValidateHeap(hHeap, 0, NULL), "Heap is not valid after churn\n");
+
+    RtlDestroyHeap(hHeap);
+
+    /* Unserialized heap: LFH is refused */
+    hHeap = RtlCreateHeap(HEAP_GROWABLE | HEAP_NO_SERIALIZE, NULL, 0, 0, NULL, NULL);
+    ok(hHeap != NULL, "RtlCreateHeap failed\n");
+    if (!hHeap)
+        return;
+
+    FrontEnd = 2;
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd));
+    ok(Status == STATUS_UNSUCCESSFUL, "Unexpected status 0x%lx\n", Status);
+    ok(QueryFrontEnd(hHeap) == 0, "LFH should not be enabled\n");
+
+    RtlDestroyHeap(hHeap);
+}
@@ -0,0 +1,427 @@
+/*
+ * PROJECT:     ws2_32.dll API tests
+ * LICENSE:     GPLv2 or any later version
+ * FILE:        apitests/ws2_32/extensions.c
+ * PURPOSE:     Test and loopback benchmark for AcceptEx, ConnectEx and
+ *              TransmitFile against the plain accept/recv/send calls
+ */
+
+#include "ws2_32.h"
+#include <mswsock.h>
+
+#define CONNECTION_COUNT    200
+#define REQUEST_SIZE        64
+#define FILE_SIZE           (4 * 1024 * 1024)
+#define WAIT_TIMEOUT_MS     10000
+
+static LPFN_ACCEPTEX pAcceptEx;
+static LPFN_GETACCEPTEXSOCKADDRS pGetAcceptExSockaddrs;
+static LPFN_CONNECTEX pConnectEx;
+static LPFN_TRANSMITFILE pTransmitFile;
+static struct sockaddr_in ServerAddress;
+
+static BOOL GetExtension(SOCKET sck, GUID *Guid, PVOID *Function)
+{
+    DWORD dwBytes;
+
+    return WSAIoctl(sck, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                    Guid, sizeof(*Guid),
+                    Function, sizeof(*Function),
+                    &dwBytes, NULL, NULL) == 0;
+}
+
+static ULONGLONG GetTimeUs(VOID)
+{
+    LARGE_INTEGER Counter, Frequency;
+
+    QueryPerformanceCounter(&Counter);
+    QueryPerformanceFrequency(&Frequency);
+    return Counter.QuadPart * 1000000 / Frequency.QuadPart;
+}
+
+/* Connects CONNECTION_COUNT times, sending a small request each time */
+static DWORD WINAPI ConnectClient(PVOID Context)
+{
+    char Request[REQUEST_SIZE];
+    SOCKET sck;
+    int i;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    memset(Request, 'R', sizeof(Request));
+
+    for (i = 0; i < CONNECTION_COUNT; i++)
+    {
+        sck = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (sck == INVALID_SOCKET)
+            return 1;
+        if (connect(sck, (struct sockaddr *)&ServerAddress, sizeof(ServerAddress)) != 0 ||
+            send(sck, Request, sizeof(Request), 0) != sizeof(Request))
+        {
+            closesocket(sck);
+            return 1;
+        }
+        /* Wait for the server to hang up */
+        recv(sck, Request, sizeof(Request), 0);
+        closesocket(sck);
+    }
+
+    return 0;
+}
+
+/* Receives one connection worth of data and returns its size */
+static DWORD WINAPI ReceiveClient(PVOID Context)
+{
+    static char Buffer[0x10000];
+    DWORD Total = 0;
+    SOCKET sck;
+    int Received;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    sck = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sck == INVALID_SOCKET)
+        return 0;
+    if (connect(sck, (struct sockaddr *)&ServerAddress, sizeof(ServerAddress)) == 0)
+    {
+        while ((Received = recv(sck, Buffer, sizeof(Buffer), 0)) > 0)
+            Total += Received;
+    }
+    closesocket(sck);
+
+    return Total;
+}
+
+static void Test_Accept(SOCKET Listener)
+{
+    char Buffer[REQUEST_SIZE];
+    ULONGLONG Start, PlainTime, AcceptExTime;
+    HANDLE hThread;
+    SOCKET sck;
+    int i, Received = 0;
+
+    hThread = CreateThread(NULL, 0, ConnectClient, NULL, 0, NULL);
+    ok(hThread != NULL, "CreateThread failed: %lu\n", GetLastError());
+    if (!hThread)
+        return;
+
+    Start = GetTimeUs();
+    for (i = 0; i < CONNECTION_COUNT; i++)
+    {
+        sck = accept(Listener, NULL, NULL);
+        if (sck == INVALID_SOCKET)
+            break;
+        Received += recv(sck, Buffer, sizeof(Buffer), 0);
+        closesocket(sck);
+    }
+    PlainTime = GetTimeUs() - Start;
+
+    ok(i == CONNECTION_COUNT, "Accepted %d connections\n", i);
+    ok(Received == CONNECTION_COUNT * REQUEST_SIZE, "Received %d bytes\n", Received);
+    ok(WaitForSingleObject(hThread, WAIT_TIMEOUT_MS) == WAIT_OBJECT_0, "Client timed out\n");
+    CloseHandle(hThread);
+
+    hThread = CreateThread(NULL, 0, ConnectClient, NULL, 0, NULL);
+    ok(hThread != NULL, "CreateThread failed: %lu\n", GetLastError());
+    if (!hThread)
+        return;
+
+    Received = 0;
+    Start = GetTimeUs();
+    for (i = 0; i < CONNECTION_COUNT; i++)
+    {
+        char OutputBuffer[REQUEST_SIZE + 2 * (sizeof(SOCKADDR_IN) + 16)];
+        struct sockaddr *LocalAddr, *RemoteAddr;
+        int LocalLength, RemoteLength;
+        OVERLAPPED Overlapped = { 0 };
+        DWORD dwBytes = 0;
+        BOOL bRet;
+
+        sck = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (sck == INVALID_SOCKET)
+            break;
+
+        Overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        bRet = pAcceptEx(Listener, sck, OutputBuffer, REQUEST_SIZE,
+                         sizeof(SOCKADDR_IN) + 16, sizeof(SOCKADDR_IN) + 16,
+                         &dwBytes, &Overlapped);
+        if (!bRet && WSAGetLastError() == WSA_IO_PENDING)
+            bRet = GetOverlappedResult((HANDLE)Listener, &Overlapped, &dwBytes, TRUE);
+        CloseHandle(Overlapped.hEvent);
+
+        if (!bRet)
+        {
+            ok(0, "AcceptEx failed: %d\n", WSAGetLastError());
+            closesocket(sck);
+            break;
+        }
+
+        if (i == 0)
+        {
+            pGetAcceptExSockaddrs(OutputBuffer, REQUEST_SIZE,
+                                  sizeof(SOCKADDR_IN) + 16, sizeof(SOCKADDR_IN) + 16,
+                                  &LocalAddr, &LocalLength, &RemoteAddr, &RemoteLength);
+            ok(LocalLength == sizeof(SOCKADDR_IN), "LocalLength = %d\n", LocalLength);
+            ok(RemoteLength == sizeof(SOCKADDR_IN), "RemoteLength = %d\n", RemoteLength);
+            ok(((struct sockaddr_in *)LocalAddr)->sin_port == ServerAddress.sin_port,
+               "Local port %u\n", ntohs(((struct sockaddr_in *)LocalAddr)->sin_port));
+            ok(((struct sockaddr_in *)RemoteAddr)->sin_addr.s_addr == htonl(INADDR_LOOPBACK),
+               "Remote address %lx\n", ((struct sockaddr_in *)RemoteAddr)->sin_addr.s_addr);
+        }
+
+        Received += dwBytes;
+        closesocket(sck);
+    }
+    AcceptExTime = GetTimeUs() - Start;
+
+    ok(i == CONNECTION_COUNT, "Accepted %d connections\n", i);
+    ok(Received == CONNECTION_COUNT * REQUEST_SIZE, "Received %d bytes\n", Received);
+    ok(WaitForSingleObject(hThread, WAIT_TIMEOUT_MS) == WAIT_OBJECT_0, "Client timed out\n");
+    CloseHandle(hThread);
+
+    trace("accept+recv: %I64u us for %d connections\n", PlainTime, CONNECTION_COUNT);
+    trace("AcceptEx:    %I64u us for %d connections\n", AcceptExTime, CONNECTION_COUNT);
+}
+
+static void Test_TransmitFile(SOCKET Listener, HANDLE hFile)
+{
+    static char Buffer[0x10000];
+    ULONGLONG Start, PlainTime, TransmitTime;
+    DWORD dwRead, dwReceived;
+    HANDLE hThread;
+    SOCKET sck;
+    BOOL bRet;
+
+    /* Plain ReadFile + send loop */
+    hThread = CreateThread(NULL, 0, ReceiveClient, NULL, 0, NULL);
+    ok(hThread != NULL, "CreateThread failed: %lu\n", GetLastError());
+    if (!hThread)
+        return;
+
+    sck = accept(Listener, NULL, NULL);
+    ok(sck != INVALID_SOCKET, "accept failed: %d\n", WSAGetLastError());
+
+    SetFilePointer(hFile, 0, NULL, FILE_BEGIN);
+    Start = GetTimeUs();
+    while (ReadFile(hFile, Buffer, sizeof(Buffer), &dwRead, NULL) && dwRead)
+    {
+        if (send(sck, Buffer, dwRead, 0) != (int)dwRead)
+            break;
+    }
+    closesocket(sck);
+    PlainTime = GetTimeUs() - Start;
+
+    ok(WaitForSingleObject(hThread, WAIT_TIMEOUT_MS) == WAIT_OBJECT_0, "Client timed out\n");
+    GetExitCodeThread(hThread, &dwReceived);
+    ok(dwReceived == FILE_SIZE, "Received %lu bytes\n", dwReceived);
+    CloseHandle(hThread);
+
+    /* TransmitFile */
+    hThread = CreateThread(NULL, 0, ReceiveClient, NULL, 0, NULL);
+    ok(hThread != NULL, "CreateThread failed: %lu\n", GetLastError());
+    if (!hThread)
+        return;
+
+    sck = accept(Listener, NULL, NULL);
+    ok(sck != INVALID_SOCKET, "accept failed: %d\n", WSAGetLastError());
+
+    SetFilePointer(hFile, 0, NULL, FILE_BEGIN);
+    Start = GetTimeUs();
+    bRet = pTransmitFile(sck, hFile, 0, 0, NULL, NULL, 0);
+    ok(bRet, "TransmitFile failed: %d\n", WSAGetLastError());
+    closesocket(sck);
+    TransmitTime = GetTimeUs() - Start;
+
+    ok(WaitForSingleObject(hThread, WAIT_TIMEOUT_MS) == WAIT_OBJECT_0, "Client timed out\n");
+    GetExitCodeThread(hThread, &dwReceived);
+    ok(dwReceived == FILE_SIZE, "Received %lu bytes\n", dwReceived);
+    CloseHandle(hThread);
+
+    trace("ReadFile+send: %I64u us for %u bytes\n", PlainTime, FILE_SIZE);
+    trace("TransmitFile:  %I64u us for %u bytes\n", TransmitTime, FILE_SIZE);
+}
+
+static void Test_ConnectEx(SOCKET Listener)
+{
+    char Request[REQUEST_SIZE], Buffer[REQUEST_SIZE];
+    struct sockaddr_in LocalAddress = { 0 };
+    OVERLAPPED Overlapped = { 0 };
+    SOCKET sck, sckAccepted;
+    DWORD dwBytes = 0;
+    BOOL bRet;
+
+    memset(Request, 'C', sizeof(Request));
+
+    sck = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ok(sck != INVALID_SOCKET, "socket failed: %d\n", WSAGetLastError());
+    if (sck == INVALID_SOCKET)
+        return;
+
+    /* ConnectEx needs a bound socket */
+    LocalAddress.sin_family = AF_INET;
+    ok(bind(sck, (struct sockaddr *)&LocalAddress, sizeof(LocalAddress)) == 0,
+       "bind failed: %d\n", WSAGetLastError());
+
+    Overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    bRet = pConnectEx(sck, (struct sockaddr *)&ServerAddress, sizeof(ServerAddress),
+                      Request, sizeof(Request), &dwBytes, &Overlapped);
+    if (!bRet && WSAGetLastError() == WSA_IO_PENDING)
+    {
+        sckAccepted = accept(Listener, NULL, NULL);
+        bRet = GetOverlappedResult((HANDLE)sck, &Overlapped, &dwBytes, TRUE);
+    }
+    else
+    {
+        sckAccepted = accept(Listener, NULL, NULL);
+    }
+    CloseHandle(Overlapped.hEvent);
+
+    ok(bRet, "ConnectEx failed: %d\n", WSAGetLastError());
+    ok(dwBytes == sizeof(Request), "dwBytes = %lu\n", dwBytes);
+    ok(setsockopt(sck, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL, 0) == 0,
+       "SO_UPDATE_CONNECT_CONTEXT failed: %d\n", WSAGetLastError());
+    ok(sckAccepted != INVALID_SOCKET, "accept failed: %d\n", WSAGetLastError());
+    if (sckAccepted != INVALID_SOCKET)
+    {
+        ok(recv(sckAccepted, Buffer, sizeof(Buffer), MSG_WAITALL) == sizeof(Buffer), "recv failed\n");
+        ok(!memcmp(Buffer, Request, sizeof(Buffer)), "Data mismatch\n");
+        closesocket(sckAccepted);
+    }
+
+    closesocket(sck);
+}
+
+/* Overlapped AcceptEx must complete through the listener's completion port */
+static void Test_AcceptExPort(void)
+{
+    char OutputBuffer[REQUEST_SIZE + 2 * (sizeof(SOCKADDR_IN) + 16)];
+    char Request[REQUEST_SIZE];
+    struct sockaddr_in Address = { 0 };
+    OVERLAPPED Overlapped = { 0 };
+    LPOVERLAPPED CompletedOverlapped = NULL;
+    SOCKET Listener, sck, sckClient;
+    ULONG_PTR Key = 0;
+    HANDLE hPort;
+    DWORD dwBytes = 0;
+    int AddressLength = sizeof(Address);
+    BOOL bRet;
+
+    Listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sck = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sckClient = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ok(Listener != INVALID_SOCKET && sck != INVALID_SOCKET && sckClient != INVALID_SOCKET,
+       "socket failed: %d\n", WSAGetLastError());
+
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ok(bind(Listener, (struct sockaddr *)&Address, sizeof(Address)) == 0 &&
+       getsockname(Listener, (struct sockaddr *)&Address, &AddressLength) == 0 &&
+       listen(Listener, 1) == 0, "Listener setup failed: %d\n", WSAGetLastError());
+
+    hPort = CreateIoCompletionPort((HANDLE)Listener, NULL, 0x1234, 0);
+    ok(hPort != NULL, "CreateIoCompletionPort failed: %lu\n", GetLastError());
+
+    bRet = pAcceptEx(Listener, sck, OutputBuffer, REQUEST_SIZE,
+                     sizeof(SOCKADDR_IN) + 16, sizeof(SOCKADDR_IN) + 16,
+                     &dwBytes, &Overlapped);
+    ok(!bRet && WSAGetLastError() == WSA_IO_PENDING, "AcceptEx returned %d, %d\n",
+       bRet, WSAGetLastError());
+
+    memset(Request, 'P', sizeof(Request));
+    ok(connect(sckClient, (struct sockaddr *)&Address, sizeof(Address)) == 0,
+       "connect failed: %d\n", WSAGetLastError());
+    ok(send(sckClient, Request, sizeof(Request), 0) == sizeof(Request),
+       "send failed: %d\n", WSAGetLastError());
+
+    bRet = GetQueuedCompletionStatus(hPort, &dwBytes, &Key, &CompletedOverlapped, WAIT_TIMEOUT_MS);
+    ok(bRet, "GetQueuedCompletionStatus failed: %lu\n", GetLastError());
+    ok(Key == 0x1234, "Key = %Ix\n", Key);
+    ok(CompletedOverlapped == &Overlapped, "Overlapped = %p\n", CompletedOverlapped);
+    ok(dwBytes == sizeof(Request), "dwBytes = %lu\n", dwBytes);
+
+    ok(setsockopt(sck, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
+                  (char *)&Listener, sizeof(Listener)) == 0,
+       "SO_UPDATE_ACCEPT_CONTEXT failed: %d\n", WSAGetLastError());
+
+    if (hPort)
+        CloseHandle(hPort);
+    closesocket(sckClient);
+    closesocket(sck);
+    closesocket(Listener);
+}
+
+START_TEST(extensions)
+{
+    GUID AcceptExGuid = WSAID_ACCEPTEX;
+    GUID GetAcceptExSockaddrsGuid = WSAID_GETACCEPTEXSOCKADDRS;
+    GUID ConnectExGuid = WSAID_CONNECTEX;
+    GUID TransmitFileGuid = WSAID_TRANSMITFILE;
+    WCHAR TempPath[MAX_PATH], TempFile[MAX_PATH];
+    static char FileData[0x10000];
+    WSADATA WsaData;
+    SOCKET Listener;
+    HANDLE hFile;
+    DWORD dwWritten;
+    int AddressLength, i;
+
+    if (WSAStartup(MAKEWORD(2, 2), &WsaData) != 0)
+    {
+        skip("WSAStartup failed\n");
+        return;
+    }
+
+    Listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (Listener == INVALID_SOCKET)
+    {
+        skip("socket failed\n");
+        WSACleanup();
+        return;
+    }
+
+    ZeroMemory(&ServerAddress, sizeof(ServerAddress));
+    ServerAddress.sin_family = AF_INET;
+    ServerAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    AddressLength = sizeof(ServerAddress);
+    if (bind(Listener, (struct sockaddr *)&ServerAddress, sizeof(ServerAddress)) != 0 ||
+        getsockname(Listener, (struct sockaddr *)&ServerAddress, &AddressLength) != 0 ||
+        listen(Listener, SOMAXCONN) != 0)
+    {
+        skip("Failed to set up the loopback listener: %d\n", WSAGetLastError());
+        closesocket(Listener);
+        WSACleanup();
+        return;
+    }
+
+    ok(GetExtension(Listener, &AcceptExGuid, (PVOID *)&pAcceptEx), "No AcceptEx\n");
+    ok(GetExtension(Listener, &GetAcceptExSockaddrsGuid, (PVOID *)&pGetAcceptExSockaddrs), "No GetAcceptExSockaddrs\n");
+    ok(GetExtension(Listener, &ConnectExGuid, (PVOID *)&pConnectEx), "No ConnectEx\n");
+    ok(GetExtension(Listener, &TransmitFileGuid, (PVOID *)&pTransmitFile), "No TransmitFile\n");
+
+    if (pAcceptEx && pGetAcceptExSockaddrs)
+        Test_Accept(Listener);
+    if (pAcceptEx)
+        Test_AcceptExPort();
+    if (pConnectEx)
+        Test_ConnectEx(Listener);
+
+    GetTempPathW(MAX_PATH, TempPath);
+    GetTempFileNameW(TempPath, L"tfl", 0, TempFile);
+    hFile = CreateFileW(TempFile, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                        CREATE_ALWAYS, FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    ok(hFile != INVALID_HANDLE_VALUE, "CreateFileW failed: %lu\n", GetLastError());
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        for (i = 0; i < sizeof(FileData); i++)
+            FileData[i] = (char)i;
+        for (i = 0; i < FILE_SIZE / sizeof(FileData); i++)
+            WriteFile(hFile, FileData, sizeof(FileData), &dwWritten, NULL);
+
+        if (pTransmitFile)
+            Test_TransmitFile(Listener, hFile);
+
+        CloseHandle(hFile);
+    }
+
+    closesocket(Listener);
+    WSACleanup();
+}
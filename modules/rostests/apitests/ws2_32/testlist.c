@@ -5,6 +5,7 @@
 
 extern void func_bind(void);
 extern void func_close(void);
+extern void func_extensions(void);
 extern void func_getaddrinfo(void);
 extern void func_getnameinfo(void);
 extern void func_getservbyname(void);
@@ -24,6 +25,7 @@ const struct test winetest_testlist[] =
 {
     { "bind", func_bind },
     { "close", func_close },
+    { "extensions", func_extensions },
     { "getaddrinfo", func_getaddrinfo },
     { "getnameinfo", func_getnameinfo },
     { "getservbyname", func_getservbyname },
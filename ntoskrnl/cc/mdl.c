@@ -15,6 +15,170 @@
 
 /* FUNCTIONS *****************************************************************/
 
+/*
+ * Unlocks and frees an MDL chain, dropping the view mapping each MDL
+ * was holding, optionally marking those views dirty.
+ */
+static
+VOID
+CcReleaseVacbMdlChain(
+    _In_ PFILE_OBJECT FileObject,
+    _In_opt_ PMDL MdlChain,
+    _In_ BOOLEAN Dirty)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_VACB Vacb;
+    LONGLONG FileOffset;
+    PMDL Mdl;
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+    while ((Mdl = MdlChain))
+    {
+        MdlChain = Mdl->Next;
+
+        /* MDLs not built by us (or left over from a torn down cache map)
+         * are simply freed */
+        Vacb = NULL;
+        if (SharedCacheMap != NULL)
+        {
+            Vacb = CcRosLookupVacbByAddress(SharedCacheMap,
+                                            MmGetMdlVirtualAddress(Mdl));
+        }
+
+        MmUnlockPages(Mdl);
+        IoFreeMdl(Mdl);
+
+        if (Vacb != NULL)
+        {
+            /* A view that wasn't read beforehand only becomes valid once
+             * the caller completed writing all of it */
+            FileOffset = Vacb->FileOffset.QuadPart;
+            CcRosReleaseVacb(SharedCacheMap, Vacb, Vacb->Valid || Dirty, FALSE, FALSE);
+            CcRosUnmapVacb(SharedCacheMap, FileOffset, Dirty);
+        }
+    }
+}
+
+/*
+ * Builds a chain of locked MDLs describing the cache views backing
+ * [FileOffset, FileOffset + Length). Each view stays mapped until the
+ * matching completion routine releases it with CcReleaseVacbMdlChain.
+ */
+static
+VOID
+CcBuildVacbMdlChain(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ LONGLONG FileOffset,
+    _In_ ULONG Length,
+    _In_ LOCK_OPERATION Operation,
+    _Inout_ PMDL *MdlChain,
+    _Out_ PIO_STATUS_BLOCK IoStatus)
+{
+    NTSTATUS Status;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_VACB Vacb;
+    PVOID BaseAddress;
+    BOOLEAN Valid;
+    ULONG VacbOffset;
+    ULONG PartialLength;
+    ULONG BytesMapped;
+    PMDL Mdl;
+    PMDL *FirstMdl;
+    PMDL *NextMdl;
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    BytesMapped = 0;
+
+    /* Append to whatever chain the caller already has */
+    FirstMdl = MdlChain;
+    while (*FirstMdl != NULL)
+    {
+        FirstMdl = &(*FirstMdl)->Next;
+    }
+    NextMdl = FirstMdl;
+
+    Status = STATUS_SUCCESS;
+    while (Length > 0)
+    {
+        VacbOffset = (ULONG)(FileOffset % VACB_MAPPING_GRANULARITY);
+        PartialLength = min(Length, VACB_MAPPING_GRANULARITY - VacbOffset);
+
+        Status = CcRosRequestVacb(SharedCacheMap,
+                                  FileOffset - VacbOffset,
+                                  &BaseAddress,
+                                  &Valid,
+                                  &Vacb);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        /* A write covering the whole view doesn't need its old content */
+        if (!Valid &&
+            (Operation != IoWriteAccess ||
+             PartialLength < VACB_MAPPING_GRANULARITY))
+        {
+            Status = CcReadVirtualAddress(Vacb);
+            if (!NT_SUCCESS(Status))
+            {
+                CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE, FALSE);
+                break;
+            }
+            Valid = TRUE;
+        }
+
+        Mdl = IoAllocateMdl((PUCHAR)BaseAddress + VacbOffset,
+                            PartialLength,
+                            FALSE,
+                            FALSE,
+                            NULL);
+        if (Mdl == NULL)
+        {
+            CcRosReleaseVacb(SharedCacheMap, Vacb, Valid, FALSE, FALSE);
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        _SEH2_TRY
+        {
+            MmProbeAndLockPages(Mdl, KernelMode, Operation);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        if (!NT_SUCCESS(Status))
+        {
+            IoFreeMdl(Mdl);
+            CcRosReleaseVacb(SharedCacheMap, Vacb, Valid, FALSE, FALSE);
+            break;
+        }
+
+        /* Keep the view mapped for as long as the MDL describes it. A view
+         * left unread stays invalid until CcMdlWriteComplete2 */
+        CcRosReleaseVacb(SharedCacheMap, Vacb, Valid, FALSE, TRUE);
+
+        *NextMdl = Mdl;
+        NextMdl = &Mdl->Next;
+
+        Length -= PartialLength;
+        FileOffset += PartialLength;
+        BytesMapped += PartialLength;
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        /* Give back what we built so far, caller's chain is left untouched */
+        CcReleaseVacbMdlChain(FileObject, *FirstMdl, FALSE);
+        *FirstMdl = NULL;
+        ExRaiseStatus(Status);
+    }
+
+    IoStatus->Status = STATUS_SUCCESS;
+    IoStatus->Information = BytesMapped;
+}
+
 /*
  * @implemented
  */
@@ -31,7 +195,12 @@ CcMdlRead (
     CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
         FileObject, FileOffset->QuadPart, Length);
 
-    UNIMPLEMENTED;
+    CcBuildVacbMdlChain(FileObject,
+                        FileOffset->QuadPart,
+                        Length,
+                        IoReadAccess,
+                        MdlChain,
+                        IoStatus);
 }
 
 /*
@@ -58,15 +227,8 @@ CcMdlReadComplete2 (
     IN PMDL MemoryDescriptorList
 )
 {
-    PMDL Mdl;
-
-    /* Free MDLs */
-    while ((Mdl = MemoryDescriptorList))
-    {
-        MemoryDescriptorList = Mdl->Next;
-        MmUnlockPages(Mdl);
-        IoFreeMdl(Mdl);
-    }
+    /* Free MDLs and unmap the views they described */
+    CcReleaseVacbMdlChain(FileObject, MemoryDescriptorList, FALSE);
 }
 
 /*
@@ -149,11 +311,15 @@ CcMdlWriteComplete2 (
     IN PLARGE_INTEGER FileOffset,
     IN PMDL MdlChain)
 {
-    UNIMPLEMENTED;
+    CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d MdlChain=%p\n",
+        FileObject, FileOffset->QuadPart, MdlChain);
+
+    /* The caller filled the views, the lazy writer takes it from here */
+    CcReleaseVacbMdlChain(FileObject, MdlChain, TRUE);
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -161,11 +327,14 @@ CcMdlWriteAbort (
     IN PFILE_OBJECT FileObject,
     IN PMDL MdlChain)
 {
-    UNIMPLEMENTED;
+    CCTRACE(CC_API_DEBUG, "FileObject=%p MdlChain=%p\n",
+        FileObject, MdlChain);
+
+    CcReleaseVacbMdlChain(FileObject, MdlChain, FALSE);
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -179,5 +348,10 @@ CcPrepareMdlWrite (
     CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
         FileObject, FileOffset->QuadPart, Length);
 
-    UNIMPLEMENTED;
+    CcBuildVacbMdlChain(FileObject,
+                        FileOffset->QuadPart,
+                        Length,
+                        IoWriteAccess,
+                        MdlChain,
+                        IoStatus);
 }
@@ -51,6 +51,15 @@ NPAGED_LOOKASIDE_LIST iBcbLookasideList;
 static NPAGED_LOOKASIDE_LIST SharedCacheMapLookasideList;
 static NPAGED_LOOKASIDE_LIST VacbLookasideList;
 
+/* VACBs are mapped on a VACB_MAPPING_GRANULARITY boundary, so any address
+ * in a view hashes to the bucket of the view's base address */
+#define VACB_ADDRESS_HASH_SIZE 256
+#define VACB_ADDRESS_HASH(Address) \
+    (((ULONG_PTR)(Address) / VACB_MAPPING_GRANULARITY) % VACB_ADDRESS_HASH_SIZE)
+
+static LIST_ENTRY VacbAddressHash[VACB_ADDRESS_HASH_SIZE];
+static KSPIN_LOCK VacbAddressHashLock;
+
 /* Internal vars (MS):
  * - Threshold above which lazy writer will start action
  * - Amount of dirty pages
@@ -488,6 +497,47 @@ CcRosLookupVacb (
     return NULL;
 }
 
+/* Returns a referenced VACB whose mapping contains Address, or NULL */
+PROS_VACB
+NTAPI
+CcRosLookupVacbByAddress (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    PVOID Address)
+{
+    PLIST_ENTRY ListHead, current_entry;
+    PROS_VACB current;
+    PVOID BaseAddress;
+    KIRQL oldIrql;
+
+    ASSERT(SharedCacheMap);
+
+    DPRINT("CcRosLookupVacbByAddress(SharedCacheMap 0x%p, Address %p)\n",
+           SharedCacheMap, Address);
+
+    BaseAddress = ALIGN_DOWN_POINTER_BY(Address, VACB_MAPPING_GRANULARITY);
+    ListHead = &VacbAddressHash[VACB_ADDRESS_HASH(BaseAddress)];
+
+    KeAcquireSpinLock(&VacbAddressHashLock, &oldIrql);
+    current_entry = ListHead->Flink;
+    while (current_entry != ListHead)
+    {
+        current = CONTAINING_RECORD(current_entry,
+                                    ROS_VACB,
+                                    AddressHashListEntry);
+        if (current->BaseAddress == BaseAddress &&
+            current->SharedCacheMap == SharedCacheMap)
+        {
+            CcRosVacbIncRefCount(current);
+            KeReleaseSpinLock(&VacbAddressHashLock, oldIrql);
+            return current;
+        }
+        current_entry = current_entry->Flink;
+    }
+    KeReleaseSpinLock(&VacbAddressHashLock, oldIrql);
+
+    return NULL;
+}
+
 VOID
 NTAPI
 CcRosMarkDirtyVacb (
@@ -638,7 +688,7 @@ CcRosMapVacbInKernelSpace(
                                 PAGE_READWRITE,
                                 (PMEMORY_AREA*)&Vacb->MemoryArea,
                                 0,
-                                PAGE_SIZE);
+                                VACB_MAPPING_GRANULARITY);
     ASSERT(Vacb->BaseAddress == NULL);
     Vacb->BaseAddress = BaseAddress;
     MmUnlockAddressSpace(MmGetKernelAddressSpace());
@@ -648,7 +698,7 @@ CcRosMapVacbInKernelSpace(
         return Status;
     }
 
-    ASSERT(((ULONG_PTR)Vacb->BaseAddress % PAGE_SIZE) == 0);
+    ASSERT(((ULONG_PTR)Vacb->BaseAddress % VACB_MAPPING_GRANULARITY) == 0);
     ASSERT((ULONG_PTR)Vacb->BaseAddress > (ULONG_PTR)MmSystemRangeStart);
     ASSERT((ULONG_PTR)Vacb->BaseAddress + VACB_MAPPING_GRANULARITY - 1 > (ULONG_PTR)MmSystemRangeStart);
 
@@ -812,6 +862,7 @@ CcRosCreateVacb (
     InitializeListHead(&current->CacheMapVacbListEntry);
     InitializeListHead(&current->DirtyVacbListEntry);
     InitializeListHead(&current->VacbLruListEntry);
+    InitializeListHead(&current->AddressHashListEntry);
 
     CcRosVacbIncRefCount(current);
 
@@ -839,6 +890,12 @@ Retry:
         return Status;
     }
 
+    /* Allow finding it from addresses in its mapping */
+    KeAcquireSpinLock(&VacbAddressHashLock, &oldIrql);
+    InsertTailList(&VacbAddressHash[VACB_ADDRESS_HASH(current->BaseAddress)],
+                   &current->AddressHashListEntry);
+    KeReleaseSpinLock(&VacbAddressHashLock, oldIrql);
+
     KeAcquireGuardedMutex(&ViewLock);
 
     *Vacb = current;
@@ -1041,6 +1098,8 @@ CcRosInternalFreeVacb (
  * FUNCTION: Releases a VACB associated with a shared cache map
  */
 {
+    KIRQL oldIrql;
+
     DPRINT("Freeing VACB 0x%p\n", Vacb);
 #if DBG
     if (Vacb->SharedCacheMap->Trace)
@@ -1049,6 +1108,11 @@ CcRosInternalFreeVacb (
     }
 #endif
 
+    /* Its base address may be reused once the memory area is gone */
+    KeAcquireSpinLock(&VacbAddressHashLock, &oldIrql);
+    RemoveEntryList(&Vacb->AddressHashListEntry);
+    KeReleaseSpinLock(&VacbAddressHashLock, oldIrql);
+
     MmLockAddressSpace(MmGetKernelAddressSpace());
     MmFreeMemoryArea(MmGetKernelAddressSpace(),
                      Vacb->MemoryArea,
@@ -1519,9 +1583,16 @@ NTAPI
 CcInitView (
     VOID)
 {
+    ULONG i;
+
     DPRINT("CcInitView()\n");
 
     InitializeListHead(&DirtyVacbListHead);
+    for (i = 0; i < VACB_ADDRESS_HASH_SIZE; i++)
+    {
+        InitializeListHead(&VacbAddressHash[i]);
+    }
+    KeInitializeSpinLock(&VacbAddressHashLock);
     InitializeListHead(&VacbLruListHead);
     InitializeListHead(&CcDeferredWrites);
     InitializeListHead(&CcCleanSharedCacheMapList);
@@ -586,6 +586,14 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\Kernel",
+        L"ThreadDpcEnable",
+        &KeThreadDpcEnable,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\I/O System",
         L"CountOperations",
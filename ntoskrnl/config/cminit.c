@@ -108,6 +108,9 @@ CmpInitializeHive(OUT PCMHIVE *CmHive,
     /* Set the current thread as creator */
     Hive->CreatorOwner = KeGetCurrentThread();
 
+    /* No lazy flush has skipped the primary file yet */
+    Hive->LogOnlyFlushes = 0;
+
     /* Initialize lists */
     InitializeListHead(&Hive->KcbConvertListHead);
     InitializeListHead(&Hive->KnodeConvertListHead);
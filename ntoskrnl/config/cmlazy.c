@@ -24,6 +24,7 @@ BOOLEAN CmpForceForceFlush;
 BOOLEAN CmpHoldLazyFlush = TRUE;
 ULONG CmpLazyFlushIntervalInSeconds = 5;
 static ULONG CmpLazyFlushHiveCount = 7;
+static ULONG CmpLazyFlushLogOnlyCount = 3;
 ULONG CmpLazyFlushCount = 1;
 LONG CmpFlushStarveWriters;
 
@@ -35,10 +36,9 @@ CmpDoFlushNextHive(_In_  BOOLEAN ForceFlush,
                    _Out_ PBOOLEAN Error,
                    _Out_ PULONG DirtyCount)
 {
-    NTSTATUS Status;
     PLIST_ENTRY NextEntry;
     PCMHIVE CmHive;
-    BOOLEAN Result;
+    BOOLEAN Result, Success;
     ULONG HiveCount = CmpLazyFlushHiveCount;
 
     /* Set Defaults */
@@ -77,15 +77,31 @@ CmpDoFlushNextHive(_In_  BOOLEAN ForceFlush,
             }
             else
             {
-                /* Do the sync */
                 DPRINT("Flushing: %wZ\n", &CmHive->FileFullPath);
                 DPRINT("Handle: %p\n", CmHive->FileHandles[HFILE_TYPE_PRIMARY]);
-                Status = HvSyncHive(&CmHive->Hive);
-                if(!NT_SUCCESS(Status))
+
+                /*
+                 * Only write the log for a few passes, so that the in-place
+                 * writes to the primary file get batched.
+                 */
+                if (!ForceFlush && CmHive->Hive.Log &&
+                    CmHive->LogOnlyFlushes < CmpLazyFlushLogOnlyCount)
+                {
+                    Success = HvSyncHiveLog(&CmHive->Hive);
+                    CmHive->LogOnlyFlushes++;
+                }
+                else
+                {
+                    /* Do the sync */
+                    Success = HvSyncHive(&CmHive->Hive);
+                    CmHive->LogOnlyFlushes = 0;
+                }
+
+                if (!Success)
                 {
                     /* Let them know we failed */
-                    DPRINT1("Failed to flush %wZ on handle %p (status 0x%08lx)\n",
-                        &CmHive->FileFullPath,  CmHive->FileHandles[HFILE_TYPE_PRIMARY], Status);
+                    DPRINT1("Failed to flush %wZ on handle %p\n",
+                        &CmHive->FileFullPath,  CmHive->FileHandles[HFILE_TYPE_PRIMARY]);
                     *Error = TRUE;
                     Result = FALSE;
                     break;
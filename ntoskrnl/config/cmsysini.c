@@ -324,8 +324,8 @@ CmpInitHiveFromFile(IN PCUNICODE_STRING HiveName,
     }
     else
     {
-        /* Open it as a file */
-        Operation = HINIT_FILE;
+        /* Open it as a file, its bins get read one by one */
+        Operation = HINIT_MAPFILE;
         *New = FALSE;
     }
 
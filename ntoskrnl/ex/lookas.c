@@ -27,6 +27,11 @@ LIST_ENTRY ExPoolLookasideListHead;
 GENERAL_LOOKASIDE ExpSmallNPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
 GENERAL_LOOKASIDE ExpSmallPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
 
+/* Depth tuning parameters */
+#define EXP_MINIMUM_LOOKASIDE_DEPTH     4
+#define EXP_LOOKASIDE_IDLE_ALLOCATES    75
+#define EXP_LOOKASIDE_MISS_RATIO        5
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 VOID
@@ -123,6 +128,104 @@ ExpInitLookasideLists(VOID)
     }
 }
 
+VOID
+NTAPI
+ExpComputeLookasideDepth(IN PGENERAL_LOOKASIDE List,
+                         IN BOOLEAN ListUsesMisses)
+{
+    ULONG Allocates, Misses, Ratio;
+    LONG Depth;
+
+    /* Get the activity since the last scan */
+    Allocates = List->TotalAllocates - List->LastTotalAllocates;
+    if (ListUsesMisses)
+    {
+        Misses = List->AllocateMisses - List->LastAllocateMisses;
+    }
+    else
+    {
+        /* The pool lists count hits instead */
+        Misses = Allocates - (List->AllocateHits - List->LastAllocateHits);
+        if (Misses > Allocates) Misses = Allocates;
+    }
+
+    /* Remember the counters for the next scan */
+    List->LastTotalAllocates = List->TotalAllocates;
+    List->LastAllocateMisses = List->AllocateMisses;
+
+    Depth = List->Depth;
+    if (Allocates < EXP_LOOKASIDE_IDLE_ALLOCATES)
+    {
+        /* The list is barely used, shrink it quickly */
+        Depth -= 10;
+    }
+    else
+    {
+        /* Get the misses per thousand allocations */
+        Ratio = (ULONG)(((ULONGLONG)Misses * 1000) / Allocates);
+        if (Ratio < EXP_LOOKASIDE_MISS_RATIO)
+        {
+            /* Almost everything is a hit, slowly give some back */
+            Depth--;
+        }
+        else
+        {
+            /* Grow in proportion to the misses and the room left */
+            Depth += ((Ratio * (List->MaximumDepth - Depth)) / (1000 * 2)) + 5;
+        }
+    }
+
+    /* Keep it within the limits */
+    if (Depth > List->MaximumDepth) Depth = List->MaximumDepth;
+    if (Depth < EXP_MINIMUM_LOOKASIDE_DEPTH) Depth = EXP_MINIMUM_LOOKASIDE_DEPTH;
+    List->Depth = (USHORT)Depth;
+}
+
+VOID
+NTAPI
+ExpScanLookasideListHead(IN PLIST_ENTRY ListHead,
+                         IN BOOLEAN ListUsesMisses)
+{
+    PLIST_ENTRY ListEntry;
+
+    /* Loop all the lookaside lists and recompute their depth */
+    for (ListEntry = ListHead->Flink;
+         ListEntry != ListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        ExpComputeLookasideDepth(CONTAINING_RECORD(ListEntry,
+                                                   GENERAL_LOOKASIDE,
+                                                   ListEntry),
+                                 ListUsesMisses);
+    }
+}
+
+VOID
+NTAPI
+ExAdjustLookasideDepth(VOID)
+{
+    KIRQL OldIrql;
+
+    /*
+     * Called once per second by the balance set manager. Lists which keep
+     * missing get deeper, idle ones get shallower. Entries above the new
+     * depth are not trimmed here, they go away with the next allocations.
+     */
+
+    /* The pool and system lists never go away, no need for a lock */
+    ExpScanLookasideListHead(&ExPoolLookasideListHead, FALSE);
+    ExpScanLookasideListHead(&ExSystemLookasideListHead, TRUE);
+
+    /* Driver lists can be deleted, so lock them */
+    KeAcquireSpinLock(&ExpNonPagedLookasideListLock, &OldIrql);
+    ExpScanLookasideListHead(&ExpNonPagedLookasideListHead, TRUE);
+    KeReleaseSpinLock(&ExpNonPagedLookasideListLock, OldIrql);
+
+    KeAcquireSpinLock(&ExpPagedLookasideListLock, &OldIrql);
+    ExpScanLookasideListHead(&ExpPagedLookasideListHead, TRUE);
+    KeReleaseSpinLock(&ExpPagedLookasideListLock, OldIrql);
+}
+
 /* PUBLIC FUNCTIONS **********************************************************/
 
 /*
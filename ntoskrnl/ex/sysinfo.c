@@ -1423,7 +1423,8 @@ QSI_DEF(SystemInterruptInformation)
     {
         Prcb = KiProcessorBlock[i];
         sii->ContextSwitches = KeGetContextSwitches(Prcb);
-        sii->DpcCount = Prcb->DpcData[0].DpcCount;
+        sii->DpcCount = Prcb->DpcData[DPC_NORMAL].DpcCount +
+                        Prcb->DpcData[DPC_THREADED].DpcCount;
         sii->DpcRate = Prcb->DpcRequestRate;
         sii->TimeIncrement = ti;
         sii->DpcBypassCount = 0;
@@ -2015,6 +2016,9 @@ ExpCopyLookasideInformation(
             Info->FreeMisses = LookasideList->TotalFrees
                                - LookasideList->FreeHits;
         }
+
+        /* Move on to the next array element */
+        Info++;
     }
 
     /* Return the updated pointer and remaining count */
@@ -215,6 +215,8 @@ typedef struct _ROS_VACB
     LIST_ENTRY DirtyVacbListEntry;
     /* Entry in the list of VACBs. */
     LIST_ENTRY VacbLruListEntry;
+    /* Entry in the hash of VACBs by base address. */
+    LIST_ENTRY AddressHashListEntry;
     /* Offset in the file which this view maps. */
     LARGE_INTEGER FileOffset;
     /* Number of references. */
@@ -357,6 +359,13 @@ CcRosLookupVacb(
     LONGLONG FileOffset
 );
 
+PROS_VACB
+NTAPI
+CcRosLookupVacbByAddress(
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    PVOID Address
+);
+
 VOID
 NTAPI
 CcInitCacheZeroPage(VOID);
@@ -432,6 +432,7 @@ typedef struct _CMHIVE
     ULONG FlushCount;
     BOOLEAN HiveIsLoading;
     PKTHREAD CreatorOwner;
+    ULONG LogOnlyFlushes;
 } CMHIVE, *PCMHIVE;
 
 //
@@ -115,7 +115,7 @@ extern ULONG KiMaximumDpcQueueDepth;
 extern ULONG KiMinimumDpcRate;
 extern ULONG KiAdjustDpcThreshold;
 extern ULONG KiIdealDpcRate;
-extern BOOLEAN KeThreadDpcEnable;
+extern ULONG KeThreadDpcEnable;
 extern LARGE_INTEGER KiTimeIncrementReciprocal;
 extern UCHAR KiTimeIncrementShiftCount;
 extern ULONG KiTimeLimitIsrMicroseconds;
@@ -253,6 +253,14 @@ KiIdleSchedule(
     IN PKPRCB Prcb
 );
 
+BOOLEAN
+FASTCALL
+KiMoveReadyThread(
+    IN PKPRCB SourcePrcb,
+    IN PKPRCB TargetPrcb,
+    IN ULONG WaitLimit
+);
+
 VOID
 FASTCALL
 KiProcessDeferredReadyList(
@@ -811,6 +819,11 @@ FASTCALL
 KeZeroPages(IN PVOID Address,
             IN ULONG Size);
 
+VOID
+FASTCALL
+KeZeroPagesFromIdleThread(IN PVOID Address,
+                          IN ULONG Size);
+
 BOOLEAN
 FASTCALL
 KeInvalidAccessAllowed(IN PVOID TrapInformation OPTIONAL);
@@ -1009,6 +1022,12 @@ KiRetireDpcList(
     IN PKPRCB Prcb
 );
 
+VOID
+NTAPI
+KiStartDpcThread(
+    IN PKPRCB Prcb
+);
+
 VOID
 NTAPI
 KiQuantumEnd(
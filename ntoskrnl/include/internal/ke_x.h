@@ -206,6 +206,26 @@ KiSetThreadSwapBusy(IN PKTHREAD Thread)
     UNREFERENCED_PARAMETER(Thread);
 }
 
+//
+// This routine protects against multiple CPU acquires, it's meaningless on UP.
+//
+FORCEINLINE
+VOID
+KiClearThreadSwapBusy(IN PKTHREAD Thread)
+{
+    UNREFERENCED_PARAMETER(Thread);
+}
+
+//
+// This routine protects against multiple CPU acquires, it's meaningless on UP.
+//
+FORCEINLINE
+VOID
+KiWaitForThreadSwap(IN PKTHREAD Thread)
+{
+    UNREFERENCED_PARAMETER(Thread);
+}
+
 //
 // This routine protects against multiple CPU acquires, it's meaningless on UP.
 //
@@ -421,6 +441,37 @@ KiSetThreadSwapBusy(IN PKTHREAD Thread)
     Thread->SwapBusy = TRUE;
 }
 
+//
+// This routine clears the swap busy state of a thread once its context has
+// been saved, so that another CPU may now switch to it.
+//
+FORCEINLINE
+VOID
+KiClearThreadSwapBusy(IN PKTHREAD Thread)
+{
+    /* Make sure the saved context is visible before the flag is cleared */
+    KeMemoryBarrier();
+    Thread->SwapBusy = FALSE;
+}
+
+//
+// This routine waits for the CPU a thread was last running on to be done
+// saving its context, before another CPU switches to it.
+//
+FORCEINLINE
+VOID
+KiWaitForThreadSwap(IN PKTHREAD Thread)
+{
+    /* Spin until the old CPU is off the thread's stack */
+    while (Thread->SwapBusy)
+    {
+        YieldProcessor();
+    }
+
+    /* Don't read the saved context any earlier */
+    KeMemoryBarrier();
+}
+
 //
 // This routine acquires the PRCB lock so that only one caller can touch
 // volatile PRCB data.
@@ -598,6 +598,16 @@ MmInitSystem(IN ULONG Phase,
 
 /* pagefile.c ****************************************************************/
 
+/*
+ * Translate between a swap entry and a file and offset pair.
+ */
+#define FILE_FROM_ENTRY(i) ((i) & 0x0f)
+#define OFFSET_FROM_ENTRY(i) ((i) >> 11)
+#define ENTRY_FROM_FILE_OFFSET(i, j) ((i) | ((j) << 11) | 0x400)
+
+/* Most swap entries written out with a single request */
+#define MM_MAXIMUM_SWAP_CLUSTER (16)
+
 SWAPENTRY
 NTAPI
 MmAllocSwapPage(VOID);
@@ -606,6 +616,12 @@ VOID
 NTAPI
 MmFreeSwapPage(SWAPENTRY Entry);
 
+SWAPENTRY
+NTAPI
+MmAllocSwapCluster(
+    IN OUT PULONG Count
+);
+
 VOID
 NTAPI
 MmInitPagingFile(VOID);
@@ -628,6 +644,14 @@ MmWriteToSwapPage(
     PFN_NUMBER Page
 );
 
+NTSTATUS
+NTAPI
+MmWriteToSwapCluster(
+    SWAPENTRY SwapEntry,
+    PPFN_NUMBER Pages,
+    ULONG Count
+);
+
 VOID
 NTAPI
 MmShowOutOfSpaceMessagePagingFile(VOID);
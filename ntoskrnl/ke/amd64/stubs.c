@@ -34,6 +34,7 @@ KiDpcInterruptHandler(VOID)
     /* Check for pending timers, pending DPCs, or pending ready threads */
     if ((Prcb->DpcData[0].DpcQueueDepth) ||
         (Prcb->TimerRequest) ||
+        (Prcb->DpcSetEventRequest) ||
         (Prcb->DeferredReadyListHead.Next))
     {
         /* Retire DPCs while under the DPC stack */
@@ -52,6 +53,9 @@ KiDpcInterruptHandler(VOID)
     }
     else if (Prcb->NextThread)
     {
+        /* Lock the PRCB, KxQueueReadyThread releases it */
+        KiAcquirePrcbLock(Prcb);
+
         /* Capture current thread data */
         OldThread = Prcb->CurrentThread;
         NewThread = Prcb->NextThread;
@@ -64,6 +68,9 @@ KiDpcInterruptHandler(VOID)
         NewThread->State = Running;
         OldThread->WaitReason = WrDispatchInt;
 
+        /* Nobody may switch to the old thread until its context is saved */
+        KiSetThreadSwapBusy(OldThread);
+
         /* Make the old thread ready */
         KxQueueReadyThread(OldThread, Prcb);
 
@@ -86,6 +93,30 @@ KeZeroPages(IN PVOID Address,
     RtlZeroMemory(Address, Size);
 }
 
+VOID
+FASTCALL
+KeZeroPagesFromIdleThread(IN PVOID Address,
+                          IN ULONG Size)
+{
+    PULONG64 Current, End;
+
+    /* Zero the pages without pulling them into the caches */
+    ASSERT((Size & (PAGE_SIZE - 1)) == 0);
+    Current = Address;
+    End = (PULONG64)((ULONG_PTR)Address + Size);
+    do
+    {
+        _mm_stream_si64x((__int64*)&Current[0], 0);
+        _mm_stream_si64x((__int64*)&Current[1], 0);
+        _mm_stream_si64x((__int64*)&Current[2], 0);
+        _mm_stream_si64x((__int64*)&Current[3], 0);
+        Current += 4;
+    } while (Current < End);
+
+    /* Make the stores visible before the pages get handed out */
+    _mm_sfence();
+}
+
 PVOID
 NTAPI
 KeSwitchKernelStack(PVOID StackBase, PVOID StackLimit)
@@ -127,6 +158,7 @@ KiIdleLoop(VOID)
         /* Check for pending timers, pending DPCs, or pending ready threads */
         if ((Prcb->DpcData[0].DpcQueueDepth) ||
             (Prcb->TimerRequest) ||
+            (Prcb->DpcSetEventRequest) ||
             (Prcb->DeferredReadyListHead.Next))
         {
             /* Quiesce the DPC software interrupt */
@@ -136,6 +168,11 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+#ifdef CONFIG_SMP
+        /* Look for ready threads on other CPUs if we just became idle */
+        if (Prcb->IdleSchedule) KiIdleSchedule(Prcb);
+#endif
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
@@ -151,6 +151,10 @@ KiSwapContextResume(
     /* Now we are the new thread. Check if it's in a new process */
     OldProcess = OldThread->ApcState.Process;
     NewProcess = NewThread->ApcState.Process;
+
+    /* We're off the old thread's stack, other CPUs may switch to it now */
+    KiClearThreadSwapBusy(OldThread);
+
     if (OldProcess != NewProcess)
     {
         /* Switch address space and flush TLB */
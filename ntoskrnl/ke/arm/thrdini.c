@@ -167,6 +167,7 @@ KiIdleLoop(VOID)
         /* Check for pending timers, pending DPCs, or pending ready threads */
         if ((Prcb->DpcData[0].DpcQueueDepth) ||
             (Prcb->TimerRequest) ||
+            (Prcb->DpcSetEventRequest) ||
             (Prcb->DeferredReadyListHead.Next))
         {
             /* Quiesce the DPC software interrupt */
@@ -220,6 +221,10 @@ KiSwapContextExit(IN PKTHREAD OldThread,
     /* Now we are the new thread. Check if it's in a new process */
     OldProcess = OldThread->ApcState.Process;
     NewProcess = NewThread->ApcState.Process;
+
+    /* We're off the old thread's stack, other CPUs may switch to it now */
+    KiClearThreadSwapBusy(OldThread);
+
     if (OldProcess != NewProcess)
     {
         TtbRegister.AsUlong = NewProcess->DirectoryTableBase[0];
@@ -283,6 +288,9 @@ KiSwapContextEntry(IN PKSWITCHFRAME SwitchFrame,
     OldThread = (PKTHREAD)(OldThreadAndApcFlag & ~3);
     NewThread = Pcr->Prcb.CurrentThread;
 
+    /* Make sure the CPU the new thread last ran on is done saving it */
+    if (NewThread != OldThread) KiWaitForThreadSwap(NewThread);
+
     /* Get the old thread and set its kernel stack */
     OldThread->KernelStack = SwitchFrame;
 
@@ -304,6 +312,7 @@ KiDispatchInterrupt(VOID)
     /* Check for pending timers, pending DPCs, or pending ready threads */
     if ((Prcb->DpcData[0].DpcQueueDepth) ||
         (Prcb->TimerRequest) ||
+        (Prcb->DpcSetEventRequest) ||
         (Prcb->DeferredReadyListHead.Next))
     {
         /* Retire DPCs while under the DPC stack */
@@ -324,6 +333,9 @@ KiDispatchInterrupt(VOID)
     }
     else if (Prcb->NextThread)
     {
+        /* Lock the PRCB, KxQueueReadyThread releases it */
+        KiAcquirePrcbLock(Prcb);
+
         /* Capture current thread data */
         OldThread = Prcb->CurrentThread;
         NewThread = Prcb->NextThread;
@@ -336,6 +348,9 @@ KiDispatchInterrupt(VOID)
         NewThread->State = Running;
         OldThread->WaitReason = WrDispatchInt;
 
+        /* Nobody may switch to the old thread until its context is saved */
+        KiSetThreadSwapBusy(OldThread);
+
         /* Make the old thread ready */
         KxQueueReadyThread(OldThread, Prcb);
 
@@ -41,6 +41,7 @@ KiIdleLoop(VOID)
         //
         if ((Prcb->DpcData[0].DpcQueueDepth) ||
             (Prcb->TimerRequest) ||
+            (Prcb->DpcSetEventRequest) ||
             (Prcb->DeferredReadyListHead.Next))
         {
             //
@@ -288,6 +289,7 @@ KiDispatchInterrupt(VOID)
     //
     if ((Prcb->DpcData[0].DpcQueueDepth) ||
         (Prcb->TimerRequest) ||
+        (Prcb->DpcSetEventRequest) ||
         (Prcb->DeferredReadyListHead.Next))
     {
         //
@@ -15,10 +15,39 @@
 /* GLOBALS *******************************************************************/
 
 #define THREAD_BOOST_PRIORITY (LOW_REALTIME_PRIORITY - 1)
+#define THREAD_BALANCE_WAIT_TICKS 4
 ULONG KiReadyScanLast;
 
 /* PRIVATE FUNCTIONS *********************************************************/
 
+#ifdef CONFIG_SMP
+static
+VOID
+KiBalanceReadyQueues(IN PKPRCB Prcb)
+{
+    ULONG WaitLimit = KeTickCount.LowPart - THREAD_BALANCE_WAIT_TICKS;
+    KAFFINITY IdleSet;
+    ULONG Number;
+
+    /* Loop the idle CPUs as long as this one has ready threads */
+    IdleSet = KiIdleSummary & ~Prcb->SetMember;
+    while ((IdleSet) && (Prcb->ReadySummary))
+    {
+        /* Get the next idle CPU */
+        Number = RtlFindLeastSignificantBit(IdleSet);
+        IdleSet &= ~AFFINITY_MASK(Number);
+
+        /* Hand it a thread that has been waiting here */
+        if ((KiMoveReadyThread(Prcb, KiProcessorBlock[Number], WaitLimit)) &&
+            (KeGetCurrentProcessorNumber() != Number))
+        {
+            /* Wake it up */
+            KiIpiSend(AFFINITY_MASK(Number), IPI_DPC);
+        }
+    }
+}
+#endif
+
 VOID
 NTAPI
 KiScanReadyQueues(IN PKDPC Dpc,
@@ -112,6 +141,11 @@ KiScanReadyQueues(IN PKDPC Dpc,
     KiReleasePrcbLock(Prcb);
     KiReleaseDispatcherLock(OldIrql);
 
+#ifdef CONFIG_SMP
+    /* Move threads that still wait on this CPU to idle CPUs */
+    KiBalanceReadyQueues(Prcb);
+#endif
+
     /* Update the queue index for next time */
     if ((Count) && (Number))
     {
@@ -176,7 +210,7 @@ KeBalanceSetManager(IN PVOID Context)
             case STATUS_WAIT_0:
 
                 /* Adjust lookaside lists */
-                //ExAdjustLookasideDepth();
+                ExAdjustLookasideDepth();
 
                 /* Call the working set manager */
                 //MmWorkingSetManager();
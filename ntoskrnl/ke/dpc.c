@@ -20,7 +20,7 @@ ULONG KiMaximumDpcQueueDepth = 4;
 ULONG KiMinimumDpcRate = 3;
 ULONG KiAdjustDpcThreshold = 20;
 ULONG KiIdealDpcRate = 20;
-BOOLEAN KeThreadDpcEnable;
+ULONG KeThreadDpcEnable = TRUE;
 FAST_MUTEX KiGenericCallDpcMutex;
 KDPC KiTimerExpireDpc;
 ULONG KiTimeLimitIsrMicroseconds;
@@ -652,6 +652,18 @@ KiRetireDpcList(IN PKPRCB Prcb)
         Prcb->DpcRoutineActive = FALSE;
         Prcb->DpcInterruptRequested = FALSE;
 
+        /* Check if threaded DPCs were queued while the DPC thread slept */
+        if (Prcb->DpcSetEventRequest)
+        {
+            /* Wake it up with interrupts enabled */
+            _enable();
+            if (InterlockedExchange(&Prcb->DpcSetEventRequest, 0))
+            {
+                KeSetEvent(&Prcb->DpcEvent, 0, FALSE);
+            }
+            _disable();
+        }
+
 #ifdef CONFIG_SMP
         /* Check if we have deferred threads */
         if (Prcb->DeferredReadyListHead.Next)
@@ -672,6 +684,148 @@ KiRetireDpcList(IN PKPRCB Prcb)
     } while (DpcData->DpcQueueDepth != 0);
 }
 
+VOID
+NTAPI
+KiExecuteDpc(IN PVOID Context)
+{
+    PKPRCB Prcb = Context;
+    PKDPC_DATA DpcData;
+    PLIST_ENTRY ListHead, DpcEntry;
+    PKDPC Dpc;
+    PKDEFERRED_ROUTINE DeferredRoutine;
+    PVOID DeferredContext, SystemArgument1, SystemArgument2;
+    BOOLEAN Enable;
+
+    /* Get data and list variables before starting anything else */
+    DpcData = &Prcb->DpcData[DPC_THREADED];
+    ListHead = &DpcData->DpcListHead;
+
+    /* Stay on our processor, above every non-DPC activity */
+    KeSetSystemAffinityThread(AFFINITY_MASK(Prcb->Number));
+    KeSetPriorityThread(KeGetCurrentThread(), HIGH_PRIORITY);
+
+    /* Main outer loop */
+    while (TRUE)
+    {
+        /* Set us as active */
+        Prcb->DpcThreadActive = TRUE;
+
+        /* Loop while we have entries in the queue */
+        while (DpcData->DpcQueueDepth != 0)
+        {
+            /*
+             * Lock the DPC data and get the DPC entry. Interrupts must be off
+             * since KeInsertQueueDpc takes the lock at HIGH_LEVEL.
+             */
+            Enable = KeDisableInterrupts();
+            KiAcquireSpinLock(&DpcData->DpcLock);
+            DpcEntry = ListHead->Flink;
+
+            /* Make sure we have an entry */
+            if (DpcEntry != ListHead)
+            {
+                /* Remove the DPC from the list */
+                RemoveEntryList(DpcEntry);
+                Dpc = CONTAINING_RECORD(DpcEntry, KDPC, DpcListEntry);
+
+                /* Clear its DPC data and save its parameters */
+                Dpc->DpcData = NULL;
+                DeferredRoutine = Dpc->DeferredRoutine;
+                DeferredContext = Dpc->DeferredContext;
+                SystemArgument1 = Dpc->SystemArgument1;
+                SystemArgument2 = Dpc->SystemArgument2;
+
+                /* Decrease the queue depth */
+                DpcData->DpcQueueDepth--;
+
+                /* Release the lock */
+                KiReleaseSpinLock(&DpcData->DpcLock);
+                if (Enable) _enable();
+
+                /* Call the DPC at passive level */
+                DeferredRoutine(Dpc,
+                                DeferredContext,
+                                SystemArgument1,
+                                SystemArgument2);
+                ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+            }
+            else
+            {
+                /* The queue should be flushed now */
+                ASSERT(DpcData->DpcQueueDepth == 0);
+
+                /* Release DPC Lock */
+                KiReleaseSpinLock(&DpcData->DpcLock);
+                if (Enable) _enable();
+            }
+        }
+
+        /* Clear DPC Flags, the next threaded DPC will wake us up again */
+        Prcb->DpcThreadActive = FALSE;
+        Prcb->DpcThreadRequested = FALSE;
+        KeMemoryBarrier();
+
+        /* Sleep unless something was queued while we cleared the flags */
+        if (DpcData->DpcQueueDepth == 0)
+        {
+            KeWaitForSingleObject(&Prcb->DpcEvent,
+                                  Executive,
+                                  KernelMode,
+                                  FALSE,
+                                  NULL);
+        }
+    }
+}
+
+VOID
+NTAPI
+INIT_FUNCTION
+KiStartDpcThread(IN PKPRCB Prcb)
+{
+    NTSTATUS Status;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    HANDLE ThreadHandle;
+    PETHREAD Thread;
+
+    /* Initialize the threaded DPC queue and the event the thread waits on */
+    InitializeListHead(&Prcb->DpcData[DPC_THREADED].DpcListHead);
+    KeInitializeSpinLock(&Prcb->DpcData[DPC_THREADED].DpcLock);
+    Prcb->DpcData[DPC_THREADED].DpcQueueDepth = 0;
+    Prcb->DpcData[DPC_THREADED].DpcCount = 0;
+    KeInitializeEvent(&Prcb->DpcEvent, SynchronizationEvent, FALSE);
+
+    /* Create the thread */
+    InitializeObjectAttributes(&ObjectAttributes, NULL, 0, NULL, NULL);
+    Status = PsCreateSystemThread(&ThreadHandle,
+                                  THREAD_ALL_ACCESS,
+                                  &ObjectAttributes,
+                                  NULL,
+                                  NULL,
+                                  KiExecuteDpc,
+                                  Prcb);
+    if (!NT_SUCCESS(Status))
+    {
+        /* Keep using the normal DPC queue on this processor */
+        DPRINT1("Failed to create the DPC thread for CPU %u: 0x%lx\n",
+                Prcb->Number,
+                Status);
+        return;
+    }
+
+    /* Remember it, it never exits */
+    ObReferenceObjectByHandle(ThreadHandle,
+                              THREAD_ALL_ACCESS,
+                              PsThreadType,
+                              KernelMode,
+                              (PVOID*)&Thread,
+                              NULL);
+    ObCloseHandle(ThreadHandle, KernelMode);
+    Prcb->DpcThread = &Thread->Tcb;
+
+    /* Threaded DPCs can be queued to this processor now */
+    Prcb->ThreadDpcEnable = TRUE;
+}
+
 VOID
 NTAPI
 KiInitializeDpc(IN PKDPC Dpc,
@@ -796,8 +950,12 @@ KeInsertQueueDpc(IN PKDPC Dpc,
             /* Make sure a threaded DPC isn't already active */
             if (!(Prcb->DpcThreadActive) && !(Prcb->DpcThreadRequested))
             {
-                /* FIXME: Setup Threaded DPC */
-                UNIMPLEMENTED_FATAL("Threaded DPC not supported\n");
+                /* Have the DPC interrupt wake up the DPC thread */
+                InterlockedExchange(&Prcb->DpcSetEventRequest, TRUE);
+                Prcb->DpcThreadRequested = TRUE;
+
+                /* Set DPC inserted */
+                DpcInserted = TRUE;
             }
         }
         else
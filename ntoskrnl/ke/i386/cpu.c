@@ -1138,6 +1138,37 @@ KeZeroPages(IN PVOID Address,
     RtlZeroMemory(Address, Size);
 }
 
+VOID
+FASTCALL
+KeZeroPagesFromIdleThread(IN PVOID Address,
+                          IN ULONG Size)
+{
+    PULONG Current, End;
+
+    /* Non-temporal stores need SSE2 */
+    if (!(KeFeatureBits & KF_XMMI64))
+    {
+        KeZeroPages(Address, Size);
+        return;
+    }
+
+    /* Zero the pages without pulling them into the caches */
+    ASSERT((Size & (PAGE_SIZE - 1)) == 0);
+    Current = Address;
+    End = (PULONG)((ULONG_PTR)Address + Size);
+    do
+    {
+        _mm_stream_si32((int*)&Current[0], 0);
+        _mm_stream_si32((int*)&Current[1], 0);
+        _mm_stream_si32((int*)&Current[2], 0);
+        _mm_stream_si32((int*)&Current[3], 0);
+        Current += 4;
+    } while (Current < End);
+
+    /* Make the stores visible before the pages get handed out */
+    _mm_sfence();
+}
+
 VOID
 NTAPI
 KiSaveProcessorState(IN PKTRAP_FRAME TrapFrame,
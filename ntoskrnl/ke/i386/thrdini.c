@@ -285,6 +285,7 @@ KiIdleLoop(VOID)
         /* Check for pending timers, pending DPCs, or pending ready threads */
         if ((Prcb->DpcData[0].DpcQueueDepth) ||
             (Prcb->TimerRequest) ||
+            (Prcb->DpcSetEventRequest) ||
             (Prcb->DeferredReadyListHead.Next))
         {
             /* Quiesce the DPC software interrupt */
@@ -294,6 +295,11 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+#ifdef CONFIG_SMP
+        /* Look for ready threads on other CPUs if we just became idle */
+        if (Prcb->IdleSchedule) KiIdleSchedule(Prcb);
+#endif
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
@@ -337,6 +343,10 @@ KiSwapContextExit(IN PKTHREAD OldThread,
     /* Now we are the new thread. Check if it's in a new process */
     OldProcess = OldThread->ApcState.Process;
     NewProcess = NewThread->ApcState.Process;
+
+    /* We're off the old thread's stack, other CPUs may switch to it now */
+    KiClearThreadSwapBusy(OldThread);
+
     if (OldProcess != NewProcess)
     {
         /* Check if there is a different LDT */
@@ -435,6 +445,9 @@ KiSwapContextEntry(IN PKSWITCHFRAME SwitchFrame,
     OldThread = (PKTHREAD)(OldThreadAndApcFlag & ~3);
     NewThread = Pcr->PrcbData.CurrentThread;
 
+    /* Make sure the CPU the new thread last ran on is done saving it */
+    if (NewThread != OldThread) KiWaitForThreadSwap(NewThread);
+
     /* Get the old thread and set its kernel stack */
     OldThread->KernelStack = SwitchFrame;
 
@@ -468,6 +481,7 @@ KiDispatchInterrupt(VOID)
     /* Check for pending timers, pending DPCs, or pending ready threads */
     if ((Prcb->DpcData[0].DpcQueueDepth) ||
         (Prcb->TimerRequest) ||
+        (Prcb->DpcSetEventRequest) ||
         (Prcb->DeferredReadyListHead.Next))
     {
         /* Switch to safe execution context */
@@ -493,6 +507,9 @@ KiDispatchInterrupt(VOID)
     }
     else if (Prcb->NextThread)
     {
+        /* Lock the PRCB, KxQueueReadyThread releases it */
+        KiAcquirePrcbLock(Prcb);
+
         /* Capture current thread data */
         OldThread = Prcb->CurrentThread;
         NewThread = Prcb->NextThread;
@@ -505,6 +522,9 @@ KiDispatchInterrupt(VOID)
         NewThread->State = Running;
         OldThread->WaitReason = WrDispatchInt;
 
+        /* Nobody may switch to the old thread until its context is saved */
+        KiSetThreadSwapBusy(OldThread);
+
         /* Make the old thread ready */
         KxQueueReadyThread(OldThread, Prcb);
 
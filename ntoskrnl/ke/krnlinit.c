@@ -292,11 +292,16 @@ NTAPI
 INIT_FUNCTION
 KeInitSystem(VOID)
 {
+    CCHAR i;
+
     /* Check if Threaded DPCs are enabled */
     if (KeThreadDpcEnable)
     {
-        /* FIXME: TODO */
-        DPRINT1("Threaded DPCs not yet supported\n");
+        /* Start the DPC thread of every processor */
+        for (i = 0; i < KeNumberProcessors; i++)
+        {
+            KiStartDpcThread(KiProcessorBlock[i]);
+        }
     }
 
     /* Initialize non-portable parts of the kernel */
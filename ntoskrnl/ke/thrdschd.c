@@ -15,11 +15,18 @@
 #ifdef _WIN64
 # define InterlockedOrSetMember(Destination, SetMember) \
     InterlockedOr64((PLONG64)Destination, SetMember);
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd64((PLONG64)Destination, SetMember);
 #else
 # define InterlockedOrSetMember(Destination, SetMember) \
     InterlockedOr((PLONG)Destination, SetMember);
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd((PLONG)Destination, SetMember);
 #endif
 
+/* Ticks a ready thread stays on its ideal CPU before idle CPUs may take it */
+#define THREAD_STEAL_WAIT_TICKS 2
+
 /* GLOBALS *******************************************************************/
 
 ULONG_PTR KiIdleSummary;
@@ -27,13 +34,164 @@ ULONG_PTR KiIdleSMTSummary;
 
 /* FUNCTIONS *****************************************************************/
 
+#ifdef CONFIG_SMP
+static
+VOID
+KiAcquireTwoPrcbLocks(IN PKPRCB FirstPrcb,
+                      IN PKPRCB SecondPrcb)
+{
+    /* Always lock the lowest CPU first so that two CPUs can't deadlock */
+    if (FirstPrcb->Number < SecondPrcb->Number)
+    {
+        KiAcquirePrcbLock(FirstPrcb);
+        KiAcquirePrcbLock(SecondPrcb);
+    }
+    else
+    {
+        KiAcquirePrcbLock(SecondPrcb);
+        KiAcquirePrcbLock(FirstPrcb);
+    }
+}
+
+static
+ULONG
+KiSelectReadyProcessor(IN PKTHREAD Thread)
+{
+    KAFFINITY Affinity, IdleSet;
+
+    /* Only consider the processors the thread may run on */
+    Affinity = Thread->Affinity & KeActiveProcessors;
+    ASSERT(Affinity != 0);
+
+    /* Prefer an idle CPU: the ideal one, then the one it last ran on */
+    IdleSet = KiIdleSummary & Affinity;
+    if (IdleSet)
+    {
+        if (IdleSet & AFFINITY_MASK(Thread->IdealProcessor)) return Thread->IdealProcessor;
+        if (IdleSet & AFFINITY_MASK(Thread->NextProcessor)) return Thread->NextProcessor;
+        return RtlFindLeastSignificantBit(IdleSet);
+    }
+
+    /* Everyone is busy, queue it on its ideal CPU or where it last ran */
+    if (Affinity & AFFINITY_MASK(Thread->IdealProcessor)) return Thread->IdealProcessor;
+    if (Affinity & AFFINITY_MASK(Thread->NextProcessor)) return Thread->NextProcessor;
+    return RtlFindLeastSignificantBit(Affinity);
+}
+
+//
+// Moves the best ready thread of a busy CPU to an idle CPU, and makes it the
+// next thread to run there. Threads are only moved to a CPU their affinity
+// allows. A thread queued on its ideal processor is only moved once it has
+// been ready since WaitLimit or earlier.
+//
+BOOLEAN
+FASTCALL
+KiMoveReadyThread(IN PKPRCB SourcePrcb,
+                  IN PKPRCB TargetPrcb,
+                  IN ULONG WaitLimit)
+{
+    ULONG Summary;
+    LONG Priority;
+    PLIST_ENTRY ListHead, NextEntry;
+    PKTHREAD Thread = NULL;
+
+    /* Check locklessly first, we'll do it again under the locks */
+    if (!(SourcePrcb->ReadySummary)) return FALSE;
+
+    /* Lock both PRCBs */
+    KiAcquireTwoPrcbLocks(SourcePrcb, TargetPrcb);
+
+    /* Make sure the target is still idle with nothing scheduled */
+    if ((KiIdleSummary & TargetPrcb->SetMember) && !(TargetPrcb->NextThread))
+    {
+        /* Scan the source's ready queues from the highest priority down */
+        Summary = SourcePrcb->ReadySummary;
+        while ((Summary) && !(Thread))
+        {
+            BitScanReverse((PULONG)&Priority, Summary);
+            Summary ^= PRIORITY_MASK(Priority);
+
+            /* Loop the threads at this priority */
+            ListHead = &SourcePrcb->DispatcherReadyListHead[Priority];
+            for (NextEntry = ListHead->Flink;
+                 NextEntry != ListHead;
+                 NextEntry = NextEntry->Flink)
+            {
+                Thread = CONTAINING_RECORD(NextEntry, KTHREAD, WaitListEntry);
+                ASSERT(Thread->Priority == Priority);
+
+                /*
+                 * Check if it may run on the target and isn't at home. The
+                 * thread its CPU just switched away from is queued while it's
+                 * still being saved, so leave it until it's swapped out.
+                 */
+                if ((Thread->State == Ready) &&
+                    !(Thread->SwapBusy) &&
+                    (Thread->Affinity & TargetPrcb->SetMember) &&
+                    ((Thread->IdealProcessor != SourcePrcb->Number) ||
+                     (WaitLimit >= Thread->WaitTime)))
+                {
+                    /* Take it */
+                    break;
+                }
+
+                /* Keep looking */
+                Thread = NULL;
+            }
+        }
+
+        /* Check if we found one */
+        if (Thread)
+        {
+            /* Remove it from the source's queue */
+            if (RemoveEntryList(&Thread->WaitListEntry))
+            {
+                /* The list is empty now, reset the ready summary */
+                SourcePrcb->ReadySummary ^= PRIORITY_MASK(Thread->Priority);
+            }
+
+            /* The target isn't idle anymore, run the thread next there */
+            InterlockedAndSetMember(&KiIdleSummary, ~TargetPrcb->SetMember);
+            Thread->NextProcessor = (UCHAR)TargetPrcb->Number;
+            Thread->State = Standby;
+            TargetPrcb->NextThread = Thread;
+        }
+    }
+
+    /* Release the locks */
+    KiReleasePrcbLock(TargetPrcb);
+    KiReleasePrcbLock(SourcePrcb);
+    return (Thread != NULL);
+}
+#endif
+
 PKTHREAD
 FASTCALL
 KiIdleSchedule(IN PKPRCB Prcb)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("SMP: Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    ULONG i, Number;
+    ULONG WaitLimit = KeTickCount.LowPart - THREAD_STEAL_WAIT_TICKS;
+
+    /* We only look for work once each time we become idle */
+    Prcb->IdleSchedule = FALSE;
+
+    /* Look at the other CPUs, starting with our neighbor */
+    Number = Prcb->Number;
+    for (i = 1; i < (ULONG)KeNumberProcessors; i++)
+    {
+        /* Steal a ready thread from it if it has any for us */
+        if (++Number == (ULONG)KeNumberProcessors) Number = 0;
+        if (KiMoveReadyThread(KiProcessorBlock[Number], Prcb, WaitLimit)) break;
+    }
+
+    /* Return the thread we'll run next, if any */
+    return Prcb->NextThread;
+#else
+    /* There are no other CPUs to take work from */
+    Prcb->IdleSchedule = FALSE;
     return NULL;
+#endif
 }
 
 VOID
@@ -228,6 +386,30 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
     OldPriority = Thread->Priority;
     Thread->Preempted = FALSE;
 
+#ifdef CONFIG_SMP
+    /* Pick the CPU to queue the thread on, and get the PRCB and lock it */
+    Processor = KiSelectReadyProcessor(Thread);
+    Prcb = KiProcessorBlock[Processor];
+    KiAcquirePrcbLock(Prcb);
+
+    /* Check if the CPU is still idle with nothing scheduled */
+    if ((KiIdleSummary & Prcb->SetMember) && !(Prcb->NextThread))
+    {
+        /* Clear its idle bit and set this thread as the next one */
+        InterlockedAndSetMember(&KiIdleSummary, ~Prcb->SetMember);
+        Thread->NextProcessor = (UCHAR)Processor;
+        Thread->State = Standby;
+        Prcb->NextThread = Thread;
+
+        /* Unlock the PRCB and wake up the CPU if it's not us */
+        KiReleasePrcbLock(Prcb);
+        if (KeGetCurrentProcessorNumber() != Processor)
+        {
+            KiIpiSend(AFFINITY_MASK(Processor), IPI_DPC);
+        }
+        return;
+    }
+#else
     /* Queue the thread on CPU 0 and get the PRCB and lock it */
     Thread->NextProcessor = 0;
     Prcb = KiProcessorBlock[0];
@@ -245,6 +427,7 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
         KiReleasePrcbLock(Prcb);
         return;
     }
+#endif
 
     /* Set the CPU number */
     Thread->NextProcessor = (UCHAR)Processor;
@@ -387,6 +570,10 @@ KiSwapThread(IN PKTHREAD CurrentThread,
         {
             /* Set the idle summary */
             InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
+#ifdef CONFIG_SMP
+            /* Have the idle thread look for work on other CPUs */
+            Prcb->IdleSchedule = TRUE;
+#endif
 
             /* Schedule the idle thread */
             NextThread = Prcb->IdleThread;
@@ -178,6 +178,12 @@ KeUpdateRunTime(IN PKTRAP_FRAME TrapFrame,
         {
             /* Handle being in kernel mode */
             Thread->KernelTime++;
+
+            /* Threaded DPCs count as DPC time as well */
+            if ((Thread == Prcb->DpcThread) && (Prcb->DpcThreadActive))
+            {
+                Prcb->DpcTime++;
+            }
         }
         else
         {
@@ -244,10 +244,18 @@ MiCheckForContiguousMemory(IN PVOID BaseAddress,
     while (StartPte < EndPte)
     {
         //
-        // Get this PTE's page number
+        // Get this PTE's page number. Pool mapped by a large page has no PTE,
+        // so the page number comes from the physical address instead
         //
-        ASSERT (StartPte->u.Hard.Valid == 1);
-        Page = PFN_FROM_PTE(StartPte);
+        if (MI_IS_PHYSICAL_ADDRESS(MiPteToAddress(StartPte)))
+        {
+            Page = MI_CONVERT_PHYSICAL_TO_PFN(MiPteToAddress(StartPte));
+        }
+        else
+        {
+            ASSERT(StartPte->u.Hard.Valid == 1);
+            Page = PFN_FROM_PTE(StartPte);
+        }
 
         //
         // Is this the beginning of our adventure?
@@ -244,7 +244,7 @@ MiInitMachineDependent(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
     PFN_NUMBER PageFrameIndex;
     PMMPTE StartPde, EndPde, PointerPte, LastPte;
     MMPTE TempPde, TempPte;
-    PVOID NonPagedPoolExpansionVa;
+    PVOID NonPagedPoolExpansionVa, LargePoolStart, LargePoolEnd;
     SIZE_T NonPagedSystemSize;
     KIRQL OldIrql;
     PMMPFN Pfn1;
@@ -363,6 +363,36 @@ MiInitMachineDependent(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
     DPRINT("PFN DB PA PFN begins at: %lx\n", PageFrameIndex);
     DPRINT("NP PA PFN begins at: %lx\n", PageFrameIndex + MxPfnAllocation);
 
+    //
+    // If the CPU supports large pages and initial NP pool is big enough, slide
+    // the pool VA so that it has the same offset inside a PDE as its physical
+    // pages, which lets us map the PDE-aligned part of it with large pages.
+    // The VA space between the PFN database and hyperspace has room for this.
+    //
+    LargePoolStart = LargePoolEnd = NULL;
+    if ((KeFeatureBits & KF_LARGE_PAGE) &&
+        (MmSizeOfNonPagedPoolInBytes >= PDE_MAPPED_VA))
+    {
+        MmNonPagedPoolStart = (PVOID)((ULONG_PTR)MmNonPagedPoolStart +
+                                      ((((PageFrameIndex & (PTE_COUNT - 1)) -
+                                         MiAddressToPteOffset(MmNonPagedPoolStart)) &
+                                        (PTE_COUNT - 1)) << PAGE_SHIFT));
+        LargePoolStart = ALIGN_UP_POINTER_BY(MmNonPagedPoolStart, PDE_MAPPED_VA);
+        LargePoolEnd = ALIGN_DOWN_POINTER_BY((ULONG_PTR)MmNonPagedPoolStart +
+                                             MmSizeOfNonPagedPoolInBytes,
+                                             PDE_MAPPED_VA);
+        if (LargePoolStart < LargePoolEnd)
+        {
+            /* The loader doesn't turn on PSE, and phase 1 would be too late */
+            __writecr4(__readcr4() | CR4_PSE);
+            DPRINT("NP pool large pages: %p-%p\n", LargePoolStart, LargePoolEnd);
+        }
+        else
+        {
+            LargePoolStart = LargePoolEnd = NULL;
+        }
+    }
+
     /* Convert nonpaged pool size from bytes to pages */
     MmMaximumNonPagedPoolInPages = MmMaximumNonPagedPoolInBytes >> PAGE_SHIFT;
 
@@ -400,6 +430,16 @@ MiInitMachineDependent(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
                                     MmSizeOfNonPagedPoolInBytes - 1));
     while (StartPde <= EndPde)
     {
+        //
+        // Large pages don't need a page table
+        //
+        if ((StartPde >= MiAddressToPde(LargePoolStart)) &&
+            (StartPde < MiAddressToPde(LargePoolEnd)))
+        {
+            StartPde++;
+            continue;
+        }
+
         //
         // Get a page
         //
@@ -429,8 +469,26 @@ MiInitMachineDependent(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
     PointerPte = MiAddressToPte(MmNonPagedPoolStart);
     LastPte = MiAddressToPte((PVOID)((ULONG_PTR)MmNonPagedPoolStart +
                                      MmSizeOfNonPagedPoolInBytes - 1));
+    TempPde.u.Hard.LargePage = 1;
     while (PointerPte <= LastPte)
     {
+        //
+        // Check if this whole PDE can be mapped with a large page
+        //
+        if ((MiPteToAddress(PointerPte) >= LargePoolStart) &&
+            (MiPteToAddress(PointerPte) < LargePoolEnd))
+        {
+            ASSERT((PageFrameIndex & (PTE_COUNT - 1)) == 0);
+            TempPde.u.Hard.PageFrameNumber = PageFrameIndex;
+            MI_WRITE_VALID_PDE(MiPteToPde(PointerPte), TempPde);
+
+            /* Remember to keep these cached */
+            MiAddCachedRange(PageFrameIndex, PageFrameIndex + PTE_COUNT - 1);
+            PageFrameIndex += PTE_COUNT;
+            PointerPte += PTE_COUNT;
+            continue;
+        }
+
         //
         // Use one of our contigous pages
         //
@@ -25,9 +25,24 @@ WCHAR MmLargePageDriverBuffer[512] = {0};
 ULONG MmLargePageDriverBufferLength = -1;
 LIST_ENTRY MiLargePageDriverList;
 BOOLEAN MiLargePageAllDrivers;
+SIZE_T MmLargePageMinimum;
 
 /* FUNCTIONS ******************************************************************/
 
+#if _MI_PAGING_LEVELS == 2
+ULONG_PTR
+NTAPI
+INIT_FUNCTION
+MiEnableLargePages(IN ULONG_PTR Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    /* Every processor walks the same page directory, so all of them need PSE */
+    __writecr4(__readcr4() | CR4_PSE);
+    return 0;
+}
+#endif
+
 VOID
 NTAPI
 INIT_FUNCTION
@@ -45,20 +60,252 @@ MiInitializeLargePageSupport(VOID)
     /* Initialize the process tracking list, and insert the system process */
     InitializeListHead(&MmProcessList);
     InsertTailList(&MmProcessList, &PsGetCurrentProcess()->MmProcessLinks);
+
+    /* A large page covers everything a page table would, if the CPU can do it */
+    if (KeFeatureBits & KF_LARGE_PAGE)
+    {
+        /* Phase 1 enables PSE too late for the boot image mappings */
+        KeIpiGenericCall(MiEnableLargePages, 0);
+        MmLargePageMinimum = PDE_MAPPED_VA;
+    }
 #endif
 }
 
+VOID
+NTAPI
+INIT_FUNCTION
+MiAddCachedRange(IN PFN_NUMBER StartFrame,
+                 IN PFN_NUMBER LastFrame)
+{
+    /* Make sure there's still room to track it */
+    if (MiLargePageRangeIndex == RTL_NUMBER_OF(MiLargePageRanges))
+    {
+        DPRINT1("Too many large page ranges, not tracking %lx-%lx\n", StartFrame, LastFrame);
+        return;
+    }
+
+    /* Remember it, so the PFN database gets told about the caching later */
+    MiLargePageRanges[MiLargePageRangeIndex].StartFrame = StartFrame;
+    MiLargePageRanges[MiLargePageRangeIndex].LastFrame = LastFrame;
+    MiLargePageRangeIndex++;
+}
+
 VOID
 NTAPI
 INIT_FUNCTION
 MiSyncCachedRanges(VOID)
 {
     ULONG i;
+    PFN_NUMBER PageFrameIndex;
+    PMMPFN Pfn1;
 
     /* Scan every range */
     for (i = 0; i < MiLargePageRangeIndex; i++)
     {
-        UNIMPLEMENTED_DBGBREAK("No support for large pages\n");
+        /* Large pages are always mapped cached, so the PFNs must agree */
+        for (PageFrameIndex = MiLargePageRanges[i].StartFrame;
+             PageFrameIndex <= MiLargePageRanges[i].LastFrame;
+             PageFrameIndex++)
+        {
+            Pfn1 = MiGetPfnEntry(PageFrameIndex);
+            if (Pfn1) Pfn1->u3.e1.CacheAttribute = MiCached;
+        }
+    }
+}
+
+VOID
+NTAPI
+INIT_FUNCTION
+MiMapLargePageImages(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
+{
+#if _MI_PAGING_LEVELS == 2
+    PLIST_ENTRY NextEntry;
+    PLDR_DATA_TABLE_ENTRY LdrEntry;
+    ULONG_PTR Address, EndAddress;
+    PMMPDE PointerPde;
+    PMMPTE PointerPte;
+    MMPDE TempPde;
+    PFN_NUMBER PageFrameIndex, PageDirectoryIndex;
+    PFN_NUMBER PageTables[16];
+    PMMPFN Pfn1;
+    ULONG i, Images = 0, PageTableCount = 0;
+    KIRQL OldIrql;
+
+    /* Nothing to do if the CPU can't map large pages */
+    if (!MmLargePageMinimum) return;
+
+    /* The kernel and the HAL are the first two boot images */
+    for (NextEntry = LoaderBlock->LoadOrderListHead.Flink;
+         (NextEntry != &LoaderBlock->LoadOrderListHead) && (Images < 2);
+         NextEntry = NextEntry->Flink, Images++)
+    {
+        LdrEntry = CONTAINING_RECORD(NextEntry,
+                                     LDR_DATA_TABLE_ENTRY,
+                                     InLoadOrderLinks);
+
+        /* Only page table sized chunks that are entirely inside the image qualify */
+        Address = ALIGN_UP_BY((ULONG_PTR)LdrEntry->DllBase, PDE_MAPPED_VA);
+        EndAddress = (ULONG_PTR)LdrEntry->DllBase + LdrEntry->SizeOfImage;
+        for (; ((Address + PDE_MAPPED_VA) <= EndAddress) &&
+               (PageTableCount < RTL_NUMBER_OF(PageTables));
+             Address += PDE_MAPPED_VA)
+        {
+            PointerPde = MiAddressToPde(Address);
+            if (!(PointerPde->u.Hard.Valid) || (MI_IS_PAGE_LARGE(PointerPde))) continue;
+
+            /* The loader must have placed the chunk physically contiguous and aligned */
+            PointerPte = MiAddressToPte(Address);
+            PageFrameIndex = PFN_FROM_PTE(PointerPte);
+            if (PageFrameIndex & (PTE_COUNT - 1)) continue;
+            for (i = 0; i < PTE_COUNT; i++)
+            {
+                if (!(PointerPte[i].u.Hard.Valid) ||
+                    (PFN_FROM_PTE(&PointerPte[i]) != (PageFrameIndex + i)))
+                {
+                    break;
+                }
+            }
+            if (i != PTE_COUNT) continue;
+
+            /* The page table page goes away once nothing can use it anymore */
+            PageTables[PageTableCount++] = PFN_FROM_PTE(PointerPde);
+
+            /* The pages now belong to the page directory */
+            PageDirectoryIndex = PFN_FROM_PTE(MiAddressToPte(PointerPde));
+            for (i = 0; i < PTE_COUNT; i++)
+            {
+                Pfn1 = MiGetPfnEntry(PageFrameIndex + i);
+                if (!Pfn1) continue;
+                Pfn1->PteAddress = (PMMPTE)PointerPde;
+                Pfn1->u4.PteFrame = PageDirectoryIndex;
+            }
+
+            /* Switch the PDE over to a large page with the same attributes */
+            TempPde = *PointerPde;
+            TempPde.u.Hard.PageFrameNumber = PageFrameIndex;
+            TempPde.u.Hard.LargePage = 1;
+            TempPde.u.Hard.Accessed = 1;
+            TempPde.u.Hard.Dirty = 1;
+            *PointerPde = TempPde;
+
+            /* Remember the range so the PFN database knows it's cached */
+            MiAddCachedRange(PageFrameIndex, PageFrameIndex + PTE_COUNT - 1);
+            DPRINT("Mapped %wZ at %p with a large page\n", &LdrEntry->BaseDllName, Address);
+        }
+    }
+
+    /* Nothing to do if no chunk qualified */
+    if (!PageTableCount) return;
+
+    /* Get rid of the old translations */
+    KeFlushEntireTb(TRUE, TRUE);
+    MiSyncCachedRanges();
+
+    /* Now free the page tables, their PTEs no longer hold share counts */
+    OldIrql = MiAcquirePfnLock();
+    for (i = 0; i < PageTableCount; i++)
+    {
+        Pfn1 = MiGetPfnEntry(PageTables[i]);
+        if (!Pfn1) continue;
+        Pfn1->u2.ShareCount = 1;
+        MI_SET_PFN_DELETED(Pfn1);
+        MiDecrementShareCount(Pfn1, PageTables[i]);
+    }
+    MiReleasePfnLock(OldIrql);
+#endif
+}
+
+VOID
+NTAPI
+MiMapUserLargePages(IN PEPROCESS Process,
+                    IN PMMVAD Vad,
+                    IN PPFN_NUMBER PageFrames)
+{
+    PMMPDE PointerPde, LastPde;
+    MMPDE TempPde;
+    PMMPFN Pfn1;
+    PFN_NUMBER PageDirectoryIndex;
+    ULONG i;
+
+    /* The caller owns the working set and allocated the pages already */
+    ASSERT(Vad->u.VadFlags.VadType == VadLargePages);
+    ASSERT(Vad->u.VadFlags.MemCommit == 1);
+    PointerPde = MiAddressToPde(Vad->StartingVpn << PAGE_SHIFT);
+    LastPde = MiAddressToPde(Vad->EndingVpn << PAGE_SHIFT);
+    ASSERT(MiAddressToPteOffset(Vad->StartingVpn << PAGE_SHIFT) == 0);
+
+    /* Build the PDE template for this VAD */
+    TempPde.u.Long = 0;
+    TempPde.u.Hard.Valid = 1;
+    TempPde.u.Hard.Owner = 1;
+    TempPde.u.Long |= MmProtectToPteMask[Vad->u.VadFlags.Protection];
+    TempPde.u.Hard.LargePage = 1;
+    TempPde.u.Hard.Accessed = 1;
+    TempPde.u.Hard.Dirty = 1;
+
+    while (PointerPde <= LastPde)
+    {
+#if _MI_PAGING_LEVELS >= 3
+        /* Make sure the page directory itself is there */
+        MiMakeSystemAddressValid(PointerPde, Process);
+#else
+        UNREFERENCED_PARAMETER(Process);
+#endif
+        PageDirectoryIndex = PFN_FROM_PTE(MiAddressToPte(PointerPde));
+
+        /* Every page of the run is now mapped by this PDE */
+        Pfn1 = MI_PFN_ELEMENT(*PageFrames);
+        for (i = 0; i < PTE_COUNT; i++, Pfn1++)
+        {
+            Pfn1->PteAddress = (PMMPTE)PointerPde;
+            Pfn1->u4.PteFrame = PageDirectoryIndex;
+        }
+
+        /* Write it */
+        TempPde.u.Hard.PageFrameNumber = *PageFrames;
+        MI_WRITE_VALID_PDE(PointerPde, TempPde);
+
+        PointerPde++;
+        PageFrames++;
+    }
+}
+
+VOID
+NTAPI
+MiDeleteUserLargePages(IN PEPROCESS Process,
+                       IN PMMVAD Vad)
+{
+    PMMPDE PointerPde, LastPde;
+    PFN_NUMBER PageFrames[16];
+    ULONG i, Count;
+
+    /* The caller owns the working set */
+    UNREFERENCED_PARAMETER(Process);
+    ASSERT(Vad->u.VadFlags.VadType == VadLargePages);
+    PointerPde = MiAddressToPde(Vad->StartingVpn << PAGE_SHIFT);
+    LastPde = MiAddressToPde(Vad->EndingVpn << PAGE_SHIFT);
+
+    while (PointerPde <= LastPde)
+    {
+        /* Unmap a batch of large pages */
+        for (Count = 0; (PointerPde <= LastPde) && (Count < RTL_NUMBER_OF(PageFrames)); PointerPde++)
+        {
+#if _MI_PAGING_LEVELS >= 3
+            if (!MiAddressToPte(PointerPde)->u.Hard.Valid) continue;
+#endif
+            /* This can only be missing if the allocation itself failed */
+            if (!PointerPde->u.Hard.Valid) continue;
+            ASSERT(MI_IS_PAGE_LARGE(PointerPde));
+            PageFrames[Count++] = PFN_FROM_PTE(PointerPde);
+            PointerPde->u.Long = 0;
+        }
+
+        /* Nothing to free in this batch */
+        if (!Count) continue;
+
+        /* Only hand the pages back once nobody can get to them anymore */
+        KeFlushEntireTb(TRUE, TRUE);
+        for (i = 0; i < Count; i++) MiFreeLargePage(PageFrames[i]);
     }
 }
 
@@ -438,10 +438,19 @@ MmBuildMdlForNonPagedPool(IN PMDL Mdl)
     do
     {
         //
-        // Write the PFN
+        // Write the PFN, large pages don't have a PTE to read it from
         //
-        Pfn = PFN_FROM_PTE(PointerPte++);
+        if (MI_IS_PHYSICAL_ADDRESS(Base))
+        {
+            Pfn = MI_CONVERT_PHYSICAL_TO_PFN(Base);
+        }
+        else
+        {
+            Pfn = PFN_FROM_PTE(PointerPte);
+        }
         *MdlPages++ = Pfn;
+        PointerPte++;
+        Base = (PVOID)((ULONG_PTR)Base + PAGE_SIZE);
     } while (MdlPages < EndPage);
 
     //
@@ -985,9 +994,6 @@ MmProbeAndLockPages(IN PMDL Mdl,
     TotalPages = LockPages;
     StartAddress = Address;
 
-    /* Large pages not supported */
-    ASSERT(!MI_IS_PHYSICAL_ADDRESS(Address));
-
     //
     // Now probe them
     //
@@ -1170,7 +1176,7 @@ MmProbeAndLockPages(IN PMDL Mdl,
                (PointerPpe->u.Hard.Valid == 0) ||
 #endif
                (PointerPde->u.Hard.Valid == 0) ||
-               (PointerPte->u.Hard.Valid == 0))
+               (!(MI_IS_PAGE_LARGE(PointerPde)) && (PointerPte->u.Hard.Valid == 0)))
         {
             //
             // What kind of lock were we using?
@@ -1226,10 +1232,21 @@ MmProbeAndLockPages(IN PMDL Mdl,
         //
         if (Operation != IoReadAccess)
         {
+            //
+            // Large pages are never copy on write, so they just have to be writable
+            //
+            if (MI_IS_PAGE_LARGE(PointerPde))
+            {
+                if (MI_IS_PAGE_WRITEABLE(PointerPde) == FALSE)
+                {
+                    Status = STATUS_ACCESS_VIOLATION;
+                    goto CleanupWithLock;
+                }
+            }
             //
             // Check if the PTE is not writable
             //
-            if (MI_IS_PAGE_WRITEABLE(PointerPte) == FALSE)
+            else if (MI_IS_PAGE_WRITEABLE(PointerPte) == FALSE)
             {
                 //
                 // Check if it's copy on write
@@ -1305,9 +1322,17 @@ MmProbeAndLockPages(IN PMDL Mdl,
         }
 
         //
-        // Grab the PFN
+        // Grab the PFN, which for a large page is relative to the PDE
         //
-        PageFrameIndex = PFN_FROM_PTE(PointerPte);
+        if (MI_IS_PAGE_LARGE(PointerPde))
+        {
+            PageFrameIndex = PFN_FROM_PTE(PointerPde) +
+                             MiAddressToPteOffset(MiPteToAddress(PointerPte));
+        }
+        else
+        {
+            PageFrameIndex = PFN_FROM_PTE(PointerPte);
+        }
         Pfn1 = MiGetPfnEntry(PageFrameIndex);
         if (Pfn1)
         {
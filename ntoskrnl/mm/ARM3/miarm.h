@@ -522,6 +522,7 @@ extern WCHAR MmVerifyDriverBuffer[512];
 extern WCHAR MmLargePageDriverBuffer[512];
 extern LIST_ENTRY MiLargePageDriverList;
 extern BOOLEAN MiLargePageAllDrivers;
+extern SIZE_T MmLargePageMinimum;
 extern ULONG MmVerifyDriverBufferLength;
 extern ULONG MmLargePageDriverBufferLength;
 extern SIZE_T MmSizeOfNonPagedPoolInBytes;
@@ -582,6 +583,7 @@ extern ULONG MmMaximumNonPagedPoolPercent;
 extern ULONG MmLargeStackSize;
 extern PMMCOLOR_TABLES MmFreePagesByColor[FreePageList + 1];
 extern MMPFNLIST MmStandbyPageListByPriority[8];
+extern MMPFNLIST MmModifiedPageListByColor[1];
 extern ULONG MmProductType;
 extern MM_SYSTEMSIZE MmSystemSize;
 extern PKEVENT MiLowMemoryEvent;
@@ -614,6 +616,10 @@ extern PMMPTE MmSharedUserDataPte;
 extern LIST_ENTRY MmProcessList;
 extern BOOLEAN MmZeroingPageThreadActive;
 extern KEVENT MmZeroingPageEvent;
+extern PFN_NUMBER MmZeroedPageTarget;
+extern ULONG MmSynchronousZeroPageCount;
+extern KEVENT MmModifiedPageWriterEvent;
+extern PFN_NUMBER MmModifiedPageMaximum;
 extern ULONG MmSystemPageColor;
 extern ULONG MmProcessColorSeed;
 extern PMMWSL MmWorkingSetList;
@@ -893,6 +899,31 @@ MI_MAKE_TRANSITION_PTE(_Out_ PMMPTE NewPte,
     NewPte->u.Trans.PageFrameNumber = Page;
 }
 
+//
+// Builds a page file PTE, the offset of a swap entry is never zero so it can't
+// be mistaken for a demand zero PTE
+//
+FORCEINLINE
+VOID
+MI_MAKE_PAGEFILE_PTE(_Out_ PMMPTE NewPte,
+                     _In_ SWAPENTRY SwapEntry,
+                     _In_ ULONG Protection)
+{
+    NewPte->u.Long = 0;
+    NewPte->u.Soft.PageFileLow = FILE_FROM_ENTRY(SwapEntry);
+    NewPte->u.Soft.PageFileHigh = OFFSET_FROM_ENTRY(SwapEntry);
+    NewPte->u.Soft.Protection = Protection;
+}
+
+FORCEINLINE
+SWAPENTRY
+MI_GET_PAGEFILE_PTE_ENTRY(_In_ PMMPTE PointerPte)
+{
+    ASSERT(PointerPte->u.Soft.PageFileHigh != 0);
+    return ENTRY_FROM_FILE_OFFSET((SWAPENTRY)PointerPte->u.Soft.PageFileLow,
+                                  (SWAPENTRY)PointerPte->u.Soft.PageFileHigh);
+}
+
 //
 // Returns if the page is physically resident (ie: a large page)
 // FIXFIX: CISC/x86 only?
@@ -908,6 +939,21 @@ MI_IS_PHYSICAL_ADDRESS(IN PVOID Address)
     return ((PointerPde->u.Hard.LargePage) && (PointerPde->u.Hard.Valid));
 }
 
+//
+// Returns the page frame backing an address mapped by a large page
+//
+FORCEINLINE
+PFN_NUMBER
+MI_CONVERT_PHYSICAL_TO_PFN(IN PVOID Address)
+{
+    PMMPDE PointerPde;
+
+    /* The PDE maps the first page, the rest follows contiguously */
+    PointerPde = MiAddressToPde(Address);
+    ASSERT(MI_IS_PHYSICAL_ADDRESS(Address));
+    return PFN_FROM_PTE(PointerPde) + MiAddressToPteOffset(Address);
+}
+
 //
 // Writes a valid PTE
 //
@@ -1961,6 +2007,30 @@ MiInsertPageInFreeList(
     IN PFN_NUMBER PageFrameIndex
 );
 
+PFN_NUMBER
+NTAPI
+MiAllocateLargePage(
+    IN BOOLEAN ZeroPages
+);
+
+VOID
+NTAPI
+MiFreeLargePage(
+    IN PFN_NUMBER PageFrameIndex
+);
+
+VOID
+NTAPI
+MiInitializeModifiedPageWriter(
+    VOID
+);
+
+VOID
+NTAPI
+MiReleasePageFileCopy(
+    IN PMMPFN Pfn1
+);
+
 PFN_COUNT
 NTAPI
 MiDeleteSystemPageableVm(
@@ -2000,6 +2070,34 @@ MiSyncCachedRanges(
     VOID
 );
 
+VOID
+NTAPI
+MiAddCachedRange(
+    IN PFN_NUMBER StartFrame,
+    IN PFN_NUMBER LastFrame
+);
+
+VOID
+NTAPI
+MiMapLargePageImages(
+    IN PLOADER_PARAMETER_BLOCK LoaderBlock
+);
+
+VOID
+NTAPI
+MiMapUserLargePages(
+    IN PEPROCESS Process,
+    IN PMMVAD Vad,
+    IN PPFN_NUMBER PageFrames
+);
+
+VOID
+NTAPI
+MiDeleteUserLargePages(
+    IN PEPROCESS Process,
+    IN PMMVAD Vad
+);
+
 BOOLEAN
 NTAPI
 MiIsPfnInUse(
@@ -782,8 +782,38 @@ MiBuildPfnDatabaseFromPages(IN PLOADER_PARAMETER_BLOCK LoaderBlock)
     Count = PD_COUNT * PDE_COUNT;
     for (i = 0; i < Count; i++)
     {
-        /* Check for valid PDE */
-        if (PointerPde->u.Hard.Valid == 1)
+        /* Check for a large page, which maps the pages directly */
+        if ((PointerPde->u.Hard.Valid == 1) && (MI_IS_PAGE_LARGE(PointerPde)))
+        {
+            /* Only nonpaged pool is mapped this way this early */
+            ASSERT((BaseAddress >= (ULONG_PTR)MmNonPagedPoolStart) &&
+                   (BaseAddress < (ULONG_PTR)MmNonPagedPoolStart +
+                                  MmSizeOfNonPagedPoolInBytes));
+            PageFrameIndex = PFN_FROM_PTE(PointerPde);
+            for (j = 0; j < PTE_COUNT; j++)
+            {
+                /* Check if this is valid memory */
+                if (MiIsRegularMemory(LoaderBlock, PageFrameIndex + j))
+                {
+                    /* Setup the PFN entry, which belongs to the page directory */
+                    Pfn2 = MiGetPfnEntry(PageFrameIndex + j);
+                    Pfn2->u4.PteFrame = StartupPdIndex;
+                    Pfn2->PteAddress = (PMMPTE)PointerPde;
+                    Pfn2->u2.ShareCount++;
+                    Pfn2->u3.e2.ReferenceCount = 1;
+                    Pfn2->u3.e1.PageLocation = ActiveAndValid;
+                    Pfn2->u3.e1.CacheAttribute = MiCached;
+#if MI_TRACE_PFNS
+                    Pfn2->PfnUsage = MI_USAGE_NONPAGED_POOL;
+                    memcpy(Pfn2->ProcessName, "Large Page", 16);
+#endif
+                }
+            }
+
+            /* Next PDE mapped address */
+            BaseAddress += PDE_MAPPED_VA;
+        }
+        else if (PointerPde->u.Hard.Valid == 1)
         {
             /* Get the PFN from it */
             PageFrameIndex = PFN_FROM_PTE(PointerPde);
@@ -2185,6 +2215,9 @@ MmArmInitSystem(IN ULONG Phase,
         KeInitializeEvent(&MmZeroingPageEvent, SynchronizationEvent, FALSE);
         MmZeroingPageThreadActive = FALSE;
 
+        /* Set the modified page writer event */
+        KeInitializeEvent(&MmModifiedPageWriterEvent, SynchronizationEvent, FALSE);
+
         /* Initialize the dead stack S-LIST */
         InitializeSListHead(&MmDeadStackSListHead);
 
@@ -2408,6 +2441,9 @@ MmArmInitSystem(IN ULONG Phase,
         /* Relocate the boot drivers into system PTE space and fixup their PFNs */
         MiReloadBootLoadedDrivers(LoaderBlock);
 
+        /* Map the kernel and HAL with large pages where the loader allows it */
+        MiMapLargePageImages(LoaderBlock);
+
         /* FIXME: Call out into Driver Verifier for initialization  */
 
         /* Check how many pages the system has */
@@ -2469,7 +2505,7 @@ MmArmInitSystem(IN ULONG Phase,
         /* Now setup the shared user data fields */
         ASSERT(SharedUserData->NumberOfPhysicalPages == 0);
         SharedUserData->NumberOfPhysicalPages = MmNumberOfPhysicalPages;
-        SharedUserData->LargePageMinimum = 0;
+        SharedUserData->LargePageMinimum = MmLargePageMinimum;
 
         /* Check for workstation (Wi for WinNT) */
         if (MmProductType == '\0i\0W')
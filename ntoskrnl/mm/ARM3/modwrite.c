@@ -0,0 +1,251 @@
+/*
+ * PROJECT:         ReactOS Kernel
+ * LICENSE:         BSD - See COPYING.ARM in the top level directory
+ * FILE:            ntoskrnl/mm/ARM3/modwrite.c
+ * PURPOSE:         ARM Memory Manager Modified Page Writer
+ * PROGRAMMERS:     ReactOS Portable Systems Group
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+#define MODULE_INVOLVED_IN_ARM3
+#include <mm/ARM3/miarm.h>
+
+/* GLOBALS ********************************************************************/
+
+KEVENT MmModifiedPageWriterEvent;
+
+/*
+ * Once this many pages are on the modified list, the modified page writer
+ * starts writing them out, until the list is back to the minimum. It also
+ * writes them out whenever we run low on available pages.
+ */
+PFN_NUMBER MmModifiedPageMaximum = 100;
+PFN_NUMBER MmModifiedPageMinimum = 50;
+
+/* PRIVATE FUNCTIONS **********************************************************/
+
+FORCEINLINE
+SWAPENTRY
+MiGetClusterSwapEntry(IN SWAPENTRY SwapEntry,
+                      IN ULONG Index)
+{
+    /* Entries of a cluster are consecutive in the same paging file */
+    return ENTRY_FROM_FILE_OFFSET(FILE_FROM_ENTRY(SwapEntry),
+                                  OFFSET_FROM_ENTRY(SwapEntry) + Index);
+}
+
+VOID
+NTAPI
+MiReleasePageFileCopy(IN PMMPFN Pfn1)
+{
+    MI_ASSERT_PFN_LOCK_HELD();
+
+    /* The page is going to be written to, so its page file copy is stale */
+    if ((Pfn1->OriginalPte.u.Soft.Prototype == 0) &&
+        (Pfn1->OriginalPte.u.Soft.PageFileHigh != 0))
+    {
+        MmFreeSwapPage(MI_GET_PAGEFILE_PTE_ENTRY(&Pfn1->OriginalPte));
+
+        /* Go back to a demand zero PTE with the same protection */
+        Pfn1->OriginalPte.u.Soft.PageFileLow = 0;
+        Pfn1->OriginalPte.u.Soft.PageFileHigh = 0;
+    }
+
+    /* And it will have to be written out again before being repurposed */
+    Pfn1->u3.e1.Modified = 1;
+}
+
+static
+BOOLEAN
+MiShouldWriteModifiedPages(VOID)
+{
+    /* Nothing to write, or nowhere to write it to */
+    if (!MmModifiedPageListHead.Total || !MiFreeSwapPages) return FALSE;
+
+    /* When memory is tight, every page written out can be repurposed */
+    if (MmAvailablePages < MmMinimumFreePages) return TRUE;
+
+    /* Otherwise bring the list back to its minimum */
+    return (MmModifiedPageListHead.Total > MmModifiedPageMinimum);
+}
+
+static
+BOOLEAN
+MiWriteModifiedPageCluster(VOID)
+{
+    PFN_NUMBER Pages[MM_MAXIMUM_SWAP_CLUSTER];
+    PFN_NUMBER PageFrameIndex, PageTableIndex;
+    SWAPENTRY SwapEntry, ClusterEntry;
+    ULONG Count, Gathered, i;
+    MMPTE OriginalPte;
+    PMMPFN Pfn1;
+    KIRQL OldIrql;
+    NTSTATUS Status;
+
+    /* Get consecutive page file space first, we may get less than we asked for */
+    Count = MM_MAXIMUM_SWAP_CLUSTER;
+    SwapEntry = MmAllocSwapCluster(&Count);
+    if (!SwapEntry)
+    {
+        MmShowOutOfSpaceMessagePagingFile();
+        return FALSE;
+    }
+
+    /* Take the oldest modified pages off the list */
+    OldIrql = MiAcquirePfnLock();
+    for (Gathered = 0; Gathered < Count; Gathered++)
+    {
+        PageFrameIndex = MmModifiedPageListByColor[0].Flink;
+        if (PageFrameIndex == LIST_HEAD) break;
+
+        /* Only pages of page file backed sections end up there for now */
+        Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
+        ASSERT(Pfn1->u3.e1.PageLocation == ModifiedPageList);
+        ASSERT(Pfn1->u3.e1.PrototypePte == 1);
+        ASSERT(Pfn1->u3.e1.Modified == 1);
+
+        /* Unlinking the page wipes its original PTE, which we still need */
+        OriginalPte = Pfn1->OriginalPte;
+        MiUnlinkPageFromList(Pfn1);
+        Pfn1->OriginalPte = OriginalPte;
+
+        /*
+         * Keep it referenced and off the lists while it's being written. It can
+         * still be faulted in meanwhile, and if it's written to it just becomes
+         * modified again.
+         */
+        InterlockedIncrement16((PSHORT)&Pfn1->u3.e2.ReferenceCount);
+        Pfn1->u3.e1.PageLocation = TransitionPage;
+        Pfn1->u3.e1.WriteInProgress = 1;
+        Pfn1->u3.e1.Modified = 0;
+
+        Pages[Gathered] = PageFrameIndex;
+    }
+    MiReleasePfnLock(OldIrql);
+
+    /* Give back the page file space we didn't need */
+    for (i = Gathered; i < Count; i++)
+    {
+        MmFreeSwapPage(MiGetClusterSwapEntry(SwapEntry, i));
+    }
+
+    if (!Gathered) return FALSE;
+
+    /* Write the whole cluster at once */
+    DPRINT("Writing %lu modified pages to swap entry %lx\n", Gathered, SwapEntry);
+    Status = MmWriteToSwapCluster(SwapEntry, Pages, Gathered);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Failed to write %lu modified pages: 0x%lx\n", Gathered, Status);
+    }
+
+    OldIrql = MiAcquirePfnLock();
+    for (i = 0; i < Gathered; i++)
+    {
+        Pfn1 = MI_PFN_ELEMENT(Pages[i]);
+        ASSERT(Pfn1->u3.e1.WriteInProgress == 1);
+        Pfn1->u3.e1.WriteInProgress = 0;
+
+        ClusterEntry = MiGetClusterSwapEntry(SwapEntry, i);
+        if (MI_IS_PFN_DELETED(Pfn1))
+        {
+            /* The section went away meanwhile, the page is ours to free */
+            MmFreeSwapPage(ClusterEntry);
+            PageTableIndex = Pfn1->u4.PteFrame;
+            MiDecrementShareCount(MI_PFN_ELEMENT(PageTableIndex), PageTableIndex);
+        }
+        else if (!NT_SUCCESS(Status) || Pfn1->u3.e1.Modified)
+        {
+            /* The copy is useless, the page has to stay on the modified list */
+            MmFreeSwapPage(ClusterEntry);
+            Pfn1->u3.e1.Modified = 1;
+        }
+        else
+        {
+            /* The page is clean, remember where its copy lives */
+            MI_MAKE_PAGEFILE_PTE(&Pfn1->OriginalPte,
+                                 ClusterEntry,
+                                 (ULONG)Pfn1->OriginalPte.u.Soft.Protection);
+        }
+
+        /* Drop our reference, unused clean pages go to the standby list */
+        MiDecrementReferenceCount(Pfn1, Pages[i]);
+    }
+    MiReleasePfnLock(OldIrql);
+
+    return NT_SUCCESS(Status);
+}
+
+static
+VOID
+NTAPI
+MiModifiedPageWriter(IN PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    /* Run above normal threads so that memory gets freed up quickly */
+    KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY + 1);
+
+    while (TRUE)
+    {
+        KeWaitForSingleObject(&MmModifiedPageWriterEvent,
+                              WrPageOut,
+                              KernelMode,
+                              FALSE,
+                              NULL);
+
+        /* Keep writing clusters until we're done, or the page file gives up */
+        while (MiShouldWriteModifiedPages())
+        {
+            if (!MiWriteModifiedPageCluster()) break;
+        }
+    }
+}
+
+VOID
+NTAPI
+INIT_FUNCTION
+MiInitializeModifiedPageWriter(VOID)
+{
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+
+    /* Bigger systems can afford to keep more modified pages around */
+    switch (MmSystemSize)
+    {
+        case MmSmallSystem:
+            MmModifiedPageMaximum = 100;
+            break;
+
+        case MmMediumSystem:
+            MmModifiedPageMaximum = 300;
+            break;
+
+        default:
+            MmModifiedPageMaximum = 800;
+            break;
+    }
+    MmModifiedPageMinimum = MmModifiedPageMaximum / 2;
+
+    /* Create the thread */
+    Status = PsCreateSystemThread(&ThreadHandle,
+                                  THREAD_ALL_ACCESS,
+                                  NULL,
+                                  NULL,
+                                  NULL,
+                                  MiModifiedPageWriter,
+                                  NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        KeBugCheck(MEMORY_MANAGEMENT);
+    }
+
+    ZwClose(ThreadHandle);
+}
+
+/* EOF */
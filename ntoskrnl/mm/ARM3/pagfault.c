@@ -647,10 +647,16 @@ MiResolveDemandZeroFault(IN PVOID Address,
     {
         /* Try to get one, if we couldn't grab a free page and zero it */
         PageFrameNumber = MiRemoveZeroPageSafe(Color);
-        if (!PageFrameNumber)
+        if (PageFrameNumber)
+        {
+            /* The zero page thread already did the work */
+            NeedZero = FALSE;
+        }
+        else
         {
             /* We'll need a free page and zero it manually */
             PageFrameNumber = MiRemoveAnyPage(Color);
+            InterlockedIncrementUL(&MmSynchronousZeroPageCount);
             NeedZero = TRUE;
         }
     }
@@ -665,8 +671,9 @@ MiResolveDemandZeroFault(IN PVOID Address,
         }
         else
         {
-            /* System wants a zero page, obtain one */
+            /* System wants a zero page, obtain one, it comes back zeroed */
             PageFrameNumber = MiRemoveZeroPage(Color);
+            NeedZero = FALSE;
         }
     }
 
@@ -801,6 +808,13 @@ MiCompleteProtoPteFault(IN BOOLEAN StoreInstruction,
         ASSERT(Pfn1->OriginalPte.u.Soft.Prototype != 0);
     }
 
+    /* Writes through this mapping won't fault, so assume the page gets modified */
+    if ((Protection & MM_READWRITE) &&
+        ((Protection & MM_WRITECOPY) != MM_WRITECOPY))
+    {
+        MiReleasePageFileCopy(Pfn1);
+    }
+
     /* Did we get a locked incoming PFN? */
     if (*LockedProtoPfn)
     {
@@ -871,11 +885,10 @@ MiResolvePageFileFault(_In_ BOOLEAN StoreInstruction,
     MMPTE TempPte = *PointerPte;
     PMMPFN Pfn1;
     ULONG PageFileIndex = TempPte.u.Soft.PageFileLow;
-    ULONG_PTR PageFileOffset = TempPte.u.Soft.PageFileHigh;
+    ULONG_PTR PageFileOffset = TempPte.u.Soft.PageFileHigh - 1;
     ULONG Protection = TempPte.u.Soft.Protection;
 
     /* Things we don't support yet */
-    ASSERT(CurrentProcess > HYDRA_PROCESS);
     ASSERT(*OldIrql != MM_NOIRQL);
 
     /* We must hold the PFN lock */
@@ -887,7 +900,10 @@ MiResolvePageFileFault(_In_ BOOLEAN StoreInstruction,
     ASSERT(TempPte.u.Soft.PageFileHigh != MI_PTE_LOOKUP_NEEDED);
 
     /* Get any page, it will be overwritten */
-    Color = MI_GET_NEXT_PROCESS_COLOR(CurrentProcess);
+    if (CurrentProcess > HYDRA_PROCESS)
+        Color = MI_GET_NEXT_PROCESS_COLOR(CurrentProcess);
+    else
+        Color = MI_GET_NEXT_COLOR();
     Page = MiRemoveAnyPage(Color);
 
     /* Initialize this PFN */
@@ -981,9 +997,12 @@ MiResolveTransitionFault(IN BOOLEAN StoreInstruction,
     /* This is from ARM3 -- Windows normally handles this here */
     ASSERT(Pfn1->u4.InPageError == 0);
 
-    /* See if we should wait before terminating the fault */
-    if ((Pfn1->u3.e1.ReadInProgress == 1)
-            || ((Pfn1->u3.e1.WriteInProgress == 1) && StoreInstruction))
+    /*
+     * See if we should wait before terminating the fault. Pages being written
+     * out by the modified page writer don't need to, a store only makes them
+     * modified again.
+     */
+    if (Pfn1->u3.e1.ReadInProgress == 1)
     {
         DPRINT1("The page is currently in a page transition !\n");
         *InPageBlock = &Pfn1->u1.Event;
@@ -1012,6 +1031,14 @@ MiResolveTransitionFault(IN BOOLEAN StoreInstruction,
         ASSERT(Pfn1->u2.ShareCount != 0);
         ASSERT(Pfn1->u3.e2.ReferenceCount != 0);
     }
+    else if (Pfn1->u3.e1.WriteInProgress == 1)
+    {
+        /* The modified page writer holds it off the lists, just add our reference */
+        DPRINT("Transition page being written out\n");
+        ASSERT(Pfn1->u3.e1.PageLocation == TransitionPage);
+        ASSERT(Pfn1->u3.e2.ReferenceCount != 0);
+        InterlockedIncrement16((PSHORT)&Pfn1->u3.e2.ReferenceCount);
+    }
     else
     {
         /* Otherwise, the page is removed from its list */
@@ -1073,6 +1100,31 @@ MiResolveTransitionFault(IN BOOLEAN StoreInstruction,
     return STATUS_PAGE_FAULT_TRANSITION;
 }
 
+static
+VOID
+MiWaitForPageRead(IN PMMPFN Pfn1,
+                  IN KIRQL OldIrql)
+{
+    PKEVENT PreviousPageEvent;
+    KEVENT CurrentPageEvent;
+
+    /* Put us into the waiting queue of the page, the reader will signal us */
+    MI_ASSERT_PFN_LOCK_HELD();
+    KeInitializeEvent(&CurrentPageEvent, NotificationEvent, FALSE);
+    PreviousPageEvent = Pfn1->u1.Event;
+    Pfn1->u1.Event = &CurrentPageEvent;
+
+    /* Release the lock and wait */
+    MiReleasePfnLock(OldIrql);
+    KeWaitForSingleObject(&CurrentPageEvent, WrPageIn, KernelMode, FALSE, NULL);
+
+    /* Let's the chain go on */
+    if (PreviousPageEvent)
+    {
+        KeSetEvent(PreviousPageEvent, IO_NO_INCREMENT, FALSE);
+    }
+}
+
 static
 NTSTATUS
 NTAPI
@@ -1238,6 +1290,38 @@ MiResolveProtoPteFault(IN BOOLEAN StoreInstruction,
     /* We might however have transition PTEs */
     if (TempPte.u.Soft.Transition == 1)
     {
+        /* The page may still be on its way in from the page file */
+        Pfn1 = MI_PFN_ELEMENT(TempPte.u.Trans.PageFrameNumber);
+        if (Pfn1->u3.e1.ReadInProgress == 1)
+        {
+            /* Wait for the read to complete, then start over */
+            MiWaitForPageRead(Pfn1, OldIrql);
+            OldIrql = MiAcquirePfnLock();
+
+            /* Somebody else may have resolved the whole fault meanwhile */
+            if (PointerPte->u.Hard.Valid == 1)
+            {
+                if (*OutPfn)
+                {
+                    MiDereferencePfnAndDropLockCount(*OutPfn);
+                    *OutPfn = NULL;
+                }
+                MiReleasePfnLock(OldIrql);
+                return STATUS_SUCCESS;
+            }
+
+            return MiResolveProtoPteFault(StoreInstruction,
+                                          Address,
+                                          PointerPte,
+                                          PointerProtoPte,
+                                          OutPfn,
+                                          PageFileData,
+                                          PteValue,
+                                          Process,
+                                          OldIrql,
+                                          TrapInformation);
+        }
+
         /* Resolve the transition fault */
         ASSERT(OldIrql != MM_NOIRQL);
         Status = MiResolveTransitionFault(StoreInstruction,
@@ -1248,11 +1332,18 @@ MiResolveProtoPteFault(IN BOOLEAN StoreInstruction,
                                           &InPageBlock);
         ASSERT(NT_SUCCESS(Status));
     }
+    else if (TempPte.u.Soft.PageFileHigh != 0)
+    {
+        /* The modified page writer wrote it out and the page got repurposed, read it back */
+        Status = MiResolvePageFileFault(StoreInstruction,
+                                        Address,
+                                        PointerProtoPte,
+                                        Process,
+                                        &OldIrql);
+        ASSERT(NT_SUCCESS(Status));
+    }
     else
     {
-        /* We also don't support paged out pages */
-        ASSERT(TempPte.u.Soft.PageFileHigh == 0);
-
         /* Resolve the demand zero fault */
         Status = MiResolveDemandZeroFault(Address,
                                           PointerProtoPte,
@@ -1399,12 +1490,12 @@ MiDispatchFault(IN ULONG FaultCode,
                     Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
                     ASSERT(Pfn1->u3.e1.PageLocation != ActiveAndValid);
 
-                    /* Should not yet happen in ReactOS */
-                    ASSERT(Pfn1->u3.e1.ReadInProgress == 0);
+                    /* A page still being read in is handled by the slow path */
+                    if (Pfn1->u3.e1.ReadInProgress == 1) break;
                     ASSERT(Pfn1->u4.InPageError == 0);
 
-                    /* Get the page */
-                    MiUnlinkPageFromList(Pfn1);
+                    /* Get the page, unless the modified page writer holds it off the lists */
+                    if (Pfn1->u3.e1.WriteInProgress == 0) MiUnlinkPageFromList(Pfn1);
 
                     /* Bump its reference count */
                     ASSERT(Pfn1->u2.ShareCount == 0);
@@ -1671,7 +1762,7 @@ MmArmAccessFault(IN ULONG FaultCode,
             (PointerPpe->u.Hard.Valid == 0) ||
 #endif
             (PointerPde->u.Hard.Valid == 0) ||
-            (PointerPte->u.Hard.Valid == 0))
+            (!(MI_IS_PAGE_LARGE(PointerPde)) && (PointerPte->u.Hard.Valid == 0)))
         {
             /* This fault is not valid, print out some debugging help */
             DbgPrint("MM:***PAGE FAULT AT IRQL > 1  Va %p, IRQL %lx\n",
@@ -1699,8 +1790,23 @@ MmArmAccessFault(IN ULONG FaultCode,
             return STATUS_IN_PAGE_ERROR | 0x10000000;
         }
 
-        /* Not yet implemented in ReactOS */
-        ASSERT(MI_IS_PAGE_LARGE(PointerPde) == FALSE);
+        /* Large pages are always resident, so only the protection can be wrong */
+        if (MI_IS_PAGE_LARGE(PointerPde))
+        {
+            if ((MI_IS_WRITE_ACCESS(FaultCode)) && !(MI_IS_PAGE_WRITEABLE(PointerPde)))
+            {
+                /* Crash with distinguished bugcheck code */
+                KeBugCheckEx(ATTEMPTED_WRITE_TO_READONLY_MEMORY,
+                             (ULONG_PTR)Address,
+                             PointerPde->u.Long,
+                             (ULONG_PTR)TrapInformation,
+                             12);
+            }
+
+            /* Nothing is actually wrong */
+            return STATUS_SUCCESS;
+        }
+
         ASSERT((!MI_IS_NOT_PRESENT_FAULT(FaultCode) && MI_IS_PAGE_COPY_ON_WRITE(PointerPte)) == FALSE);
 
         /* Check if this was a write */
@@ -1757,6 +1863,23 @@ MmArmAccessFault(IN ULONG FaultCode,
                          2);
         }
 
+        /* Large pages are always resident, so only the protection can be wrong */
+        if (MI_IS_PAGE_LARGE(PointerPde))
+        {
+            if ((MI_IS_WRITE_ACCESS(FaultCode)) && !(MI_IS_PAGE_WRITEABLE(PointerPde)))
+            {
+                /* Crash with distinguished bugcheck code */
+                KeBugCheckEx(ATTEMPTED_WRITE_TO_READONLY_MEMORY,
+                             (ULONG_PTR)Address,
+                             PointerPde->u.Long,
+                             (ULONG_PTR)TrapInformation,
+                             13);
+            }
+
+            /* This was a stale TB entry */
+            return STATUS_SUCCESS;
+        }
+
         /* Not handling session faults yet */
         IsSessionAddress = MI_IS_SESSION_ADDRESS(Address);
 
@@ -2151,6 +2274,13 @@ UserFault:
             return Status;
         }
 
+        /* Large page VADs are mapped when they are created, never on demand */
+        if ((Vad) && (Vad->u.VadFlags.VadType == VadLargePages))
+        {
+            MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
+            return STATUS_ACCESS_VIOLATION;
+        }
+
         /* Resolve a demand zero fault */
         MiResolveDemandZeroFault(PointerPte,
                                  PointerPde,
@@ -2164,10 +2294,18 @@ UserFault:
         ASSERT(KeAreAllApcsDisabled() == TRUE);
         ASSERT(PointerPde->u.Hard.Valid == 1);
     }
-    else
+    else if (MI_IS_PAGE_LARGE(PointerPde))
     {
-        /* Not yet implemented in ReactOS */
-        ASSERT(MI_IS_PAGE_LARGE(PointerPde) == FALSE);
+        /* Large pages are always resident, so only the protection can be wrong */
+        Status = STATUS_SUCCESS;
+        if (((MI_IS_WRITE_ACCESS(FaultCode)) && !(MI_IS_PAGE_WRITEABLE(PointerPde))) ||
+            ((MI_IS_INSTRUCTION_FETCH(FaultCode)) && !(MI_IS_PAGE_EXECUTABLE(PointerPde))))
+        {
+            Status = STATUS_ACCESS_VIOLATION;
+        }
+
+        MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
+        return Status;
     }
 
     /* Now capture the PTE. */
@@ -2343,6 +2481,7 @@ UserFault:
                 /* Grab a page out of there. Later we should grab a colored zero page */
                 PageFrameIndex = MiRemoveAnyPage(Color);
                 ASSERT(PageFrameIndex);
+                InterlockedIncrementUL(&MmSynchronousZeroPageCount);
 
                 /* Release the lock since we need to do some zeroing */
                 MiReleasePfnLock(OldIrql);
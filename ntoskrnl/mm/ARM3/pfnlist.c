@@ -108,7 +108,13 @@ MiDecrementAvailablePages(
     MmAvailablePages--;
     if (MmAvailablePages < MmMinimumFreePages)
     {
-        /* FIXME: Should wake up the MPW and working set manager, if we had one */
+        /* Have the modified page writer turn modified pages into standby ones */
+        if (MmModifiedPageListHead.Total)
+        {
+            KeSetEvent(&MmModifiedPageWriterEvent, 0, FALSE);
+        }
+
+        /* FIXME: Should wake up the working set manager, if we had one */
 
         DPRINT1("Running low on pages: %lu remaining\n", MmAvailablePages);
 
@@ -470,6 +476,102 @@ MiRemovePageByColor(IN PFN_NUMBER PageIndex,
     return PageIndex;
 }
 
+static
+VOID
+MiRestoreTransitionPte(IN PMMPFN Pfn1,
+                       IN MMPTE OriginalPte)
+{
+    PMMPTE PointerPte;
+    PFN_NUMBER PageTableIndex;
+    NTSTATUS Status;
+
+    /* Standby pages only back prototype PTEs, which live in paged pool */
+    PointerPte = Pfn1->PteAddress;
+    ASSERT(Pfn1->u3.e1.PrototypePte == 1);
+    ASSERT((PointerPte >= (PMMPTE)MmPagedPoolStart) && (PointerPte <= (PMMPTE)MmPagedPoolEnd));
+
+    /* Make sure the PDE gets paged in properly */
+    if (MiAddressToPte(PointerPte)->u.Hard.Valid == 0)
+    {
+        Status = MiCheckPdeForPagedPool(PointerPte);
+        if (!NT_SUCCESS(Status))
+        {
+            /* Crash */
+            KeBugCheckEx(MEMORY_MANAGEMENT,
+                         0x61941,
+                         (ULONG_PTR)PointerPte,
+                         (ULONG_PTR)MiAddressToPte(PointerPte)->u.Long,
+                         (ULONG_PTR)MiPteToAddress(PointerPte));
+        }
+    }
+
+    /* The prototype PTE should still be in transition to this page */
+    ASSERT(PointerPte->u.Hard.Valid == 0);
+    ASSERT(PointerPte->u.Soft.Transition == 1);
+    ASSERT(PointerPte->u.Trans.PageFrameNumber == MiGetPfnEntryIndex(Pfn1));
+
+    /* Point it back to the page file copy written by the modified page writer */
+    ASSERT(OriginalPte.u.Soft.Transition == 0);
+    MI_WRITE_INVALID_PTE(PointerPte, OriginalPte);
+
+    /* The page doesn't hold on to its page table anymore */
+    PageTableIndex = Pfn1->u4.PteFrame;
+    MiDecrementShareCount(MI_PFN_ELEMENT(PageTableIndex), PageTableIndex);
+}
+
+static
+VOID
+MiRepurposeStandbyPage(IN PMMPFN Pfn1)
+{
+    MMPTE OriginalPte;
+    USHORT OldColor, OldCache;
+
+    /* Only clean pages backing prototype PTEs are kept on standby */
+    ASSERT(Pfn1->u3.e1.PageLocation == StandbyPageList);
+    ASSERT(Pfn1->u3.e1.Modified == 0);
+    DPRINT("Repurposing standby page: %lx\n", MiGetPfnEntryIndex(Pfn1));
+
+    /* Unlinking the page wipes its original PTE, so capture it first */
+    OriginalPte = Pfn1->OriginalPte;
+    MiUnlinkPageFromList(Pfn1);
+
+    /* Whoever touches the prototype PTE next will have to read the page back */
+    MiRestoreTransitionPte(Pfn1, OriginalPte);
+
+    /* Zero flags but restore color and cache, like for a free page */
+    OldColor = Pfn1->u3.e1.PageColor;
+    OldCache = Pfn1->u3.e1.CacheAttribute;
+    Pfn1->u3.e2.ShortFlags = 0;
+    Pfn1->u3.e1.PageColor = OldColor;
+    Pfn1->u3.e1.CacheAttribute = OldCache;
+
+#if MI_TRACE_PFNS
+    Pfn1->PfnUsage = MI_PFN_CURRENT_USAGE;
+    memcpy(Pfn1->ProcessName, MI_PFN_CURRENT_PROCESS_NAME, 16);
+#endif
+}
+
+static
+PFN_NUMBER
+MiRemoveStandbyPage(VOID)
+{
+    PFN_NUMBER PageIndex = LIST_HEAD;
+    ULONG Priority;
+
+    /* Repurpose the oldest page of the lowest priority first */
+    for (Priority = 0; Priority < 8; Priority++)
+    {
+        ASSERT_LIST_INVARIANT(&MmStandbyPageListByPriority[Priority]);
+        PageIndex = MmStandbyPageListByPriority[Priority].Blink;
+        if (PageIndex != LIST_HEAD) break;
+    }
+
+    /* Available pages are free, zeroed or standby, so there has to be one */
+    ASSERT(PageIndex != LIST_HEAD);
+    MiRepurposeStandbyPage(MI_PFN_ELEMENT(PageIndex));
+    return PageIndex;
+}
+
 PFN_NUMBER
 NTAPI
 MiRemoveAnyPage(IN ULONG Color)
@@ -500,11 +602,11 @@ MiRemoveAnyPage(IN ULONG Color)
                 ASSERT_LIST_INVARIANT(&MmZeroedPageListHead);
                 PageIndex = MmZeroedPageListHead.Flink;
                 Color = PageIndex & MmSecondaryColorMask;
-                ASSERT(PageIndex != LIST_HEAD);
                 if (PageIndex == LIST_HEAD)
                 {
-                    /* FIXME: Should check the standby list */
+                    /* Nothing free, take a page from the standby list */
                     ASSERT(MmZeroedPageListHead.Total == 0);
+                    return MiRemoveStandbyPage();
                 }
             }
         }
@@ -560,11 +662,14 @@ MiRemoveZeroPage(IN ULONG Color)
                 ASSERT_LIST_INVARIANT(&MmFreePageListHead);
                 PageIndex = MmFreePageListHead.Flink;
                 Color = PageIndex & MmSecondaryColorMask;
-                ASSERT(PageIndex != LIST_HEAD);
                 if (PageIndex == LIST_HEAD)
                 {
-                    /* FIXME: Should check the standby list */
-                    ASSERT(MmZeroedPageListHead.Total == 0);
+                    /* Nothing free, take a page from the standby list and zero it */
+                    ASSERT(MmFreePageListHead.Total == 0);
+                    PageIndex = MiRemoveStandbyPage();
+                    InterlockedIncrementUL(&MmSynchronousZeroPageCount);
+                    MiZeroPhysicalPage(PageIndex);
+                    return PageIndex;
                 }
             }
         }
@@ -584,7 +689,19 @@ MiRemoveZeroPage(IN ULONG Color)
     ASSERT(Pfn1 == MI_PFN_ELEMENT(PageIndex));
 
     /* Zero it, if needed */
-    if (Zero) MiZeroPhysicalPage(PageIndex);
+    if (Zero)
+    {
+        InterlockedIncrementUL(&MmSynchronousZeroPageCount);
+        MiZeroPhysicalPage(PageIndex);
+    }
+
+    /* Wake up the zero page thread if this color is running low */
+    if ((MmFreePagesByColor[ZeroedPageList][Color].Count < MmZeroedPageTarget) &&
+        (MmFreePagesByColor[FreePageList][Color].Flink != LIST_HEAD) &&
+        !(MmZeroingPageThreadActive))
+    {
+        KeSetEvent(&MmZeroingPageEvent, IO_NO_INCREMENT, FALSE);
+    }
 
     /* Sanity checks */
     ASSERT(Pfn1->u3.e2.ReferenceCount == 0);
@@ -596,6 +713,183 @@ MiRemoveZeroPage(IN ULONG Color)
     return PageIndex;
 }
 
+static
+BOOLEAN
+MiIsPfnAvailable(IN PMMPFN Pfn1)
+{
+    /* Free and zeroed pages can always be taken */
+    if ((Pfn1->u1.Flink) &&
+        (Pfn1->u2.Blink) &&
+        (Pfn1->u3.e2.ReferenceCount == 0) &&
+        (Pfn1->u3.e1.Rom == 0) &&
+        (Pfn1->u3.e1.RemovalRequested == 0))
+    {
+        if (Pfn1->u3.e1.PageLocation <= FreePageList) return TRUE;
+
+        /* Standby pages can be repurposed, since their content is on disk */
+        if ((Pfn1->u3.e1.PageLocation == StandbyPageList) &&
+            (Pfn1->u3.e1.Modified == 0) &&
+            (Pfn1->u3.e1.PrototypePte == 1))
+        {
+            return TRUE;
+        }
+    }
+
+    /* Anything else is in use */
+    return FALSE;
+}
+
+PFN_NUMBER
+NTAPI
+MiAllocateLargePage(IN BOOLEAN ZeroPages)
+{
+    PFN_NUMBER Page, LastPage, RunLength;
+    ULONG i, Run;
+    PMMPFN Pfn1;
+    KIRQL OldIrql;
+    RTL_BITMAP DirtyPages;
+    ULONG DirtyBuffer[PTE_COUNT / (sizeof(ULONG) * 8)];
+    PAGED_CODE();
+
+    /* Pages that did not come from the zeroed list are tracked here */
+    RtlInitializeBitMap(&DirtyPages, DirtyBuffer, PTE_COUNT);
+
+    /* Disable APCs */
+    KeEnterGuardedRegion();
+
+    /* Loop all the physical memory blocks */
+    for (Run = 0; Run < MmPhysicalMemoryBlock->NumberOfRuns; Run++)
+    {
+        /* Large pages must be naturally aligned, so round the run inwards */
+        Page = ALIGN_UP_BY(MmPhysicalMemoryBlock->Run[Run].BasePage, PTE_COUNT);
+        LastPage = MmPhysicalMemoryBlock->Run[Run].BasePage +
+                   MmPhysicalMemoryBlock->Run[Run].PageCount;
+
+        /* Check every aligned chunk of this run */
+        while ((Page + PTE_COUNT) <= LastPage)
+        {
+            /* Scan the chunk without the PFN lock first, from the top down */
+            RunLength = PTE_COUNT;
+            Pfn1 = MI_PFN_ELEMENT(Page + PTE_COUNT - 1);
+            while ((RunLength) && (MiIsPfnAvailable(Pfn1)))
+            {
+                RunLength--;
+                Pfn1--;
+            }
+
+            /* A page is in use, so move on to the next aligned chunk */
+            if (RunLength)
+            {
+                Page += PTE_COUNT;
+                continue;
+            }
+
+            /* Now confirm the chunk under the PFN lock and take it */
+            OldIrql = MiAcquirePfnLock();
+            for (i = 0; i < PTE_COUNT; i++)
+            {
+                if (!MiIsPfnAvailable(MI_PFN_ELEMENT(Page + i))) break;
+            }
+
+            /* Something changed in the meantime, try the next chunk */
+            if (i != PTE_COUNT)
+            {
+                MiReleasePfnLock(OldIrql);
+                Page += PTE_COUNT;
+                continue;
+            }
+
+            /* Make sure there will still be enough pages for everybody else */
+            if (MmAvailablePages < (PTE_COUNT + MmMinimumFreePages))
+            {
+                MiReleasePfnLock(OldIrql);
+                KeLeaveGuardedRegion();
+                return 0;
+            }
+
+            /* Pull every page off its list */
+            RtlClearAllBits(&DirtyPages);
+            for (i = 0, Pfn1 = MI_PFN_ELEMENT(Page); i < PTE_COUNT; i++, Pfn1++)
+            {
+                MI_SET_USAGE(MI_USAGE_CONTINOUS_ALLOCATION);
+                MI_SET_PROCESS2("Large Page");
+                if (Pfn1->u3.e1.PageLocation == StandbyPageList)
+                {
+                    MiRepurposeStandbyPage(Pfn1);
+                    RtlSetBit(&DirtyPages, i);
+                }
+                else
+                {
+                    if (Pfn1->u3.e1.PageLocation == FreePageList) RtlSetBit(&DirtyPages, i);
+                    MiUnlinkFreeOrZeroedPage(Pfn1);
+                }
+
+                /* This PFN is now a used page, set it up */
+                Pfn1->u3.e2.ReferenceCount = 1;
+                Pfn1->u2.ShareCount = 1;
+                Pfn1->u3.e1.PageLocation = ActiveAndValid;
+                Pfn1->u3.e1.StartOfAllocation = 0;
+                Pfn1->u3.e1.EndOfAllocation = 0;
+                Pfn1->u3.e1.PrototypePte = 0;
+                Pfn1->u3.e1.Modified = 1;
+                Pfn1->u4.VerifierAllocation = 0;
+                Pfn1->PteAddress = (PVOID)(ULONG_PTR)0xBAADF00DBAADF00DULL;
+            }
+
+            /* Mark the first and last PFN so we can find them later */
+            MI_PFN_ELEMENT(Page)->u3.e1.StartOfAllocation = 1;
+            MI_PFN_ELEMENT(Page + PTE_COUNT - 1)->u3.e1.EndOfAllocation = 1;
+            MiReleasePfnLock(OldIrql);
+
+            /* Zero whatever didn't come from the zeroed list */
+            if (ZeroPages)
+            {
+                for (i = 0; i < PTE_COUNT; i++)
+                {
+                    if (RtlCheckBit(&DirtyPages, i)) MiZeroPhysicalPage(Page + i);
+                }
+            }
+
+            /* Enable APCs and return the first page */
+            KeLeaveGuardedRegion();
+            DPRINT("Allocated large page at PFN %lx\n", Page);
+            return Page;
+        }
+    }
+
+    /* Nothing large enough is available */
+    KeLeaveGuardedRegion();
+    return 0;
+}
+
+VOID
+NTAPI
+MiFreeLargePage(IN PFN_NUMBER PageFrameIndex)
+{
+    PMMPFN Pfn1;
+    KIRQL OldIrql;
+    ULONG i;
+
+    /* Make sure this is really what MiAllocateLargePage handed out */
+    ASSERT((PageFrameIndex & (PTE_COUNT - 1)) == 0);
+    Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
+    ASSERT(Pfn1->u3.e1.StartOfAllocation == 1);
+    ASSERT((Pfn1 + PTE_COUNT - 1)->u3.e1.EndOfAllocation == 1);
+
+    /* Release every page back to the free list */
+    OldIrql = MiAcquirePfnLock();
+    Pfn1->u3.e1.StartOfAllocation = 0;
+    (Pfn1 + PTE_COUNT - 1)->u3.e1.EndOfAllocation = 0;
+    for (i = 0; i < PTE_COUNT; i++, Pfn1++)
+    {
+        ASSERT(Pfn1->u3.e1.PageLocation == ActiveAndValid);
+        ASSERT(Pfn1->u2.ShareCount == 1);
+        MI_SET_PFN_DELETED(Pfn1);
+        MiDecrementShareCount(Pfn1, PageFrameIndex + i);
+    }
+    MiReleasePfnLock(OldIrql);
+}
+
 /* HACK for keeping legacy Mm alive */
 extern BOOLEAN MmRosNotifyAvailablePage(PFN_NUMBER PageFrameIndex);
 
@@ -700,8 +994,9 @@ MiInsertPageInFreeList(IN PFN_NUMBER PageFrameIndex)
     /* And increase the count in the colored list */
     ColorTable->Count++;
 
-    /* Notify zero page thread if enough pages are on the free list now */
-    if ((ListHead->Total >= 8) && !(MmZeroingPageThreadActive))
+    /* Notify zero page thread if this color needs more zeroed pages */
+    if ((MmFreePagesByColor[ZeroedPageList][Color].Count < MmZeroedPageTarget) &&
+        !(MmZeroingPageThreadActive))
     {
         /* Set the event */
         KeSetEvent(&MmZeroingPageEvent, IO_NO_INCREMENT, FALSE);
@@ -955,7 +1250,12 @@ MiInsertPageInList(IN PMMPFNLIST ListHead,
         /* Increment the number of per-process modified pages */
         PsGetCurrentProcess()->ModifiedPageCount++;
 
-        /* FIXME: Wake up modified page writer if there are not enough free pages */
+        /* Wake up the modified page writer if there's too much to write or not enough free pages */
+        if ((MmModifiedPageListHead.Total >= MmModifiedPageMaximum) ||
+            (MmAvailablePages < MmMinimumFreePages))
+        {
+            KeSetEvent(&MmModifiedPageWriterEvent, 0, FALSE);
+        }
     }
     else if (ListName == ModifiedNoWritePageList)
     {
@@ -50,6 +50,9 @@ MiProtectFreeNonPagedPool(IN PVOID VirtualAddress,
     LastPte = PointerPte + PageCount;
     do
     {
+        /* The free range can run into pool that is mapped by large pages */
+        if (MI_IS_PHYSICAL_ADDRESS(MiPteToAddress(PointerPte))) break;
+
         /* Capture the PTE for safety */
         TempPte = *PointerPte;
 
@@ -90,14 +93,35 @@ MiUnProtectFreeNonPagedPool(IN PVOID VirtualAddress,
         /* One more page */
         if (++UnprotectedPages == PageCount) break;
 
+        /* Pool mapped by large pages is never protected */
+        if (MI_IS_PHYSICAL_ADDRESS(MiPteToAddress(++PointerPte))) break;
+
         /* Capture next PTE */
-        TempPte = *(++PointerPte);
+        TempPte = *PointerPte;
     }
 
     /* Return if any pages were unprotected */
     return UnprotectedPages ? TRUE : FALSE;
 }
 
+FORCEINLINE
+PMMPFN
+MiGetNonPagedPoolPfn(IN PVOID VirtualAddress)
+{
+    PMMPTE PointerPte;
+
+    /* Initial pool can be mapped by large pages, which have no PTEs */
+    if (MI_IS_PHYSICAL_ADDRESS(VirtualAddress))
+    {
+        return MiGetPfnEntry(MI_CONVERT_PHYSICAL_TO_PFN(VirtualAddress));
+    }
+
+    /* Otherwise only a valid PTE maps pool, the rest are guard pages */
+    PointerPte = MiAddressToPte(VirtualAddress);
+    if (PointerPte->u.Hard.Valid == 0) return NULL;
+    return MiGetPfnEntry(PFN_FROM_PTE(PointerPte));
+}
+
 FORCEINLINE
 VOID
 MiProtectedPoolUnProtectLinks(IN PLIST_ENTRY Links,
@@ -279,6 +303,7 @@ MiInitializeNonPagedPool(VOID)
     PFN_COUNT PoolPages;
     PMMFREE_POOL_ENTRY FreeEntry, FirstEntry;
     PMMPTE PointerPte;
+    PMMPFN Pfn1;
     PAGED_CODE();
 
     //
@@ -357,9 +382,9 @@ MiInitializeNonPagedPool(VOID)
     //
     // Validate and remember first allocated pool page
     //
-    PointerPte = MiAddressToPte(MmNonPagedPoolStart);
-    ASSERT(PointerPte->u.Hard.Valid == 1);
-    MiStartOfInitialPoolFrame = PFN_FROM_PTE(PointerPte);
+    Pfn1 = MiGetNonPagedPoolPfn(MmNonPagedPoolStart);
+    ASSERT(Pfn1 != NULL);
+    MiStartOfInitialPoolFrame = MiGetPfnEntryIndex(Pfn1);
 
     //
     // Keep track of where initial nonpaged pool ends
@@ -370,9 +395,9 @@ MiInitializeNonPagedPool(VOID)
     //
     // Validate and remember last allocated pool page
     //
-    PointerPte = MiAddressToPte((PVOID)((ULONG_PTR)MmNonPagedPoolEnd0 - 1));
-    ASSERT(PointerPte->u.Hard.Valid == 1);
-    MiEndOfInitialPoolFrame = PFN_FROM_PTE(PointerPte);
+    Pfn1 = MiGetNonPagedPoolPfn((PVOID)((ULONG_PTR)MmNonPagedPoolEnd0 - 1));
+    ASSERT(Pfn1 != NULL);
+    MiEndOfInitialPoolFrame = MiGetPfnEntryIndex(Pfn1);
 
     //
     // Validate the first nonpaged pool expansion page (which is a guard page)
@@ -752,15 +777,10 @@ MiAllocatePoolPages(IN POOL_TYPE PoolType,
                 }
 
                 //
-                // Grab the PTE for this allocation
+                // Grab the PFN entry for this allocation
                 //
-                PointerPte = MiAddressToPte(BaseVa);
-                ASSERT(PointerPte->u.Hard.Valid == 1);
-
-                //
-                // Grab the PFN NextEntry and index
-                //
-                Pfn1 = MiGetPfnEntry(PFN_FROM_PTE(PointerPte));
+                Pfn1 = MiGetNonPagedPoolPfn(BaseVa);
+                ASSERT(Pfn1 != NULL);
 
                 //
                 // Now mark it as the beginning of an allocation
@@ -781,11 +801,11 @@ MiAllocatePoolPages(IN POOL_TYPE PoolType,
                 if (SizeInPages != 1)
                 {
                     //
-                    // Navigate to the last PFN entry and PTE
+                    // Navigate to the last PFN entry
                     //
-                    PointerPte += SizeInPages - 1;
-                    ASSERT(PointerPte->u.Hard.Valid == 1);
-                    Pfn1 = MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber);
+                    Pfn1 = MiGetNonPagedPoolPfn((PVOID)((ULONG_PTR)BaseVa +
+                                                        ((SizeInPages - 1) << PAGE_SHIFT)));
+                    ASSERT(Pfn1 != NULL);
                 }
 
                 //
@@ -977,7 +997,7 @@ MiFreePoolPages(IN PVOID StartingVa)
     // the S-LIST instead of freeing it
     //
     StartPte = PointerPte = MiAddressToPte(StartingVa);
-    StartPfn = Pfn1 = MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber);
+    StartPfn = Pfn1 = MiGetNonPagedPoolPfn(StartingVa);
     if ((Pfn1->u3.e1.EndOfAllocation == 1) &&
         (ExQueryDepthSList(&MiNonPagedPoolSListHead) < MiNonPagedPoolSListMaximum))
     {
@@ -994,7 +1014,7 @@ MiFreePoolPages(IN PVOID StartingVa)
         // Keep going
         //
         PointerPte++;
-        Pfn1 = MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber);
+        Pfn1 = MiGetNonPagedPoolPfn(MiPteToAddress(PointerPte));
     }
 
     //
@@ -1048,24 +1068,10 @@ MiFreePoolPages(IN PVOID StartingVa)
         //
         // Otherwise, our entire allocation must've fit within the initial non
         // paged pool, or the expansion nonpaged pool, so get the PFN entry of
-        // the next allocation
+        // the next allocation, unless we've reached the guard page that
+        // protects the end of the expansion nonpaged pool
         //
-        if (PointerPte->u.Hard.Valid == 1)
-        {
-            //
-            // It's either expansion or initial: get the PFN entry
-            //
-            Pfn1 = MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber);
-        }
-        else
-        {
-            //
-            // This means we've reached the guard page that protects the end of
-            // the expansion nonpaged pool
-            //
-            Pfn1 = NULL;
-        }
-
+        Pfn1 = MiGetNonPagedPoolPfn(MiPteToAddress(PointerPte));
     }
 
     //
@@ -1120,21 +1126,8 @@ MiFreePoolPages(IN PVOID StartingVa)
             MiUnProtectFreeNonPagedPool(MiPteToAddress(PointerPte), 0);
         }
 
-        /* Check if this is valid pool, or a guard page */
-        if (PointerPte->u.Hard.Valid == 1)
-        {
-            //
-            // It's either expansion or initial nonpaged pool, get the PFN entry
-            //
-            Pfn1 = MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber);
-        }
-        else
-        {
-            //
-            // We must've reached the guard page, so don't risk touching it
-            //
-            Pfn1 = NULL;
-        }
+        /* Get the PFN entry, or NULL if we've reached the guard page */
+        Pfn1 = MiGetNonPagedPoolPfn(MiPteToAddress(PointerPte));
     }
 
     //
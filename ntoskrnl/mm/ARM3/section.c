@@ -609,8 +609,8 @@ MiSegmentDelete(IN PSEGMENT Segment)
     PSUBSECTION Subsection;
     PMMPTE PointerPte, LastPte, PteForProto;
     PMMPFN Pfn1;
-    PFN_NUMBER PageFrameIndex;
-    MMPTE TempPte;
+    PFN_NUMBER PageFrameIndex, PageTableIndex;
+    MMPTE TempPte, OriginalPte;
     KIRQL OldIrql;
 
     /* Capture data */
@@ -680,25 +680,46 @@ MiSegmentDelete(IN PSEGMENT Segment)
                 PageFrameIndex = PFN_FROM_PTE(&TempPte);
                 Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
 
-                /* As this is a paged-backed section, nobody should reference it anymore (no cache or whatever) */
-                ASSERT(Pfn1->u3.ReferenceCount == 0);
+                /* The modified page writer may be writing it out right now */
+                if (Pfn1->u3.e1.WriteInProgress == 1)
+                {
+                    /* It will free the page and its page file copy once it's done */
+                    ASSERT(Pfn1->u3.e1.PageLocation == TransitionPage);
+                    MI_SET_PFN_DELETED(Pfn1);
+                }
+                else
+                {
+                    /* As this is a paged-backed section, nobody should reference it anymore (no cache or whatever) */
+                    ASSERT(Pfn1->u3.ReferenceCount == 0);
+
+                    /* And it should be in standby or modified list */
+                    ASSERT((Pfn1->u3.e1.PageLocation == ModifiedPageList) || (Pfn1->u3.e1.PageLocation == StandbyPageList));
 
-                /* And it should be in standby or modified list */
-                ASSERT((Pfn1->u3.e1.PageLocation == ModifiedPageList) || (Pfn1->u3.e1.PageLocation == StandbyPageList));
+                    /* Standby pages also have a copy in the page file */
+                    OriginalPte = Pfn1->OriginalPte;
+                    if (OriginalPte.u.Soft.PageFileHigh != 0)
+                    {
+                        MmFreeSwapPage(MI_GET_PAGEFILE_PTE_ENTRY(&OriginalPte));
+                    }
+
+                    /* Unlink it and put it back in free list */
+                    MiUnlinkPageFromList(Pfn1);
 
-                /* Unlink it and put it back in free list */
-                MiUnlinkPageFromList(Pfn1);
+                    /* It doesn't hold on to the page containing its prototype PTE anymore */
+                    PageTableIndex = Pfn1->u4.PteFrame;
+                    MiDecrementShareCount(MI_PFN_ELEMENT(PageTableIndex), PageTableIndex);
 
-                /* Temporarily mark this as active and make it free again */
-                Pfn1->u3.e1.PageLocation = ActiveAndValid;
-                MI_SET_PFN_DELETED(Pfn1);
+                    /* Temporarily mark this as active and make it free again */
+                    Pfn1->u3.e1.PageLocation = ActiveAndValid;
+                    MI_SET_PFN_DELETED(Pfn1);
 
-                MiInsertPageInFreeList(PageFrameIndex);
+                    MiInsertPageInFreeList(PageFrameIndex);
+                }
             }
             else if (TempPte.u.Soft.PageFileHigh != 0)
             {
-                /* Should not happen for now */
-                ASSERT(FALSE);
+                /* The page itself was repurposed, only its page file copy is left */
+                MmFreeSwapPage(MI_GET_PAGEFILE_PTE_ENTRY(&TempPte));
             }
         }
         else
@@ -1429,19 +1429,32 @@ MiFreeInitializationCode(IN PVOID InitStart,
 {
     PMMPTE PointerPte;
     PFN_NUMBER PagesFreed;
+    ULONG_PTR StartVa, EndVa;
 
-    /* Get the start PTE */
-    PointerPte = MiAddressToPte(InitStart);
-    ASSERT(MI_IS_PHYSICAL_ADDRESS(InitStart) == FALSE);
+    /* Go one page table at a time, since parts may be mapped by large pages */
+    StartVa = (ULONG_PTR)InitStart;
+    do
+    {
+        EndVa = min(StartVa | (PDE_MAPPED_VA - 1), (ULONG_PTR)InitEnd);
+
+        /* Large pages can't be broken up, so that code just stays resident */
+        if (!MI_IS_PHYSICAL_ADDRESS((PVOID)StartVa))
+        {
+            /* Get the start PTE */
+            PointerPte = MiAddressToPte(StartVa);
+
+            /*  Compute the number of pages we expect to free */
+            PagesFreed = (PFN_NUMBER)(MiAddressToPte(EndVa) - PointerPte + 1);
 
-    /*  Compute the number of pages we expect to free */
-    PagesFreed = (PFN_NUMBER)(MiAddressToPte(InitEnd) - PointerPte + 1);
+            /* Try to actually free them */
+            PagesFreed = MiDeleteSystemPageableVm(PointerPte,
+                                                  PagesFreed,
+                                                  0,
+                                                  NULL);
+        }
 
-    /* Try to actually free them */
-    PagesFreed = MiDeleteSystemPageableVm(PointerPte,
-                                          PagesFreed,
-                                          0,
-                                          NULL);
+        StartVa = EndVa + 1;
+    } while (EndVa != (ULONG_PTR)InitEnd);
 }
 
 VOID
@@ -1587,7 +1600,6 @@ MiFindInitializationCode(OUT PVOID *StartVa,
                     else
                     {
                         /* This isn't us -- go ahead and free it */
-                        ASSERT(MI_IS_PHYSICAL_ADDRESS((PVOID)InitStart) == FALSE);
                         MiFreeInitializationCode((PVOID)InitStart, (PVOID)InitEnd);
                     }
                 }
@@ -1462,6 +1462,14 @@ MiQueryAddressState(IN PVOID Va,
     ASSERT((Vad->StartingVpn <= ((ULONG_PTR)Va >> PAGE_SHIFT)) &&
            (Vad->EndingVpn >= ((ULONG_PTR)Va >> PAGE_SHIFT)));
 
+    /* Large page VADs are always mapped and committed in their entirety */
+    if (Vad->u.VadFlags.VadType == VadLargePages)
+    {
+        *NextVa = (PVOID)((Vad->EndingVpn + 1) << PAGE_SHIFT);
+        *ReturnedProtect = MmProtectToValue[Vad->u.VadFlags.Protection];
+        return MEM_COMMIT;
+    }
+
     /* Only normal VADs supported */
     ASSERT(Vad->u.VadFlags.VadType == VadNone);
 
@@ -4389,6 +4397,8 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
     PMMPTE PointerPte, LastPte;
     PMMPDE PointerPde;
     TABLE_SEARCH_RESULT Result;
+    PPFN_NUMBER LargePageFrames = NULL;
+    SIZE_T LargePageCount = 0, i;
     PAGED_CODE();
 
     /* Check for valid Zero bits */
@@ -4567,13 +4577,43 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
     }
 
     //
-    // Fail on the things we don't yet support
+    // Check if large pages can be used for this allocation
     //
     if ((AllocationType & MEM_LARGE_PAGES) == MEM_LARGE_PAGES)
     {
-        DPRINT1("MEM_LARGE_PAGES not supported\n");
-        Status = STATUS_INVALID_PARAMETER;
-        goto FailPathNoLock;
+        /* The CPU might not support them */
+        if (!MmLargePageMinimum)
+        {
+            DPRINT1("MEM_LARGE_PAGES not supported\n");
+            Status = STATUS_INVALID_PARAMETER;
+            goto FailPathNoLock;
+        }
+
+        /* Large pages can't be committed on top of an existing reservation */
+        if ((PBaseAddress) && !(AllocationType & MEM_RESERVE))
+        {
+            DPRINT1("MEM_LARGE_PAGES used without MEM_RESERVE\n");
+            Status = STATUS_INVALID_PARAMETER_5;
+            goto FailPathNoLock;
+        }
+
+        /* The address and size must be multiples of the large page size */
+        if (((ULONG_PTR)PBaseAddress & (MmLargePageMinimum - 1)) ||
+            (PRegionSize & (MmLargePageMinimum - 1)))
+        {
+            DPRINT1("MEM_LARGE_PAGES used with unaligned address or size\n");
+            Status = STATUS_INVALID_PARAMETER;
+            goto FailPathNoLock;
+        }
+
+        /* And there is no PTE to hold guard, no-access or write-combine bits */
+        if (((ProtectionMask & MM_PROTECT_ACCESS) == MM_ZERO_ACCESS) ||
+            ((ProtectionMask & MM_PROTECT_SPECIAL) > MM_NOCACHE))
+        {
+            DPRINT1("Invalid protection for MEM_LARGE_PAGES\n");
+            Status = STATUS_INVALID_PAGE_PROTECTION;
+            goto FailPathNoLock;
+        }
     }
     if ((AllocationType & MEM_PHYSICAL) == MEM_PHYSICAL)
     {
@@ -4644,6 +4684,37 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
             StartingAddress = (ULONG_PTR)PBaseAddress;
         }
 
+        //
+        // Large pages have to be physically there before the VAD is, so grab
+        // them all up front
+        //
+        if (AllocationType & MEM_LARGE_PAGES)
+        {
+            LargePageCount = PRegionSize / MmLargePageMinimum;
+            LargePageFrames = ExAllocatePoolWithTag(NonPagedPool,
+                                                    LargePageCount * sizeof(PFN_NUMBER),
+                                                    'lPmM');
+            if (LargePageFrames == NULL)
+            {
+                DPRINT1("Failed to allocate the large page array!\n");
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto FailPathNoLock;
+            }
+
+            for (i = 0; i < LargePageCount; i++)
+            {
+                LargePageFrames[i] = MiAllocateLargePage(TRUE);
+                if (!LargePageFrames[i])
+                {
+                    DPRINT1("Not enough contiguous memory for %Iu large pages\n", LargePageCount);
+                    while (i) MiFreeLargePage(LargePageFrames[--i]);
+                    ExFreePoolWithTag(LargePageFrames, 'lPmM');
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    goto FailPathNoLock;
+                }
+            }
+        }
+
         //
         // Allocate and initialize the VAD
         //
@@ -4652,7 +4723,7 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
         {
             DPRINT1("Failed to allocate a VAD!\n");
             Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto FailPathNoLock;
+            goto FailPathLargePages;
         }
 
         RtlZeroMemory(Vad, sizeof(MMVAD_LONG));
@@ -4660,6 +4731,7 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
         Vad->u.VadFlags.Protection = ProtectionMask;
         Vad->u.VadFlags.PrivateMemory = 1;
         Vad->ControlArea = NULL; // For Memory-Area hack
+        if (LargePageFrames) Vad->u.VadFlags.VadType = VadLargePages;
 
         //
         // Insert the VAD
@@ -4668,12 +4740,38 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
                                &StartingAddress,
                                PRegionSize,
                                HighestAddress,
-                               MM_VIRTMEM_GRANULARITY,
+                               LargePageFrames ? MmLargePageMinimum : MM_VIRTMEM_GRANULARITY,
                                AllocationType);
         if (!NT_SUCCESS(Status))
         {
             DPRINT1("Failed to insert the VAD!\n");
-            goto FailPathNoLock;
+            ExFreePoolWithTag(Vad, 'SdaV');
+            goto FailPathLargePages;
+        }
+
+        //
+        // Now map the large pages. The VAD could have been freed again by the
+        // time we get the address space back, in which case the pages are ours
+        // to get rid of.
+        //
+        if (LargePageFrames)
+        {
+            AddressSpace = MmGetCurrentAddressSpace();
+            MmLockAddressSpace(AddressSpace);
+            if ((Process->VmDeleted) ||
+                (MiLocateAddress((PVOID)StartingAddress) != Vad))
+            {
+                DPRINT1("Large page VAD went away before it was mapped\n");
+                MmUnlockAddressSpace(AddressSpace);
+                Status = STATUS_CONFLICTING_ADDRESSES;
+                goto FailPathLargePages;
+            }
+
+            MiLockProcessWorkingSetUnsafe(Process, CurrentThread);
+            MiMapUserLargePages(Process, Vad, LargePageFrames);
+            MiUnlockProcessWorkingSetUnsafe(Process, CurrentThread);
+            MmUnlockAddressSpace(AddressSpace);
+            ExFreePoolWithTag(LargePageFrames, 'lPmM');
         }
 
         //
@@ -5052,6 +5150,14 @@ FailPath:
                                &OldProtection);
     }
 
+FailPathLargePages:
+    if (LargePageFrames != NULL)
+    {
+        ASSERT(!NT_SUCCESS(Status));
+        for (i = 0; i < LargePageCount; i++) MiFreeLargePage(LargePageFrames[i]);
+        ExFreePoolWithTag(LargePageFrames, 'lPmM');
+    }
+
 FailPathNoLock:
     if (Attached) KeUnstackDetachProcess(&ApcState);
     if (ProcessHandle != NtCurrentProcess()) ObDereferenceObject(Process);
@@ -5266,9 +5372,23 @@ NtFreeVirtualMemory(IN HANDLE ProcessHandle,
     if (FreeType & MEM_RELEASE)
     {
         //
-        // ARM3 only supports this VAD in this path
+        // ARM3 only supports these VADs in this path
         //
-        ASSERT(Vad->u.VadFlags.VadType == VadNone);
+        ASSERT((Vad->u.VadFlags.VadType == VadNone) ||
+               (Vad->u.VadFlags.VadType == VadLargePages));
+
+        //
+        // Large pages can't be split, so they can only be released all at once
+        //
+        if ((Vad->u.VadFlags.VadType == VadLargePages) &&
+            (PRegionSize) &&
+            (((StartingAddress >> PAGE_SHIFT) != Vad->StartingVpn) ||
+             ((EndingAddress >> PAGE_SHIFT) != Vad->EndingVpn)))
+        {
+            DPRINT1("Trying to release part of a large page VAD\n");
+            Status = STATUS_FREE_VM_NOT_AT_BASE;
+            goto FailPath;
+        }
 
         //
         // Is the caller trying to remove the whole VAD, or remove only a portion
@@ -5407,7 +5527,14 @@ NtFreeVirtualMemory(IN HANDLE ProcessHandle,
         // to do that and then release the working set, since we're done messing
         // around with process pages.
         //
-        MiDeleteVirtualAddresses(StartingAddress, EndingAddress, NULL);
+        if ((Vad) && (Vad->u.VadFlags.VadType == VadLargePages))
+        {
+            MiDeleteUserLargePages(Process, Vad);
+        }
+        else
+        {
+            MiDeleteVirtualAddresses(StartingAddress, EndingAddress, NULL);
+        }
         MiUnlockProcessWorkingSetUnsafe(Process, CurrentThread);
         Status = STATUS_SUCCESS;
 
@@ -19,6 +19,18 @@
 
 BOOLEAN MmZeroingPageThreadActive;
 KEVENT MmZeroingPageEvent;
+KTIMER MiZeroingPageTimer;
+
+/* Zeroed pages kept ready per color, grown on synchronous zeroing */
+PFN_NUMBER MmZeroedPageTarget = 8;
+PFN_NUMBER MmMinimumZeroedPageTarget = 8;
+PFN_NUMBER MmMaximumZeroedPageTarget;
+
+/* Zeroed page requests which had to zero inline */
+ULONG MmSynchronousZeroPageCount;
+
+ULONG MiLastSynchronousZeroPageCount;
+ULONG MiQuietZeroingPeriods;
 
 /* PRIVATE FUNCTIONS **********************************************************/
 
@@ -32,61 +44,58 @@ NTAPI
 MiFreeInitializationCode(IN PVOID StartVa,
 IN PVOID EndVa);
 
+static
 VOID
-NTAPI
-MmZeroPageThread(VOID)
+MiAdjustZeroedPageTarget(VOID)
 {
-    PKTHREAD Thread = KeGetCurrentThread();
-    PVOID StartAddress, EndAddress;
-    PVOID WaitObjects[2];
-    KIRQL OldIrql;
-    PVOID ZeroAddress;
-    PFN_NUMBER PageIndex, FreePage;
-    PMMPFN Pfn1;
+    ULONG SynchronousCount, Misses;
 
-    /* Get the discardable sections to free them */
-    MiFindInitializationCode(&StartAddress, &EndAddress);
-    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
-    DPRINT("Free non-cache pages: %lx\n", MmAvailablePages + MiMemoryConsumers[MC_CACHE].PagesUsed);
+    /* See how many zeroed page requests had to zero inline since last time */
+    SynchronousCount = MmSynchronousZeroPageCount;
+    Misses = SynchronousCount - MiLastSynchronousZeroPageCount;
+    MiLastSynchronousZeroPageCount = SynchronousCount;
 
-    /* Set our priority to 0 */
-    Thread->BasePriority = 0;
-    KeSetPriorityThread(Thread, 0);
+    if (Misses)
+    {
+        /* Demand outran us, so keep more zeroed pages around */
+        MmZeroedPageTarget = min(MmZeroedPageTarget * 2, MmMaximumZeroedPageTarget);
+        MiQuietZeroingPeriods = 0;
+    }
+    else if (++MiQuietZeroingPeriods >= 8)
+    {
+        /* Nobody needed more for a while, let the target shrink back */
+        MmZeroedPageTarget = max(MmZeroedPageTarget - MmZeroedPageTarget / 4,
+                                 MmMinimumZeroedPageTarget);
+        MiQuietZeroingPeriods = 0;
+    }
+}
 
-    /* Setup the wait objects */
-    WaitObjects[0] = &MmZeroingPageEvent;
-//    WaitObjects[1] = &PoSystemIdleTimer; FIXME: Implement idle timer
+static
+VOID
+MiZeroFreePagesByColor(IN ULONG Color)
+{
+    KIRQL OldIrql;
+    PVOID ZeroAddress;
+    PFN_NUMBER PageIndex, FreePage, PageCount;
+    PMMPFN Pfn1, FirstPfn;
 
-    while (TRUE)
-    {
-        KeWaitForMultipleObjects(1, // 2
-                                 WaitObjects,
-                                 WaitAny,
-                                 WrFreePage,
-                                 KernelMode,
-                                 FALSE,
-                                 NULL,
-                                 NULL);
-        OldIrql = MiAcquirePfnLock();
-        MmZeroingPageThreadActive = TRUE;
+    OldIrql = MiAcquirePfnLock();
 
-        while (TRUE)
+    while ((MmFreePagesByColor[ZeroedPageList][Color].Count < MmZeroedPageTarget) &&
+           (MmFreePagesByColor[FreePageList][Color].Flink != LIST_HEAD))
+    {
+        /* Pull a batch of free pages of this color, chained for zero space */
+        FirstPfn = (PMMPFN)LIST_HEAD;
+        PageCount = 0;
+        do
         {
-            if (!MmFreePageListHead.Total)
-            {
-                MmZeroingPageThreadActive = FALSE;
-                MiReleasePfnLock(OldIrql);
-                break;
-            }
-
-            PageIndex = MmFreePageListHead.Flink;
-            ASSERT(PageIndex != LIST_HEAD);
+            PageIndex = MmFreePagesByColor[FreePageList][Color].Flink;
             Pfn1 = MiGetPfnEntry(PageIndex);
             MI_SET_USAGE(MI_USAGE_ZERO_LOOP);
             MI_SET_PROCESS2("Kernel 0 Loop");
-            FreePage = MiRemoveAnyPage(MI_GET_PAGE_COLOR(PageIndex));
+            FreePage = MiRemoveAnyPage(Color);
 
-            /* The first global free page should also be the first on its own list */
+            /* The first free page of the color should also be the one we got */
             if (FreePage != PageIndex)
             {
                 KeBugCheckEx(PFN_LIST_CORRUPT,
@@ -96,18 +105,87 @@ MmZeroPageThread(VOID)
                              0);
             }
 
-            Pfn1->u1.Flink = LIST_HEAD;
-            MiReleasePfnLock(OldIrql);
+            Pfn1->u1.Flink = (ULONG_PTR)FirstPfn;
+            FirstPfn = Pfn1;
+            PageCount++;
+        } while ((PageCount < (MI_ZERO_PTES - 1)) &&
+                 (MmFreePagesByColor[ZeroedPageList][Color].Count + PageCount < MmZeroedPageTarget) &&
+                 (MmFreePagesByColor[FreePageList][Color].Flink != LIST_HEAD));
+
+        MiReleasePfnLock(OldIrql);
+
+        /* Zero them without dragging the pages through the caches */
+        ZeroAddress = MiMapPagesInZeroSpace(FirstPfn, PageCount);
+        ASSERT(ZeroAddress);
+        KeZeroPagesFromIdleThread(ZeroAddress, (ULONG)(PageCount << PAGE_SHIFT));
+        MiUnmapPagesInZeroSpace(ZeroAddress, PageCount);
+
+        OldIrql = MiAcquirePfnLock();
+
+        /* Insert them in the zeroed list, the chain is lost as we go */
+        while (FirstPfn != (PMMPFN)LIST_HEAD)
+        {
+            Pfn1 = FirstPfn;
+            FirstPfn = (PMMPFN)Pfn1->u1.Flink;
+            MiInsertPageInList(&MmZeroedPageListHead, MiGetPfnEntryIndex(Pfn1));
+        }
+    }
+
+    MiReleasePfnLock(OldIrql);
+}
+
+VOID
+NTAPI
+MmZeroPageThread(VOID)
+{
+    PKTHREAD Thread = KeGetCurrentThread();
+    PVOID StartAddress, EndAddress;
+    PVOID WaitObjects[2];
+    LARGE_INTEGER DueTime;
+    NTSTATUS Status;
+    ULONG Color;
+
+    /* Get the discardable sections to free them */
+    MiFindInitializationCode(&StartAddress, &EndAddress);
+    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
+    DPRINT("Free non-cache pages: %lx\n", MmAvailablePages + MiMemoryConsumers[MC_CACHE].PagesUsed);
 
-            ZeroAddress = MiMapPagesInZeroSpace(Pfn1, 1);
-            ASSERT(ZeroAddress);
-            RtlZeroMemory(ZeroAddress, PAGE_SIZE);
-            MiUnmapPagesInZeroSpace(ZeroAddress, 1);
+    /* Set our priority to 0, so we only ever run when the processor is idle */
+    Thread->BasePriority = 0;
+    KeSetPriorityThread(Thread, 0);
 
-            OldIrql = MiAcquirePfnLock();
+    /* Never keep more than 1/32 of memory zeroed in advance */
+    MmMaximumZeroedPageTarget = max(MmNumberOfPhysicalPages / 32 / MmSecondaryColors,
+                                    MmMinimumZeroedPageTarget);
 
-            MiInsertPageInList(&MmZeroedPageListHead, PageIndex);
+    /* Wake up every second to fill up the zeroed lists and retune the target */
+    KeInitializeTimerEx(&MiZeroingPageTimer, SynchronizationTimer);
+    DueTime.QuadPart = -10000000LL;
+    KeSetTimerEx(&MiZeroingPageTimer, DueTime, 1000, NULL);
+
+    /* Setup the wait objects */
+    WaitObjects[0] = &MmZeroingPageEvent;
+    WaitObjects[1] = &MiZeroingPageTimer;
+
+    while (TRUE)
+    {
+        Status = KeWaitForMultipleObjects(2,
+                                          WaitObjects,
+                                          WaitAny,
+                                          WrFreePage,
+                                          KernelMode,
+                                          FALSE,
+                                          NULL,
+                                          NULL);
+        if (Status == STATUS_WAIT_1) MiAdjustZeroedPageTarget();
+
+        /* Bring every color back up to the target */
+        MmZeroingPageThreadActive = TRUE;
+        for (Color = 0; Color < MmSecondaryColors; Color++)
+        {
+            MiZeroFreePagesByColor(Color);
         }
+        MmZeroingPageThreadActive = FALSE;
     }
 }
 
@@ -271,6 +271,9 @@ MmInitSystem(IN ULONG Phase,
     /* Initialize the balance set manager */
     MmInitBsmThread();
 
+    /* Start the modified page writer */
+    MiInitializeModifiedPageWriter();
+
     return TRUE;
 }
 
@@ -107,13 +107,6 @@ static PFN_COUNT MiReservedSwapPages;
  */
 #define MM_PAGEFILE_COMMIT_GRACE      (256)
 
-/*
- * Translate between a swap entry and a file and offset pair.
- */
-#define FILE_FROM_ENTRY(i) ((i) & 0x0f)
-#define OFFSET_FROM_ENTRY(i) ((i) >> 11)
-#define ENTRY_FROM_FILE_OFFSET(i, j) ((i) | ((j) << 11) | 0x400)
-
 /* Make sure there can be only 16 paging files */
 C_ASSERT(FILE_FROM_ENTRY(0xffffffff) < MAX_PAGING_FILES);
 
@@ -275,6 +268,86 @@ MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
 }
 
 
+NTSTATUS
+NTAPI
+MmWriteToSwapCluster(SWAPENTRY SwapEntry, PPFN_NUMBER Pages, ULONG Count)
+{
+    ULONG i, Run;
+    ULONG_PTR offset;
+    LARGE_INTEGER file_offset, next_offset;
+    IO_STATUS_BLOCK Iosb;
+    NTSTATUS Status = STATUS_SUCCESS;
+    KEVENT Event;
+    UCHAR MdlBase[sizeof(MDL) + MM_MAXIMUM_SWAP_CLUSTER * sizeof(PFN_NUMBER)];
+    PMDL Mdl = (PMDL)MdlBase;
+
+    DPRINT("MmWriteToSwapCluster\n");
+
+    if (SwapEntry == 0 || Count == 0 || Count > MM_MAXIMUM_SWAP_CLUSTER)
+    {
+        KeBugCheck(MEMORY_MANAGEMENT);
+        return(STATUS_UNSUCCESSFUL);
+    }
+
+    i = FILE_FROM_ENTRY(SwapEntry);
+    offset = OFFSET_FROM_ENTRY(SwapEntry) - 1;
+
+    if (PagingFileList[i]->FileObject == NULL ||
+            PagingFileList[i]->FileObject->DeviceObject == NULL)
+    {
+        DPRINT1("Bad paging file 0x%.8X\n", SwapEntry);
+        KeBugCheck(MEMORY_MANAGEMENT);
+    }
+
+    while (Count)
+    {
+        /* The entries are consecutive in the file, but the file may be fragmented on disk */
+        file_offset.QuadPart = offset * PAGE_SIZE;
+        file_offset = MmGetOffsetPageFile(PagingFileList[i]->RetrievalPointers, file_offset);
+        for (Run = 1; Run < Count; Run++)
+        {
+            next_offset.QuadPart = (offset + Run) * PAGE_SIZE;
+            next_offset = MmGetOffsetPageFile(PagingFileList[i]->RetrievalPointers, next_offset);
+            if (next_offset.QuadPart != file_offset.QuadPart + Run * PAGE_SIZE)
+                break;
+        }
+
+        /* Write the contiguous part with a single request */
+        MmInitializeMdl(Mdl, NULL, Run * PAGE_SIZE);
+        MmBuildMdlFromPages(Mdl, Pages);
+        Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+
+        KeInitializeEvent(&Event, NotificationEvent, FALSE);
+        Status = IoSynchronousPageWrite(PagingFileList[i]->FileObject,
+                                        Mdl,
+                                        &file_offset,
+                                        &Event,
+                                        &Iosb);
+        if (Status == STATUS_PENDING)
+        {
+            KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+            Status = Iosb.Status;
+        }
+
+        if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
+        {
+            MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+        }
+
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+
+        Pages += Run;
+        offset += Run;
+        Count -= Run;
+    }
+
+    return(Status);
+}
+
+
 NTSTATUS
 NTAPI
 MmReadFromSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
@@ -299,12 +372,6 @@ MiReadPageFile(
 
     DPRINT("MiReadSwapFile\n");
 
-    if (PageFileOffset == 0)
-    {
-        KeBugCheck(MEMORY_MANAGEMENT);
-        return(STATUS_UNSUCCESSFUL);
-    }
-
     ASSERT(PageFileIndex < MAX_PAGING_FILES);
 
     PagingFile = PagingFileList[PageFileIndex];
@@ -460,6 +527,108 @@ MmAllocSwapPage(VOID)
     return(0);
 }
 
+static ULONG
+MiAllocClusterFromPagingFile(PPAGINGFILE PagingFile, PULONG Count)
+{
+    KIRQL oldIrql;
+    ULONG i, Pages, Start, Length, BestStart, BestLength;
+
+    Pages = (ULONG)(PagingFile->CurrentSize.QuadPart / PAGE_SIZE);
+    Start = 0;
+    Length = 0;
+    BestStart = 0xFFFFFFFF;
+    BestLength = 0;
+
+    KeAcquireSpinLock(&PagingFile->AllocMapLock, &oldIrql);
+
+    /* Take the first free run which is long enough, or the longest one */
+    for (i = 0; i < Pages; i++)
+    {
+        if (!(i % 32) && PagingFile->AllocMap[i >> 5] == 0xFFFFFFFF)
+        {
+            Length = 0;
+            i += 31;
+            continue;
+        }
+
+        if (PagingFile->AllocMap[i >> 5] & (1 << (i % 32)))
+        {
+            Length = 0;
+            continue;
+        }
+
+        if (Length++ == 0)
+        {
+            Start = i;
+        }
+
+        if (Length > BestLength)
+        {
+            BestStart = Start;
+            BestLength = Length;
+            if (BestLength == *Count)
+            {
+                break;
+            }
+        }
+    }
+
+    for (i = BestStart; i < BestStart + BestLength; i++)
+    {
+        PagingFile->AllocMap[i >> 5] |= (1 << (i % 32));
+    }
+    PagingFile->UsedPages += BestLength;
+    PagingFile->FreePages -= BestLength;
+
+    KeReleaseSpinLock(&PagingFile->AllocMapLock, oldIrql);
+
+    *Count = BestLength;
+    return(BestStart);
+}
+
+SWAPENTRY
+NTAPI
+MmAllocSwapCluster(IN OUT PULONG Count)
+{
+    KIRQL oldIrql;
+    ULONG i;
+    ULONG off;
+
+    ASSERT(*Count != 0);
+
+    KeAcquireSpinLock(&PagingFileListLock, &oldIrql);
+
+    if (MiFreeSwapPages == 0)
+    {
+        KeReleaseSpinLock(&PagingFileListLock, oldIrql);
+        *Count = 0;
+        return(0);
+    }
+
+    for (i = 0; i < MAX_PAGING_FILES; i++)
+    {
+        if (PagingFileList[i] != NULL &&
+                PagingFileList[i]->FreePages >= 1)
+        {
+            /* The entries have to be consecutive, so they all come from the same file */
+            off = MiAllocClusterFromPagingFile(PagingFileList[i], Count);
+            if (off == 0xFFFFFFFF)
+            {
+                KeBugCheck(MEMORY_MANAGEMENT);
+            }
+            MiUsedSwapPages += *Count;
+            MiFreeSwapPages -= *Count;
+            KeReleaseSpinLock(&PagingFileListLock, oldIrql);
+
+            return(ENTRY_FROM_FILE_OFFSET(i, off + 1));
+        }
+    }
+
+    KeReleaseSpinLock(&PagingFileListLock, oldIrql);
+    *Count = 0;
+    return(0);
+}
+
 static PRETRIEVEL_DESCRIPTOR_LIST FASTCALL
 MmAllocRetrievelDescriptorList(ULONG Pairs)
 {
@@ -1941,6 +1941,20 @@ __INTRIN_INLINE void _mm_pause(void)
 }
 #endif
 
+#if !HAS_BUILTIN(_mm_stream_si32)
+__INTRIN_INLINE void _mm_stream_si32(int *Destination, int Value)
+{
+	__asm__ __volatile__("movnti %k[Value], %[Destination]" : [Destination] "=m" (*Destination) : [Value] "r" (Value));
+}
+#endif
+
+#if defined(__x86_64__) && !HAS_BUILTIN(_mm_stream_si64x)
+__INTRIN_INLINE void _mm_stream_si64x(long long *Destination, long long Value)
+{
+	__asm__ __volatile__("movnti %q[Value], %[Destination]" : [Destination] "=m" (*Destination) : [Value] "r" (Value));
+}
+#endif
+
 __INTRIN_INLINE void __nop(void)
 {
 	__asm__ __volatile__("nop");
@@ -149,6 +149,25 @@ typedef struct _AFD_TDI_HANDLE_DATA
     HANDLE TdiConnectionHandle;
 } AFD_TDI_HANDLE_DATA, *PAFD_TDI_HANDLE_DATA;
 
+typedef struct _AFD_TRANSMIT_FILE_INFO {
+    HANDLE				FileHandle;
+    LARGE_INTEGER			Offset;
+    ULONG				WriteLength;
+    ULONG				SendPacketLength;
+    PVOID				Head;
+    ULONG				HeadLength;
+    PVOID				Tail;
+    ULONG				TailLength;
+    ULONG				Flags;
+} AFD_TRANSMIT_FILE_INFO, *PAFD_TRANSMIT_FILE_INFO;
+
+typedef struct _AFD_SUPER_ACCEPT_INFO {
+    HANDLE				AcceptHandle;
+    ULONG				ReceiveDataLength;
+    ULONG				LocalAddressLength;
+    ULONG				RemoteAddressLength;
+} AFD_SUPER_ACCEPT_INFO, *PAFD_SUPER_ACCEPT_INFO;
+
 /* AFD Packet Endpoint Flags */
 #define AFD_ENDPOINT_CONNECTIONLESS	0x1
 #define AFD_ENDPOINT_MESSAGE_ORIENTED	0x10
@@ -219,6 +238,10 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_OVERLAPPED			0x2L
 #define AFD_IMMEDIATE                   0x4L
 
+/* AFD TransmitFile Flags */
+#define AFD_TF_DISCONNECT		0x1L
+#define AFD_TF_REUSE_SOCKET		0x2L
+
 /* IOCTL Generation */
 #define FSCTL_AFD_BASE                  FILE_DEVICE_NETWORK
 #define _AFD_CONTROL_CODE(Operation,Method) \
@@ -261,6 +284,9 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_DEFER_ACCEPT		35
 #define AFD_GET_PENDING_CONNECT_DATA	41
 #define AFD_VALIDATE_GROUP		42
+#define AFD_TRANSMIT_FILE		43
+#define AFD_SUPER_ACCEPT		44
+#define AFD_SUPER_CONNECT		45
 
 /* AFD IOCTLs */
 
@@ -336,6 +362,12 @@ typedef struct _AFD_TDI_HANDLE_DATA
   _AFD_CONTROL_CODE(AFD_ENUM_NETWORK_EVENTS, METHOD_NEITHER)
 #define IOCTL_AFD_VALIDATE_GROUP \
   _AFD_CONTROL_CODE(AFD_VALIDATE_GROUP, METHOD_NEITHER)
+#define IOCTL_AFD_TRANSMIT_FILE \
+  _AFD_CONTROL_CODE(AFD_TRANSMIT_FILE, METHOD_NEITHER)
+#define IOCTL_AFD_SUPER_ACCEPT \
+  _AFD_CONTROL_CODE(AFD_SUPER_ACCEPT, METHOD_NEITHER)
+#define IOCTL_AFD_SUPER_CONNECT \
+  _AFD_CONTROL_CODE(AFD_SUPER_CONNECT, METHOD_NEITHER)
 
 typedef struct _AFD_SOCKET_INFORMATION {
     BOOL CommandChannel;
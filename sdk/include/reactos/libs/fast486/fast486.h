@@ -116,6 +116,15 @@
 C_ASSERT((FAST486_CACHE_SIZE >= sizeof(DWORD))
          && (FAST486_CACHE_SIZE <= FAST486_PAGE_SIZE));
 
+/*
+ * Decoded blocks of straight-line code are at most as long as the prefetch
+ * cache, since they are validated against it before being executed.
+ */
+#define FAST486_BLOCK_MAX_INSTRUCTIONS  16
+#define FAST486_NUM_BLOCKS              1024
+
+C_ASSERT((FAST486_NUM_BLOCKS & (FAST486_NUM_BLOCKS - 1)) == 0);
+
 struct _FAST486_STATE;
 typedef struct _FAST486_STATE FAST486_STATE, *PFAST486_STATE;
 
@@ -459,6 +468,29 @@ typedef union _FAST486_FLAGS_REG
     };
 } FAST486_FLAGS_REG, *PFAST486_FLAGS_REG;
 
+typedef enum _FAST486_LAZY_OPERATION
+{
+    FAST486_LAZY_NONE,      // The flags register is up to date
+    FAST486_LAZY_ADD,
+    FAST486_LAZY_SUB,
+    FAST486_LAZY_LOGIC,     // OR, AND, XOR and TEST; AF is kept
+    FAST486_LAZY_INC,       // Like ADD with 1, but CF is kept
+    FAST486_LAZY_DEC        // Like SUB with 1, but CF is kept
+} FAST486_LAZY_OPERATION, *PFAST486_LAZY_OPERATION;
+
+/*
+ * The last instruction that changed the arithmetic flags (CF, PF, AF, ZF, SF
+ * and OF), kept until something actually looks at them.
+ */
+typedef struct _FAST486_LAZY_FLAGS
+{
+    ULONG FirstValue;
+    ULONG SecondValue;
+    ULONG Result;
+    ULONG SignFlag;         // Highest bit of the operand size
+    FAST486_LAZY_OPERATION Operation;
+} FAST486_LAZY_FLAGS, *PFAST486_LAZY_FLAGS;
+
 typedef struct _FAST486_FPU_DATA_REG
 {
     ULONGLONG Mantissa;
@@ -511,6 +543,29 @@ typedef union _FAST486_FPU_CONTROL_REG
     };
 } FAST486_FPU_CONTROL_REG, *PFAST486_FPU_CONTROL_REG;
 
+typedef struct _FAST486_BLOCK_ENTRY
+{
+    UCHAR Opcode;
+    UCHAR PrefixFlags;
+    UCHAR SegmentOverride;
+    UCHAR OpcodeLength;     // Length of the prefixes and the opcode
+    UCHAR NextOffset;       // Offset of the next instruction in the block
+} FAST486_BLOCK_ENTRY, *PFAST486_BLOCK_ENTRY;
+
+typedef struct _FAST486_BLOCK
+{
+    ULONG Address;          // Linear address of the first instruction
+    UCHAR Length;
+    UCHAR Count;
+    UCHAR Bytes[FAST486_CACHE_SIZE];
+    FAST486_BLOCK_ENTRY Entries[FAST486_BLOCK_MAX_INSTRUCTIONS];
+} FAST486_BLOCK, *PFAST486_BLOCK;
+
+typedef struct _FAST486_BLOCK_CACHE
+{
+    FAST486_BLOCK Blocks[FAST486_NUM_BLOCKS];
+} FAST486_BLOCK_CACHE, *PFAST486_BLOCK_CACHE;
+
 struct _FAST486_STATE
 {
     FAST486_MEM_READ_PROC MemReadCallback;
@@ -525,6 +580,7 @@ struct _FAST486_STATE
     FAST486_REG InstPtr, SavedInstPtr;
     FAST486_REG SavedStackPtr;
     FAST486_FLAGS_REG Flags;
+    FAST486_LAZY_FLAGS LazyFlags;
     FAST486_TABLE_REG Gdtr, Idtr;
     FAST486_LDT_REG Ldtr;
     FAST486_TASK_REG TaskReg;
@@ -543,7 +599,10 @@ struct _FAST486_STATE
     BOOLEAN PrefetchValid;
     ULONG PrefetchAddress;
     UCHAR PrefetchCache[FAST486_CACHE_SIZE];
+    BOOLEAN PrefetchModified;
+    PFAST486_BLOCK_CACHE BlockCache;
 #endif
+    BOOLEAN BopExecuted;
 #ifndef FAST486_NO_FPU
     FAST486_FPU_DATA_REG FpuRegisters[FAST486_NUM_FPU_REGS];
     FAST486_FPU_STATUS_REG FpuStatus;
@@ -568,7 +627,8 @@ Fast486Initialize(PFAST486_STATE         State,
                   FAST486_BOP_PROC       BopCallback,
                   FAST486_INT_ACK_PROC   IntAckCallback,
                   FAST486_FPU_PROC       FpuCallback,
-                  PULONG                 Tlb);
+                  PULONG                 Tlb,
+                  PFAST486_BLOCK_CACHE   BlockCache);
 
 VOID
 NTAPI
@@ -582,6 +642,10 @@ VOID
 NTAPI
 Fast486StepInto(PFAST486_STATE State);
 
+ULONG
+NTAPI
+Fast486Run(PFAST486_STATE State, ULONG Count);
+
 VOID
 NTAPI
 Fast486StepOver(PFAST486_STATE State);
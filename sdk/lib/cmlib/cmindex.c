@@ -645,17 +645,15 @@ static HCELL_INDEX
 NTAPI
 CmpFindSubKeyByHash(IN PHHIVE Hive,
                     IN PCM_KEY_FAST_INDEX FastIndex,
-                    IN PCUNICODE_STRING SearchName)
+                    IN PCUNICODE_STRING SearchName,
+                    IN ULONG HashKey)
 {
-    ULONG HashKey, i;
+    ULONG i;
     PCM_INDEX FastEntry;
 
     /* Make sure it's really a hash */
     ASSERT(FastIndex->Signature == CM_KEY_HASH_LEAF);
 
-    /* Compute the hash key for the name */
-    HashKey = CmpComputeHashKey(0, SearchName, FALSE);
-
     /* Loop all the entries */
     for (i = 0; i < FastIndex->Count; i++)
     {
@@ -687,7 +685,8 @@ CmpFindSubKeyByName(IN PHHIVE Hive,
     ULONG i;
     PCM_KEY_INDEX IndexRoot;
     HCELL_INDEX SubKey, CellToRelease;
-    ULONG Found;
+    ULONG Found, HashKey = 0;
+    BOOLEAN HashComputed = FALSE;
 
     /* Loop each storage type */
     for (i = 0; i < Hive->StorageTypeCount; i++)
@@ -747,10 +746,18 @@ CmpFindSubKeyByName(IN PHHIVE Hive,
             }
             else
             {
+                /* Compute the hash key only once for all the leaves */
+                if (!HashComputed)
+                {
+                    HashKey = CmpComputeHashKey(0, SearchName, FALSE);
+                    HashComputed = TRUE;
+                }
+
                 /* Find the subkey in the hash */
                 SubKey = CmpFindSubKeyByHash(Hive,
                                              (PCM_KEY_FAST_INDEX)IndexRoot,
-                                             SearchName);
+                                             SearchName,
+                                             HashKey);
 
                 /* Release the previous cell */
                 ASSERT(CellToRelease != HCELL_NIL);
@@ -1131,20 +1138,22 @@ CmpSplitLeaf(IN PHHIVE Hive,
     FirstHalf = (LeafKey->Count / 2);
     LastHalf = LeafKey->Count - FirstHalf;
 
-    /* Now check what kind of hive we're dealing with,
+    /* Now check what kind of leaf we're dealing with,
      * and compute entry size
      */
-    if (Hive->Version >= 5)
+    if (LeafKey->Signature == CM_KEY_INDEX_LEAF)
     {
-        /* XP Hive: Use hash leaf */
-        ASSERT(LeafKey->Signature == CM_KEY_HASH_LEAF);
-        EntrySize = sizeof(CM_INDEX);
+        /* Old-style leaf from an older hive: use index entries */
+        FastLeaf = NULL;
+        EntrySize = sizeof(HCELL_INDEX);
     }
     else
     {
-        /* Use index leaf */
-        ASSERT(LeafKey->Signature == CM_KEY_INDEX_LEAF);
-        EntrySize = sizeof(HCELL_INDEX);
+        /* Fast or hash leaf: use fast index entries */
+        ASSERT((LeafKey->Signature == CM_KEY_FAST_LEAF) ||
+               (LeafKey->Signature == CM_KEY_HASH_LEAF));
+        FastLeaf = (PCM_KEY_FAST_INDEX)LeafKey;
+        EntrySize = sizeof(CM_INDEX);
     }
 
     /* Compute the total size */
@@ -1173,17 +1182,8 @@ CmpSplitLeaf(IN PHHIVE Hive,
     /* Release the newly created cell */
     HvReleaseCell(Hive, NewCell);
 
-    /* Set its signature according to the version of the hive */
-    if (Hive->Version >= 5)
-    {
-        /* XP Hive: Use hash leaf signature */
-        NewKey->Signature = CM_KEY_HASH_LEAF;
-    }
-    else
-    {
-        /* Use index leaf signature */
-        NewKey->Signature = CM_KEY_INDEX_LEAF;
-    }
+    /* The new leaf holds the same kind of entries as the one we split */
+    NewKey->Signature = LeafKey->Signature;
 
     /* Calculate the size of the free entries in the root key */
     TotalSize = HvGetCellSize(Hive, IndexKey) -
@@ -1216,12 +1216,11 @@ CmpSplitLeaf(IN PHHIVE Hive,
     }
 
     /* Splitting is done, now we need to copy the contents,
-     * according to the hive version
+     * according to the leaf type
      */
-    if (Hive->Version >= 5)
+    if (FastLeaf)
     {
         /* Copy the fast indexes */
-        FastLeaf = (PCM_KEY_FAST_INDEX)LeafKey;
         RtlMoveMemory(&NewKey->List[0],
                       &FastLeaf->List[FirstHalf],
                       LastHalf * EntrySize);
@@ -1462,6 +1461,91 @@ CmpSelectLeaf(IN PHHIVE Hive,
     return HCELL_NIL;
 }
 
+static BOOLEAN
+NTAPI
+CmpConvertFastLeafToHashLeaf(IN PHHIVE Hive,
+                             IN HCELL_INDEX IndexCell,
+                             IN PCM_KEY_FAST_INDEX FastIndex)
+{
+    PCM_KEY_NODE Node;
+    UNICODE_STRING Name;
+    HCELL_INDEX Cell;
+    PULONG HashKeys;
+    ULONG i;
+
+    /* Make sure it's really a fast leaf */
+    ASSERT(FastIndex->Signature == CM_KEY_FAST_LEAF);
+
+    /*
+     * Compute all the hashes aside first, so that the leaf is left untouched
+     * if we fail to get any of the key nodes.
+     */
+    HashKeys = Hive->Allocate(FastIndex->Count * sizeof(ULONG) + sizeof(ULONG),
+                              FALSE,
+                              TAG_CM);
+    if (!HashKeys) return FALSE;
+
+    /* Loop all the entries, the hash key takes the place of the name hint */
+    for (i = 0; i < FastIndex->Count; i++)
+    {
+        /* Get the key node of this entry */
+        Cell = FastIndex->List[i].Cell;
+        Node = (PCM_KEY_NODE)HvGetCell(Hive, Cell);
+        if (!Node) goto Fail;
+
+        /* Check if the name is compressed */
+        if (Node->Flags & KEY_COMP_NAME)
+        {
+            /* Build a Unicode copy of the compressed name */
+            Name.Length = CmpCompressedNameSize(Node->Name, Node->NameLength);
+            Name.MaximumLength = Name.Length;
+            Name.Buffer = Hive->Allocate(Name.Length, TRUE, TAG_CM);
+            if (!Name.Buffer)
+            {
+                /* Release the cell and fail */
+                HvReleaseCell(Hive, Cell);
+                goto Fail;
+            }
+
+            /* Copy the compressed name and hash it */
+            CmpCopyCompressedName(Name.Buffer,
+                                  Name.MaximumLength,
+                                  Node->Name,
+                                  Node->NameLength);
+            HashKeys[i] = CmpComputeHashKey(0, &Name, FALSE);
+            Hive->Free(Name.Buffer, 0);
+        }
+        else
+        {
+            /* Hash the Unicode name directly */
+            Name.Length = Node->NameLength;
+            Name.MaximumLength = Node->NameLength;
+            Name.Buffer = &Node->Name[0];
+            HashKeys[i] = CmpComputeHashKey(0, &Name, FALSE);
+        }
+
+        /* Release the key node */
+        HvReleaseCell(Hive, Cell);
+    }
+
+    /* Everything was hashed, now the leaf can be changed */
+    if (!HvMarkCellDirty(Hive, IndexCell, FALSE)) goto Fail;
+
+    /* Commit the hashes, so that this is now a hash leaf */
+    for (i = 0; i < FastIndex->Count; i++)
+    {
+        FastIndex->List[i].HashKey = HashKeys[i];
+    }
+    FastIndex->Signature = CM_KEY_HASH_LEAF;
+
+    Hive->Free(HashKeys, 0);
+    return TRUE;
+
+Fail:
+    Hive->Free(HashKeys, 0);
+    return FALSE;
+}
+
 BOOLEAN
 NTAPI
 CmpAddSubKey(IN PHHIVE Hive,
@@ -1554,7 +1638,7 @@ CmpAddSubKey(IN PHHIVE Hive,
         }
 
         /* Now check what kind of hive we're dealing with */
-        if (Hive->Version >= 5)
+        if (Hive->Version >= HSYS_WHISTLER)
         {
             /* XP Hive: Use hash leaf */
             Index->Signature = CM_KEY_HASH_LEAF;
@@ -1587,6 +1671,29 @@ CmpAddSubKey(IN PHHIVE Hive,
         /* Remember to release the cell later */
         CellToRelease = KeyNode->SubKeyLists[Type];
 
+        /*
+         * A fast leaf in an XP hive can be hashed in place. Older hives must
+         * keep their fast leaves: raising their version would also turn on
+         * big value cells, which we don't support.
+         */
+        if ((Index->Signature == CM_KEY_FAST_LEAF) &&
+            (Hive->Version >= HSYS_WHISTLER))
+        {
+            DPRINT("Doing Fast->Hash Leaf conversion\n");
+
+            /* Convert it in place, the entries have the same size */
+            if (!CmpConvertFastLeafToHashLeaf(Hive,
+                                              CellToRelease,
+                                              (PCM_KEY_FAST_INDEX)Index))
+            {
+                /* The leaf is unchanged, nothing was added yet */
+                if (IsCompressed) Hive->Free(Name.Buffer, 0);
+                HvReleaseCell(Hive, CellToRelease);
+                HvReleaseCell(Hive, Parent);
+                return FALSE;
+            }
+        }
+
         /* Check if this is a fast leaf that's gotten too full */
         if ((Index->Signature == CM_KEY_FAST_LEAF) &&
             (Index->Count >= CmpMaxFastIndexPerHblock))
@@ -444,6 +444,10 @@ BOOLEAN CMAPI
 HvSyncHive(
    PHHIVE RegistryHive);
 
+BOOLEAN CMAPI
+HvSyncHiveLog(
+   PHHIVE RegistryHive);
+
 BOOLEAN CMAPI
 HvWriteHive(
    PHHIVE RegistryHive);
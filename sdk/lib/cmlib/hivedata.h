@@ -45,6 +45,7 @@
 #define HV_LOG_HEADER_SIZE              FIELD_OFFSET(HBASE_BLOCK, Reserved2)
 #define HV_SIGNATURE                    0x66676572  // "regf"
 #define HV_BIN_SIGNATURE                0x6e696268  // "hbin"
+#define HV_LOG_DIRT_SIGNATURE           0x54524944  // "DIRT"
 
 //
 // Hive versions
@@ -320,6 +321,9 @@ typedef struct _HHIVE
     ULONG StorageTypeCount;
     ULONG Version;
     DUAL Storage[HTYPE_COUNT];
+
+    /* ReactOS-specific: DirtyCount when the log file was last written */
+    ULONG LoggedDirtyCount;
 } HHIVE, *PHHIVE;
 
 #define IsFreeCell(Cell)    ((Cell)->Size >= 0)
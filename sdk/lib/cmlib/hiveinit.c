@@ -411,6 +411,130 @@ HvpGetHiveHeader(IN PHHIVE Hive,
     return HiveSuccess;
 }
 
+/**
+ * @name HvpRecoverFromLog
+ *
+ * Internal function to replay the log file of a hive into its primary file,
+ * when the log was completely written after the last complete write of the
+ * primary file. HvSyncHiveLog leaves a hive in that state on purpose, an
+ * interrupted HvSyncHive by accident.
+ */
+static VOID CMAPI
+HvpRecoverFromLog(
+    IN PHHIVE Hive)
+{
+    PHBASE_BLOCK LogBlock;
+    PHBASE_BLOCK BaseBlock = NULL;
+    PUCHAR Buffer = NULL;
+    RTL_BITMAP DirtyVector;
+    ULONG BlockCount;
+    ULONG BitmapSize;
+    ULONG BufferSize;
+    ULONG BlockIndex;
+    ULONG LastIndex;
+    ULONG LogOffset;
+    ULONG Offset;
+
+    LogBlock = HvpAllocBaseBlockAligned(Hive, TRUE, TAG_CM);
+    if (!LogBlock) return;
+
+    /* Check for a complete log */
+    Offset = 0;
+    if (!Hive->FileRead(Hive, HFILE_TYPE_LOG, &Offset, LogBlock, HBLOCK_SIZE) ||
+        LogBlock->Signature != HV_SIGNATURE ||
+        LogBlock->Type != HFILE_TYPE_LOG ||
+        LogBlock->Sequence1 != LogBlock->Sequence2 ||
+        LogBlock->CheckSum != HvpHiveHeaderChecksum(LogBlock) ||
+        (LogBlock->Length % HBLOCK_SIZE) != 0)
+    {
+        goto Quit;
+    }
+
+    /* Check whether the primary file already is more recent than the log */
+    BaseBlock = HvpAllocBaseBlockAligned(Hive, TRUE, TAG_CM);
+    if (!BaseBlock) goto Quit;
+    RtlZeroMemory(BaseBlock, sizeof(HBASE_BLOCK));
+
+    Offset = 0;
+    if (Hive->FileRead(Hive, HFILE_TYPE_PRIMARY, &Offset, BaseBlock,
+                       Hive->Cluster * HSECTOR_SIZE) &&
+        HvpVerifyHiveHeader(BaseBlock) &&
+        BaseBlock->Sequence1 >= LogBlock->Sequence1)
+    {
+        goto Quit;
+    }
+
+    /* Read the dirty block bitmap that follows the log header */
+    BlockCount = LogBlock->Length / HBLOCK_SIZE;
+    BitmapSize = ROUND_UP(BlockCount, sizeof(ULONG) * 8) / 8;
+    BufferSize = ROUND_UP(HV_LOG_HEADER_SIZE + sizeof(ULONG) + BitmapSize,
+                          HBLOCK_SIZE);
+    Buffer = Hive->Allocate(BufferSize, TRUE, TAG_CM);
+    if (!Buffer) goto Quit;
+
+    Offset = 0;
+    if (!Hive->FileRead(Hive, HFILE_TYPE_LOG, &Offset, Buffer, BufferSize) ||
+        *(PULONG)(Buffer + HV_LOG_HEADER_SIZE) != HV_LOG_DIRT_SIGNATURE)
+    {
+        goto Quit;
+    }
+
+    DPRINT1("Replaying the log file of a hive\n");
+
+    RtlInitializeBitMap(&DirtyVector,
+                        (PULONG)(Buffer + HV_LOG_HEADER_SIZE + sizeof(ULONG)),
+                        BlockCount);
+
+    /* Copy the dirty blocks, stored one after the other, to their place */
+    LogOffset = BufferSize;
+    BlockIndex = 0;
+    while (BlockIndex < BlockCount)
+    {
+        LastIndex = BlockIndex;
+        BlockIndex = RtlFindSetBits(&DirtyVector, 1, BlockIndex);
+        if (BlockIndex == ~0U || BlockIndex < LastIndex)
+        {
+            break;
+        }
+
+        if (!Hive->FileRead(Hive, HFILE_TYPE_LOG, &LogOffset,
+                            BaseBlock, HBLOCK_SIZE))
+        {
+            goto Quit;
+        }
+
+        Offset = (BlockIndex + 1) * HBLOCK_SIZE;
+        if (!Hive->FileWrite(Hive, HFILE_TYPE_PRIMARY, &Offset,
+                             BaseBlock, HBLOCK_SIZE))
+        {
+            goto Quit;
+        }
+
+        LogOffset += HBLOCK_SIZE;
+        BlockIndex++;
+    }
+
+    Hive->FileFlush(Hive, HFILE_TYPE_PRIMARY, NULL, 0);
+
+    /* Only now write the base block, it makes the primary file valid again */
+    RtlZeroMemory(BaseBlock, sizeof(HBASE_BLOCK));
+    RtlCopyMemory(BaseBlock, LogBlock, HV_LOG_HEADER_SIZE);
+    BaseBlock->Type = HFILE_TYPE_PRIMARY;
+    BaseBlock->CheckSum = HvpHiveHeaderChecksum(BaseBlock);
+
+    Offset = 0;
+    if (Hive->FileWrite(Hive, HFILE_TYPE_PRIMARY, &Offset,
+                        BaseBlock, sizeof(HBASE_BLOCK)))
+    {
+        Hive->FileFlush(Hive, HFILE_TYPE_PRIMARY, NULL, 0);
+    }
+
+Quit:
+    if (Buffer) Hive->Free(Buffer, 0);
+    if (BaseBlock) Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+    Hive->Free(LogBlock, Hive->BaseBlockAlloc);
+}
+
 NTSTATUS CMAPI
 HvLoadHive(IN PHHIVE Hive,
            IN PCUNICODE_STRING FileName OPTIONAL)
@@ -423,6 +547,10 @@ HvLoadHive(IN PHHIVE Hive,
     PVOID HiveData;
     ULONG FileSize;
 
+    /* Bring the primary file up to date with the log first */
+    if (Hive->Log)
+        HvpRecoverFromLog(Hive);
+
     /* Get the hive header */
     Result = HvpGetHiveHeader(Hive, &BaseBlock, &TimeStamp);
     switch (Result)
@@ -488,6 +616,172 @@ HvLoadHive(IN PHHIVE Hive,
     return Status;
 }
 
+/**
+ * @name HvpMapHive
+ *
+ * Internal helper function to initialize hive descriptor structure for
+ * a hive file. Each stable bin is read from the file straight into its
+ * own allocation, so the file is never held in memory twice.
+ *
+ * @see HvInitialize
+ */
+NTSTATUS CMAPI
+HvpMapHive(IN PHHIVE Hive,
+           IN PCUNICODE_STRING FileName OPTIONAL)
+{
+    NTSTATUS Status;
+    PHBASE_BLOCK BaseBlock = NULL;
+    ULONG Result;
+    LARGE_INTEGER TimeStamp;
+    ULONG Offset;
+    HBIN BinHeader;
+    PHBIN Bin;
+    ULONG BlockCount;
+    ULONG BlockIndex;
+    ULONG BitmapSize;
+    PULONG BitmapBuffer;
+    ULONG i;
+
+    /* Bring the primary file up to date with the log first */
+    if (Hive->Log)
+        HvpRecoverFromLog(Hive);
+
+    /* Get the hive header */
+    Result = HvpGetHiveHeader(Hive, &BaseBlock, &TimeStamp);
+    switch (Result)
+    {
+        /* Out of memory */
+        case NoMemory:
+
+            /* Fail */
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        /* Not a hive */
+        case NotHive:
+
+            /* Fail */
+            return STATUS_NOT_REGISTRY_FILE;
+
+        /* Has recovery data */
+        case RecoverData:
+        case RecoverHeader:
+
+            /* Fail */
+            return STATUS_REGISTRY_CORRUPT;
+    }
+
+    if ((BaseBlock->Length % HBLOCK_SIZE) != 0)
+    {
+        DPRINT1("Registry is corrupt: hive length 0x%x\n", BaseBlock->Length);
+        Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+        return STATUS_REGISTRY_CORRUPT;
+    }
+
+    /* Set default boot type */
+    BaseBlock->BootType = 0;
+
+    /* Setup hive data */
+    Hive->BaseBlock = BaseBlock;
+    Hive->Version = BaseBlock->Minor;
+
+    BlockCount = BaseBlock->Length / HBLOCK_SIZE;
+    Hive->Storage[Stable].BlockList =
+        Hive->Allocate(BlockCount * sizeof(HMAP_ENTRY), FALSE, TAG_CM);
+    if (Hive->Storage[Stable].BlockList == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Quit;
+    }
+    RtlZeroMemory(Hive->Storage[Stable].BlockList, BlockCount * sizeof(HMAP_ENTRY));
+    Hive->Storage[Stable].Length = BlockCount;
+
+    /*
+     * Read the bins one by one. The whole hive is in memory before it goes
+     * live, so cell accesses never have to go to the file and never fail.
+     */
+    for (BlockIndex = 0; BlockIndex < BlockCount; )
+    {
+        Offset = (BlockIndex + 1) * HBLOCK_SIZE;
+        if (!Hive->FileRead(Hive,
+                            HFILE_TYPE_PRIMARY,
+                            &Offset,
+                            &BinHeader,
+                            sizeof(BinHeader)))
+        {
+            Status = STATUS_NOT_REGISTRY_FILE;
+            goto Quit;
+        }
+
+        if (BinHeader.Signature != HV_BIN_SIGNATURE ||
+            BinHeader.Size == 0 ||
+            (BinHeader.Size % HBLOCK_SIZE) != 0 ||
+            BinHeader.Size / HBLOCK_SIZE > BlockCount - BlockIndex ||
+            BinHeader.FileOffset != BlockIndex * HBLOCK_SIZE)
+        {
+            DPRINT1("Invalid bin at BlockIndex %lu, Signature 0x%x, Size 0x%x\n",
+                    (unsigned long)BlockIndex, (unsigned)BinHeader.Signature, (unsigned)BinHeader.Size);
+            Status = STATUS_REGISTRY_CORRUPT;
+            goto Quit;
+        }
+
+        Bin = Hive->Allocate(BinHeader.Size, TRUE, TAG_CM);
+        if (Bin == NULL)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Quit;
+        }
+
+        Offset = (BlockIndex + 1) * HBLOCK_SIZE;
+        if (!Hive->FileRead(Hive,
+                            HFILE_TYPE_PRIMARY,
+                            &Offset,
+                            Bin,
+                            BinHeader.Size))
+        {
+            Hive->Free(Bin, 0);
+            Status = STATUS_NOT_REGISTRY_FILE;
+            goto Quit;
+        }
+
+        for (i = 0; i < BinHeader.Size / HBLOCK_SIZE; i++)
+        {
+            Hive->Storage[Stable].BlockList[BlockIndex + i].BinAddress = (ULONG_PTR)Bin;
+            Hive->Storage[Stable].BlockList[BlockIndex + i].BlockAddress =
+                ((ULONG_PTR)Bin + (i * HBLOCK_SIZE));
+        }
+
+        BlockIndex += BinHeader.Size / HBLOCK_SIZE;
+    }
+
+    Status = HvpCreateHiveFreeCellList(Hive);
+    if (!NT_SUCCESS(Status))
+        goto Quit;
+
+    BitmapSize = ROUND_UP(BlockCount, sizeof(ULONG) * 8) / 8;
+    BitmapBuffer = (PULONG)Hive->Allocate(BitmapSize, TRUE, TAG_CM);
+    if (BitmapBuffer == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Quit;
+    }
+
+    RtlInitializeBitMap(&Hive->DirtyVector, BitmapBuffer, BitmapSize * 8);
+    RtlClearAllBits(&Hive->DirtyVector);
+
+    HvpInitFileName(Hive->BaseBlock, FileName);
+
+    return STATUS_SUCCESS;
+
+Quit:
+    if (Hive->Storage[Stable].BlockList)
+        HvpFreeHiveBins(Hive);
+    Hive->Storage[Stable].BlockList = NULL;
+    Hive->Storage[Stable].Length = 0;
+    Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+    Hive->BaseBlock = NULL;
+    return Status;
+}
+
 /**
  * @name HvInitialize
  *
@@ -588,12 +882,18 @@ HvInitialize(
             break;
         }
 
+        case HINIT_MAPFILE:
+        {
+            Status = HvpMapHive(Hive, FileName);
+            if (!NT_SUCCESS(Status))
+                return Status;
+            break;
+        }
+
         case HINIT_MEMORY_INPLACE:
             // Status = HvpInitializeMemoryInplaceHive(Hive, HiveData);
             // break;
 
-        case HINIT_MAPFILE:
-
         default:
         /* FIXME: A better return status value is needed */
         Status = STATUS_NOT_IMPLEMENTED;
@@ -9,6 +9,108 @@
 #define NDEBUG
 #include <debug.h>
 
+/* Dirty blocks are gathered into writes of up to this size */
+#define HV_WRITE_BUFFER_SIZE    (16 * HBLOCK_SIZE)
+
+/*
+ * Write the stable blocks of a hive, or only its dirty ones, to the given
+ * file. Blocks that follow each other in the file are gathered into large
+ * sequential writes. If FileOffset is NULL each block goes to its place in
+ * the primary file, otherwise the blocks are packed from *FileOffset on,
+ * which is updated, as the log file expects them.
+ */
+static BOOLEAN CMAPI
+HvpWriteBlocks(
+    PHHIVE RegistryHive,
+    ULONG FileType,
+    PULONG FileOffset OPTIONAL,
+    BOOLEAN OnlyDirty)
+{
+    PUCHAR Buffer;
+    ULONG BufferOffset = 0;
+    ULONG BufferLength = 0;
+    ULONG BufferSize;
+    ULONG BlockOffset;
+    ULONG BlockIndex;
+    ULONG LastIndex;
+    PVOID BlockPtr;
+    BOOLEAN Success = TRUE;
+
+    /* Without a gather buffer, write the blocks one at a time */
+    Buffer = RegistryHive->Allocate(HV_WRITE_BUFFER_SIZE, TRUE, TAG_CM);
+    BufferSize = Buffer ? HV_WRITE_BUFFER_SIZE : HBLOCK_SIZE;
+
+    BlockIndex = 0;
+    while (BlockIndex < RegistryHive->Storage[Stable].Length)
+    {
+        if (OnlyDirty)
+        {
+            LastIndex = BlockIndex;
+            BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
+            if (BlockIndex == ~0U || BlockIndex < LastIndex)
+            {
+                break;
+            }
+        }
+
+        BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
+
+        if (FileOffset)
+        {
+            BlockOffset = *FileOffset;
+            *FileOffset += HBLOCK_SIZE;
+        }
+        else
+        {
+            BlockOffset = (BlockIndex + 1) * HBLOCK_SIZE;
+        }
+
+        /* Write out what was gathered if this block does not follow it */
+        if (BufferLength != 0 &&
+            (BlockOffset != BufferOffset + BufferLength ||
+             BufferLength == BufferSize))
+        {
+            Success = RegistryHive->FileWrite(RegistryHive, FileType,
+                                              &BufferOffset, Buffer,
+                                              BufferLength);
+            if (!Success)
+                break;
+            BufferLength = 0;
+        }
+
+        if (BufferLength == 0)
+            BufferOffset = BlockOffset;
+
+        if (Buffer)
+        {
+            RtlCopyMemory(Buffer + BufferLength, BlockPtr, HBLOCK_SIZE);
+            BufferLength += HBLOCK_SIZE;
+        }
+        else
+        {
+            Success = RegistryHive->FileWrite(RegistryHive, FileType,
+                                              &BufferOffset, BlockPtr,
+                                              HBLOCK_SIZE);
+            if (!Success)
+                break;
+        }
+
+        BlockIndex++;
+    }
+
+    if (Success && BufferLength != 0)
+    {
+        Success = RegistryHive->FileWrite(RegistryHive, FileType,
+                                          &BufferOffset, Buffer,
+                                          BufferLength);
+    }
+
+    if (Buffer)
+        RegistryHive->Free(Buffer, 0);
+
+    return Success;
+}
+
 static BOOLEAN CMAPI
 HvpWriteLog(
     PHHIVE RegistryHive)
@@ -18,17 +120,13 @@ HvpWriteLog(
     UINT32 BitmapSize;
     PUCHAR Buffer;
     PUCHAR Ptr;
-    ULONG BlockIndex;
-    ULONG LastIndex;
-    PVOID BlockPtr;
     BOOLEAN Success;
-    static ULONG PrintCount = 0;
 
-    if (PrintCount++ == 0)
+    /* Nothing to do for hives without a log file */
+    if (!RegistryHive->Log)
     {
-        UNIMPLEMENTED;
+        return TRUE;
     }
-    return TRUE;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
     ASSERT(RegistryHive->BaseBlock->Length ==
@@ -42,7 +140,7 @@ HvpWriteLog(
         return FALSE;
     }
 
-    BitmapSize = RegistryHive->DirtyVector.SizeOfBitMap;
+    BitmapSize = RegistryHive->DirtyVector.SizeOfBitMap / 8;
     BufferSize = HV_LOG_HEADER_SIZE + sizeof(ULONG) + BitmapSize;
     BufferSize = ROUND_UP(BufferSize, HBLOCK_SIZE);
 
@@ -53,6 +151,7 @@ HvpWriteLog(
     {
         return FALSE;
     }
+    RtlZeroMemory(Buffer, BufferSize);
 
     /* Update first update counter and CheckSum */
     RegistryHive->BaseBlock->Type = HFILE_TYPE_LOG;
@@ -78,30 +177,11 @@ HvpWriteLog(
         return FALSE;
     }
 
-    /* Write dirty blocks */
+    /* Write dirty blocks, packed one after the other */
     FileOffset = BufferSize;
-    BlockIndex = 0;
-    while (BlockIndex < RegistryHive->Storage[Stable].Length)
+    if (!HvpWriteBlocks(RegistryHive, HFILE_TYPE_LOG, &FileOffset, TRUE))
     {
-        LastIndex = BlockIndex;
-        BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
-        if (BlockIndex == ~0U || BlockIndex < LastIndex)
-        {
-            break;
-        }
-
-        BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
-
-        /* Write hive block */
-        Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
-                                         &FileOffset, BlockPtr, HBLOCK_SIZE);
-        if (!Success)
-        {
-            return FALSE;
-        }
-
-        BlockIndex++;
-        FileOffset += HBLOCK_SIZE;
+        return FALSE;
     }
 
     Success = RegistryHive->FileSetSize(RegistryHive, HFILE_TYPE_LOG, FileOffset, FileOffset);
@@ -140,6 +220,9 @@ HvpWriteLog(
         DPRINT("FileFlush failed\n");
     }
 
+    /* The log now holds everything the primary file is missing */
+    RegistryHive->LoggedDirtyCount = RegistryHive->DirtyCount;
+
     return TRUE;
 }
 
@@ -149,9 +232,6 @@ HvpWriteHive(
     BOOLEAN OnlyDirty)
 {
     ULONG FileOffset;
-    ULONG BlockIndex;
-    ULONG LastIndex;
-    PVOID BlockPtr;
     BOOLEAN Success;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
@@ -182,31 +262,10 @@ HvpWriteHive(
         return FALSE;
     }
 
-    BlockIndex = 0;
-    while (BlockIndex < RegistryHive->Storage[Stable].Length)
+    /* Write hive blocks in place */
+    if (!HvpWriteBlocks(RegistryHive, HFILE_TYPE_PRIMARY, NULL, OnlyDirty))
     {
-        if (OnlyDirty)
-        {
-            LastIndex = BlockIndex;
-            BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
-            if (BlockIndex == ~0U || BlockIndex < LastIndex)
-            {
-                break;
-            }
-        }
-
-        BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
-        FileOffset = (BlockIndex + 1) * HBLOCK_SIZE;
-
-        /* Write hive block */
-        Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY,
-                                          &FileOffset, BlockPtr, HBLOCK_SIZE);
-        if (!Success)
-        {
-            return FALSE;
-        }
-
-        BlockIndex++;
+        return FALSE;
     }
 
     Success = RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_PRIMARY, NULL, 0);
@@ -250,13 +309,16 @@ HvSyncHive(
         return TRUE;
     }
 
-    /* Update hive header modification time */
-    KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
-
-    /* Update log file */
-    if (!HvpWriteLog(RegistryHive))
+    /* Update log file, unless HvSyncHiveLog already did it */
+    if (RegistryHive->LoggedDirtyCount != RegistryHive->DirtyCount)
     {
-        return FALSE;
+        /* Update hive header modification time */
+        KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
+
+        if (!HvpWriteLog(RegistryHive))
+        {
+            return FALSE;
+        }
     }
 
     /* Update hive file */
@@ -268,10 +330,41 @@ HvSyncHive(
     /* Clear dirty bitmap. */
     RtlClearAllBits(&RegistryHive->DirtyVector);
     RegistryHive->DirtyCount = 0;
+    RegistryHive->LoggedDirtyCount = 0;
 
     return TRUE;
 }
 
+/*
+ * Write the dirty blocks of a hive to its log file only. The primary file
+ * is left alone until the next HvSyncHive, which then only has to write
+ * the dirty blocks in place; HvLoadHive replays the log if that never
+ * happens. Hives without a log file are fully synced.
+ */
+BOOLEAN CMAPI
+HvSyncHiveLog(
+    PHHIVE RegistryHive)
+{
+    ASSERT(RegistryHive->ReadOnly == FALSE);
+
+    if (!RegistryHive->Log)
+    {
+        return HvSyncHive(RegistryHive);
+    }
+
+    /* Nothing was dirtied since the log was last written */
+    if (RegistryHive->LoggedDirtyCount == RegistryHive->DirtyCount ||
+        RtlFindSetBits(&RegistryHive->DirtyVector, 1, 0) == ~0U)
+    {
+        return TRUE;
+    }
+
+    /* Update hive header modification time */
+    KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
+
+    return HvpWriteLog(RegistryHive);
+}
+
 BOOLEAN
 CMAPI
 HvHiveWillShrink(IN PHHIVE RegistryHive)
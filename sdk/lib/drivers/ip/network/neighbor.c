@@ -6,11 +6,263 @@
  * PROGRAMMERS: Casper S. Hornstrup (chorns@users.sourceforge.net)
  * REVISIONS:
  *   CSH 01/08-2000 Created
+ * NOTES:
+ *   The cache is a hash table which doubles its number of buckets when
+ *   the chains get long. Each bucket has a reader/writer spin lock, and
+ *   the whole table has one too, which is only taken exclusively to
+ *   resize the table and to age the entries.
+ *   Entries are aged through a timer wheel, so that NBTimeout only looks
+ *   at the entries which have an event due on the current tick.
  */
 
 #include "precomp.h"
 
-NEIGHBOR_CACHE_TABLE NeighborCache[NB_HASHMASK + 1];
+/* Reader/writer spin lock values */
+#define NB_LOCK_EXCLUSIVE       ((LONG)0x80000000)
+#define NB_LOCK_WRITER_WAITING  0x40000000
+
+/* Maximum number of solicitations sent per aging pass */
+#define NB_SOLICIT_BATCH 16
+
+/* Solicitation to send once the cache is unlocked */
+typedef struct _NB_SOLICIT {
+    IP_ADDRESS Address;
+    PIP_INTERFACE Interface;
+    BOOLEAN Broadcast;
+    UCHAR LinkAddress[MAX_PHYSADDR_LEN];
+} NB_SOLICIT, *PNB_SOLICIT;
+
+/* Packets to complete once the cache is unlocked, by failure status */
+typedef struct _NB_FLUSH {
+    LIST_ENTRY NetworkUnreachable;
+    LIST_ENTRY HostUnreachable;
+    LIST_ENTRY Aborted;
+} NB_FLUSH, *PNB_FLUSH;
+
+NEIGHBOR_CACHE_TABLE NeighborCacheInitial[NB_INITIAL_HASH_SIZE];
+PNEIGHBOR_CACHE_TABLE NeighborCache;
+ULONG NeighborCacheMask;
+LONG NeighborCacheLock;
+LONG NeighborCount;
+
+LIST_ENTRY NeighborTimerWheel[NB_TIMER_WHEEL_SIZE];
+KSPIN_LOCK NeighborTimerLock;
+ULONG NeighborTick;
+
+static VOID NBAcquireLockShared( PLONG Lock ) {
+    LONG Value;
+
+    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+
+    /* Let a waiting writer through before taking the lock again */
+    for (;;) {
+        Value = *(volatile LONG *)Lock;
+        if (!(Value & (NB_LOCK_EXCLUSIVE | NB_LOCK_WRITER_WAITING)) &&
+            InterlockedCompareExchange(Lock, Value + 1, Value) == Value)
+            return;
+        YieldProcessor();
+    }
+}
+
+static VOID NBReleaseLockShared( PLONG Lock ) {
+    InterlockedDecrement(Lock);
+}
+
+static VOID NBAcquireLockExclusive( PLONG Lock ) {
+    LONG Value;
+
+    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+
+    for (;;) {
+        Value = *(volatile LONG *)Lock;
+        if (Value == 0 || Value == NB_LOCK_WRITER_WAITING) {
+            if (InterlockedCompareExchange(Lock, NB_LOCK_EXCLUSIVE, Value) == Value)
+                return;
+        } else if (!(Value & NB_LOCK_WRITER_WAITING)) {
+            /* Keep new readers out until we get in */
+            InterlockedOr(Lock, NB_LOCK_WRITER_WAITING);
+        }
+        YieldProcessor();
+    }
+}
+
+static VOID NBReleaseLockExclusive( PLONG Lock ) {
+    /* Other waiting writers will set their flag again */
+    InterlockedExchange(Lock, 0);
+}
+
+static ULONG NBHashAddress( PIP_ADDRESS Address ) {
+    ULONG HashValue;
+
+    /* Spread all the address bits over the bits used as index */
+    HashValue  = *(PULONG)&Address->Address;
+    HashValue ^= HashValue >> 16;
+    HashValue *= 0x45D9F3B;
+    HashValue ^= HashValue >> 16;
+
+    return HashValue;
+}
+
+static PNEIGHBOR_CACHE_TABLE NBLockBucket( PIP_ADDRESS Address,
+					   BOOLEAN Exclusive,
+					   PKIRQL OldIrql ) {
+    PNEIGHBOR_CACHE_TABLE Bucket;
+
+    KeRaiseIrql(DISPATCH_LEVEL, OldIrql);
+
+    /* The table can't be resized while we hold it shared */
+    NBAcquireLockShared(&NeighborCacheLock);
+    Bucket = &NeighborCache[NBHashAddress(Address) & NeighborCacheMask];
+
+    if (Exclusive)
+        NBAcquireLockExclusive(&Bucket->Lock);
+    else
+        NBAcquireLockShared(&Bucket->Lock);
+
+    return Bucket;
+}
+
+static VOID NBUnlockBucket( PNEIGHBOR_CACHE_TABLE Bucket,
+			    BOOLEAN Exclusive,
+			    KIRQL OldIrql ) {
+    if (Exclusive)
+        NBReleaseLockExclusive(&Bucket->Lock);
+    else
+        NBReleaseLockShared(&Bucket->Lock);
+
+    NBReleaseLockShared(&NeighborCacheLock);
+    KeLowerIrql(OldIrql);
+}
+
+static BOOLEAN NBNextEventTick( PNEIGHBOR_CACHE_ENTRY NCE,
+				PULONG DueTick ) {
+    ULONG Age, Next;
+
+    /* Incomplete entries solicit on every tick */
+    if (NCE->State & NUD_INCOMPLETE) {
+        *DueTick = NeighborTick + 1;
+        return TRUE;
+    }
+
+    if (NCE->EventTimer == 0)
+        return FALSE;
+
+    /* Complete entries go stale after ARP_RATE, then solicit every
+     * ARP_TIMEOUT_RETRANSMISSION ticks until they time out */
+    Age = NeighborTick - NCE->EventTick;
+    if (Age < ARP_RATE)
+        Next = ARP_RATE;
+    else
+        Next = Age - Age % ARP_TIMEOUT_RETRANSMISSION + ARP_TIMEOUT_RETRANSMISSION;
+    Next = min(Next, NCE->EventTimer);
+
+    *DueTick = max(NCE->EventTick + Next, NeighborTick + 1);
+    return TRUE;
+}
+
+static VOID NBScheduleNeighbor( PNEIGHBOR_CACHE_ENTRY NCE ) {
+/*
+ * FUNCTION: Puts an NCE in the timer wheel slot of its next event
+ * NOTES:
+ *   The NCE's bucket must be locked exclusively, or the whole table
+ */
+    ULONG DueTick;
+
+    TcpipAcquireSpinLockAtDpcLevel(&NeighborTimerLock);
+
+    RemoveEntryList(&NCE->TimerEntry);
+    if (NBNextEventTick(NCE, &DueTick)) {
+        NCE->DueTick = DueTick;
+        InsertTailList(&NeighborTimerWheel[DueTick % NB_TIMER_WHEEL_SIZE],
+                       &NCE->TimerEntry);
+    } else {
+        InitializeListHead(&NCE->TimerEntry);
+    }
+
+    TcpipReleaseSpinLockFromDpcLevel(&NeighborTimerLock);
+}
+
+static VOID NBUnscheduleNeighbor( PNEIGHBOR_CACHE_ENTRY NCE ) {
+    TcpipAcquireSpinLockAtDpcLevel(&NeighborTimerLock);
+    RemoveEntryList(&NCE->TimerEntry);
+    InitializeListHead(&NCE->TimerEntry);
+    TcpipReleaseSpinLockFromDpcLevel(&NeighborTimerLock);
+}
+
+static VOID NBGrowCache( VOID ) {
+/*
+ * FUNCTION: Doubles the number of buckets in the neighbor cache
+ */
+    PNEIGHBOR_CACHE_TABLE NewCache, OldCache;
+    PNEIGHBOR_CACHE_ENTRY NCE, NextNCE;
+    ULONG Size, NewMask, i;
+    KIRQL OldIrql;
+
+    Size = (NeighborCacheMask + 1) * 2;
+    if (Size > NB_MAXIMUM_HASH_SIZE)
+        return;
+
+    NewCache = ExAllocatePoolWithTag(NonPagedPool,
+                                     Size * sizeof(NEIGHBOR_CACHE_TABLE),
+                                     NCE_TAG);
+    if (!NewCache)
+        return;
+
+    for (i = 0; i < Size; i++) {
+        NewCache[i].Cache = NULL;
+        NewCache[i].Lock = 0;
+    }
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    NBAcquireLockExclusive(&NeighborCacheLock);
+
+    /* Someone else may have grown it meanwhile */
+    if (NeighborCacheMask + 1 != Size / 2) {
+        NBReleaseLockExclusive(&NeighborCacheLock);
+        KeLowerIrql(OldIrql);
+        ExFreePoolWithTag(NewCache, NCE_TAG);
+        return;
+    }
+
+    /* Move every entry to its new chain */
+    NewMask = Size - 1;
+    for (i = 0; i <= NeighborCacheMask; i++) {
+        for (NCE = NeighborCache[i].Cache; NCE; NCE = NextNCE) {
+            NextNCE = NCE->Next;
+            NCE->Next = NewCache[NBHashAddress(&NCE->Address) & NewMask].Cache;
+            NewCache[NBHashAddress(&NCE->Address) & NewMask].Cache = NCE;
+        }
+    }
+
+    OldCache = NeighborCache;
+    NeighborCache = NewCache;
+    NeighborCacheMask = NewMask;
+
+    NBReleaseLockExclusive(&NeighborCacheLock);
+    KeLowerIrql(OldIrql);
+
+    TI_DbgPrint(DEBUG_NCACHE, ("Neighbor cache grown to %d buckets.\n", Size));
+
+    if (OldCache != NeighborCacheInitial)
+        ExFreePoolWithTag(OldCache, NCE_TAG);
+}
+
+static VOID NBUnlinkNeighbor( PNEIGHBOR_CACHE_TABLE Bucket,
+			      PNEIGHBOR_CACHE_ENTRY NCE ) {
+/*
+ * FUNCTION: Removes an NCE from its chain and from the timer wheel
+ * NOTES:
+ *   The NCE's bucket must be locked exclusively, or the whole table
+ */
+    PNEIGHBOR_CACHE_ENTRY *PrevNCE;
+
+    for (PrevNCE = &Bucket->Cache; *PrevNCE != NCE; PrevNCE = &(*PrevNCE)->Next)
+        ASSERT(*PrevNCE);
+
+    *PrevNCE = NCE->Next;
+    NBUnscheduleNeighbor(NCE);
+    InterlockedDecrement(&NeighborCount);
+}
 
 VOID NBCompleteSend( PVOID Context,
 		     PNDIS_PACKET NdisPacket,
@@ -26,22 +278,29 @@ VOID NBCompleteSend( PVOID Context,
 }
 
 VOID NBSendPackets( PNEIGHBOR_CACHE_ENTRY NCE ) {
+    LIST_ENTRY PacketQueue;
     PLIST_ENTRY PacketEntry;
     PNEIGHBOR_PACKET Packet;
-    UINT HashValue;
+    KIRQL OldIrql;
 
     ASSERT(!(NCE->State & NUD_INCOMPLETE));
 
-    HashValue  = *(PULONG)(&NCE->Address.Address);
-    HashValue ^= HashValue >> 16;
-    HashValue ^= HashValue >> 8;
-    HashValue ^= HashValue >> 4;
-    HashValue &= NB_HASHMASK;
-
-    /* Send any waiting packets */
-    while ((PacketEntry = ExInterlockedRemoveHeadList(&NCE->PacketQueue,
-                                              &NeighborCache[HashValue].Lock)) != NULL)
+    /* Take all the waiting packets at once */
+    TcpipAcquireSpinLock(&NCE->PacketQueueLock, &OldIrql);
+    if (IsListEmpty(&NCE->PacketQueue)) {
+        TcpipReleaseSpinLock(&NCE->PacketQueueLock, OldIrql);
+        return;
+    }
+    PacketQueue = NCE->PacketQueue;
+    PacketQueue.Flink->Blink = &PacketQueue;
+    PacketQueue.Blink->Flink = &PacketQueue;
+    InitializeListHead(&NCE->PacketQueue);
+    TcpipReleaseSpinLock(&NCE->PacketQueueLock, OldIrql);
+
+    /* Send them */
+    while (!IsListEmpty(&PacketQueue))
     {
+	PacketEntry = RemoveHeadList(&PacketQueue);
 	Packet = CONTAINING_RECORD( PacketEntry, NEIGHBOR_PACKET, Next );
 
 	TI_DbgPrint
@@ -61,14 +320,38 @@ VOID NBSendPackets( PNEIGHBOR_CACHE_ENTRY NCE ) {
     }
 }
 
-/* Must be called with table lock acquired */
-VOID NBFlushPacketQueue( PNEIGHBOR_CACHE_ENTRY NCE,
-			 NTSTATUS ErrorCode ) {
+static VOID NBDetachPacketQueue( PNEIGHBOR_CACHE_ENTRY NCE,
+				 PLIST_ENTRY Queue ) {
+/*
+ * FUNCTION: Moves the packets waiting on an NCE to the end of a queue
+ * NOTES:
+ *   Must be called at DISPATCH_LEVEL. The packets are completed with
+ *   NBCompletePacketQueue once the cache is unlocked
+ */
+    TcpipAcquireSpinLockAtDpcLevel(&NCE->PacketQueueLock);
+    if (!IsListEmpty(&NCE->PacketQueue)) {
+        Queue->Blink->Flink = NCE->PacketQueue.Flink;
+        NCE->PacketQueue.Flink->Blink = Queue->Blink;
+        NCE->PacketQueue.Blink->Flink = Queue;
+        Queue->Blink = NCE->PacketQueue.Blink;
+        InitializeListHead(&NCE->PacketQueue);
+    }
+    TcpipReleaseSpinLockFromDpcLevel(&NCE->PacketQueueLock);
+}
+
+static VOID NBCompletePacketQueue( PLIST_ENTRY Queue,
+				   NTSTATUS ErrorCode ) {
+/*
+ * FUNCTION: Completes and frees detached packets
+ * NOTES:
+ *   Must not be called with the cache locked, the completion
+ *   routines may come back here
+ */
     PLIST_ENTRY PacketEntry;
     PNEIGHBOR_PACKET Packet;
 
-    while( !IsListEmpty(&NCE->PacketQueue) ) {
-        PacketEntry = RemoveHeadList(&NCE->PacketQueue);
+    while( !IsListEmpty(Queue) ) {
+        PacketEntry = RemoveHeadList(Queue);
 	Packet = CONTAINING_RECORD
 	    ( PacketEntry, NEIGHBOR_PACKET, Next );
 
@@ -88,82 +371,137 @@ VOID NBFlushPacketQueue( PNEIGHBOR_CACHE_ENTRY NCE,
     }
 }
 
+static BOOLEAN NBAgeNeighbor( PNEIGHBOR_CACHE_ENTRY NCE,
+			      PNB_SOLICIT Solicit,
+			      PNB_FLUSH Flush ) {
+/*
+ * FUNCTION: Handles the events of an NCE which are due on this tick
+ * ARGUMENTS:
+ *   NCE     = Pointer to NCE to age
+ *   Solicit = Where to store a solicitation to send
+ *   Flush   = Where to move the packets which failed
+ * RETURNS:
+ *   TRUE if a solicitation should be sent
+ * NOTES:
+ *   The whole table must be locked exclusively. The NCE is destroyed
+ *   if it timed out
+ */
+    BOOLEAN SendSolicit = FALSE;
+    ULONG Age;
+
+    Age = NeighborTick - NCE->EventTick;
+
+    if (NCE->State & NUD_INCOMPLETE)
+    {
+        /* Solicit for an address */
+        SendSolicit = TRUE;
+        if (NCE->EventTimer == 0 && Age % ARP_INCOMPLETE_TIMEOUT == 0)
+        {
+            NBDetachPacketQueue(NCE, &Flush->NetworkUnreachable);
+        }
+    }
+
+    /* Check if event timer is running */
+    if (NCE->EventTimer > 0)  {
+        ASSERT(!(NCE->State & NUD_PERMANENT));
+
+        if (Age >= ARP_RATE && Age % ARP_TIMEOUT_RETRANSMISSION == 0)
+        {
+            /* We haven't gotten a packet from them in
+             * Age seconds so we mark them as stale
+             * and solicit now */
+            NCE->State |= NUD_STALE;
+            SendSolicit = TRUE;
+        }
+    }
+
+    if (SendSolicit) {
+        Solicit->Address = NCE->Address;
+        Solicit->Interface = NCE->Interface;
+        Solicit->Broadcast = (NCE->State & NUD_INCOMPLETE) ||
+                             NCE->LinkAddressLength > MAX_PHYSADDR_LEN;
+        if (!Solicit->Broadcast)
+            RtlCopyMemory(Solicit->LinkAddress, NCE->LinkAddress, NCE->LinkAddressLength);
+    }
+
+    if (NCE->EventTimer > 0 && Age >= NCE->EventTimer) {
+        /* Unlink and destroy the NCE */
+        NBUnlinkNeighbor(&NeighborCache[NBHashAddress(&NCE->Address) & NeighborCacheMask], NCE);
+
+        /* Choose the proper failure status */
+        if (NCE->State & NUD_INCOMPLETE)
+        {
+            /* We couldn't get an address to this IP at all */
+            NBDetachPacketQueue(NCE, &Flush->HostUnreachable);
+        }
+        else
+        {
+            /* This guy was stale for way too long */
+            NBDetachPacketQueue(NCE, &Flush->Aborted);
+        }
+
+        ExFreePoolWithTag(NCE, NCE_TAG);
+    } else {
+        NBScheduleNeighbor(NCE);
+    }
+
+    return SendSolicit;
+}
+
 VOID NBTimeout(VOID)
 /*
  * FUNCTION: Neighbor address cache timeout handler
  * NOTES:
  *     This routine is called by IPTimeout to remove outdated cache
- *     entries.
+ *     entries. Only the entries in the timer wheel slot of this tick
+ *     are looked at
  */
 {
-    UINT i;
-    PNEIGHBOR_CACHE_ENTRY *PrevNCE;
+    NB_SOLICIT Solicits[NB_SOLICIT_BATCH];
+    NB_FLUSH Flush;
+    PLIST_ENTRY Slot, Entry, NextEntry;
     PNEIGHBOR_CACHE_ENTRY NCE;
-    NDIS_STATUS Status;
+    UINT Count, i;
 
-    for (i = 0; i <= NB_HASHMASK; i++) {
-        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache[i].Lock);
+    NeighborTick++;
+    Slot = &NeighborTimerWheel[NeighborTick % NB_TIMER_WHEEL_SIZE];
 
-        for (PrevNCE = &NeighborCache[i].Cache;
-             (NCE = *PrevNCE) != NULL;) {
-            if (NCE->State & NUD_INCOMPLETE)
-            {
-                /* Solicit for an address */
-                NBSendSolicit(NCE);
-                if (NCE->EventTimer == 0)
-                {
-                    NCE->EventCount++;
-                    if (NCE->EventCount == ARP_INCOMPLETE_TIMEOUT)
-                    {
-                        NBFlushPacketQueue(NCE, NDIS_STATUS_NETWORK_UNREACHABLE);
-                        NCE->EventCount = 0;
-                    }
-                }
-            }
+    do {
+        Count = 0;
+        InitializeListHead(&Flush.NetworkUnreachable);
+        InitializeListHead(&Flush.HostUnreachable);
+        InitializeListHead(&Flush.Aborted);
 
-            /* Check if event timer is running */
-            if (NCE->EventTimer > 0)  {
-                ASSERT(!(NCE->State & NUD_PERMANENT));
-                NCE->EventCount++;
-
-                if ((NCE->EventCount > ARP_RATE &&
-                     NCE->EventCount % ARP_TIMEOUT_RETRANSMISSION == 0) ||
-                    (NCE->EventCount == ARP_RATE))
-                {
-                    /* We haven't gotten a packet from them in
-                     * EventCount seconds so we mark them as stale
-                     * and solicit now */
-                    NCE->State |= NUD_STALE;
-                    NBSendSolicit(NCE);
-                }
-                if (NCE->EventTimer - NCE->EventCount == 0) {
-                    /* Unlink and destroy the NCE */
-                    *PrevNCE = NCE->Next;
-                    
-                    /* Choose the proper failure status */
-                    if (NCE->State & NUD_INCOMPLETE)
-                    {
-                        /* We couldn't get an address to this IP at all */
-                        Status = NDIS_STATUS_HOST_UNREACHABLE;
-                    }
-                    else
-                    {
-                        /* This guy was stale for way too long */
-                        Status = NDIS_STATUS_REQUEST_ABORTED;
-                    }
-                    
-                    NBFlushPacketQueue(NCE, Status);
-
-                    ExFreePoolWithTag(NCE, NCE_TAG);
-
-                    continue;
-                }
-            }
-            PrevNCE = &NCE->Next;
+        NBAcquireLockExclusive(&NeighborCacheLock);
+
+        /* Handled entries leave the slot, or go to its end with a later tick */
+        for (Entry = Slot->Flink;
+             Entry != Slot && Count < NB_SOLICIT_BATCH;
+             Entry = NextEntry) {
+            NextEntry = Entry->Flink;
+            NCE = CONTAINING_RECORD(Entry, NEIGHBOR_CACHE_ENTRY, TimerEntry);
+
+            /* This one is due on a later turn of the wheel */
+            if (NCE->DueTick != NeighborTick)
+                continue;
+
+            if (NBAgeNeighbor(NCE, &Solicits[Count], &Flush))
+                Count++;
         }
 
-        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache[i].Lock);
-    }
+        NBReleaseLockExclusive(&NeighborCacheLock);
+
+        NBCompletePacketQueue(&Flush.NetworkUnreachable, NDIS_STATUS_NETWORK_UNREACHABLE);
+        NBCompletePacketQueue(&Flush.HostUnreachable, NDIS_STATUS_HOST_UNREACHABLE);
+        NBCompletePacketQueue(&Flush.Aborted, NDIS_STATUS_REQUEST_ABORTED);
+
+        /* Solicit outside of the lock, the transmit path may come back here */
+        for (i = 0; i < Count; i++) {
+            ARPTransmit(&Solicits[i].Address,
+                        Solicits[i].Broadcast ? NULL : Solicits[i].LinkAddress,
+                        Solicits[i].Interface);
+        }
+    } while (Count == NB_SOLICIT_BATCH);
 }
 
 VOID NBStartup(VOID)
@@ -175,10 +513,20 @@ VOID NBStartup(VOID)
 
     TI_DbgPrint(DEBUG_NCACHE, ("Called.\n"));
 
-    for (i = 0; i <= NB_HASHMASK; i++) {
-	NeighborCache[i].Cache = NULL;
-	TcpipInitializeSpinLock(&NeighborCache[i].Lock);
+    for (i = 0; i < NB_INITIAL_HASH_SIZE; i++) {
+	NeighborCacheInitial[i].Cache = NULL;
+	NeighborCacheInitial[i].Lock = 0;
     }
+
+    NeighborCache = NeighborCacheInitial;
+    NeighborCacheMask = NB_INITIAL_HASH_SIZE - 1;
+    NeighborCacheLock = 0;
+    NeighborCount = 0;
+
+    for (i = 0; i < NB_TIMER_WHEEL_SIZE; i++)
+	InitializeListHead(&NeighborTimerWheel[i]);
+    TcpipInitializeSpinLock(&NeighborTimerLock);
+    NeighborTick = 0;
 }
 
 VOID NBShutdown(VOID)
@@ -188,22 +536,27 @@ VOID NBShutdown(VOID)
 {
   PNEIGHBOR_CACHE_ENTRY NextNCE;
   PNEIGHBOR_CACHE_ENTRY CurNCE;
+  PNEIGHBOR_CACHE_TABLE OldCache;
+  LIST_ENTRY PacketQueue;
   KIRQL OldIrql;
   UINT i;
 
   TI_DbgPrint(DEBUG_NCACHE, ("Called.\n"));
 
+  InitializeListHead(&PacketQueue);
+
+  KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+  NBAcquireLockExclusive(&NeighborCacheLock);
+
   /* Remove possible entries from the cache */
-  for (i = 0; i <= NB_HASHMASK; i++)
+  for (i = 0; i <= NeighborCacheMask; i++)
     {
-      TcpipAcquireSpinLock(&NeighborCache[i].Lock, &OldIrql);
-
       CurNCE = NeighborCache[i].Cache;
       while (CurNCE) {
           NextNCE = CurNCE->Next;
 
           /* Flush wait queue */
-	  NBFlushPacketQueue( CurNCE, NDIS_STATUS_NOT_ACCEPTED );
+	  NBDetachPacketQueue( CurNCE, &PacketQueue );
 
           ExFreePoolWithTag(CurNCE, NCE_TAG);
 
@@ -211,10 +564,25 @@ VOID NBShutdown(VOID)
       }
 
     NeighborCache[i].Cache = NULL;
-
-    TcpipReleaseSpinLock(&NeighborCache[i].Lock, OldIrql);
   }
 
+  for (i = 0; i < NB_TIMER_WHEEL_SIZE; i++)
+      InitializeListHead(&NeighborTimerWheel[i]);
+  NeighborCount = 0;
+
+  /* Go back to the initial table */
+  OldCache = NeighborCache;
+  NeighborCache = NeighborCacheInitial;
+  NeighborCacheMask = NB_INITIAL_HASH_SIZE - 1;
+
+  NBReleaseLockExclusive(&NeighborCacheLock);
+  KeLowerIrql(OldIrql);
+
+  NBCompletePacketQueue(&PacketQueue, NDIS_STATUS_NOT_ACCEPTED);
+
+  if (OldCache != NeighborCacheInitial)
+      ExFreePoolWithTag(OldCache, NCE_TAG);
+
   TI_DbgPrint(MAX_TRACE, ("Leaving.\n"));
 }
 
@@ -224,7 +592,7 @@ VOID NBSendSolicit(PNEIGHBOR_CACHE_ENTRY NCE)
  * ARGUMENTS:
  *   NCE = Pointer to NCE of neighbor to solicit
  * NOTES:
- *   May be called with lock held on NCE's table
+ *   Must not be called with the NCE's table locked
  */
 {
     TI_DbgPrint(DEBUG_NCACHE, ("Called. NCE (0x%X).\n", NCE));
@@ -239,13 +607,16 @@ VOID NBDestroyNeighborsForInterface(PIP_INTERFACE Interface)
     KIRQL OldIrql;
     PNEIGHBOR_CACHE_ENTRY *PrevNCE;
     PNEIGHBOR_CACHE_ENTRY NCE;
+    LIST_ENTRY PacketQueue;
     ULONG i;
 
+    InitializeListHead(&PacketQueue);
+
     KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
-    for (i = 0; i <= NB_HASHMASK; i++)
+    NBAcquireLockExclusive(&NeighborCacheLock);
+
+    for (i = 0; i <= NeighborCacheMask; i++)
     {
-        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache[i].Lock);
-        
         for (PrevNCE = &NeighborCache[i].Cache;
              (NCE = *PrevNCE) != NULL;)
         {
@@ -253,8 +624,10 @@ VOID NBDestroyNeighborsForInterface(PIP_INTERFACE Interface)
             {
                 /* Unlink and destroy the NCE */
                 *PrevNCE = NCE->Next;
+                NBUnscheduleNeighbor(NCE);
+                InterlockedDecrement(&NeighborCount);
 
-                NBFlushPacketQueue(NCE, NDIS_STATUS_REQUEST_ABORTED);
+                NBDetachPacketQueue(NCE, &PacketQueue);
                 ExFreePoolWithTag(NCE, NCE_TAG);
 
                 continue;
@@ -264,10 +637,12 @@ VOID NBDestroyNeighborsForInterface(PIP_INTERFACE Interface)
                 PrevNCE = &NCE->Next;
             }
         }
-        
-        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache[i].Lock);
     }
+
+    NBReleaseLockExclusive(&NeighborCacheLock);
     KeLowerIrql(OldIrql);
+
+    NBCompletePacketQueue(&PacketQueue, NDIS_STATUS_REQUEST_ABORTED);
 }
 
 PNEIGHBOR_CACHE_ENTRY NBAddNeighbor(
@@ -294,7 +669,7 @@ PNEIGHBOR_CACHE_ENTRY NBAddNeighbor(
  */
 {
   PNEIGHBOR_CACHE_ENTRY NCE;
-  ULONG HashValue;
+  PNEIGHBOR_CACHE_TABLE Bucket;
   KIRQL OldIrql;
 
   TI_DbgPrint
@@ -322,23 +697,24 @@ PNEIGHBOR_CACHE_ENTRY NBAddNeighbor(
       memset(NCE->LinkAddress, 0xff, LinkAddressLength);
   NCE->State = State;
   NCE->EventTimer = EventTimer;
-  NCE->EventCount = 0;
+  NCE->EventTick = NeighborTick;
+  InitializeListHead( &NCE->TimerEntry );
+  TcpipInitializeSpinLock( &NCE->PacketQueueLock );
   InitializeListHead( &NCE->PacketQueue );
 
   TI_DbgPrint(MID_TRACE,("NCE: %x\n", NCE));
 
-  HashValue = *(PULONG)&Address->Address;
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
+  Bucket = NBLockBucket(Address, TRUE, &OldIrql);
 
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+  NCE->Next = Bucket->Cache;
+  Bucket->Cache = NCE;
+  NBScheduleNeighbor(NCE);
 
-  NCE->Next = NeighborCache[HashValue].Cache;
-  NeighborCache[HashValue].Cache = NCE;
+  NBUnlockBucket(Bucket, TRUE, OldIrql);
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  /* Keep the chains short */
+  if ((ULONG)InterlockedIncrement(&NeighborCount) > 2 * (NeighborCacheMask + 1))
+      NBGrowCache();
 
   return NCE;
 }
@@ -357,61 +733,50 @@ VOID NBUpdateNeighbor(
  *   The link address and state is updated. Any waiting packets are sent
  */
 {
+    PNEIGHBOR_CACHE_TABLE Bucket;
     KIRQL OldIrql;
-    UINT HashValue;
 
     TI_DbgPrint(DEBUG_NCACHE, ("Called. NCE (0x%X)  LinkAddress (0x%X)  State (0x%X).\n", NCE, LinkAddress, State));
 
-    HashValue  = *(PULONG)(&NCE->Address.Address);
-    HashValue ^= HashValue >> 16;
-    HashValue ^= HashValue >> 8;
-    HashValue ^= HashValue >> 4;
-    HashValue &= NB_HASHMASK;
-
-    TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+    Bucket = NBLockBucket(&NCE->Address, TRUE, &OldIrql);
 
     RtlCopyMemory(NCE->LinkAddress, LinkAddress, NCE->LinkAddressLength);
     NCE->State = State;
-    NCE->EventCount = 0;
+    NCE->EventTick = NeighborTick;
+    if (!(NCE->State & NUD_INCOMPLETE) && NCE->EventTimer)
+        NCE->EventTimer = ARP_COMPLETE_TIMEOUT;
+    NBScheduleNeighbor(NCE);
 
-    TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+    NBUnlockBucket(Bucket, TRUE, OldIrql);
 
     if( !(NCE->State & NUD_INCOMPLETE) )
-    {
-        if (NCE->EventTimer) NCE->EventTimer = ARP_COMPLETE_TIMEOUT;
         NBSendPackets( NCE );
-    }
 }
 
 VOID
 NBResetNeighborTimeout(PIP_ADDRESS Address)
 {
+    PNEIGHBOR_CACHE_TABLE Bucket;
     KIRQL OldIrql;
-    UINT HashValue;
     PNEIGHBOR_CACHE_ENTRY NCE;
 
     TI_DbgPrint(DEBUG_NCACHE, ("Resetting NCE timout for 0x%s\n", A2S(Address)));
 
-    HashValue  = *(PULONG)(&Address->Address);
-    HashValue ^= HashValue >> 16;
-    HashValue ^= HashValue >> 8;
-    HashValue ^= HashValue >> 4;
-    HashValue &= NB_HASHMASK;
-
-    TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+    Bucket = NBLockBucket(Address, FALSE, &OldIrql);
 
-    for (NCE = NeighborCache[HashValue].Cache;
+    for (NCE = Bucket->Cache;
          NCE != NULL;
          NCE = NCE->Next)
     {
          if (AddrIsEqual(Address, &NCE->Address))
          {
-             NCE->EventCount = 0;
+             /* The timer wheel picks this up when the old event is due */
+             NCE->EventTick = NeighborTick;
              break;
          }
     }
 
-    TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+    NBUnlockBucket(Bucket, FALSE, OldIrql);
 }
 
 PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
@@ -430,19 +795,13 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
  */
 {
   PNEIGHBOR_CACHE_ENTRY NCE;
-  UINT HashValue;
+  PNEIGHBOR_CACHE_TABLE Bucket;
   KIRQL OldIrql;
   PIP_INTERFACE FirstInterface;
 
   TI_DbgPrint(DEBUG_NCACHE, ("Called. Address (0x%X).\n", Address));
 
-  HashValue = *(PULONG)&Address->Address;
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
-
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+  Bucket = NBLockBucket(Address, FALSE, &OldIrql);
 
   /* If there's no adapter specified, we'll look for a match on
    * each one. */
@@ -458,7 +817,7 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
 
   do
   {
-      NCE = NeighborCache[HashValue].Cache;
+      NCE = Bucket->Cache;
       while (NCE != NULL)
       {
          if (NCE->Interface == Interface &&
@@ -466,10 +825,10 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
          {
              break;
          }
- 
+
          NCE = NCE->Next;
       }
-      
+
       if (NCE != NULL)
           break;
   }
@@ -479,7 +838,7 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
   if ((NCE == NULL) && (FirstInterface != NULL))
   {
       /* This time we'll even match loopback NCEs */
-      NCE = NeighborCache[HashValue].Cache;
+      NCE = Bucket->Cache;
       while (NCE != NULL)
       {
          if (AddrIsEqual(Address, &NCE->Address))
@@ -491,7 +850,7 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
       }
   }
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  NBUnlockBucket(Bucket, FALSE, OldIrql);
 
   TI_DbgPrint(MAX_TRACE, ("Leaving.\n"));
 
@@ -550,11 +909,13 @@ BOOLEAN NBQueuePacket(
  *   NdisPacket = Pointer to NDIS packet to queue
  * RETURNS:
  *   TRUE if the packet was successfully queued, FALSE if not
+ * NOTES:
+ *   Packets queued on an incomplete NCE are all sent at once when
+ *   the neighbor's link address is resolved
  */
 {
   KIRQL OldIrql;
   PNEIGHBOR_PACKET Packet;
-  UINT HashValue;
 
   TI_DbgPrint
       (DEBUG_NCACHE,
@@ -566,20 +927,13 @@ BOOLEAN NBQueuePacket(
 
   /* FIXME: Should we limit the number of queued packets? */
 
-  HashValue  = *(PULONG)(&NCE->Address.Address);
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
-
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
-
   Packet->Complete = PacketComplete;
   Packet->Context = PacketContext;
   Packet->Packet = NdisPacket;
-  InsertTailList( &NCE->PacketQueue, &Packet->Next );
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  TcpipAcquireSpinLock(&NCE->PacketQueueLock, &OldIrql);
+  InsertTailList( &NCE->PacketQueue, &Packet->Next );
+  TcpipReleaseSpinLock(&NCE->PacketQueueLock, OldIrql);
 
   if( !(NCE->State & NUD_INCOMPLETE) )
       NBSendPackets( NCE );
@@ -597,39 +951,35 @@ VOID NBRemoveNeighbor(
  *   The NCE must be in a safe state
  */
 {
-  PNEIGHBOR_CACHE_ENTRY *PrevNCE;
+  PNEIGHBOR_CACHE_TABLE Bucket;
   PNEIGHBOR_CACHE_ENTRY CurNCE;
-  ULONG HashValue;
+  LIST_ENTRY PacketQueue;
   KIRQL OldIrql;
 
   TI_DbgPrint(DEBUG_NCACHE, ("Called. NCE (0x%X).\n", NCE));
 
-  HashValue  = *(PULONG)(&NCE->Address.Address);
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
+  InitializeListHead(&PacketQueue);
 
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+  Bucket = NBLockBucket(&NCE->Address, TRUE, &OldIrql);
 
   /* Search the list and remove the NCE from the list if found */
-  for (PrevNCE = &NeighborCache[HashValue].Cache;
-    (CurNCE = *PrevNCE) != NULL;
-    PrevNCE = &CurNCE->Next)
+  for (CurNCE = Bucket->Cache; CurNCE != NULL; CurNCE = CurNCE->Next)
     {
       if (CurNCE == NCE)
         {
           /* Found it, now unlink it from the list */
-          *PrevNCE = CurNCE->Next;
+          NBUnlinkNeighbor(Bucket, CurNCE);
 
-	  NBFlushPacketQueue( CurNCE, NDIS_STATUS_REQUEST_ABORTED );
+	  NBDetachPacketQueue( CurNCE, &PacketQueue );
           ExFreePoolWithTag(CurNCE, NCE_TAG);
 
 	  break;
         }
     }
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  NBUnlockBucket(Bucket, TRUE, OldIrql);
+
+  NBCompletePacketQueue(&PacketQueue, NDIS_STATUS_REQUEST_ABORTED);
 }
 
 ULONG NBCopyNeighbors
@@ -640,8 +990,11 @@ ULONG NBCopyNeighbors
   KIRQL OldIrql;
   UINT Size = 0, i;
 
-  for (i = 0; i <= NB_HASHMASK; i++) {
-      TcpipAcquireSpinLock(&NeighborCache[i].Lock, &OldIrql);
+  KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+  NBAcquireLockShared(&NeighborCacheLock);
+
+  for (i = 0; i <= NeighborCacheMask; i++) {
+      NBAcquireLockShared(&NeighborCache[i].Lock);
       for( CurNCE = NeighborCache[i].Cache;
 	   CurNCE;
 	   CurNCE = CurNCE->Next ) {
@@ -651,7 +1004,7 @@ ULONG NBCopyNeighbors
 		  ArpTable[Size].Index = Interface->Index;
 		  ArpTable[Size].AddrSize = CurNCE->LinkAddressLength;
 		  RtlCopyMemory
-		      (ArpTable[Size].PhysAddr, 
+		      (ArpTable[Size].PhysAddr,
 		       CurNCE->LinkAddress,
 		       CurNCE->LinkAddressLength);
 		  ArpTable[Size].LogAddr = CurNCE->Address.Address.IPv4Address;
@@ -665,8 +1018,11 @@ ULONG NBCopyNeighbors
 	      Size++;
 	  }
       }
-      TcpipReleaseSpinLock(&NeighborCache[i].Lock, OldIrql);
+      NBReleaseLockShared(&NeighborCache[i].Lock);
   }
-  
+
+  NBReleaseLockShared(&NeighborCacheLock);
+  KeLowerIrql(OldIrql);
+
   return Size;
 }
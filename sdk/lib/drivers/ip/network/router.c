@@ -17,6 +17,11 @@
 LIST_ENTRY FIBListHead;
 KSPIN_LOCK FIBLock;
 
+/* IPv4 route table snapshot, read without taking the FIB lock */
+PROUTE_TABLE RouterTable;
+LONG RouterTableEpoch;
+LONG RouterTableReaders[2];
+
 void RouterDumpRoutes() {
     PLIST_ENTRY CurrentEntry;
     PLIST_ENTRY NextEntry;
@@ -186,6 +191,252 @@ UINT CommonPrefixLength(
 }
 
 
+static ULONG RouterPrefixMask(
+    UINT PrefixLength)
+/*
+ * FUNCTION: Builds the host order netmask for a prefix length
+ */
+{
+    return PrefixLength ? 0xFFFFFFFF << (32 - PrefixLength) : 0;
+}
+
+
+static UINT RouterCommonBits(
+    ULONG Address1,
+    ULONG Address2)
+/*
+ * FUNCTION: Counts the leading bits two host order IPv4 addresses share
+ */
+{
+    ULONG Difference = Address1 ^ Address2;
+    UINT Bits = 0;
+
+    while (Bits < 32 && !(Difference & (0x80000000 >> Bits)))
+        Bits++;
+
+    return Bits;
+}
+
+
+static PROUTE_TRIE_NODE RouterAllocateNode(
+    PROUTE_TABLE Table,
+    ULONG Prefix,
+    UINT PrefixLength)
+{
+    PROUTE_TRIE_NODE Node = Table->NextNode++;
+
+    Node->Child[0] = Node->Child[1] = NULL;
+    Node->Prefix = Prefix;
+    Node->PrefixLength = PrefixLength;
+    Node->Routes = NULL;
+
+    return Node;
+}
+
+
+static PROUTE_TRIE_NODE RouterInsertPrefix(
+    PROUTE_TABLE Table,
+    ULONG Prefix,
+    UINT PrefixLength)
+/*
+ * FUNCTION: Finds or creates the trie node for a prefix
+ * ARGUMENTS:
+ *     Table        = Route table being built
+ *     Prefix       = Host order prefix with the host bits clear
+ *     PrefixLength = Length of the prefix
+ * RETURNS:
+ *     Node for the prefix
+ * NOTES:
+ *     Each insertion uses at most two nodes from the table
+ */
+{
+    PROUTE_TRIE_NODE *Link = &Table->Root;
+    PROUTE_TRIE_NODE Node, NewNode, Branch;
+    UINT Common;
+
+    while ((Node = *Link)) {
+        Common = min(RouterCommonBits(Prefix, Node->Prefix),
+                     min(PrefixLength, Node->PrefixLength));
+
+        if (Common == Node->PrefixLength) {
+            /* Node covers our prefix, so it is either ours or an ancestor */
+            if (PrefixLength == Node->PrefixLength)
+                return Node;
+
+            Link = &Node->Child[(Prefix >> (31 - Node->PrefixLength)) & 1];
+            continue;
+        }
+
+        NewNode = RouterAllocateNode(Table, Prefix, PrefixLength);
+
+        if (Common == PrefixLength) {
+            /* Our prefix covers the node, so we go between it and its parent */
+            NewNode->Child[(Node->Prefix >> (31 - PrefixLength)) & 1] = Node;
+            *Link = NewNode;
+            return NewNode;
+        }
+
+        /* The prefixes diverge, so both hang off a new branch node */
+        Branch = RouterAllocateNode(Table, Prefix & RouterPrefixMask(Common), Common);
+        Branch->Child[(Node->Prefix >> (31 - Common)) & 1] = Node;
+        Branch->Child[(Prefix >> (31 - Common)) & 1] = NewNode;
+        *Link = Branch;
+        return NewNode;
+    }
+
+    *Link = RouterAllocateNode(Table, Prefix, PrefixLength);
+    return *Link;
+}
+
+
+static PROUTE_TABLE RouterBuildTable(
+    VOID)
+/*
+ * FUNCTION: Builds a route table snapshot from the IPv4 FIB entries
+ * RETURNS:
+ *     Pointer to the new route table, NULL if there are not enough resources
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PLIST_ENTRY CurrentEntry;
+    PFIB_ENTRY Current;
+    PROUTE_TABLE Table;
+    PROUTE_TRIE_NODE Node;
+    PROUTE_TRIE_ROUTE Route, *Link;
+    UINT Count = 0, PrefixLength;
+    ULONG Prefix;
+
+    for (CurrentEntry = FIBListHead.Flink;
+         CurrentEntry != &FIBListHead;
+         CurrentEntry = CurrentEntry->Flink) {
+        Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, ListEntry);
+        if (Current->NetworkAddress.Type == IP_ADDRESS_V4)
+            Count++;
+    }
+
+    /* Everything lives in one block: the header, the nodes and the routes */
+    Table = ExAllocatePoolWithTag(NonPagedPool,
+                                  sizeof(ROUTE_TABLE) +
+                                  2 * Count * sizeof(ROUTE_TRIE_NODE) +
+                                  Count * sizeof(ROUTE_TRIE_ROUTE),
+                                  FIB_TAG);
+    if (!Table) {
+        TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        return NULL;
+    }
+
+    Table->Root = NULL;
+    Table->NextNode = (PROUTE_TRIE_NODE)(Table + 1);
+    Route = (PROUTE_TRIE_ROUTE)(Table->NextNode + 2 * Count);
+
+    for (CurrentEntry = FIBListHead.Flink;
+         CurrentEntry != &FIBListHead;
+         CurrentEntry = CurrentEntry->Flink) {
+        Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, ListEntry);
+        if (Current->NetworkAddress.Type != IP_ADDRESS_V4)
+            continue;
+
+        PrefixLength = AddrCountPrefixBits(&Current->Netmask);
+        Prefix = IPv4NToHl(Current->NetworkAddress.Address.IPv4Address) &
+                 RouterPrefixMask(PrefixLength);
+        Node = RouterInsertPrefix(Table, Prefix, PrefixLength);
+
+        /* Keep the cheapest route first, earlier routes win ties */
+        Route->Router = Current->Router;
+        Route->Metric = Current->Metric;
+        for (Link = &Node->Routes; *Link && (*Link)->Metric <= Route->Metric;
+             Link = &(*Link)->Next);
+        Route->Next = *Link;
+        *Link = Route++;
+    }
+
+    return Table;
+}
+
+
+static VOID RouterPublishTable(
+    PROUTE_TABLE Table)
+/*
+ * FUNCTION: Replaces the route table snapshot and frees the old one
+ * ARGUMENTS:
+ *     Table = New route table, NULL makes lookups use the FIB list
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PROUTE_TABLE OldTable;
+    LONG Epoch;
+
+    OldTable = InterlockedExchangePointer((PVOID*)&RouterTable, Table);
+
+    /* New readers register in the next epoch, wait for the old ones.
+     * Readers run at DISPATCH_LEVEL so they can't be preempted by us */
+    Epoch = InterlockedIncrement(&RouterTableEpoch) - 1;
+    while (RouterTableReaders[Epoch & 1])
+        YieldProcessor();
+
+    if (OldTable)
+        ExFreePoolWithTag(OldTable, FIB_TAG);
+}
+
+
+static VOID RouterUpdateTable(
+    VOID)
+/*
+ * FUNCTION: Rebuilds the route table snapshot after the FIB changed
+ * NOTES:
+ *     The forward information base lock must be held when called.
+ *     If the new table can't be built, lookups fall back to the FIB list
+ */
+{
+    RouterPublishTable(RouterBuildTable());
+}
+
+
+static PNEIGHBOR_CACHE_ENTRY RouterLookupTable(
+    PROUTE_TABLE Table,
+    PIP_ADDRESS Destination)
+/*
+ * FUNCTION: Finds the router for the longest prefix matching Destination
+ * ARGUMENTS:
+ *     Table       = Route table snapshot
+ *     Destination = Pointer to IPv4 destination address
+ * RETURNS:
+ *     Pointer to NCE for router, NULL if none was found
+ * NOTES:
+ *     Routers which are neither stale nor incomplete are preferred
+ */
+{
+    PROUTE_TRIE_NODE Node = Table->Root;
+    PROUTE_TRIE_ROUTE Route;
+    PNEIGHBOR_CACHE_ENTRY BestNCE = NULL, BestReachableNCE = NULL;
+    ULONG Address = IPv4NToHl(Destination->Address.IPv4Address);
+
+    while (Node) {
+        if ((Address ^ Node->Prefix) & RouterPrefixMask(Node->PrefixLength))
+            break;
+
+        if (Node->Routes) {
+            BestNCE = Node->Routes->Router;
+            for (Route = Node->Routes; Route; Route = Route->Next) {
+                if (!(Route->Router->State & (NUD_STALE | NUD_INCOMPLETE))) {
+                    BestReachableNCE = Route->Router;
+                    break;
+                }
+            }
+        }
+
+        if (Node->PrefixLength == 32)
+            break;
+
+        Node = Node->Child[(Address >> (31 - Node->PrefixLength)) & 1];
+    }
+
+    return BestReachableNCE ? BestReachableNCE : BestNCE;
+}
+
+
 PFIB_ENTRY RouterAddRoute(
     PIP_ADDRESS NetworkAddress,
     PIP_ADDRESS Netmask,
@@ -207,6 +458,7 @@ PFIB_ENTRY RouterAddRoute(
  */
 {
     PFIB_ENTRY FIBE;
+    KIRQL OldIrql;
 
     TI_DbgPrint(DEBUG_ROUTER, ("Called. NetworkAddress (0x%X)  Netmask (0x%X) "
         "Router (0x%X)  Metric (%d).\n", NetworkAddress, Netmask, Router, Metric));
@@ -230,15 +482,18 @@ PFIB_ENTRY RouterAddRoute(
     FIBE->Metric         = Metric;
 
     /* Add FIB to the forward information base */
-    TcpipInterlockedInsertTailList(&FIBListHead, &FIBE->ListEntry, &FIBLock);
+    TcpipAcquireSpinLock(&FIBLock, &OldIrql);
+    InsertTailList(&FIBListHead, &FIBE->ListEntry);
+    RouterUpdateTable();
+    TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
     return FIBE;
 }
 
 
-PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
+static PNEIGHBOR_CACHE_ENTRY RouterGetRouteFromList(PIP_ADDRESS Destination)
 /*
- * FUNCTION: Finds a router to use to get to Destination
+ * FUNCTION: Finds a router to use to get to Destination by scanning the FIB
  * ARGUMENTS:
  *     Destination = Pointer to destination address (NULL means don't care)
  * RETURNS:
@@ -297,6 +552,58 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
     return BestNCE;
 }
 
+
+PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
+/*
+ * FUNCTION: Finds a router to use to get to Destination
+ * ARGUMENTS:
+ *     Destination = Pointer to destination address (NULL means don't care)
+ * RETURNS:
+ *     Pointer to NCE for router, NULL if none was found
+ * NOTES:
+ *     If found the NCE is referenced.
+ *     IPv4 lookups use the route table snapshot and take no lock
+ */
+{
+    KIRQL OldIrql;
+    LONG Epoch;
+    PROUTE_TABLE Table;
+    PNEIGHBOR_CACHE_ENTRY NCE = NULL;
+
+    if (Destination->Type != IP_ADDRESS_V4)
+        return RouterGetRouteFromList(Destination);
+
+    /* Register as a reader of the current epoch, so that the table we
+     * see isn't freed under us, and stay on this processor meanwhile */
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    do {
+        Epoch = *(volatile LONG *)&RouterTableEpoch;
+        InterlockedIncrement(&RouterTableReaders[Epoch & 1]);
+        if (Epoch == *(volatile LONG *)&RouterTableEpoch)
+            break;
+        InterlockedDecrement(&RouterTableReaders[Epoch & 1]);
+    } while (TRUE);
+
+    Table = *(PROUTE_TABLE volatile *)&RouterTable;
+    if (Table)
+        NCE = RouterLookupTable(Table, Destination);
+
+    InterlockedDecrement(&RouterTableReaders[Epoch & 1]);
+    KeLowerIrql(OldIrql);
+
+    /* The table couldn't be built, do it the slow way */
+    if (!Table)
+        return RouterGetRouteFromList(Destination);
+
+    if( NCE ) {
+	TI_DbgPrint(DEBUG_ROUTER,("Routing to %s\n", A2S(&NCE->Address)));
+    } else {
+	TI_DbgPrint(DEBUG_ROUTER,("Packet won't be routed\n"));
+    }
+
+    return NCE;
+}
+
 PNEIGHBOR_CACHE_ENTRY RouteGetRouteToDestination(PIP_ADDRESS Destination)
 /*
  * FUNCTION: Locates an RCN describing a route to a destination address
@@ -357,6 +664,8 @@ VOID RouterRemoveRoutesForInterface(PIP_INTERFACE Interface)
 
         CurrentEntry = NextEntry;
     }
+
+    RouterUpdateTable();
     
     TcpipReleaseSpinLock(&FIBLock, OldIrql);
 }
@@ -406,6 +715,7 @@ NTSTATUS RouterRemoveRoute(PIP_ADDRESS Target, PIP_ADDRESS Router)
     if( Found ) {
         TI_DbgPrint(DEBUG_ROUTER, ("Deleting route\n"));
         DestroyFIBE( Current );
+        RouterUpdateTable();
     }
 
     RouterDumpRoutes();
@@ -512,6 +822,7 @@ NTSTATUS RouterShutdown(
     /* Clear Forward Information Base */
     TcpipAcquireSpinLock(&FIBLock, &OldIrql);
     DestroyFIBEs();
+    RouterPublishTable(NULL);
     TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
     return STATUS_SUCCESS;
@@ -0,0 +1,395 @@
+/*
+ * Fast486 386/486 CPU Emulation Library
+ * blocks.c
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Straight-line code is decoded once into blocks, which remember the prefixes
+ * and the opcode of each instruction, so that executing the block again only
+ * has to call the opcode handlers. A block never spans more than the prefetch
+ * cache, and it is only executed if its bytes still match the prefetched ones,
+ * so any change of the code (self-modifying code, or memory written by the
+ * host) makes the block be decoded again.
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include <windef.h>
+
+// #define NDEBUG
+#include <debug.h>
+
+#include <fast486.h>
+#include "common.h"
+#include "opcodes.h"
+#include "blocks.h"
+
+#ifndef FAST486_NO_PREFETCH
+
+/* PRIVATE FUNCTIONS **********************************************************/
+
+FORCEINLINE
+ULONG
+Fast486GetCodeAddress(PFAST486_STATE State)
+{
+    PFAST486_SEG_REG CodeSegment = &State->SegmentRegs[FAST486_REG_CS];
+
+    return CodeSegment->Base + (CodeSegment->Size ? State->InstPtr.Long
+                                                  : State->InstPtr.LowWord);
+}
+
+FORCEINLINE
+BOOLEAN
+Fast486IsPrefetched(PFAST486_STATE State, ULONG Address, ULONG Length)
+{
+    ASSERT(Length <= FAST486_CACHE_SIZE);
+
+    return State->PrefetchValid
+           && (Address >= State->PrefetchAddress)
+           && ((Address - State->PrefetchAddress) <= (FAST486_CACHE_SIZE - Length));
+}
+
+FORCEINLINE
+BOOLEAN
+Fast486IsBlockEnd(UCHAR Opcode, UCHAR NextByte)
+{
+    /* Conditional jumps, LOOPs, JCXZ, IN, OUT, CALL and JMP */
+    if (((Opcode & 0xF0) == 0x70) || ((Opcode & 0xF0) == 0xE0)) return TRUE;
+
+    switch (Opcode)
+    {
+        /* Only keep the two-byte opcodes which can't change the flow or the mode */
+        case 0x0F:
+        {
+            return !(((NextByte >= 0x90) && (NextByte <= 0x9F))     /* SETcc */
+                     || (NextByte == 0xA3) || (NextByte == 0xAB)    /* BT, BTS */
+                     || (NextByte == 0xB3) || (NextByte == 0xBB)    /* BTR, BTC */
+                     || (NextByte == 0xBA)                          /* BTx imm8 */
+                     || (NextByte == 0xA4) || (NextByte == 0xA5)    /* SHLD */
+                     || (NextByte == 0xAC) || (NextByte == 0xAD)    /* SHRD */
+                     || (NextByte == 0xAF)                          /* IMUL */
+                     || (NextByte == 0xB0) || (NextByte == 0xB1)    /* CMPXCHG */
+                     || ((NextByte >= 0xB6) && (NextByte <= 0xB7))  /* MOVZX */
+                     || ((NextByte >= 0xBC) && (NextByte <= 0xBF))  /* BSF, BSR, MOVSX */
+                     || (NextByte == 0xC0) || (NextByte == 0xC1)    /* XADD */
+                     || ((NextByte >= 0xC8) && (NextByte <= 0xCF)));/* BSWAP */
+        }
+
+        case 0x62:  /* BOUND */
+        case 0x6C:  /* INS */
+        case 0x6D:
+        case 0x6E:  /* OUTS */
+        case 0x6F:
+        case 0x9A:  /* CALL far */
+        case 0x9D:  /* POPF */
+        case 0xC2:  /* RET */
+        case 0xC3:
+        case 0xC4:  /* LES, also used for BOPs */
+        case 0xC5:  /* LDS */
+        case 0xCA:  /* RETF */
+        case 0xCB:
+        case 0xCC:  /* INT */
+        case 0xCD:
+        case 0xCE:  /* INTO */
+        case 0xCF:  /* IRET */
+        case 0xF4:  /* HLT */
+        case 0xFF:  /* CALL and JMP indirect */
+        {
+            return TRUE;
+        }
+
+        default:
+        {
+            return FALSE;
+        }
+    }
+}
+
+FORCEINLINE
+VOID
+Fast486BlockEpilog(PFAST486_STATE State)
+{
+    /* Same as the end of Fast486ExecutionControl, the trap flag being clear */
+    if (State->DoNotInterrupt)
+    {
+        /* Clear the interrupt delay flag */
+        State->DoNotInterrupt = FALSE;
+    }
+    else if (State->Flags.If && State->IntSignaled)
+    {
+        /* No longer halted */
+        State->Halted = FALSE;
+
+        /* Acknowledge the interrupt and perform it */
+        Fast486PerformInterrupt(State, State->IntAckCallback(State));
+
+        /* Clear the interrupt status */
+        State->IntSignaled = FALSE;
+    }
+}
+
+static
+ULONG
+FASTCALL
+Fast486RecordBlock(PFAST486_STATE State, ULONG Address, ULONG Count)
+{
+    FAST486_BLOCK Block;
+    PFAST486_BLOCK_ENTRY Entry;
+    FAST486_OPCODE_HANDLER_PROC CurrentHandler;
+    ULONG Executed = 0;
+    ULONG Start, OpcodeEnd, End;
+    UCHAR Opcode, NextByte;
+    BOOLEAN BlockEnd;
+
+    Block.Address = Address;
+    Block.Length = 0;
+    Block.Count = 0;
+    State->PrefetchModified = FALSE;
+
+    /* Interpret the instructions while decoding them into the block */
+    while (Executed < Count)
+    {
+        Start = Fast486GetCodeAddress(State);
+        State->SavedInstPtr = State->InstPtr;
+        State->SavedStackPtr = State->GeneralRegs[FAST486_REG_ESP];
+
+        /* Fetch the prefixes and the opcode */
+        for (;;)
+        {
+            if (!Fast486FetchByte(State, &Opcode))
+            {
+                /* Exception occurred */
+                State->PrefixFlags = 0;
+                Executed++;
+                goto Done;
+            }
+
+            CurrentHandler = Fast486OpcodeHandlers[Opcode];
+            if (CurrentHandler != Fast486OpcodePrefix) break;
+
+            CurrentHandler(State, Opcode);
+        }
+
+        /* Bring the flags up to date if this opcode might need them */
+        if (!Fast486OpcodeLazyFlags[Opcode]) Fast486MaterializeFlags(State);
+
+        OpcodeEnd = Fast486GetCodeAddress(State);
+        Entry = &Block.Entries[Block.Count];
+
+        /* The instruction must directly follow the previous one, in the prefetch cache */
+        if ((Block.Count == FAST486_BLOCK_MAX_INSTRUCTIONS)
+            || (Start != Address + Block.Length)
+            || (OpcodeEnd <= Start)
+            || ((OpcodeEnd - Address) > FAST486_CACHE_SIZE)
+            || State->PrefetchModified
+            || !Fast486IsPrefetched(State, Start, OpcodeEnd - Start))
+        {
+            /* Just execute it and stop here */
+            CurrentHandler(State, Opcode);
+            State->PrefixFlags = 0;
+            Executed++;
+            Fast486BlockEpilog(State);
+            break;
+        }
+
+        Entry->Opcode = Opcode;
+        Entry->PrefixFlags = (UCHAR)State->PrefixFlags;
+        Entry->SegmentOverride = (UCHAR)State->SegmentOverride;
+        Entry->OpcodeLength = (UCHAR)(OpcodeEnd - Start);
+        RtlCopyMemory(&Block.Bytes[Block.Length],
+                      &State->PrefetchCache[Start - State->PrefetchAddress],
+                      Entry->OpcodeLength);
+
+        /* Two-byte opcodes need to be looked at more closely */
+        if (Fast486IsPrefetched(State, OpcodeEnd, sizeof(UCHAR)))
+        {
+            NextByte = State->PrefetchCache[OpcodeEnd - State->PrefetchAddress];
+            BlockEnd = Fast486IsBlockEnd(Opcode, NextByte);
+        }
+        else
+        {
+            BlockEnd = TRUE;
+        }
+
+        /* Call the opcode handler */
+        CurrentHandler(State, Opcode);
+        State->PrefixFlags = 0;
+        Executed++;
+
+        if (BlockEnd)
+        {
+            /*
+             * The handler decodes the rest of the instruction itself, and this
+             * is the last one of the block, so the opcode is all we need.
+             */
+            Entry->NextOffset = Block.Length + Entry->OpcodeLength;
+            Block.Length = Entry->NextOffset;
+            Block.Count++;
+
+            Fast486BlockEpilog(State);
+            break;
+        }
+
+        /* Keep the operands as well, so that the next instruction is where we expect */
+        End = Fast486GetCodeAddress(State);
+        if ((End < OpcodeEnd)
+            || ((End - Address) > FAST486_CACHE_SIZE)
+            || State->PrefetchModified
+            || !Fast486IsPrefetched(State, OpcodeEnd, End - OpcodeEnd))
+        {
+            Fast486BlockEpilog(State);
+            break;
+        }
+
+        RtlCopyMemory(&Block.Bytes[Block.Length + Entry->OpcodeLength],
+                      &State->PrefetchCache[OpcodeEnd - State->PrefetchAddress],
+                      End - OpcodeEnd);
+        Entry->NextOffset = (UCHAR)(End - Address);
+        Block.Length = Entry->NextOffset;
+        Block.Count++;
+
+        Fast486BlockEpilog(State);
+        if (State->Halted || State->BopExecuted) break;
+    }
+
+Done:
+    if (Block.Count > 0)
+    {
+        /* Save the block for the next time */
+        RtlCopyMemory(&State->BlockCache->Blocks[FAST486_BLOCK_HASH(Address)],
+                      &Block,
+                      sizeof(Block));
+    }
+
+    return Executed;
+}
+
+/* PUBLIC FUNCTIONS ***********************************************************/
+
+ULONG
+FASTCALL
+Fast486ExecuteBlock(PFAST486_STATE State, ULONG Count)
+{
+    PFAST486_BLOCK Block;
+    PFAST486_BLOCK_ENTRY Entry;
+    ULONG Address, Window, Executed = 0;
+    UCHAR i, BlockCount, Opcode, NextOffset;
+
+    ASSERT(State->BlockCache != NULL);
+    ASSERT(State->PrefixFlags == 0);
+    ASSERT(!State->Flags.Tf && !State->Halted);
+    ASSERT(Count > 0);
+
+    Address = Fast486GetCodeAddress(State);
+    Block = &State->BlockCache->Blocks[FAST486_BLOCK_HASH(Address)];
+
+    if ((Block->Count == 0) || (Block->Address != Address))
+    {
+        /* Decode a new block */
+        return Fast486RecordBlock(State, Address, Count);
+    }
+
+    if (!Fast486IsPrefetched(State, Address, Block->Length))
+    {
+        /* Prefetch the code of the block */
+        State->PrefetchValid = FALSE;
+        State->SavedInstPtr = State->InstPtr;
+        State->SavedStackPtr = State->GeneralRegs[FAST486_REG_ESP];
+
+        if (!Fast486ReadMemory(State,
+                               FAST486_REG_CS,
+                               State->SegmentRegs[FAST486_REG_CS].Size
+                               ? State->InstPtr.Long : State->InstPtr.LowWord,
+                               TRUE,
+                               &Opcode,
+                               sizeof(UCHAR)))
+        {
+            /* Exception occurred */
+            State->PrefixFlags = 0;
+            return 1;
+        }
+
+        if (!Fast486IsPrefetched(State, Address, Block->Length))
+        {
+            /* It can't be prefetched as a whole, interpret it */
+            return Fast486RecordBlock(State, Address, Count);
+        }
+    }
+
+    /* Make sure the code didn't change since it was decoded */
+    if (RtlCompareMemory(&State->PrefetchCache[Address - State->PrefetchAddress],
+                         Block->Bytes,
+                         Block->Length) != Block->Length)
+    {
+        return Fast486RecordBlock(State, Address, Count);
+    }
+
+    Window = State->PrefetchAddress;
+    State->PrefetchModified = FALSE;
+
+    /*
+     * The handlers can reenter the emulator (BOPs), which may replace this
+     * block, so don't look at it again after the last instruction.
+     */
+    BlockCount = Block->Count;
+
+    for (i = 0; i < BlockCount; i++)
+    {
+        Entry = &Block->Entries[i];
+        Opcode = Entry->Opcode;
+        NextOffset = Entry->NextOffset;
+
+        State->SavedInstPtr = State->InstPtr;
+        State->SavedStackPtr = State->GeneralRegs[FAST486_REG_ESP];
+
+        /* Skip the prefixes and the opcode, as if they had been fetched */
+        if (State->SegmentRegs[FAST486_REG_CS].Size) State->InstPtr.Long += Entry->OpcodeLength;
+        else State->InstPtr.LowWord += Entry->OpcodeLength;
+
+        State->PrefixFlags = Entry->PrefixFlags;
+        State->SegmentOverride = Entry->SegmentOverride;
+
+        if (!Fast486OpcodeLazyFlags[Opcode]) Fast486MaterializeFlags(State);
+
+        /* Call the opcode handler */
+        Fast486OpcodeHandlers[Opcode](State, Opcode);
+        State->PrefixFlags = 0;
+        Executed++;
+
+        Fast486BlockEpilog(State);
+
+        /* Leave the block if the flow or the code changed */
+        if ((Executed == Count)
+            || (Fast486GetCodeAddress(State) != Address + NextOffset)
+            || State->PrefetchModified
+            || !State->PrefetchValid
+            || (State->PrefetchAddress != Window)
+            || State->Halted
+            || State->BopExecuted)
+        {
+            break;
+        }
+    }
+
+    return Executed;
+}
+
+#endif
+
+/* EOF */
@@ -0,0 +1,47 @@
+/*
+ * Fast486 386/486 CPU Emulation Library
+ * blocks.h
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _BLOCKS_H_
+#define _BLOCKS_H_
+
+#pragma once
+
+/* DEFINES ********************************************************************/
+
+#define FAST486_BLOCK_HASH(x) ((((x) >> 12) ^ (x)) & (FAST486_NUM_BLOCKS - 1))
+
+/* FUNCTIONS ******************************************************************/
+
+#ifndef FAST486_NO_PREFETCH
+
+ULONG
+FASTCALL
+Fast486ExecuteBlock
+(
+    PFAST486_STATE State,
+    ULONG Count
+);
+
+#endif
+
+#endif // _BLOCKS_H_
+
+/* EOF */
@@ -1013,6 +1013,127 @@ Fast486CalculateParity(UCHAR Number)
     return (0x9669 >> ((Number & 0x0F) ^ (Number >> 4))) & 1;
 }
 
+FORCEINLINE
+BOOLEAN
+FASTCALL
+Fast486GetLazyCarry(PFAST486_STATE State)
+{
+    PFAST486_LAZY_FLAGS LazyFlags = &State->LazyFlags;
+
+    switch (LazyFlags->Operation)
+    {
+        case FAST486_LAZY_ADD:
+            return (LazyFlags->Result < LazyFlags->FirstValue)
+                   && (LazyFlags->Result < LazyFlags->SecondValue);
+
+        case FAST486_LAZY_SUB:
+            return (LazyFlags->FirstValue < LazyFlags->SecondValue);
+
+        case FAST486_LAZY_LOGIC:
+            return FALSE;
+
+        default:
+            return State->Flags.Cf;
+    }
+}
+
+FORCEINLINE
+BOOLEAN
+FASTCALL
+Fast486GetLazyAuxCarry(PFAST486_STATE State)
+{
+    PFAST486_LAZY_FLAGS LazyFlags = &State->LazyFlags;
+
+    switch (LazyFlags->Operation)
+    {
+        case FAST486_LAZY_ADD:
+        case FAST486_LAZY_SUB:
+        case FAST486_LAZY_INC:
+        case FAST486_LAZY_DEC:
+            /* The carry (or borrow) out of the low nibble */
+            return ((LazyFlags->FirstValue
+                    ^ LazyFlags->SecondValue
+                    ^ LazyFlags->Result) & 0x10) != 0;
+
+        default:
+            return State->Flags.Af;
+    }
+}
+
+FORCEINLINE
+VOID
+FASTCALL
+Fast486SetLazyFlags(PFAST486_STATE State,
+                    FAST486_LAZY_OPERATION Operation,
+                    ULONG FirstValue,
+                    ULONG SecondValue,
+                    ULONG Result,
+                    ULONG SignFlag)
+{
+    /* Save the flags this operation doesn't change before they're lost */
+    if (Operation == FAST486_LAZY_LOGIC)
+    {
+        State->Flags.Af = Fast486GetLazyAuxCarry(State);
+    }
+    else if ((Operation == FAST486_LAZY_INC) || (Operation == FAST486_LAZY_DEC))
+    {
+        State->Flags.Cf = Fast486GetLazyCarry(State);
+    }
+
+    State->LazyFlags.FirstValue = FirstValue;
+    State->LazyFlags.SecondValue = SecondValue;
+    State->LazyFlags.Result = Result;
+    State->LazyFlags.SignFlag = SignFlag;
+    State->LazyFlags.Operation = Operation;
+}
+
+FORCEINLINE
+VOID
+FASTCALL
+Fast486MaterializeFlags(PFAST486_STATE State)
+{
+    PFAST486_LAZY_FLAGS LazyFlags = &State->LazyFlags;
+    ULONG FirstSign, SecondSign, ResultSign;
+
+    if (LazyFlags->Operation == FAST486_LAZY_NONE) return;
+
+    FirstSign = LazyFlags->FirstValue & LazyFlags->SignFlag;
+    SecondSign = LazyFlags->SecondValue & LazyFlags->SignFlag;
+    ResultSign = LazyFlags->Result & LazyFlags->SignFlag;
+
+    switch (LazyFlags->Operation)
+    {
+        case FAST486_LAZY_ADD:
+        case FAST486_LAZY_INC:
+        {
+            State->Flags.Of = (FirstSign == SecondSign) && (FirstSign != ResultSign);
+            break;
+        }
+
+        case FAST486_LAZY_SUB:
+        case FAST486_LAZY_DEC:
+        {
+            State->Flags.Of = (FirstSign != SecondSign) && (FirstSign != ResultSign);
+            break;
+        }
+
+        default:
+        {
+            State->Flags.Of = FALSE;
+            break;
+        }
+    }
+
+    /* INC and DEC already saved CF, logic operations already saved AF */
+    State->Flags.Cf = Fast486GetLazyCarry(State);
+    State->Flags.Af = Fast486GetLazyAuxCarry(State);
+    State->Flags.Zf = (LazyFlags->Result == 0);
+    State->Flags.Sf = (ResultSign != 0);
+    State->Flags.Pf = Fast486CalculateParity(LOBYTE(LazyFlags->Result));
+
+    LazyFlags->Operation = FAST486_LAZY_NONE;
+}
+
 FORCEINLINE
 BOOLEAN
 FASTCALL
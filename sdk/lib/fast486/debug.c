@@ -29,6 +29,7 @@
 #include <fast486.h>
 #include "common.h"
 #include "opcodes.h"
+#include "blocks.h"
 #include "fpu.h"
 
 /* DEFINES ********************************************************************/
@@ -78,6 +79,9 @@ NextInst:
 
             // TODO: Check for CALL/RET to update ProcedureCallCount.
 
+            /* Bring the flags up to date if this opcode might need them */
+            if (!Fast486OpcodeLazyFlags[Opcode]) Fast486MaterializeFlags(State);
+
             /* Call the opcode handler */
             CurrentHandler = Fast486OpcodeHandlers[Opcode];
             CurrentHandler(State, Opcode);
@@ -118,6 +122,9 @@ NextInst:
     while ((Command == FAST486_CONTINUE) ||
            (Command == FAST486_STEP_OVER && ProcedureCallCount > 0) ||
            (Command == FAST486_STEP_OUT && ProcedureCallCount >= 0));
+
+    /* The caller may look at the flags */
+    Fast486MaterializeFlags(State);
 }
 
 /* PUBLIC FUNCTIONS ***********************************************************/
@@ -126,6 +133,8 @@ VOID
 NTAPI
 Fast486DumpState(PFAST486_STATE State)
 {
+    Fast486MaterializeFlags(State);
+
     DbgPrint("\nFast486DumpState -->\n");
     DbgPrint("\nCPU currently executing in %s mode at %04X:%08X\n",
             (State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_PE) ? "protected" : "real",
@@ -251,6 +260,42 @@ Fast486StepInto(PFAST486_STATE State)
     Fast486ExecutionControl(State, FAST486_STEP_INTO);
 }
 
+ULONG
+NTAPI
+Fast486Run(PFAST486_STATE State, ULONG Count)
+{
+    ULONG Executed = 0;
+
+    /* Run until enough instructions were executed, or a BOP needs the host */
+    State->BopExecuted = FALSE;
+    while (Executed < Count)
+    {
+#ifndef FAST486_NO_PREFETCH
+        /* Use the decoded blocks, unless single-stepping or halted */
+        if ((State->BlockCache != NULL)
+            && (State->PrefixFlags == 0)
+            && !State->Flags.Tf
+            && !State->Halted)
+        {
+            Executed += Fast486ExecuteBlock(State, Count - Executed);
+        }
+        else
+#endif
+        {
+            Fast486ExecutionControl(State, FAST486_STEP_INTO);
+            Executed++;
+        }
+
+        if (State->BopExecuted) break;
+    }
+
+    /* The caller may look at the flags */
+    Fast486MaterializeFlags(State);
+
+    State->BopExecuted = FALSE;
+    return Executed;
+}
+
 VOID
 NTAPI
 Fast486StepOver(PFAST486_STATE State)
@@ -108,7 +108,8 @@ Fast486Initialize(PFAST486_STATE         State,
                   FAST486_BOP_PROC       BopCallback,
                   FAST486_INT_ACK_PROC   IntAckCallback,
                   FAST486_FPU_PROC       FpuCallback,
-                  PULONG                 Tlb)
+                  PULONG                 Tlb,
+                  PFAST486_BLOCK_CACHE   BlockCache)
 {
     /* Set the callbacks (or use default ones if some are NULL) */
     State->MemReadCallback  = (MemReadCallback  ? MemReadCallback  : Fast486MemReadCallback );
@@ -122,6 +123,17 @@ Fast486Initialize(PFAST486_STATE         State,
     /* Set the TLB (if given) */
     State->Tlb = Tlb;
 
+#ifndef FAST486_NO_PREFETCH
+    /* Set the block cache (if given) */
+    State->BlockCache = BlockCache;
+
+    if (BlockCache != NULL)
+    {
+        /* Start with no decoded blocks */
+        RtlZeroMemory(BlockCache, sizeof(*BlockCache));
+    }
+#endif
+
     /* Reset the CPU */
     Fast486Reset(State);
 }
@@ -132,7 +144,7 @@ Fast486Reset(PFAST486_STATE State)
 {
     FAST486_SEG_REGS i;
 
-    /* Save the callbacks and TLB */
+    /* Save the callbacks, TLB and block cache */
     FAST486_MEM_READ_PROC  MemReadCallback  = State->MemReadCallback;
     FAST486_MEM_WRITE_PROC MemWriteCallback = State->MemWriteCallback;
     FAST486_IO_READ_PROC   IoReadCallback   = State->IoReadCallback;
@@ -141,6 +153,9 @@ Fast486Reset(PFAST486_STATE State)
     FAST486_INT_ACK_PROC   IntAckCallback   = State->IntAckCallback;
     FAST486_FPU_PROC       FpuCallback      = State->FpuCallback;
     PULONG                 Tlb              = State->Tlb;
+#ifndef FAST486_NO_PREFETCH
+    PFAST486_BLOCK_CACHE   BlockCache       = State->BlockCache;
+#endif
 
     /* Clear the entire structure */
     RtlZeroMemory(State, sizeof(*State));
@@ -186,7 +201,7 @@ Fast486Reset(PFAST486_STATE State)
     State->FpuTag = 0xFFFF;
 #endif
 
-    /* Restore the callbacks and TLB */
+    /* Restore the callbacks, TLB and block cache */
     State->MemReadCallback  = MemReadCallback;
     State->MemWriteCallback = MemWriteCallback;
     State->IoReadCallback   = IoReadCallback;
@@ -195,6 +210,9 @@ Fast486Reset(PFAST486_STATE State)
     State->IntAckCallback   = IntAckCallback;
     State->FpuCallback      = FpuCallback;
     State->Tlb              = Tlb;
+#ifndef FAST486_NO_PREFETCH
+    State->BlockCache       = BlockCache;
+#endif
 
     /* Flush the TLB */
     Fast486FlushTlb(State);
@@ -296,6 +296,48 @@ Fast486OpcodeHandlers[FAST486_NUM_OPCODE_HANDLERS] =
     Fast486OpcodeGroupFF,               /* 0xFF */
 };
 
+/*
+ * Opcodes that never look at the arithmetic flags. The flags of the last
+ * arithmetic instruction stay pending while only these are executed, anything
+ * else brings them up to date first.
+ */
+const BOOLEAN
+Fast486OpcodeLazyFlags[FAST486_NUM_OPCODE_HANDLERS] =
+{
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  FALSE, FALSE,   /* 0x00 - 0x07 */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  FALSE, FALSE,   /* 0x08 - 0x0F */
+    FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,   /* 0x10 - 0x17 */
+    FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,   /* 0x18 - 0x1F */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  FALSE,   /* 0x20 - 0x27 */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  FALSE,   /* 0x28 - 0x2F */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  FALSE,   /* 0x30 - 0x37 */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  FALSE,   /* 0x38 - 0x3F */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 0x40 - 0x47 */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 0x48 - 0x4F */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 0x50 - 0x57 */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 0x58 - 0x5F */
+    FALSE, FALSE, FALSE, FALSE, TRUE,  TRUE,  TRUE,  TRUE,    /* 0x60 - 0x67 */
+    TRUE,  FALSE, TRUE,  FALSE, FALSE, FALSE, FALSE, FALSE,   /* 0x68 - 0x6F */
+    FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,   /* 0x70 - 0x77 */
+    FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,   /* 0x78 - 0x7F */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 0x80 - 0x87 */
+    TRUE,  TRUE,  TRUE,  TRUE,  FALSE, TRUE,  FALSE, FALSE,   /* 0x88 - 0x8F */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 0x90 - 0x97 */
+    TRUE,  TRUE,  FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,   /* 0x98 - 0x9F */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  FALSE, FALSE,   /* 0xA0 - 0xA7 */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  FALSE, FALSE,   /* 0xA8 - 0xAF */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 0xB0 - 0xB7 */
+    TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,  TRUE,    /* 0xB8 - 0xBF */
+    FALSE, FALSE, TRUE,  TRUE,  FALSE, FALSE, TRUE,  TRUE,    /* 0xC0 - 0xC7 */
+    FALSE, TRUE,  FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,   /* 0xC8 - 0xCF */
+    FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,   /* 0xD0 - 0xD7 */
+    FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,   /* 0xD8 - 0xDF */
+    FALSE, FALSE, FALSE, TRUE,  FALSE, FALSE, FALSE, FALSE,   /* 0xE0 - 0xE7 */
+    TRUE,  TRUE,  FALSE, TRUE,  FALSE, FALSE, FALSE, FALSE,   /* 0xE8 - 0xEF */
+    TRUE,  FALSE, TRUE,  TRUE,  FALSE, FALSE, FALSE, FALSE,   /* 0xF0 - 0xF7 */
+    FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,   /* 0xF8 - 0xFF */
+};
+
 /* PUBLIC FUNCTIONS ***********************************************************/
 
 FAST486_OPCODE_HANDLER(Fast486OpcodeInvalid)
@@ -410,7 +452,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodePrefix)
 
 FAST486_OPCODE_HANDLER(Fast486OpcodeIncrement)
 {
-    ULONG Value;
+    ULONG Value, SignFlag;
     BOOLEAN Size = State->SegmentRegs[FAST486_REG_CS].Size;
 
     TOGGLE_OPSIZE(Size);
@@ -422,26 +464,26 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeIncrement)
     if (Size)
     {
         Value = ++State->GeneralRegs[Opcode & 0x07].Long;
-
-        State->Flags.Of = (Value == SIGN_FLAG_LONG);
-        State->Flags.Sf = ((Value & SIGN_FLAG_LONG) != 0);
+        SignFlag = SIGN_FLAG_LONG;
     }
     else
     {
         Value = ++State->GeneralRegs[Opcode & 0x07].LowWord;
-
-        State->Flags.Of = (Value == SIGN_FLAG_WORD);
-        State->Flags.Sf = ((Value & SIGN_FLAG_WORD) != 0);
+        SignFlag = SIGN_FLAG_WORD;
     }
 
-    State->Flags.Zf = (Value == 0);
-    State->Flags.Af = ((Value & 0x0F) == 0);
-    State->Flags.Pf = Fast486CalculateParity(LOBYTE(Value));
+    /* Update the flags */
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_INC,
+                        Value - 1,
+                        1,
+                        Value,
+                        SignFlag);
 }
 
 FAST486_OPCODE_HANDLER(Fast486OpcodeDecrement)
 {
-    ULONG Value;
+    ULONG Value, SignFlag;
     BOOLEAN Size = State->SegmentRegs[FAST486_REG_CS].Size;
 
     TOGGLE_OPSIZE(Size);
@@ -453,21 +495,21 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeDecrement)
     if (Size)
     {
         Value = --State->GeneralRegs[Opcode & 0x07].Long;
-
-        State->Flags.Of = (Value == (SIGN_FLAG_LONG - 1));
-        State->Flags.Sf = ((Value & SIGN_FLAG_LONG) != 0);
+        SignFlag = SIGN_FLAG_LONG;
     }
     else
     {
         Value = --State->GeneralRegs[Opcode & 0x07].LowWord;
-
-        State->Flags.Of = (Value == (SIGN_FLAG_WORD - 1));
-        State->Flags.Sf = ((Value & SIGN_FLAG_WORD) != 0);
+        SignFlag = SIGN_FLAG_WORD;
     }
 
-    State->Flags.Zf = (Value == 0);
-    State->Flags.Af = ((Value & 0x0F) == 0x0F);
-    State->Flags.Pf = Fast486CalculateParity(LOBYTE(Value));
+    /* Update the flags */
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_DEC,
+                        Value + 1,
+                        1,
+                        Value,
+                        SignFlag);
 }
 
 FAST486_OPCODE_HANDLER(Fast486OpcodePushReg)
@@ -1066,13 +1108,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddByteModrm)
     Result = FirstValue + SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) == (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_ADD,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 
     /* Write back the result */
     Fast486WriteModrmByteOperands(State,
@@ -1119,13 +1160,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddModrm)
         Result = FirstValue + SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) == (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_ADD,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
 
         /* Write back the result */
         Fast486WriteModrmDwordOperands(State,
@@ -1150,13 +1190,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddModrm)
         Result = FirstValue + SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) == (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_ADD,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
 
         /* Write back the result */
         Fast486WriteModrmWordOperands(State,
@@ -1186,13 +1225,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddAl)
     Result = FirstValue + SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) == (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_ADD,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 
     /* Write back the result */
     State->GeneralRegs[FAST486_REG_EAX].LowByte = Result;
@@ -1223,13 +1261,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddEax)
         Result = FirstValue + SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) == (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_ADD,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].Long = Result;
@@ -1249,13 +1286,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddEax)
         Result = FirstValue + SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) == (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_ADD,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].LowWord = Result;
@@ -1293,11 +1329,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrByteModrm)
     Result = FirstValue | SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_LOGIC,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 
     /* Write back the result */
     Fast486WriteModrmByteOperands(State,
@@ -1344,11 +1381,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrModrm)
         Result = FirstValue | SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
 
         /* Write back the result */
         Fast486WriteModrmDwordOperands(State,
@@ -1373,11 +1411,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrModrm)
         Result = FirstValue | SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
 
         /* Write back the result */
         Fast486WriteModrmWordOperands(State,
@@ -1407,11 +1446,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrAl)
     Result = FirstValue | SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_LOGIC,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 
     /* Write back the result */
     State->GeneralRegs[FAST486_REG_EAX].LowByte = Result;
@@ -1442,11 +1482,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrEax)
         Result = FirstValue | SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].Long = Result;
@@ -1466,11 +1507,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrEax)
         Result = FirstValue | SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].LowWord = Result;
@@ -1508,11 +1550,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndByteModrm)
     Result = FirstValue & SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_LOGIC,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 
     /* Write back the result */
     Fast486WriteModrmByteOperands(State,
@@ -1559,11 +1602,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndModrm)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
 
         /* Write back the result */
         Fast486WriteModrmDwordOperands(State,
@@ -1588,11 +1632,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndModrm)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
 
         /* Write back the result */
         Fast486WriteModrmWordOperands(State,
@@ -1622,11 +1667,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndAl)
     Result = FirstValue & SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_LOGIC,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 
     /* Write back the result */
     State->GeneralRegs[FAST486_REG_EAX].LowByte = Result;
@@ -1657,11 +1703,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndEax)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].Long = Result;
@@ -1681,11 +1728,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndEax)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].LowWord = Result;
@@ -1723,11 +1771,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorByteModrm)
     Result = FirstValue ^ SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_LOGIC,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 
     /* Write back the result */
     Fast486WriteModrmByteOperands(State,
@@ -1774,11 +1823,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorModrm)
         Result = FirstValue ^ SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
 
         /* Write back the result */
         Fast486WriteModrmDwordOperands(State,
@@ -1803,11 +1853,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorModrm)
         Result = FirstValue ^ SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
 
         /* Write back the result */
         Fast486WriteModrmWordOperands(State,
@@ -1837,11 +1888,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorAl)
     Result = FirstValue ^ SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_LOGIC,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 
     /* Write back the result */
     State->GeneralRegs[FAST486_REG_EAX].LowByte = Result;
@@ -1872,11 +1924,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorEax)
         Result = FirstValue ^ SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].Long = Result;
@@ -1896,11 +1949,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorEax)
         Result = FirstValue ^ SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].LowWord = Result;
@@ -1937,11 +1991,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestByteModrm)
     Result = FirstValue & SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_LOGIC,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 }
 
 FAST486_OPCODE_HANDLER(Fast486OpcodeTestModrm)
@@ -1982,11 +2037,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestModrm)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
     }
     else
     {
@@ -2005,11 +2061,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestModrm)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
     }
 }
 
@@ -2033,11 +2090,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestAl)
     Result = FirstValue & SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_LOGIC,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 }
 
 FAST486_OPCODE_HANDLER(Fast486OpcodeTestEax)
@@ -2065,11 +2123,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestEax)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
     }
     else
     {
@@ -2086,11 +2145,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestEax)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_LOGIC,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
     }
 }
 
@@ -2872,13 +2932,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubByteModrm)
     Result = FirstValue - SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = (FirstValue < SecondValue);
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) != (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_SUB,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 
     /* Check if this is not a CMP */
     if (!(Opcode & 0x10))
@@ -2936,13 +2995,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubModrm)
         Result = FirstValue - SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) != (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_SUB,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
 
         /* Check if this is not a CMP */
         if (!(Opcode & 0x10))
@@ -2978,13 +3036,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubModrm)
         Result = FirstValue - SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) != (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_SUB,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
 
         /* Check if this is not a CMP */
         if (!(Opcode & 0x10))
@@ -3018,13 +3075,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubAl)
     Result = FirstValue - SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = (FirstValue < SecondValue);
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) != (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State,
+                        FAST486_LAZY_SUB,
+                        FirstValue,
+                        SecondValue,
+                        Result,
+                        SIGN_FLAG_BYTE);
 
     /* Check if this is not a CMP */
     if (!(Opcode & 0x10))
@@ -3059,13 +3115,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubEax)
         Result = FirstValue - SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) != (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_SUB,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_LONG);
 
         /* Check if this is not a CMP */
         if (!(Opcode & 0x10))
@@ -3089,13 +3144,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubEax)
         Result = FirstValue - SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) != (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State,
+                            FAST486_LAZY_SUB,
+                            FirstValue,
+                            SecondValue,
+                            Result,
+                            SIGN_FLAG_WORD);
 
         /* Check if this is not a CMP */
         if (!(Opcode & 0x10))
@@ -4148,6 +4202,9 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeLdsLes)
             /* Call the BOP handler */
             State->BopCallback(State, BopCode);
 
+            /* Let Fast486Run return to the host */
+            State->BopExecuted = TRUE;
+
             /*
              * If an interrupt should occur at this time, delay it.
              * We must do this because if an interrupt begins and the BOP callback
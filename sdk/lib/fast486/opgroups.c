@@ -56,28 +56,36 @@ Fast486ArithmeticOperation(PFAST486_STATE State,
         case 0:
         {
             Result = (FirstValue + SecondValue) & MaxValue;
-
-            /* Update CF, OF and AF */
-            State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-            State->Flags.Of = ((FirstValue & SignFlag) == (SecondValue & SignFlag))
-                              && ((FirstValue & SignFlag) != (Result & SignFlag));
-            State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-
-            break;
+            Fast486SetLazyFlags(State,
+                                FAST486_LAZY_ADD,
+                                FirstValue,
+                                SecondValue,
+                                Result,
+                                SignFlag);
+            return Result;
         }
 
         /* OR */
         case 1:
         {
             Result = FirstValue | SecondValue;
-            State->Flags.Cf = State->Flags.Of = FALSE;
-            break;
+            Fast486SetLazyFlags(State,
+                                FAST486_LAZY_LOGIC,
+                                FirstValue,
+                                SecondValue,
+                                Result,
+                                SignFlag);
+            return Result;
         }
 
         /* ADC */
         case 2:
         {
-            INT Carry = State->Flags.Cf ? 1 : 0;
+            INT Carry;
+
+            /* This one needs CF, and sets the flags right away */
+            Fast486MaterializeFlags(State);
+            Carry = State->Flags.Cf ? 1 : 0;
 
             Result = (FirstValue + SecondValue + Carry) & MaxValue;
 
@@ -94,7 +102,11 @@ Fast486ArithmeticOperation(PFAST486_STATE State,
         /* SBB */
         case 3:
         {
-            INT Carry = State->Flags.Cf ? 1 : 0;
+            INT Carry;
+
+            /* This one needs CF, and sets the flags right away */
+            Fast486MaterializeFlags(State);
+            Carry = State->Flags.Cf ? 1 : 0;
 
             Result = (FirstValue - SecondValue - Carry) & MaxValue;
 
@@ -113,8 +125,13 @@ Fast486ArithmeticOperation(PFAST486_STATE State,
         case 4:
         {
             Result = FirstValue & SecondValue;
-            State->Flags.Cf = State->Flags.Of = FALSE;
-            break;
+            Fast486SetLazyFlags(State,
+                                FAST486_LAZY_LOGIC,
+                                FirstValue,
+                                SecondValue,
+                                Result,
+                                SignFlag);
+            return Result;
         }
 
         /* SUB or CMP */
@@ -122,28 +139,33 @@ Fast486ArithmeticOperation(PFAST486_STATE State,
         case 7:
         {
             Result = (FirstValue - SecondValue) & MaxValue;
-
-            /* Update CF, OF and AF */
-            State->Flags.Cf = (FirstValue < SecondValue);
-            State->Flags.Of = ((FirstValue & SignFlag) != (SecondValue & SignFlag))
-                              && ((FirstValue & SignFlag) != (Result & SignFlag));
-            State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-
-            break;
+            Fast486SetLazyFlags(State,
+                                FAST486_LAZY_SUB,
+                                FirstValue,
+                                SecondValue,
+                                Result,
+                                SignFlag);
+            return Result;
         }
 
         /* XOR */
         case 6:
         {
             Result = FirstValue ^ SecondValue;
-            State->Flags.Cf = State->Flags.Of = FALSE;
-            break;
+            Fast486SetLazyFlags(State,
+                                FAST486_LAZY_LOGIC,
+                                FirstValue,
+                                SecondValue,
+                                Result,
+                                SignFlag);
+            return Result;
         }
 
         default:
         {
             /* Shouldn't happen */
             ASSERT(FALSE);
+            return 0;
         }
     }
 
@@ -16,6 +16,12 @@
 
 #define MAX_STATIC_CS_DEBUG_OBJECTS 64
 
+/* The upper byte of the spin count is reserved for flags */
+#define RTL_CRITSECT_SPIN_COUNT_MASK 0x00FFFFFF
+
+/* Spin limit used for a lock whose history has not been recorded yet */
+#define RTL_CRITSECT_MIN_SPIN_LIMIT 16
+
 static RTL_CRITICAL_SECTION RtlCriticalSectionLock;
 static LIST_ENTRY RtlCriticalSectionList;
 static BOOLEAN RtlpCritSectInitialized = FALSE;
@@ -247,6 +253,81 @@ RtlpUnWaitCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
     }
 }
 
+/*++
+ * RtlpSpinOnCriticalSection
+ *
+ *     Spins for a while to acquire a critical section owned by another thread.
+ *
+ * Params:
+ *     CriticalSection - Critical section to acquire.
+ *
+ * Returns:
+ *     TRUE if the critical section was acquired, FALSE if the caller must
+ *     queue up as a waiter.
+ *
+ * Remarks:
+ *     Only called when another thread owns the critical section. The spin
+ *     limit adapts to how long the lock was held the last times it was
+ *     contended: it is twice the average number of iterations that the recent
+ *     successful spins needed, never more than the spin count set for the
+ *     critical section. The average is kept in the SpareWORD member of the
+ *     debug data, so locks without debug data always spin to the limit.
+ *     Spinning stops as soon as other threads are waiting, because the lock
+ *     is handed over to them when it is released.
+ *
+ *--*/
+static
+BOOLEAN
+RtlpSpinOnCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
+{
+    PRTL_CRITICAL_SECTION_DEBUG DebugInfo = CriticalSection->DebugInfo;
+    ULONG MaxSpins, SpinLimit, Spins;
+    LONG AverageSpins = 0;
+    BOOLEAN Acquired = FALSE;
+
+    /* Get the most the caller allows us to spin */
+    MaxSpins = (ULONG)CriticalSection->SpinCount & RTL_CRITSECT_SPIN_COUNT_MASK;
+    SpinLimit = MaxSpins;
+
+    /* Shorten it to what this lock usually needed */
+    if (DebugInfo)
+    {
+        AverageSpins = DebugInfo->SpareWORD;
+        SpinLimit = min(MaxSpins, 2 * (ULONG)AverageSpins + RTL_CRITSECT_MIN_SPIN_LIMIT);
+    }
+
+    for (Spins = 0; Spins < SpinLimit; Spins++)
+    {
+        /* Only try to grab it when it looks free, to keep the cache line shared */
+        if ((CriticalSection->LockCount == -1) &&
+            (InterlockedCompareExchange(&CriticalSection->LockCount, 0, -1) == -1))
+        {
+            Acquired = TRUE;
+            break;
+        }
+
+        /* Give up if somebody is waiting already, it's going to be next */
+        if (CriticalSection->LockCount > 0) break;
+
+        /* Let the other hardware thread run */
+        YieldProcessor();
+    }
+
+    /*
+     * Fold the iterations of a successful spin into the average. This is a
+     * hint only, so racing with other threads here is harmless, but the line
+     * is only written when the average actually moves.
+     */
+    if (DebugInfo && Acquired)
+    {
+        Spins = min(Spins + 1, MAXUSHORT);
+        Spins = AverageSpins + ((LONG)Spins - AverageSpins) / 8;
+        if (Spins != (ULONG)AverageSpins) DebugInfo->SpareWORD = (WORD)Spins;
+    }
+
+    return Acquired;
+}
+
 /*++
  * RtlpInitDeferedCriticalSection
  *
@@ -477,7 +558,8 @@ RtlSetCriticalSectionSpinCount(PRTL_CRITICAL_SECTION CriticalSection,
  *     STATUS_SUCCESS.
  *
  * Remarks:
- *     Uses a fast-path unless contention happens.
+ *     Uses a fast-path unless contention happens. Contended critical sections
+ *     with a spin count spin before waiting.
  *
  *--*/
 NTSTATUS
@@ -486,6 +568,22 @@ RtlEnterCriticalSection(PRTL_CRITICAL_SECTION CriticalSection)
 {
     HANDLE Thread = (HANDLE)NtCurrentTeb()->ClientId.UniqueThread;
 
+    /*
+     * On MP systems, take it right away if it's free, and otherwise spin a
+     * bit while another thread owns it. Short contention is then resolved
+     * without waiting on the event and switching context.
+     */
+    if ((CriticalSection->SpinCount) &&
+        (Thread != CriticalSection->OwningThread) &&
+        ((InterlockedCompareExchange(&CriticalSection->LockCount, 0, -1) == -1) ||
+         (RtlpSpinOnCriticalSection(CriticalSection))))
+    {
+        /* Got it */
+        CriticalSection->OwningThread = Thread;
+        CriticalSection->RecursionCount = 1;
+        return STATUS_SUCCESS;
+    }
+
     /* Try to lock it */
     if (InterlockedIncrement(&CriticalSection->LockCount) != 0)
     {
@@ -598,6 +696,7 @@ RtlInitializeCriticalSectionAndSpinCount(PRTL_CRITICAL_SECTION CriticalSection,
     CritcalSectionDebugData->EntryCount = 0;
     CritcalSectionDebugData->CriticalSection = CriticalSection;
     CritcalSectionDebugData->Flags = 0;
+    CritcalSectionDebugData->SpareWORD = 0;
     CriticalSection->DebugInfo = CritcalSectionDebugData;
 
     /*
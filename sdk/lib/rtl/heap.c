@@ -155,6 +155,10 @@ RtlpInitializeHeap(OUT PHEAP Heap,
     Heap->MaximumAllocationSize = Parameters->MaximumAllocationSize;
     Heap->CommitRoutine = Parameters->CommitRoutine;
 
+    /* No front end until someone asks for it */
+    Heap->FrontEndHeap = NULL;
+    Heap->FrontEndHeapType = HEAP_FRONT_END_NONE;
+
     /* Initialise the Heap validation info */
     Heap->HeaderValidateCopy = NULL;
     Heap->HeaderValidateLength = (USHORT)HeaderSize;
@@ -1977,6 +1981,24 @@ RtlAllocateHeap(IN PVOID HeapPtr,
 
     Index = AllocationSize >> HEAP_ENTRY_SHIFT;
 
+    /* Small blocks come from the low fragmentation front end, if enabled */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH &&
+        Index < HEAP_LFH_BUCKETS &&
+        !(EntryFlags & HEAP_ENTRY_EXTRA_PRESENT))
+    {
+        InUseEntry = RtlpLfhAllocate(Heap, Index, EntryFlags, (UCHAR)(AllocationSize - Size));
+        if (InUseEntry)
+        {
+            /* Zero memory if that was requested */
+            if (Flags & HEAP_ZERO_MEMORY)
+                RtlZeroMemory(InUseEntry + 1, Size);
+
+            return InUseEntry + 1;
+        }
+
+        /* Otherwise let the backend try, and fail properly */
+    }
+
     /* Acquire the lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -2180,6 +2202,10 @@ BOOLEAN NTAPI RtlFreeHeap(
     if (RtlpHeapIsSpecial(Flags))
         return RtlDebugFreeHeap(Heap, Flags, Ptr);
 
+    /* Blocks of the low fragmentation front end go back to it, lock-free */
+    if (RtlpIsLfhEntry((PHEAP_ENTRY)Ptr - 1))
+        return RtlpLfhFree(Heap, (PHEAP_ENTRY)Ptr - 1);
+
     /* Lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -2192,7 +2218,7 @@ BOOLEAN NTAPI RtlFreeHeap(
 
     /* Check this entry, fail if it's invalid */
     if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY) ||
-        (((ULONG_PTR)Ptr & 0x7) != 0) ||
+        (((ULONG_PTR)Ptr & (HEAP_ENTRY_SIZE - 1)) != 0) ||
         (HeapEntry->SegmentOffset >= HEAP_SEGMENTS))
     {
         /* This is an invalid block */
@@ -2590,6 +2616,10 @@ RtlReAllocateHeap(HANDLE HeapPtr,
         return NULL;
     }
 
+    /* Blocks of the low fragmentation front end have a fixed size */
+    if (RtlpIsLfhEntry((PHEAP_ENTRY)Ptr - 1))
+        return RtlpLfhReAllocate(Heap, Flags, Ptr, Size);
+
     /* Calculate allocation size and index */
     if (Size)
         AllocationSize = Size;
@@ -3154,6 +3184,9 @@ RtlpValidateHeapEntry(
     if ((ULONG_PTR)HeapEntry & (HEAP_ENTRY_SIZE - 1)) goto invalid_entry;
     if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY)) goto invalid_entry;
 
+    /* Front end blocks live inside busy backend blocks */
+    if (RtlpIsLfhEntry(HeapEntry)) return RtlpLfhValidateEntry(Heap, HeapEntry);
+
     BigAllocation = HeapEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC;
     Segment = Heap->Segments[HeapEntry->SegmentOffset];
 
@@ -3532,6 +3565,13 @@ RtlpValidateHeap(PHEAP Heap,
         return FALSE;
     }
 
+    /* Check the front end blocks too */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH &&
+        !RtlpLfhValidate(Heap))
+    {
+        return FALSE;
+    }
+
     return TRUE;
 }
 
@@ -3918,13 +3958,17 @@ RtlSetHeapInformation(IN HANDLE HeapHandle OPTIONAL,
         }
 
         /* Check for a special magic value for enabling LFH */
-        if (*(PULONG)HeapInformation != 2)
+        if (*(PULONG)HeapInformation != HEAP_FRONT_END_LFH)
         {
             return STATUS_UNSUCCESSFUL;
         }
 
-        DPRINT1("RtlSetHeapInformation() needs to enable LFH\n");
-        return STATUS_SUCCESS;
+        if (!HeapHandle)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        return RtlpLfhEnable((PHEAP)HeapHandle);
     }
 
     return STATUS_SUCCESS;
@@ -3963,7 +4007,86 @@ RtlQueryHeapInformation(HANDLE HeapHandle,
     return STATUS_UNSUCCESSFUL;
 }
 
-NTSTATUS
+/* Heap lock held. Cuts one busy block of Count * Index units (give or take
+   the unit RtlpSplitEntry may have left at its end) into Count busy blocks */
+static
+VOID
+RtlpCarveBusyBlock(PHEAP_ENTRY HeapEntry,
+                   SIZE_T Index,
+                   SIZE_T Size,
+                   ULONG Count,
+                   PVOID *Array)
+{
+    SIZE_T TotalSize = HeapEntry->Size;
+    UCHAR EntryFlags = HeapEntry->Flags & ~HEAP_ENTRY_LAST_ENTRY;
+    UCHAR LastFlags = HeapEntry->Flags & HEAP_ENTRY_LAST_ENTRY;
+    PHEAP_ENTRY CurrentEntry = HeapEntry, LastEntry = NULL;
+    ULONG i;
+
+    ASSERT(TotalSize >= Count * Index && TotalSize - Count * Index <= 1);
+
+    for (i = 0; i < Count; i++)
+    {
+        /* The first one keeps its previous size, the last one takes the spare unit */
+        if (i != 0)
+        {
+            CurrentEntry->PreviousSize = (USHORT)Index;
+            CurrentEntry->SegmentOffset = HeapEntry->SegmentOffset;
+            CurrentEntry->SmallTagIndex = 0;
+        }
+
+        CurrentEntry->Size = (USHORT)((i == Count - 1) ? TotalSize - i * Index : Index);
+        CurrentEntry->Flags = EntryFlags;
+        CurrentEntry->UnusedBytes = (UCHAR)(((SIZE_T)CurrentEntry->Size << HEAP_ENTRY_SHIFT) - Size);
+
+        Array[i] = CurrentEntry + 1;
+        LastEntry = CurrentEntry;
+        CurrentEntry += CurrentEntry->Size;
+    }
+
+    /* Hand the last entry flag over, or fix the back link of the following entry */
+    if (LastFlags)
+        LastEntry->Flags |= HEAP_ENTRY_LAST_ENTRY;
+    else
+        CurrentEntry->PreviousSize = LastEntry->Size;
+}
+
+/* Heap lock held. Turns a run of adjacent busy blocks into a single one and
+   frees it, so that it's coalesced and put in a free list only once. The
+   blocks carry no extra, fill pattern or virtual allocation flags */
+static
+BOOLEAN
+RtlpFreeBusyRun(PHEAP Heap,
+                ULONG Flags,
+                PHEAP_ENTRY FirstEntry,
+                PHEAP_ENTRY LastEntry)
+{
+    SIZE_T RunSize = (LastEntry - FirstEntry) + LastEntry->Size;
+
+    if (FirstEntry != LastEntry)
+    {
+        /* The merged block ends where the last one did */
+        FirstEntry->Size = (USHORT)RunSize;
+        FirstEntry->Flags &= ~HEAP_ENTRY_LAST_ENTRY;
+        FirstEntry->Flags |= LastEntry->Flags & HEAP_ENTRY_LAST_ENTRY;
+        FirstEntry->UnusedBytes = LastEntry->UnusedBytes;
+
+        if (!(FirstEntry->Flags & HEAP_ENTRY_LAST_ENTRY))
+            (FirstEntry + RunSize)->PreviousSize = (USHORT)RunSize;
+    }
+
+    return RtlFreeHeap(Heap, Flags, FirstEntry + 1);
+}
+
+/*
+ * Allocates Count blocks of Size bytes, taking the heap lock only once.
+ * Whenever possible the blocks are carved out of one large block of the
+ * backend, so they end up next to each other.
+ * Returns the number of blocks allocated, they are stored in Array.
+ *
+ * @implemented
+ */
+ULONG
 NTAPI
 RtlMultipleAllocateHeap(IN PVOID HeapHandle,
                         IN ULONG Flags,
@@ -3971,19 +4094,201 @@ RtlMultipleAllocateHeap(IN PVOID HeapHandle,
                         IN ULONG Count,
                         OUT PVOID *Array)
 {
-    UNIMPLEMENTED;
-    return 0;
+    PHEAP Heap = (PHEAP)HeapHandle;
+    SIZE_T AllocationSize, Index = 0;
+    ULONG Allocated = 0, Chunk, MaxChunk = 0;
+    PHEAP_ENTRY HeapEntry;
+    BOOLEAN Locked = FALSE, Carve;
+    PVOID Ptr;
+
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
+
+    /* Special heaps have their own locking and layout, go one by one */
+    if (RtlpHeapIsSpecial(Flags))
+    {
+        while (Allocated < Count)
+        {
+            Array[Allocated] = RtlAllocateHeap(Heap, Flags, Size);
+            if (!Array[Allocated])
+                break;
+            Allocated++;
+        }
+
+        return Allocated;
+    }
+
+    /* Carving needs plain entries without extras, fill patterns or alignment
+       padding, and a failed attempt must be able to fall back quietly */
+    Carve = Count > 1 &&
+            !(Flags & (HEAP_EXTRA_FLAGS_MASK | HEAP_GENERATE_EXCEPTIONS)) &&
+            !Heap->PseudoTagEntries &&
+            !(Heap->Flags & (HEAP_CREATE_ALIGN_16 |
+                             HEAP_TAIL_CHECKING_ENABLED |
+                             HEAP_FREE_CHECKING_ENABLED)) &&
+            Size < ((SIZE_T)Heap->VirtualMemoryThreshold << HEAP_ENTRY_SHIFT);
+
+    if (Carve)
+    {
+        /* Calculate allocation size and index the same way RtlAllocateHeap does */
+        AllocationSize = (Size ? Size : 1);
+        AllocationSize = (AllocationSize + Heap->AlignRound) & Heap->AlignMask;
+        Index = AllocationSize >> HEAP_ENTRY_SHIFT;
+
+        /* The large block must stay a normal one, not a virtual allocation */
+        MaxChunk = (ULONG)(min(Heap->VirtualMemoryThreshold, HEAP_MAX_BLOCK_SIZE) / Index);
+
+        /* Small blocks are better served by the front end, which needs no lock */
+        if (MaxChunk < 2 ||
+            (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH && Index < HEAP_LFH_BUCKETS))
+        {
+            Carve = FALSE;
+        }
+    }
+
+    /* Lock once for the whole batch */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        Locked = TRUE;
+    }
+
+    _SEH2_TRY
+    {
+        while (Allocated < Count)
+        {
+            if (Carve && Count - Allocated > 1)
+            {
+                Chunk = min(Count - Allocated, MaxChunk);
+
+                Ptr = RtlAllocateHeap(Heap,
+                                      Flags | HEAP_NO_SERIALIZE,
+                                      ((Chunk * Index) << HEAP_ENTRY_SHIFT) - sizeof(HEAP_ENTRY));
+                if (Ptr)
+                {
+                    HeapEntry = (PHEAP_ENTRY)Ptr - 1;
+                    RtlpCarveBusyBlock(HeapEntry, Index, Size, Chunk, &Array[Allocated]);
+                    Allocated += Chunk;
+                    continue;
+                }
+
+                /* No block that large is available, the rest goes one by one */
+                Carve = FALSE;
+            }
+
+            Array[Allocated] = RtlAllocateHeap(Heap, Flags | HEAP_NO_SERIALIZE, Size);
+            if (!Array[Allocated])
+                break;
+            Allocated++;
+        }
+    }
+    _SEH2_FINALLY
+    {
+        /* Release the lock */
+        if (Locked) RtlLeaveHeapLock(Heap->LockVariable);
+    }
+    _SEH2_END;
+
+    return Allocated;
 }
 
-NTSTATUS
+/*
+ * Frees Count blocks, taking the heap lock only once. Runs of blocks which
+ * follow each other in memory, like the ones RtlMultipleAllocateHeap hands
+ * out, are merged and go through the coalescing and free lists only once.
+ * NULL entries are skipped and not counted. Returns the number of blocks freed.
+ *
+ * @implemented
+ */
+ULONG
 NTAPI
 RtlMultipleFreeHeap(IN PVOID HeapHandle,
                     IN ULONG Flags,
                     IN ULONG Count,
                     OUT PVOID *Array)
 {
-    UNIMPLEMENTED;
-    return 0;
+    PHEAP Heap = (PHEAP)HeapHandle;
+    PHEAP_ENTRY HeapEntry, FirstEntry = NULL, LastEntry = NULL;
+    ULONG Freed = 0, RunCount = 0, i;
+    SIZE_T RunSize = 0;
+    BOOLEAN Locked = FALSE;
+
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
+
+    /* Special heaps have their own locking and layout, go one by one */
+    if (RtlpHeapIsSpecial(Flags))
+    {
+        for (i = 0; i < Count; i++)
+        {
+            if (Array[i] && RtlFreeHeap(Heap, Flags, Array[i]))
+                Freed++;
+        }
+
+        return Freed;
+    }
+
+    /* Lock once for the whole batch */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        Locked = TRUE;
+    }
+
+    _SEH2_TRY
+    {
+        for (i = 0; i < Count; i++)
+        {
+            if (!Array[i])
+                continue;
+
+            HeapEntry = (PHEAP_ENTRY)Array[i] - 1;
+
+            /* Only normal busy entries of the backend can be merged */
+            if (((ULONG_PTR)Array[i] & (HEAP_ENTRY_SIZE - 1)) != 0 ||
+                !(HeapEntry->Flags & HEAP_ENTRY_BUSY) ||
+                (HeapEntry->Flags & ~(HEAP_ENTRY_BUSY | HEAP_ENTRY_LAST_ENTRY | HEAP_ENTRY_SETTABLE_FLAGS)) ||
+                RtlpIsLfhEntry(HeapEntry) ||
+                HeapEntry->SegmentOffset >= HEAP_SEGMENTS)
+            {
+                if (RtlFreeHeap(Heap, Flags | HEAP_NO_SERIALIZE, Array[i]))
+                    Freed++;
+                continue;
+            }
+
+            /* Extend the current run if this entry directly follows it */
+            if (FirstEntry &&
+                HeapEntry == FirstEntry + RunSize &&
+                !(LastEntry->Flags & HEAP_ENTRY_LAST_ENTRY) &&
+                HeapEntry->SegmentOffset == FirstEntry->SegmentOffset &&
+                RunSize + HeapEntry->Size <= HEAP_MAX_BLOCK_SIZE)
+            {
+                LastEntry = HeapEntry;
+                RunSize += HeapEntry->Size;
+                RunCount++;
+                continue;
+            }
+
+            /* Otherwise flush it and start a new one */
+            if (FirstEntry && RtlpFreeBusyRun(Heap, Flags | HEAP_NO_SERIALIZE, FirstEntry, LastEntry))
+                Freed += RunCount;
+
+            FirstEntry = LastEntry = HeapEntry;
+            RunSize = HeapEntry->Size;
+            RunCount = 1;
+        }
+
+        if (FirstEntry && RtlpFreeBusyRun(Heap, Flags | HEAP_NO_SERIALIZE, FirstEntry, LastEntry))
+            Freed += RunCount;
+    }
+    _SEH2_FINALLY
+    {
+        /* Release the lock */
+        if (Locked) RtlLeaveHeapLock(Heap->LockVariable);
+    }
+    _SEH2_END;
+
+    return Freed;
 }
 
 /* EOF */
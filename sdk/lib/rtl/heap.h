@@ -51,10 +51,25 @@
 /* Signatures */
 #define HEAP_SIGNATURE         0xeefeeff
 #define HEAP_SEGMENT_SIGNATURE 0xffeeffee
+#define HEAP_LFH_SIGNATURE     0xf1f1eeff
 
 /* Segment flags */
 #define HEAP_USER_ALLOCATED    0x1
 
+/* Front end heap types, as reported by HeapCompatibilityInformation */
+#define HEAP_FRONT_END_NONE    0
+#define HEAP_FRONT_END_LFH     2
+
+/* Low fragmentation heap parameters */
+#define HEAP_LFH_BUCKETS         HEAP_FREELISTS
+#define HEAP_LFH_AFFINITY_SLOTS  8
+#define HEAP_LFH_SUBSEGMENT_SIZE 0x2000
+#define HEAP_LFH_MIN_BLOCKS      8
+#define HEAP_LFH_MAX_BLOCKS      0x400
+
+/* LFHFlags value of blocks owned by the front end, never a valid SegmentOffset */
+#define HEAP_LFH_BLOCK         0x80
+
 /* A handy inline to distinguis normal heap, special "debug heap" and special "page heap" */
 FORCEINLINE BOOLEAN
 RtlpHeapIsSpecial(ULONG Flags)
@@ -144,6 +159,15 @@ C_ASSERT(sizeof(HEAP_ENTRY) == 16);
 C_ASSERT(sizeof(HEAP_ENTRY) == 8);
 #endif
 C_ASSERT((1 << HEAP_ENTRY_SHIFT) == sizeof(HEAP_ENTRY));
+C_ASSERT(HEAP_SEGMENTS <= HEAP_LFH_BLOCK);
+
+/* Tells blocks carved by the low fragmentation front end from backend ones */
+FORCEINLINE BOOLEAN
+RtlpIsLfhEntry(PHEAP_ENTRY HeapEntry)
+{
+    return !(HeapEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC) &&
+           HeapEntry->LFHFlags == HEAP_LFH_BLOCK;
+}
 
 typedef struct _HEAP_TAG_ENTRY
 {
@@ -203,6 +227,49 @@ typedef struct _HEAP_LIST_LOOKUP
     PLIST_ENTRY *ListHints;
 } HEAP_LIST_LOOKUP, *PHEAP_LIST_LOOKUP;
 
+/* Free block list of a LFH subsegment, updated with a single 64-bit CAS */
+typedef union _HEAP_LFH_AGGREGATE
+{
+    struct
+    {
+        USHORT Depth;
+        USHORT FreeEntryOffset;
+        ULONG Sequence:31;
+        ULONG Active:1;
+    };
+    LONGLONG Value;
+} HEAP_LFH_AGGREGATE, *PHEAP_LFH_AGGREGATE;
+
+C_ASSERT(sizeof(HEAP_LFH_AGGREGATE) == sizeof(LONGLONG));
+
+typedef struct _HEAP_LFH_SUBSEGMENT
+{
+    volatile HEAP_LFH_AGGREGATE Aggregate;
+    ULONG Signature;
+    USHORT BlockUnits;
+    USHORT BlockCount;
+    BOOLEAN OnPartialList;
+    LIST_ENTRY PartialListEntry;
+    LIST_ENTRY SubSegmentListEntry;
+} HEAP_LFH_SUBSEGMENT, *PHEAP_LFH_SUBSEGMENT;
+
+typedef struct _HEAP_LFH_BUCKET
+{
+    USHORT BlockUnits;
+    USHORT BlocksPerSubSegment;
+    ULONG SubSegmentCount;
+    LIST_ENTRY PartialList;
+    PHEAP_LFH_SUBSEGMENT volatile ActiveSubSegment[HEAP_LFH_AFFINITY_SLOTS];
+} HEAP_LFH_BUCKET, *PHEAP_LFH_BUCKET;
+
+typedef struct _HEAP_LFH
+{
+    struct _HEAP *Heap;
+    ULONG AffinitySlots;
+    LIST_ENTRY SubSegmentList;
+    HEAP_LFH_BUCKET Buckets[HEAP_LFH_BUCKETS];
+} HEAP_LFH, *PHEAP_LFH;
+
 typedef struct _HEAP
 {
     HEAP_ENTRY Entry;
@@ -352,6 +419,33 @@ RtlpValidateHeapEntry(PHEAP Heap, PHEAP_ENTRY HeapEntry);
 BOOLEAN NTAPI
 RtlpValidateHeapHeaders(PHEAP Heap, BOOLEAN Recalculate);
 
+/* heaplfh.c */
+NTSTATUS NTAPI
+RtlpLfhEnable(PHEAP Heap);
+
+PHEAP_ENTRY NTAPI
+RtlpLfhAllocate(PHEAP Heap,
+                SIZE_T Index,
+                UCHAR EntryFlags,
+                UCHAR UnusedBytes);
+
+BOOLEAN NTAPI
+RtlpLfhFree(PHEAP Heap,
+            PHEAP_ENTRY HeapEntry);
+
+PVOID NTAPI
+RtlpLfhReAllocate(PHEAP Heap,
+                  ULONG Flags,
+                  PVOID Ptr,
+                  SIZE_T Size);
+
+BOOLEAN NTAPI
+RtlpLfhValidate(PHEAP Heap);
+
+BOOLEAN NTAPI
+RtlpLfhValidateEntry(PHEAP Heap,
+                     PHEAP_ENTRY HeapEntry);
+
 /* heapdbg.c */
 HANDLE NTAPI
 RtlDebugCreateHeap(ULONG Flags,
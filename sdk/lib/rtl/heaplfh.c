@@ -0,0 +1,600 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS system libraries
+ * FILE:            lib/rtl/heaplfh.c
+ * PURPOSE:         RTL Heap low fragmentation front end
+ */
+
+/* Overview:
+
+   Small requests (less than HEAP_LFH_BUCKETS heap entries, header included)
+   are served from buckets of same-sized blocks. A bucket carves its blocks
+   out of subsegments, which are plain busy blocks of the backend heap, so
+   the backend (and its validation) sees them as ordinary allocations.
+
+   Each subsegment keeps its free blocks in an index-linked list whose head,
+   depth and a sequence number share one 64-bit word, so allocation and free
+   are a single compare-exchange. Threads are spread over affinity slots,
+   each slot owning one "active" subsegment per bucket, which keeps threads
+   from fighting over the same cache lines. The heap lock is only taken when
+   a slot runs dry or when a retired subsegment gets its first block back.
+
+   Subsegments are given back to the backend only when the heap is destroyed:
+   the footprint of a bucket is bounded by its peak usage, and not having to
+   reclaim them is what keeps the lock-free paths safe. */
+
+/* INCLUDES *****************************************************************/
+
+#include <rtl.h>
+#include <heap.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/* Blocks of a subsegment follow its header, aligned on a heap entry */
+#define HEAP_LFH_HEADER_UNITS \
+    ((sizeof(HEAP_LFH_SUBSEGMENT) + sizeof(HEAP_ENTRY) - 1) >> HEAP_ENTRY_SHIFT)
+
+/* FUNCTIONS *****************************************************************/
+
+FORCEINLINE
+PHEAP_ENTRY
+RtlpLfhGetBlock(PHEAP_LFH_SUBSEGMENT SubSegment,
+                ULONG BlockIndex)
+{
+    return (PHEAP_ENTRY)SubSegment + HEAP_LFH_HEADER_UNITS +
+           BlockIndex * SubSegment->BlockUnits;
+}
+
+FORCEINLINE
+PHEAP_LFH_SUBSEGMENT
+RtlpLfhGetSubSegment(PHEAP_ENTRY HeapEntry)
+{
+    /* PreviousSize holds the index of the block inside its subsegment */
+    return (PHEAP_LFH_SUBSEGMENT)(HeapEntry -
+                                  (ULONG_PTR)HeapEntry->PreviousSize * HeapEntry->Size -
+                                  HEAP_LFH_HEADER_UNITS);
+}
+
+FORCEINLINE
+ULONG
+RtlpLfhGetAffinitySlot(PHEAP_LFH Lfh)
+{
+    /* Thread IDs are multiples of 4, spread them over the slots */
+    return (ULONG)((ULONG_PTR)NtCurrentTeb()->ClientId.UniqueThread >> 2) % Lfh->AffinitySlots;
+}
+
+static
+PHEAP_ENTRY
+RtlpLfhPopBlock(PHEAP_LFH_SUBSEGMENT SubSegment)
+{
+    HEAP_LFH_AGGREGATE Old, New;
+    PHEAP_ENTRY HeapEntry;
+
+    for (;;)
+    {
+        Old.Value = SubSegment->Aggregate.Value;
+
+        /* Retired or drained, the caller has to find another one */
+        if (!Old.Active || Old.Depth == 0)
+            return NULL;
+
+        /* A torn read may give us garbage, don't step out of the subsegment */
+        if (Old.FreeEntryOffset >= SubSegment->BlockCount)
+            continue;
+
+        HeapEntry = RtlpLfhGetBlock(SubSegment, Old.FreeEntryOffset);
+
+        /* The link may be stale if someone beat us, the sequence catches it */
+        New.Value = Old.Value;
+        New.Depth--;
+        New.FreeEntryOffset = *(volatile USHORT *)(HeapEntry + 1);
+        New.Sequence++;
+
+        if (InterlockedCompareExchange64(&SubSegment->Aggregate.Value,
+                                         New.Value,
+                                         Old.Value) == Old.Value)
+        {
+            return HeapEntry;
+        }
+    }
+}
+
+static
+HEAP_LFH_AGGREGATE
+RtlpLfhPushBlock(PHEAP_LFH_SUBSEGMENT SubSegment,
+                 PHEAP_ENTRY HeapEntry)
+{
+    HEAP_LFH_AGGREGATE Old, New;
+
+    for (;;)
+    {
+        Old.Value = SubSegment->Aggregate.Value;
+
+        *(volatile USHORT *)(HeapEntry + 1) = Old.FreeEntryOffset;
+
+        New.Value = Old.Value;
+        New.Depth++;
+        New.FreeEntryOffset = HeapEntry->PreviousSize;
+        New.Sequence++;
+
+        if (InterlockedCompareExchange64(&SubSegment->Aggregate.Value,
+                                         New.Value,
+                                         Old.Value) == Old.Value)
+        {
+            return New;
+        }
+    }
+}
+
+static
+VOID
+RtlpLfhSetActive(PHEAP_LFH_SUBSEGMENT SubSegment,
+                 BOOLEAN Active)
+{
+    HEAP_LFH_AGGREGATE Old, New;
+
+    /* Frees may still be racing with us, the list itself must be preserved */
+    do
+    {
+        Old.Value = SubSegment->Aggregate.Value;
+        New.Value = Old.Value;
+        New.Active = Active;
+        New.Sequence++;
+    }
+    while (InterlockedCompareExchange64(&SubSegment->Aggregate.Value,
+                                        New.Value,
+                                        Old.Value) != Old.Value);
+}
+
+/* Called without the heap lock: the backend may raise */
+static
+PHEAP_LFH_SUBSEGMENT
+RtlpLfhCreateSubSegment(PHEAP_LFH Lfh,
+                        PHEAP_LFH_BUCKET Bucket)
+{
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    PHEAP_ENTRY HeapEntry;
+    HEAP_LFH_AGGREGATE Aggregate;
+    SIZE_T Size;
+    USHORT Index;
+
+    Size = (HEAP_LFH_HEADER_UNITS +
+            (SIZE_T)Bucket->BlocksPerSubSegment * Bucket->BlockUnits) << HEAP_ENTRY_SHIFT;
+
+    SubSegment = RtlAllocateHeap(Lfh->Heap, 0, Size);
+    if (!SubSegment)
+        return NULL;
+
+    SubSegment->Signature = HEAP_LFH_SIGNATURE;
+    SubSegment->BlockUnits = Bucket->BlockUnits;
+    SubSegment->BlockCount = Bucket->BlocksPerSubSegment;
+    SubSegment->OnPartialList = FALSE;
+
+    /* Carve the blocks and chain them in address order */
+    for (Index = 0; Index < SubSegment->BlockCount; Index++)
+    {
+        HeapEntry = RtlpLfhGetBlock(SubSegment, Index);
+        HeapEntry->Size = SubSegment->BlockUnits;
+        HeapEntry->Flags = 0;
+        HeapEntry->SmallTagIndex = 0;
+        HeapEntry->PreviousSize = Index;
+        HeapEntry->LFHFlags = HEAP_LFH_BLOCK;
+        HeapEntry->UnusedBytes = 0;
+        *(PUSHORT)(HeapEntry + 1) = Index + 1;
+    }
+
+    /* It starts its life as the active subsegment of the caller's slot */
+    Aggregate.Value = 0;
+    Aggregate.Depth = SubSegment->BlockCount;
+    Aggregate.FreeEntryOffset = 0;
+    Aggregate.Active = 1;
+    SubSegment->Aggregate.Value = Aggregate.Value;
+
+    return SubSegment;
+}
+
+/* Heap lock held. Returns TRUE if the slot has a subsegment to pop from */
+static
+BOOLEAN
+RtlpLfhRefillSlot(PHEAP_LFH_BUCKET Bucket,
+                  ULONG Slot)
+{
+    HEAP_LFH_AGGREGATE Old, New;
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    PLIST_ENTRY ListEntry;
+
+    SubSegment = Bucket->ActiveSubSegment[Slot];
+    if (SubSegment)
+    {
+        /* Retire it, unless a free sneaked in since we found it empty */
+        for (;;)
+        {
+            Old.Value = SubSegment->Aggregate.Value;
+            if (Old.Depth != 0)
+                return TRUE;
+
+            New.Value = Old.Value;
+            New.Active = 0;
+            New.Sequence++;
+
+            if (InterlockedCompareExchange64(&SubSegment->Aggregate.Value,
+                                             New.Value,
+                                             Old.Value) == Old.Value)
+            {
+                break;
+            }
+        }
+
+        /* The first free into it will put it on the partial list */
+        Bucket->ActiveSubSegment[Slot] = NULL;
+    }
+
+    if (IsListEmpty(&Bucket->PartialList))
+        return FALSE;
+
+    /* Reuse a subsegment which got blocks back */
+    ListEntry = RemoveHeadList(&Bucket->PartialList);
+    SubSegment = CONTAINING_RECORD(ListEntry, HEAP_LFH_SUBSEGMENT, PartialListEntry);
+    SubSegment->OnPartialList = FALSE;
+
+    RtlpLfhSetActive(SubSegment, TRUE);
+    Bucket->ActiveSubSegment[Slot] = SubSegment;
+
+    return TRUE;
+}
+
+PHEAP_ENTRY NTAPI
+RtlpLfhAllocate(PHEAP Heap,
+                SIZE_T Index,
+                UCHAR EntryFlags,
+                UCHAR UnusedBytes)
+{
+    PHEAP_LFH Lfh = Heap->FrontEndHeap;
+    PHEAP_LFH_BUCKET Bucket;
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    PHEAP_ENTRY HeapEntry;
+    BOOLEAN Refilled;
+    ULONG Slot;
+
+    ASSERT(Index < HEAP_LFH_BUCKETS);
+
+    Bucket = &Lfh->Buckets[Index];
+    Slot = RtlpLfhGetAffinitySlot(Lfh);
+
+    for (;;)
+    {
+        /* Fast path: take a block from the active subsegment of our slot */
+        SubSegment = Bucket->ActiveSubSegment[Slot];
+        if (SubSegment)
+        {
+            HeapEntry = RtlpLfhPopBlock(SubSegment);
+            if (HeapEntry)
+            {
+                HeapEntry->Flags = EntryFlags;
+                HeapEntry->UnusedBytes = UnusedBytes;
+                return HeapEntry;
+            }
+        }
+
+        /* Slow path: swap the drained subsegment for a partial one */
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        Refilled = RtlpLfhRefillSlot(Bucket, Slot);
+        RtlLeaveHeapLock(Heap->LockVariable);
+
+        if (Refilled)
+            continue;
+
+        /* No luck, grow the bucket */
+        SubSegment = RtlpLfhCreateSubSegment(Lfh, Bucket);
+        if (!SubSegment)
+            return NULL;
+
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+
+        InsertTailList(&Lfh->SubSegmentList, &SubSegment->SubSegmentListEntry);
+        Bucket->SubSegmentCount++;
+
+        if (!Bucket->ActiveSubSegment[Slot])
+        {
+            Bucket->ActiveSubSegment[Slot] = SubSegment;
+        }
+        else
+        {
+            /* Someone refilled the slot meanwhile, keep this one for later.
+               Nobody else knows about it yet, no need to be atomic */
+            SubSegment->Aggregate.Active = 0;
+            InsertTailList(&Bucket->PartialList, &SubSegment->PartialListEntry);
+            SubSegment->OnPartialList = TRUE;
+        }
+
+        RtlLeaveHeapLock(Heap->LockVariable);
+    }
+}
+
+BOOLEAN NTAPI
+RtlpLfhFree(PHEAP Heap,
+            PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_LFH Lfh = Heap->FrontEndHeap;
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    PHEAP_LFH_BUCKET Bucket;
+    HEAP_LFH_AGGREGATE Aggregate;
+
+    /* Check this entry, fail if it's invalid */
+    SubSegment = RtlpLfhGetSubSegment(HeapEntry);
+    if (!Lfh ||
+        !(HeapEntry->Flags & HEAP_ENTRY_BUSY) ||
+        SubSegment->Signature != HEAP_LFH_SIGNATURE ||
+        SubSegment->BlockUnits != HeapEntry->Size ||
+        HeapEntry->PreviousSize >= SubSegment->BlockCount)
+    {
+        DPRINT1("HEAP: Trying to free an invalid address %p!\n", HeapEntry + 1);
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    /* Mark it free, the rest of the header stays as carved */
+    HeapEntry->Flags = 0;
+    HeapEntry->UnusedBytes = 0;
+
+    Aggregate = RtlpLfhPushBlock(SubSegment, HeapEntry);
+
+    /* First block back into a retired subsegment, make it available again */
+    if (Aggregate.Depth == 1 && !Aggregate.Active)
+    {
+        Bucket = &Lfh->Buckets[SubSegment->BlockUnits];
+
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        if (!SubSegment->OnPartialList)
+        {
+            InsertTailList(&Bucket->PartialList, &SubSegment->PartialListEntry);
+            SubSegment->OnPartialList = TRUE;
+        }
+        RtlLeaveHeapLock(Heap->LockVariable);
+    }
+
+    return TRUE;
+}
+
+PVOID NTAPI
+RtlpLfhReAllocate(PHEAP Heap,
+                  ULONG Flags,
+                  PVOID Ptr,
+                  SIZE_T Size)
+{
+    PHEAP_ENTRY HeapEntry = (PHEAP_ENTRY)Ptr - 1;
+    SIZE_T AllocationSize, OldSize, BlockSize;
+    PVOID NewPtr;
+
+    if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY))
+    {
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    BlockSize = (SIZE_T)HeapEntry->Size << HEAP_ENTRY_SHIFT;
+    OldSize = BlockSize - HeapEntry->UnusedBytes;
+
+    /* Calculate allocation size the same way the backend does */
+    if (Size)
+        AllocationSize = Size;
+    else
+        AllocationSize = 1;
+    AllocationSize = (AllocationSize + Heap->AlignRound) & Heap->AlignMask;
+
+    /* If it still fits the block, only the bookkeeping changes */
+    if (!(Flags & HEAP_EXTRA_FLAGS_MASK) &&
+        AllocationSize <= BlockSize &&
+        BlockSize - Size <= MAXUCHAR)
+    {
+        if (Size > OldSize && (Flags & HEAP_ZERO_MEMORY))
+            RtlZeroMemory((PCHAR)Ptr + OldSize, Size - OldSize);
+
+        HeapEntry->UnusedBytes = (UCHAR)(BlockSize - Size);
+        return Ptr;
+    }
+
+    if (Flags & HEAP_REALLOC_IN_PLACE_ONLY)
+    {
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_NO_MEMORY);
+        return NULL;
+    }
+
+    /* Move it to a block of the right size, which may come from any bucket or the backend */
+    NewPtr = RtlAllocateHeap(Heap, Flags & ~HEAP_ZERO_MEMORY, Size);
+    if (!NewPtr)
+        return NULL;
+
+    RtlCopyMemory(NewPtr, Ptr, min(OldSize, Size));
+
+    if (Size > OldSize && (Flags & HEAP_ZERO_MEMORY))
+        RtlZeroMemory((PCHAR)NewPtr + OldSize, Size - OldSize);
+
+    RtlpLfhFree(Heap, HeapEntry);
+
+    return NewPtr;
+}
+
+/* Heap lock held */
+BOOLEAN NTAPI
+RtlpLfhValidateEntry(PHEAP Heap,
+                     PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_LFH Lfh = Heap->FrontEndHeap;
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    PLIST_ENTRY ListEntry;
+
+    if (!Lfh || !(HeapEntry->Flags & HEAP_ENTRY_BUSY))
+        goto invalid_entry;
+
+    /* Only trust the header once we know it leads to one of our subsegments */
+    SubSegment = RtlpLfhGetSubSegment(HeapEntry);
+    for (ListEntry = Lfh->SubSegmentList.Flink;
+         ListEntry != &Lfh->SubSegmentList;
+         ListEntry = ListEntry->Flink)
+    {
+        if (SubSegment == CONTAINING_RECORD(ListEntry, HEAP_LFH_SUBSEGMENT, SubSegmentListEntry))
+            break;
+    }
+
+    if (ListEntry == &Lfh->SubSegmentList ||
+        SubSegment->BlockUnits != HeapEntry->Size ||
+        HeapEntry->PreviousSize >= SubSegment->BlockCount)
+    {
+        goto invalid_entry;
+    }
+
+    return TRUE;
+
+invalid_entry:
+    DPRINT1("HEAP: Invalid LFH entry %p in heap %p\n", HeapEntry, Heap);
+    return FALSE;
+}
+
+/* Heap lock held, blocks may still come and go through the lock-free paths */
+BOOLEAN NTAPI
+RtlpLfhValidate(PHEAP Heap)
+{
+    PHEAP_LFH Lfh = Heap->FrontEndHeap;
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    PHEAP_LFH_BUCKET Bucket;
+    PHEAP_ENTRY HeapEntry;
+    PLIST_ENTRY ListEntry;
+    ULONG Index, Count;
+
+    /* Check every carved block header */
+    for (ListEntry = Lfh->SubSegmentList.Flink;
+         ListEntry != &Lfh->SubSegmentList;
+         ListEntry = ListEntry->Flink)
+    {
+        SubSegment = CONTAINING_RECORD(ListEntry, HEAP_LFH_SUBSEGMENT, SubSegmentListEntry);
+
+        if (SubSegment->Signature != HEAP_LFH_SIGNATURE ||
+            SubSegment->BlockUnits >= HEAP_LFH_BUCKETS ||
+            SubSegment->BlockUnits != Lfh->Buckets[SubSegment->BlockUnits].BlockUnits)
+        {
+            DPRINT1("HEAP: LFH subsegment %p is corrupted\n", SubSegment);
+            return FALSE;
+        }
+
+        for (Index = 0; Index < SubSegment->BlockCount; Index++)
+        {
+            HeapEntry = RtlpLfhGetBlock(SubSegment, Index);
+            if (HeapEntry->LFHFlags != HEAP_LFH_BLOCK ||
+                HeapEntry->Size != SubSegment->BlockUnits ||
+                HeapEntry->PreviousSize != Index)
+            {
+                DPRINT1("HEAP: LFH block %p of subsegment %p has a corrupted header\n",
+                        HeapEntry, SubSegment);
+                return FALSE;
+            }
+        }
+    }
+
+    /* Partial lists only hold retired subsegments of their own bucket */
+    for (Index = 0; Index < HEAP_LFH_BUCKETS; Index++)
+    {
+        Bucket = &Lfh->Buckets[Index];
+        Count = 0;
+
+        for (ListEntry = Bucket->PartialList.Flink;
+             ListEntry != &Bucket->PartialList;
+             ListEntry = ListEntry->Flink)
+        {
+            SubSegment = CONTAINING_RECORD(ListEntry, HEAP_LFH_SUBSEGMENT, PartialListEntry);
+
+            if (!SubSegment->OnPartialList ||
+                SubSegment->Aggregate.Active ||
+                SubSegment->BlockUnits != Bucket->BlockUnits)
+            {
+                DPRINT1("HEAP: LFH subsegment %p is misplaced on the partial list of bucket %lu\n",
+                        SubSegment, Index);
+                return FALSE;
+            }
+
+            Count++;
+        }
+
+        if (Count > Bucket->SubSegmentCount)
+        {
+            DPRINT1("HEAP: LFH bucket %lu has %lu partial subsegments out of %lu\n",
+                    Index, Count, Bucket->SubSegmentCount);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+NTSTATUS NTAPI
+RtlpLfhEnable(PHEAP Heap)
+{
+    PHEAP_LFH Lfh;
+    PHEAP_LFH_BUCKET Bucket;
+    ULONG Index, Blocks;
+    BOOLEAN Enabled;
+
+    /* Page heap handles don't point to a normal heap */
+    if (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS)
+        return STATUS_UNSUCCESSFUL;
+
+    /* Nothing to do if it's already on */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH)
+        return STATUS_SUCCESS;
+
+    /* The front end is user mode only, needs the heap lock for its slow paths
+       and doesn't know about the debug heap nor the checking patterns */
+    if (RtlpGetMode() != UserMode ||
+        (Heap->Flags & (HEAP_NO_SERIALIZE |
+                        HEAP_CREATE_ALIGN_16 |
+                        HEAP_TAIL_CHECKING_ENABLED |
+                        HEAP_FREE_CHECKING_ENABLED)) ||
+        RtlpHeapIsSpecial(Heap->Flags | Heap->ForceFlags))
+    {
+        DPRINT1("HEAP: LFH can't be enabled for heap %p with flags %lx\n", Heap, Heap->Flags);
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    Lfh = RtlAllocateHeap(Heap, HEAP_ZERO_MEMORY, sizeof(HEAP_LFH));
+    if (!Lfh)
+        return STATUS_NO_MEMORY;
+
+    Lfh->Heap = Heap;
+    Lfh->AffinitySlots = min(max(RtlGetCurrentPeb()->NumberOfProcessors, 1),
+                             HEAP_LFH_AFFINITY_SLOTS);
+    InitializeListHead(&Lfh->SubSegmentList);
+
+    for (Index = 0; Index < HEAP_LFH_BUCKETS; Index++)
+    {
+        Bucket = &Lfh->Buckets[Index];
+        Bucket->BlockUnits = (USHORT)Index;
+        InitializeListHead(&Bucket->PartialList);
+
+        /* Zero-sized blocks are never requested, buckets 0 and 1 stay unused */
+        if (!Index)
+            continue;
+
+        Blocks = HEAP_LFH_SUBSEGMENT_SIZE / (Index << HEAP_ENTRY_SHIFT);
+        Bucket->BlocksPerSubSegment = (USHORT)min(max(Blocks, HEAP_LFH_MIN_BLOCKS),
+                                                  HEAP_LFH_MAX_BLOCKS);
+    }
+
+    /* Publish it, allocations may use it as soon as the type is set */
+    RtlEnterHeapLock(Heap->LockVariable, TRUE);
+    Enabled = (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH);
+    if (!Enabled)
+    {
+        InterlockedExchangePointer(&Heap->FrontEndHeap, Lfh);
+        Heap->FrontEndHeapType = HEAP_FRONT_END_LFH;
+    }
+    RtlLeaveHeapLock(Heap->LockVariable);
+
+    /* Somebody else won the race */
+    if (Enabled)
+        RtlFreeHeap(Heap, 0, Lfh);
+
+    return STATUS_SUCCESS;
+}
+
+/* EOF */
@@ -0,0 +1,409 @@
+/*
+ * PROJECT:     ReactOS cabinet manager
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     CCompressionPool class implementation
+ * COPYRIGHT:   Copyright 2018 ReactOS Team
+ * NOTES:       Compresses the CFDATA blocks of a folder on several threads.
+ *              Every block is compressed on its own (the MSZIP codec does
+ *              not keep a dictionary between blocks), so they can be
+ *              compressed in any order. They are handed back to the caller
+ *              in the order they were queued.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cabinet.h"
+
+#if !defined(CAB_READ_ONLY)
+
+#if defined(_WIN32)
+#define LockPool(l)         EnterCriticalSection(l)
+#define UnlockPool(l)       LeaveCriticalSection(l)
+#define WaitPool(e, l)      SleepConditionVariableCS(e, l, INFINITE)
+#define SignalPool(e)       WakeConditionVariable(e)
+#define BroadcastPool(e)    WakeAllConditionVariable(e)
+#else
+#define LockPool(l)         pthread_mutex_lock(l)
+#define UnlockPool(l)       pthread_mutex_unlock(l)
+#define WaitPool(e, l)      pthread_cond_wait(e, l)
+#define SignalPool(e)       pthread_cond_signal(e)
+#define BroadcastPool(e)    pthread_cond_broadcast(e)
+#endif
+
+static ULONG GetProcessorCount()
+{
+#if defined(_WIN32)
+    SYSTEM_INFO SystemInfo;
+
+    GetSystemInfo(&SystemInfo);
+    return SystemInfo.dwNumberOfProcessors;
+#else
+    long Count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (Count > 0) ? (ULONG)Count : 1;
+#endif
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Default constructor
+*/
+CCompressionPool::CCompressionPool()
+{
+    WorkerCount = 0;
+    JobCount = 0;
+    Jobs = NULL;
+    OldestJob = 0;
+    Queued = 0;
+    Started = 0;
+    Shutdown = false;
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Default destructor
+*/
+CCompressionPool::~CCompressionPool()
+{
+    ASSERT(Jobs == NULL);
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Starts the worker threads
+*
+* @param CodecId
+* Codec engine to compress the data blocks with
+*
+* @param ThreadCount
+* Number of worker threads, or 0 to use one per processor
+*
+* @return
+* Status of operation
+*/
+ULONG CCompressionPool::Create(LONG CodecId, ULONG ThreadCount)
+{
+    ULONG i;
+
+    if (ThreadCount == 0)
+        ThreadCount = GetProcessorCount();
+    if (ThreadCount > CAB_MAX_THREADS)
+        ThreadCount = CAB_MAX_THREADS;
+
+    /* Keep two blocks per thread in flight so that reading and writing
+       blocks overlaps with compressing them */
+    JobCount = ThreadCount * 2;
+    Jobs = (PCAB_BLOCK_JOB)calloc(JobCount, sizeof(CAB_BLOCK_JOB));
+    if (!Jobs)
+    {
+        DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+        return CAB_STATUS_NOMEMORY;
+    }
+
+    for (i = 0; i < JobCount; i++)
+    {
+        Jobs[i].InputBuffer  = malloc(CAB_BLOCKSIZE + 12);
+        Jobs[i].OutputBuffer = malloc(CAB_BLOCKSIZE + 12);
+        if ((!Jobs[i].InputBuffer) || (!Jobs[i].OutputBuffer))
+        {
+            DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+            Destroy();
+            return CAB_STATUS_NOMEMORY;
+        }
+    }
+
+#if defined(_WIN32)
+    InitializeCriticalSection(&Lock);
+    InitializeConditionVariable(&JobQueued);
+    InitializeConditionVariable(&JobDone);
+#else
+    pthread_mutex_init(&Lock, NULL);
+    pthread_cond_init(&JobQueued, NULL);
+    pthread_cond_init(&JobDone, NULL);
+#endif
+
+    OldestJob = 0;
+    Queued = 0;
+    Started = 0;
+    Shutdown = false;
+
+    for (i = 0; i < ThreadCount; i++)
+    {
+        Workers[i].Pool = this;
+        Workers[i].Codec = CreateCodec(CodecId);
+        if (!Workers[i].Codec)
+            break;
+
+#if defined(_WIN32)
+        Workers[i].Thread = CreateThread(NULL, 0, WorkerThread, &Workers[i], 0, NULL);
+        if (Workers[i].Thread == NULL)
+#else
+        if (pthread_create(&Workers[i].Thread, NULL, WorkerThread, &Workers[i]) != 0)
+#endif
+        {
+            delete Workers[i].Codec;
+            break;
+        }
+
+        WorkerCount++;
+    }
+
+    if (WorkerCount != ThreadCount)
+    {
+        DPRINT(MIN_TRACE, ("Cannot start compression thread %u.\n", (UINT)WorkerCount));
+        Destroy();
+        return CAB_STATUS_NOMEMORY;
+    }
+
+    DPRINT(MID_TRACE, ("Compressing with %u threads.\n", (UINT)WorkerCount));
+
+    return CAB_STATUS_SUCCESS;
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Stops the worker threads and frees the data blocks. Blocks that were
+* not retired are discarded.
+*/
+void CCompressionPool::Destroy()
+{
+    ULONG i;
+
+    if (!Jobs)
+        return;
+
+    if (WorkerCount != 0)
+    {
+        LockPool(&Lock);
+        Shutdown = true;
+        BroadcastPool(&JobQueued);
+        UnlockPool(&Lock);
+    }
+
+    for (i = 0; i < WorkerCount; i++)
+    {
+#if defined(_WIN32)
+        WaitForSingleObject(Workers[i].Thread, INFINITE);
+        CloseHandle(Workers[i].Thread);
+#else
+        pthread_join(Workers[i].Thread, NULL);
+#endif
+        delete Workers[i].Codec;
+    }
+
+    if (WorkerCount != 0)
+    {
+#if defined(_WIN32)
+        DeleteCriticalSection(&Lock);
+#else
+        pthread_mutex_destroy(&Lock);
+        pthread_cond_destroy(&JobQueued);
+        pthread_cond_destroy(&JobDone);
+#endif
+    }
+
+    for (i = 0; i < JobCount; i++)
+    {
+        free(Jobs[i].InputBuffer);
+        free(Jobs[i].OutputBuffer);
+    }
+
+    free(Jobs);
+    Jobs = NULL;
+    JobCount = 0;
+    WorkerCount = 0;
+    Queued = 0;
+    Started = 0;
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Returns the number of queued data blocks that were not retired yet
+*/
+ULONG CCompressionPool::QueuedBlocks()
+{
+    /* Only the thread queueing blocks changes this value */
+    return Queued;
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Returns whether the oldest data block must be retired before another
+* one can be queued
+*/
+bool CCompressionPool::IsFull()
+{
+    return (Queued == JobCount);
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Queues a data block to be compressed
+*
+* @param Buffer
+* Address of the pointer to the buffer with the data block. The buffer
+* is taken over by the pool and replaced with a free one of the same size.
+*
+* @param Length
+* Number of bytes in the data block
+*
+* @return
+* Status of operation
+*/
+ULONG CCompressionPool::QueueBlock(void** Buffer, ULONG Length)
+{
+    PCAB_BLOCK_JOB Job;
+    void* FreeBuffer;
+
+    ASSERT(!IsFull());
+
+    LockPool(&Lock);
+
+    Job = &Jobs[(OldestJob + Queued) % JobCount];
+    ASSERT(!Job->Done);
+
+    FreeBuffer       = Job->InputBuffer;
+    Job->InputBuffer = *Buffer;
+    Job->InputLength = Length;
+    *Buffer          = FreeBuffer;
+
+    Queued++;
+    SignalPool(&JobQueued);
+
+    UnlockPool(&Lock);
+
+    return CAB_STATUS_SUCCESS;
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Waits until the oldest queued data block is compressed
+*
+* @return
+* Pointer to the job of the oldest data block. It stays valid until
+* RetireOldestBlock is called.
+*/
+PCAB_BLOCK_JOB CCompressionPool::WaitForOldestBlock()
+{
+    PCAB_BLOCK_JOB Job;
+
+    ASSERT(Queued != 0);
+
+    LockPool(&Lock);
+
+    Job = &Jobs[OldestJob];
+    while (!Job->Done)
+        WaitPool(&JobDone, &Lock);
+
+    UnlockPool(&Lock);
+
+    return Job;
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Frees the slot of the oldest data block once it has been written
+*/
+void CCompressionPool::RetireOldestBlock()
+{
+    LockPool(&Lock);
+
+    ASSERT(Jobs[OldestJob].Done);
+
+    Jobs[OldestJob].Done = false;
+    OldestJob = (OldestJob + 1) % JobCount;
+    Queued--;
+    Started--;
+
+    UnlockPool(&Lock);
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Compresses queued data blocks until the pool is destroyed
+*
+* @param Codec
+* Codec engine private to the calling thread
+*/
+void CCompressionPool::CompressBlocks(CCABCodec* Codec)
+{
+    PCAB_BLOCK_JOB Job;
+
+    LockPool(&Lock);
+
+    while (true)
+    {
+        while ((Started == Queued) && (!Shutdown))
+            WaitPool(&JobQueued, &Lock);
+
+        if (Shutdown)
+            break;
+
+        /* Take the oldest job no other worker has started on */
+        Job = &Jobs[(OldestJob + Started) % JobCount];
+        Started++;
+
+        UnlockPool(&Lock);
+
+        Job->Status = Codec->Compress(Job->OutputBuffer,
+                                      Job->InputBuffer,
+                                      Job->InputLength,
+                                      &Job->OutputLength);
+
+        LockPool(&Lock);
+
+        Job->Done = true;
+        BroadcastPool(&JobDone);
+    }
+
+    UnlockPool(&Lock);
+}
+
+/**
+* @name CCompressionPool class
+* @implemented
+*
+* Entry point of the worker threads
+*
+* @param Context
+* Pointer to the worker
+*/
+#if defined(_WIN32)
+DWORD WINAPI CCompressionPool::WorkerThread(LPVOID Context)
+#else
+void* CCompressionPool::WorkerThread(void* Context)
+#endif
+{
+    PCAB_WORKER Worker = (PCAB_WORKER)Context;
+
+    Worker->Pool->CompressBlocks(Worker->Codec);
+
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+#endif /* CAB_READ_ONLY */
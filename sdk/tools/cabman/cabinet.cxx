@@ -100,6 +100,8 @@ CCabinet::CCabinet()
     MaxDiskSize  = 0;
     BlockIsSplit = false;
     ScratchFile  = NULL;
+    ThreadCount  = 0;
+    CompressionPool = NULL;
 
     FolderUncompSize = 0;
     BytesLeftInBlock = 0;
@@ -122,6 +124,14 @@ CCabinet::~CCabinet()
 
     if (CodecSelected)
         delete Codec;
+
+#ifndef CAB_READ_ONLY
+    if (CompressionPool)
+    {
+        CompressionPool->Destroy();
+        delete CompressionPool;
+    }
+#endif /* CAB_READ_ONLY */
 }
 
 bool CCabinet::IsSeparator(char Char)
@@ -1105,6 +1115,28 @@ bool CCabinet::IsCodecSelected()
     return CodecSelected;
 }
 
+CCABCodec* CreateCodec(LONG Id)
+/*
+ * FUNCTION: Creates an instance of a codec engine
+ * ARGUMENTS:
+ *     Id = Codec identifier
+ * RETURNS:
+ *     Pointer to the codec engine, NULL if the codec is not supported
+ */
+{
+    switch (Id)
+    {
+        case CAB_CODEC_RAW:
+            return new CRawCodec();
+
+        case CAB_CODEC_MSZIP:
+            return new CMSZipCodec();
+
+        default:
+            return NULL;
+    }
+}
+
 void CCabinet::SelectCodec(LONG Id)
 /*
  * FUNCTION: Selects codec engine to use
@@ -1121,19 +1153,9 @@ void CCabinet::SelectCodec(LONG Id)
         delete Codec;
     }
 
-    switch (Id)
-    {
-        case CAB_CODEC_RAW:
-            Codec = new CRawCodec();
-            break;
-
-        case CAB_CODEC_MSZIP:
-            Codec = new CMSZipCodec();
-            break;
-
-        default:
-            return;
-    }
+    Codec = CreateCodec(Id);
+    if (!Codec)
+        return;
 
     CodecId       = Id;
     CodecSelected = true;
@@ -1165,6 +1187,26 @@ ULONG CCabinet::NewCabinet()
     CurrentIBuffer     = InputBuffer;
     CurrentIBufferSize = 0;
 
+    /* Compress the data blocks on several threads unless told not to.
+       Storing them uncompressed is not worth handing them over */
+    if ((!CompressionPool) && (ThreadCount != 1) && (CodecId != CAB_CODEC_RAW))
+    {
+        CompressionPool = new CCompressionPool;
+        if (!CompressionPool)
+        {
+            DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+            return CAB_STATUS_NOMEMORY;
+        }
+
+        Status = CompressionPool->Create(CodecId, ThreadCount);
+        if (Status != CAB_STATUS_SUCCESS)
+        {
+            /* Fall back to compressing on this thread */
+            delete CompressionPool;
+            CompressionPool = NULL;
+        }
+    }
+
     CABHeader.Signature     = CAB_SIGNATURE;
     CABHeader.Reserved1     = 0;            // Not used
     CABHeader.CabinetSize   = 0;            // Not yet known
@@ -1246,8 +1288,15 @@ ULONG CCabinet::NewFolder()
  *     Status of operation
  */
 {
+    ULONG Status;
+
     DPRINT(MAX_TRACE, ("Creating new folder.\n"));
 
+    /* Queued data blocks belong to the current folder */
+    Status = FlushQueuedDataBlocks();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
     CurrentFolderNode = NewFolderNode();
     if (!CurrentFolderNode)
     {
@@ -1358,7 +1407,12 @@ ULONG CCabinet::WriteFileToScratchStorage(PCFFILE_NODE FileNode)
 
             if (CurrentIBufferSize == CAB_BLOCKSIZE)
             {
-                Status = WriteDataBlock();
+                /* Full blocks can be compressed ahead, as long as the disk
+                   size is not limited and no block can need to be split */
+                if ((CompressionPool) && (MaxDiskSize == 0))
+                    Status = QueueDataBlock();
+                else
+                    Status = WriteDataBlock();
                 if (Status != CAB_STATUS_SUCCESS)
                     return Status;
             }
@@ -1496,6 +1550,10 @@ ULONG CCabinet::CommitDisk(ULONG MoreDisks)
     PCFFOLDER_NODE FolderNode;
     ULONG Status;
 
+    Status = FlushQueuedDataBlocks();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
     OnCabinetName(CurrentDiskNumber, CabinetName);
 
     /* Create file, fail if it already exists */
@@ -1580,6 +1638,13 @@ ULONG CCabinet::CloseCabinet()
 {
     ULONG Status;
 
+    if (CompressionPool)
+    {
+        CompressionPool->Destroy();
+        delete CompressionPool;
+        CompressionPool = NULL;
+    }
+
     DestroyFileNodes();
 
     DestroyFolderNodes();
@@ -1837,6 +1902,17 @@ void CCabinet::SetMaxDiskSize(ULONG Size)
     MaxDiskSize = Size;
 }
 
+void CCabinet::SetThreadCount(ULONG Count)
+/*
+ * FUNCTION: Sets the number of threads used to compress data blocks
+ * ARGUMENTS:
+ *     Count = Number of threads (0 means one per processor, 1 means
+ *             compress on the calling thread only)
+ */
+{
+    ThreadCount = Count;
+}
+
 #endif /* CAB_READ_ONLY */
 
 
@@ -2984,6 +3060,11 @@ ULONG CCabinet::WriteDataBlock()
     ULONG BytesWritten;
     PCFDATA_NODE DataNode;
 
+    /* Write the blocks compressed ahead first to keep them in order */
+    Status = FlushQueuedDataBlocks();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
     if (!BlockIsSplit)
     {
         Status = Codec->Compress(OutputBuffer,
@@ -3060,6 +3141,120 @@ ULONG CCabinet::WriteDataBlock()
     return CAB_STATUS_SUCCESS;
 }
 
+
+ULONG CCabinet::QueueDataBlock()
+/*
+ * FUNCTION: Queues the current data block to be compressed by the
+ *           compression threads
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    ULONG Status;
+
+    ASSERT(CompressionPool != NULL);
+    ASSERT(!BlockIsSplit);
+
+    /* Make room for the block by writing the oldest one */
+    if (CompressionPool->IsFull())
+    {
+        Status = WriteQueuedDataBlock();
+        if (Status != CAB_STATUS_SUCCESS)
+            return Status;
+    }
+
+    /* The pool takes the input buffer and gives us a free one back */
+    Status = CompressionPool->QueueBlock(&InputBuffer, CurrentIBufferSize);
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
+    CurrentIBufferSize = 0;
+    CurrentIBuffer     = InputBuffer;
+
+    return CAB_STATUS_SUCCESS;
+}
+
+
+ULONG CCabinet::WriteQueuedDataBlock()
+/*
+ * FUNCTION: Writes the oldest queued data block to the scratch file
+ *           once it is compressed
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    ULONG Status;
+    ULONG BytesWritten;
+    PCFDATA_NODE DataNode;
+    PCAB_BLOCK_JOB Job;
+
+    Job = CompressionPool->WaitForOldestBlock();
+    if (Job->Status != CS_SUCCESS)
+    {
+        DPRINT(MIN_TRACE, ("Cannot compress block (%u).\n", (UINT)Job->Status));
+        return (Job->Status == CS_NOMEMORY) ? CAB_STATUS_NOMEMORY : CAB_STATUS_FAILURE;
+    }
+
+    DPRINT(MAX_TRACE, ("Block compressed. InputLength (%u)  OutputLength(%u).\n",
+        (UINT)Job->InputLength, (UINT)Job->OutputLength));
+
+    DataNode = NewDataNode(CurrentFolderNode);
+    if (!DataNode)
+    {
+        DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+        return CAB_STATUS_NOMEMORY;
+    }
+
+    /* Blocks are only queued when the disk size is not limited */
+    ASSERT(MaxDiskSize == 0);
+
+    DiskSize += sizeof(CFDATA);
+
+    DataNode->Data.CompSize   = (USHORT)Job->OutputLength;
+    DataNode->Data.UncompSize = (USHORT)Job->InputLength;
+    DataNode->Data.Checksum   = 0;
+    DataNode->ScratchFilePosition = ScratchFile->Position();
+
+    Status = ScratchFile->WriteBlock(&DataNode->Data,
+        Job->OutputBuffer, &BytesWritten);
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
+    DiskSize += BytesWritten;
+
+    CurrentFolderNode->TotalFolderSize += (BytesWritten + sizeof(CFDATA));
+    CurrentFolderNode->Folder.DataBlockCount++;
+
+    LastBlockStart += DataNode->Data.UncompSize;
+
+    CompressionPool->RetireOldestBlock();
+
+    return CAB_STATUS_SUCCESS;
+}
+
+
+ULONG CCabinet::FlushQueuedDataBlocks()
+/*
+ * FUNCTION: Writes all queued data blocks to the scratch file
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    ULONG Status;
+
+    if (!CompressionPool)
+        return CAB_STATUS_SUCCESS;
+
+    while (CompressionPool->QueuedBlocks() > 0)
+    {
+        Status = WriteQueuedDataBlock();
+        if (Status != CAB_STATUS_SUCCESS)
+            return Status;
+    }
+
+    return CAB_STATUS_SUCCESS;
+}
+
 #if !defined(_WIN32)
 
 void CCabinet::ConvertDateAndTime(time_t* Time,
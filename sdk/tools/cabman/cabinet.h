@@ -9,10 +9,14 @@
 
 #if defined(_WIN32)
     #define WIN32_LEAN_AND_MEAN
+    #ifndef _WIN32_WINNT
+    #define _WIN32_WINNT 0x0600 // For condition variables
+    #endif
     #include <windows.h>
 #else
     #include <typedefs.h>
     #include <unistd.h>
+    #include <pthread.h>
 #endif
 
 #include <errno.h>
@@ -291,6 +295,9 @@ public:
 #define CAB_CODEC_LZX   0x01
 #define CAB_CODEC_MSZIP 0x02
 
+/* Creates an instance of a codec engine */
+CCABCodec* CreateCodec(LONG Id);
+
 
 
 /* Classes */
@@ -316,6 +323,72 @@ private:
     FILE* FileHandle;
 };
 
+/* Maximum number of threads compressing data blocks */
+#define CAB_MAX_THREADS      32
+
+#if defined(_WIN32)
+typedef HANDLE CAB_THREAD;
+typedef CRITICAL_SECTION CAB_LOCK;
+typedef CONDITION_VARIABLE CAB_EVENT;
+#else
+typedef pthread_t CAB_THREAD;
+typedef pthread_mutex_t CAB_LOCK;
+typedef pthread_cond_t CAB_EVENT;
+#endif
+
+typedef struct _CAB_BLOCK_JOB
+{
+    void* InputBuffer;          // Uncompressed data block
+    ULONG InputLength;          // Number of uncompressed bytes
+    void* OutputBuffer;         // Compressed data block
+    ULONG OutputLength;         // Number of compressed bytes
+    ULONG Status;               // Codec status (CS_*)
+    bool  Done;                 // true when the block has been compressed
+} CAB_BLOCK_JOB, *PCAB_BLOCK_JOB;
+
+class CCompressionPool;
+
+typedef struct _CAB_WORKER
+{
+    CCompressionPool* Pool;
+    CCABCodec* Codec;           // Codec engine private to this thread
+    CAB_THREAD Thread;
+} CAB_WORKER, *PCAB_WORKER;
+
+class CCompressionPool
+{
+public:
+    /* Default constructor */
+    CCompressionPool();
+    /* Default destructor */
+    virtual ~CCompressionPool();
+    ULONG Create(LONG CodecId, ULONG ThreadCount);
+    void Destroy();
+    ULONG QueuedBlocks();
+    bool IsFull();
+    ULONG QueueBlock(void** Buffer, ULONG Length);
+    PCAB_BLOCK_JOB WaitForOldestBlock();
+    void RetireOldestBlock();
+private:
+#if defined(_WIN32)
+    static DWORD WINAPI WorkerThread(LPVOID Context);
+#else
+    static void* WorkerThread(void* Context);
+#endif
+    void CompressBlocks(CCABCodec* Codec);
+    ULONG WorkerCount;
+    CAB_WORKER Workers[CAB_MAX_THREADS];
+    ULONG JobCount;
+    PCAB_BLOCK_JOB Jobs;
+    ULONG OldestJob;            // Index of the oldest queued job
+    ULONG Queued;               // Number of queued jobs, in order from OldestJob
+    ULONG Started;              // Number of queued jobs taken by a worker
+    bool Shutdown;
+    CAB_LOCK Lock;
+    CAB_EVENT JobQueued;        // Signaled when a job is queued
+    CAB_EVENT JobDone;          // Signaled when a job is compressed
+};
+
 #endif /* CAB_READ_ONLY */
 
 class CCabinet
@@ -395,6 +468,8 @@ public:
     ULONG AddFile(char* FileName);
     /* Sets the maximum size of the current disk */
     void SetMaxDiskSize(ULONG Size);
+    /* Sets the number of threads used to compress data blocks */
+    void SetThreadCount(ULONG Count);
 #endif /* CAB_READ_ONLY */
 
     /* Default event handlers */
@@ -438,6 +513,9 @@ private:
     ULONG WriteFileEntries();
     ULONG CommitDataBlocks(PCFFOLDER_NODE FolderNode);
     ULONG WriteDataBlock();
+    ULONG QueueDataBlock();
+    ULONG WriteQueuedDataBlock();
+    ULONG FlushQueuedDataBlocks();
     ULONG GetAttributesOnFile(PCFFILE_NODE File);
     ULONG SetAttributesOnFile(char* FileName, USHORT FileAttributes);
     ULONG GetFileTimes(FILE* FileHandle, PCFFILE_NODE File);
@@ -503,6 +581,8 @@ private:
     ULONG TotalBytesLeft;
     bool BlockIsSplit;                  // true if current data block is split
     ULONG NextFolderNumber;     // Zero based folder number
+    ULONG ThreadCount;          // Number of threads compressing data blocks
+    CCompressionPool *CompressionPool;
 #endif /* CAB_READ_ONLY */
 };
 
@@ -34,7 +34,10 @@ public:
                              PULONG OutputLength);
 private:
     int Status;
-    z_stream ZStream; /* Zlib stream */
+    z_stream DeflateStream; /* Zlib stream used to compress */
+    z_stream InflateStream; /* Zlib stream used to uncompress */
+    bool DeflateInitialized;
+    bool InflateInitialized;
 };
 
 /* EOF */
@@ -77,6 +77,7 @@ VOID ClockUpdate(VOID)
 {
     extern BOOLEAN CpuRunning;
     UINT i;
+    ULONG Steps;
     PLIST_ENTRY Entry;
     PHARDWARE_TIMER Timer;
 
@@ -88,11 +89,11 @@ VOID ClockUpdate(VOID)
         NtQueryPerformanceCounter(&Counter, NULL);
         /// SetThreadAffinityMask(GetCurrentThread(), oldmask);
 
-        /* Continue CPU emulation */
-        for (i = 0; VdmRunning && CpuRunning && (i < STEPS_PER_CYCLE); i++)
+        /* Continue CPU emulation, the CPU returns early after BOPs */
+        for (i = 0; VdmRunning && CpuRunning && (i < STEPS_PER_CYCLE); i += Steps)
         {
-            CpuStep();
-            ++CurrentCycleCount;
+            Steps = CpuRun(STEPS_PER_CYCLE - i);
+            CurrentCycleCount += Steps;
         }
 
         Entry = Timers.Flink;
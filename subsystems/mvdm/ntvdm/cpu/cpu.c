@@ -39,6 +39,9 @@
 FAST486_STATE EmulatorContext;
 BOOLEAN CpuRunning = FALSE;
 
+/* Decoded code blocks, used by CpuRun */
+static FAST486_BLOCK_CACHE CpuBlockCache;
+
 /* No more than 'MaxCpuCallLevel' recursive CPU calls are allowed */
 static const INT MaxCpuCallLevel = 32;
 static INT CpuCallLevel = 0; // == 0: CPU stopped; >= 1: CPU running or halted
@@ -114,6 +117,12 @@ VOID CpuStep(VOID)
     Fast486StepInto(&EmulatorContext);
 }
 
+ULONG CpuRun(ULONG Count)
+{
+    /* Execute up to 'Count' instructions, stopping after a BOP */
+    return Fast486Run(&EmulatorContext, Count);
+}
+
 LONG CpuExceptionFilter(IN PEXCEPTION_POINTERS ExceptionInfo)
 {
     /* Get the exception record */
@@ -231,7 +240,8 @@ BOOLEAN CpuInitialize(VOID)
                       EmulatorBiosOperation,
                       EmulatorIntAcknowledge,
                       EmulatorFpu,
-                      NULL /* TODO: Use a TLB */);
+                      NULL /* TODO: Use a TLB */,
+                      &CpuBlockCache);
 
     /* Initialize the software callback system and register the emulator BOPs */
     // RegisterBop(BOP_DEBUGGER  , EmulatorDebugBreakBop);
@@ -65,6 +65,7 @@ VOID EmulatorException(BYTE ExceptionNumber, LPWORD Stack);
 
 VOID CpuExecute(WORD Segment, WORD Offset);
 VOID CpuStep(VOID);
+ULONG CpuRun(ULONG Count);
 VOID CpuSimulate(VOID);
 VOID CpuUnsimulate(VOID);
 #if 0
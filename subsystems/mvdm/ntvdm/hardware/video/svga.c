@@ -297,6 +297,40 @@ static COORD CurrResolution   = {0};
 
 static SMALL_RECT UpdateRectangle = { 0, 0, 0, 0 };
 
+/*
+ * Graphics mode dirty tracking -- VgaWriteMemory marks the pages of the VGA
+ * memory it writes to, and only the scanlines showing a modified page are
+ * converted again, unless the way the memory is displayed changed as well.
+ */
+#define VGA_PAGE_SHIFT      12
+#define VGA_NUM_PAGES       ((VGA_NUM_BANKS * SVGA_BANK_SIZE) >> VGA_PAGE_SHIFT)
+#define VGA_MAX_SCANLINE    (256 * 9)
+
+typedef struct _VGA_DISPLAY_STATE
+{
+    PVOID Framebuffer;
+    COORD Resolution;
+    DWORD StartAddress;
+    DWORD ScanlineSize;
+    BOOLEAN PaletteDisable;
+    BYTE SeqExtMode;
+    BYTE GcMode;
+    BYTE GcMisc;
+    BYTE CrtcRegisters[SVGA_CRTC_MAX_REG];
+    BYTE AcRegisters[VGA_AC_MAX_REG];
+} VGA_DISPLAY_STATE, *PVGA_DISPLAY_STATE;
+
+static BOOLEAN VgaDirtyPages[VGA_NUM_PAGES];
+static BOOLEAN VgaMemoryDirty = FALSE;
+static BOOLEAN VgaFullRedraw  = TRUE;
+static VGA_DISPLAY_STATE VgaDisplayState;
+
+/* One scanline of pixels, with room for the panning and a partial last group */
+static BYTE VgaScanline[VGA_MAX_SCANLINE + 16];
+
+/* Spreads the 8 bits of a plane byte to the low bit of 8 pixels, in memory order */
+static ULONGLONG VgaPlaneToPixels[256];
+
 
 
 
@@ -641,6 +675,9 @@ static BOOL VgaEnterNewMode(SCREEN_MODE NewScreenMode, PCOORD Resolution)
         /* The active framebuffer is now the graphics framebuffer */
         ActiveFramebuffer = GraphicsFramebuffer;
 
+        /* It doesn't hold anything yet, convert everything */
+        VgaFullRedraw = TRUE;
+
         /* Set the screen mode flag */
         ScreenMode = GRAPHICS_MODE;
 
@@ -733,9 +770,299 @@ static inline VOID VgaMarkForUpdate(SHORT Row, SHORT Column)
     NeedsUpdate = TRUE;
 }
 
+static inline VOID VgaMarkMemoryDirty(DWORD Offset, DWORD Size)
+{
+    DWORD Page, LastPage;
+
+    if (Size == 0) return;
+
+    LastPage = min((Offset + Size - 1) >> VGA_PAGE_SHIFT, VGA_NUM_PAGES - 1);
+    for (Page = Offset >> VGA_PAGE_SHIFT; Page <= LastPage; Page++)
+    {
+        VgaDirtyPages[Page] = TRUE;
+    }
+
+    VgaMemoryDirty = TRUE;
+}
+
+static inline BOOLEAN VgaIsMemoryDirty(DWORD Start, DWORD End)
+{
+    DWORD Page, LastPage;
+
+    /* The range wrapped around, don't bother */
+    if (End <= Start) return TRUE;
+
+    LastPage = min((End - 1) >> VGA_PAGE_SHIFT, VGA_NUM_PAGES - 1);
+    for (Page = Start >> VGA_PAGE_SHIFT; Page <= LastPage; Page++)
+    {
+        if (VgaDirtyPages[Page]) return TRUE;
+    }
+
+    return FALSE;
+}
+
+static BOOLEAN VgaDisplayStateChanged(VOID)
+{
+    VGA_DISPLAY_STATE NewState;
+
+    /* Gather everything the conversion of the VGA memory depends on */
+    RtlZeroMemory(&NewState, sizeof(NewState));
+    NewState.Framebuffer    = ActiveFramebuffer;
+    NewState.Resolution     = CurrResolution;
+    NewState.StartAddress   = StartAddressLatch;
+    NewState.ScanlineSize   = ScanlineSizeLatch;
+    NewState.PaletteDisable = VgaAcPalDisable;
+    NewState.SeqExtMode     = VgaSeqRegisters[SVGA_SEQ_EXT_MODE_REG];
+    NewState.GcMode         = VgaGcRegisters[VGA_GC_MODE_REG]
+                              & (VGA_GC_MODE_OE | VGA_GC_MODE_SHIFTREG | VGA_GC_MODE_SHIFT256);
+    NewState.GcMisc         = VgaGcRegisters[VGA_GC_MISC_REG];
+    RtlCopyMemory(NewState.CrtcRegisters, VgaCrtcRegisters, sizeof(VgaCrtcRegisters));
+    RtlCopyMemory(NewState.AcRegisters, VgaAcRegisters, sizeof(VgaAcRegisters));
+
+    if (RtlCompareMemory(&NewState, &VgaDisplayState, sizeof(NewState)) == sizeof(NewState))
+    {
+        return FALSE;
+    }
+
+    VgaDisplayState = NewState;
+    return TRUE;
+}
+
+static VOID VgaInitializePlaneTable(VOID)
+{
+    UINT i, j;
+
+    for (i = 0; i < ARRAYSIZE(VgaPlaneToPixels); i++)
+    {
+        VgaPlaneToPixels[i] = 0ULL;
+
+        /* The leftmost pixel is in the highest bit, and in the lowest byte */
+        for (j = 0; j < 8; j++)
+        {
+            if (i & (0x80 >> j)) VgaPlaneToPixels[i] |= 1ULL << (j * 8);
+        }
+    }
+}
+
+static inline PBYTE VgaConvertPlanarScanline(DWORD Address, SHORT Panning, DWORD AddressSize)
+{
+    SHORT j;
+    DWORD Offset;
+
+    /*
+     * 16 color planar modes (0Dh, 0Eh, 10h, 12h): each byte holds one bit of
+     * 8 pixels, so combine one byte of each plane into 8 pixels at once.
+     */
+    for (j = 0; j < CurrResolution.X + Panning; j += 8)
+    {
+        Offset = WRAP_OFFSET((Address + (j >> 3)) * AddressSize) * VGA_NUM_BANKS;
+
+        *(PULONGLONG)&VgaScanline[j] = VgaPlaneToPixels[VgaMemory[Offset]]
+                                       | (VgaPlaneToPixels[VgaMemory[Offset + 1]] << 1)
+                                       | (VgaPlaneToPixels[VgaMemory[Offset + 2]] << 2)
+                                       | (VgaPlaneToPixels[VgaMemory[Offset + 3]] << 3);
+    }
+
+    return &VgaScanline[Panning];
+}
+
+static inline PBYTE VgaConvertPackedScanline(DWORD Address, SHORT Panning, DWORD AddressSize)
+{
+    SHORT j;
+
+    /*
+     * 256 color modes (13h and the unchained "Mode X"): 4 consecutive pixels
+     * are the same byte of each plane, which is a whole DWORD of VGA memory.
+     */
+    for (j = 0; j < CurrResolution.X + Panning; j += VGA_NUM_BANKS)
+    {
+        *(PULONG)&VgaScanline[j] =
+            *(PULONG)&VgaMemory[WRAP_OFFSET((Address + (j / VGA_NUM_BANKS)) * AddressSize) * VGA_NUM_BANKS];
+    }
+
+    return &VgaScanline[Panning];
+}
+
+static PBYTE VgaConvertScanline(DWORD Address, SHORT Panning, DWORD AddressSize)
+{
+    SHORT j, k, X;
+
+    /* Loop through the pixels */
+    for (j = 0; j < CurrResolution.X; j++)
+    {
+        BYTE PixelData = 0;
+
+        /* Apply horizontal pixel panning */
+        X = j + Panning;
+
+        if (VgaSeqRegisters[SVGA_SEQ_EXT_MODE_REG] & SVGA_SEQ_EXT_MODE_HIGH_RES)
+        {
+            // TODO: Check for high color modes
+
+            /* 256 color mode */
+            PixelData = VgaMemory[Address + X];
+        }
+        else
+        {
+            /* Check the shifting mode */
+            if (VgaGcRegisters[VGA_GC_MODE_REG] & VGA_GC_MODE_SHIFT256)
+            {
+                /* 4 bits shifted from each plane */
+
+                /* Check if this is 16 or 256 color mode */
+                if (VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_8BIT)
+                {
+                    /* One byte per pixel */
+                    PixelData = VgaMemory[WRAP_OFFSET((Address + (X / VGA_NUM_BANKS)) * AddressSize)
+                                          * VGA_NUM_BANKS + (X % VGA_NUM_BANKS)];
+                }
+                else
+                {
+                    /* 4-bits per pixel */
+
+                    PixelData = VgaMemory[WRAP_OFFSET((Address + (X / (VGA_NUM_BANKS * 2))) * AddressSize)
+                                          * VGA_NUM_BANKS + ((X / 2) % VGA_NUM_BANKS)];
+
+                    /* Check if we should use the highest 4 bits or lowest 4 */
+                    if ((X % 2) == 0)
+                    {
+                        /* Highest 4 */
+                        PixelData >>= 4;
+                    }
+                    else
+                    {
+                        /* Lowest 4 */
+                        PixelData &= 0x0F;
+                    }
+                }
+            }
+            else if (VgaGcRegisters[VGA_GC_MODE_REG] & VGA_GC_MODE_SHIFTREG)
+            {
+                /* Check if this is 16 or 256 color mode */
+                if (VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_8BIT)
+                {
+                    // TODO: NOT IMPLEMENTED
+                    DPRINT1("8-bit interleaved mode is not implemented!\n");
+                }
+                else
+                {
+                    /*
+                     * 2 bits shifted from plane 0 and 2 for the first 4 pixels,
+                     * then 2 bits shifted from plane 1 and 3 for the next 4
+                     */
+                    DWORD BankNumber = (X / 4) % 2;
+                    DWORD Offset = Address + (X / 8);
+                    BYTE LowPlaneData = VgaMemory[WRAP_OFFSET(Offset * AddressSize) * VGA_NUM_BANKS + BankNumber];
+                    BYTE HighPlaneData = VgaMemory[WRAP_OFFSET(Offset * AddressSize) * VGA_NUM_BANKS + (BankNumber + 2)];
+
+                    /* Extract the two bits from each plane */
+                    LowPlaneData  = (LowPlaneData  >> (6 - ((X % 4) * 2))) & 0x03;
+                    HighPlaneData = (HighPlaneData >> (6 - ((X % 4) * 2))) & 0x03;
+
+                    /* Combine them into the pixel */
+                    PixelData = LowPlaneData | (HighPlaneData << 2);
+                }
+            }
+            else
+            {
+                /* 1 bit shifted from each plane */
+
+                /* Check if this is 16 or 256 color mode */
+                if (VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_8BIT)
+                {
+                    /* 8 bits per pixel, 2 on each plane */
+
+                    for (k = 0; k < VGA_NUM_BANKS; k++)
+                    {
+                        /* The data is on plane k, 4 pixels per byte */
+                        BYTE PlaneData = VgaMemory[WRAP_OFFSET((Address + (X >> 2)) * AddressSize) * VGA_NUM_BANKS + k];
+
+                        /* The mask of the first bit in the pair */
+                        BYTE BitMask = 1 << (((3 - (X % VGA_NUM_BANKS)) * 2) + 1);
+
+                        /* Bits 0, 1, 2 and 3 come from the first bit of the pair */
+                        if (PlaneData & BitMask) PixelData |= 1 << k;
+
+                        /* Bits 4, 5, 6 and 7 come from the second bit of the pair */
+                        if (PlaneData & (BitMask >> 1)) PixelData |= 1 << (k + 4);
+                    }
+                }
+                else
+                {
+                    /* 4 bits per pixel, 1 on each plane */
+
+                    for (k = 0; k < VGA_NUM_BANKS; k++)
+                    {
+                        BYTE PlaneData = VgaMemory[WRAP_OFFSET((Address + (X >> 3)) * AddressSize) * VGA_NUM_BANKS + k];
+
+                        /* If the bit on that plane is set, set it */
+                        if (PlaneData & (1 << (7 - (X % 8)))) PixelData |= 1 << k;
+                    }
+                }
+            }
+        }
+
+        VgaScanline[j] = PixelData;
+    }
+
+    return VgaScanline;
+}
+
+static VOID VgaCommitScanline(PBYTE GraphicsBuffer, SHORT Row, PBYTE Pixels)
+{
+    SHORT j, First = -1, Last = -1;
+    SHORT Width = CurrResolution.X;
+    PBYTE Line;
+
+    /* Take into account DoubleVision mode when checking for pixel updates */
+    if (DoubleWidth)
+    {
+        Line = &GraphicsBuffer[(DoubleHeight ? Row * 2 : Row) * Width * 2];
+
+        for (j = 0; j < Width; j++)
+        {
+            /* Check if the pixel data has changed */
+            if (Line[j * 2] == Pixels[j]) continue;
+
+            /* Yes, write the new value */
+            Line[j * 2] = Line[j * 2 + 1] = Pixels[j];
+
+            if (First < 0) First = j;
+            Last = j;
+        }
+
+        if (First < 0) return;
+
+        if (DoubleHeight)
+        {
+            /* Duplicate the changed part of the line */
+            RtlCopyMemory(&Line[(Width + First) * 2],
+                          &Line[First * 2],
+                          (Last - First + 1) * 2);
+        }
+    }
+    else
+    {
+        Line = &GraphicsBuffer[(DoubleHeight ? Row * 2 : Row) * Width];
+
+        /* Find the part of the line that has changed */
+        for (First = 0; First < Width && Line[First] == Pixels[First]; First++);
+        if (First == Width) return;
+        for (Last = Width - 1; Line[Last] == Pixels[Last]; Last--);
+
+        /* Write the new values */
+        RtlCopyMemory(&Line[First], &Pixels[First], Last - First + 1);
+        if (DoubleHeight) RtlCopyMemory(&Line[Width + First], &Pixels[First], Last - First + 1);
+    }
+
+    /* Mark the changed pixels */
+    VgaMarkForUpdate(Row, First);
+    VgaMarkForUpdate(Row, Last);
+}
+
 static VOID VgaUpdateFramebuffer(VOID)
 {
-    SHORT i, j, k;
+    SHORT i, j;
     DWORD AddressSize = VgaGetAddressSize();
     DWORD Address = StartAddressLatch;
     BYTE BytePanning = (VgaCrtcRegisters[VGA_CRTC_PRESET_ROW_SCAN_REG] >> 5) & 3;
@@ -756,7 +1083,19 @@ static VOID VgaUpdateFramebuffer(VOID)
         /* Graphics mode */
         PBYTE GraphicsBuffer = (PBYTE)ActiveFramebuffer;
         DWORD InterlaceHighBit = VGA_INTERLACE_HIGH_BIT;
-        SHORT X;
+        BOOLEAN HighRes = !!(VgaSeqRegisters[SVGA_SEQ_EXT_MODE_REG] & SVGA_SEQ_EXT_MODE_HIGH_RES);
+        BOOLEAN EightBit = !!(VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_8BIT);
+        BYTE ShiftMode = VgaGcRegisters[VGA_GC_MODE_REG] & (VGA_GC_MODE_SHIFTREG | VGA_GC_MODE_SHIFT256);
+        BYTE PaletteMap[16];
+        PBYTE Pixels;
+        SHORT Panning;
+        DWORD Start, End;
+
+        /* Check if the way the VGA memory is displayed has changed */
+        if (VgaDisplayStateChanged()) VgaFullRedraw = TRUE;
+
+        /* If it didn't, and nothing was written to it either, the frame is the same */
+        if (!VgaFullRedraw && !VgaMemoryDirty) return;
 
         /*
          * Synchronize access to the graphics framebuffer
@@ -781,6 +1120,31 @@ static VOID VgaUpdateFramebuffer(VOID)
             LineCompare /= 1 + (VgaCrtcRegisters[VGA_CRTC_MAX_SCAN_LINE_REG] & 0x1F);
         }
 
+        /*
+         * In 16 color mode, the value is an index to the AC registers
+         * if external palette access is disabled, otherwise (in case
+         * of palette loading) it is a blank pixel.
+         */
+        for (j = 0; j < ARRAYSIZE(PaletteMap); j++)
+        {
+            if (!VgaAcPalDisable)
+            {
+                PaletteMap[j] = 0;
+            }
+            else if (!(VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_P54S))
+            {
+                /* Bits 4 and 5 are taken from the palette register */
+                PaletteMap[j] = ((VgaAcRegisters[VGA_AC_COLOR_SEL_REG] << 4) & 0xC0)
+                                | (VgaAcRegisters[j] & 0x3F);
+            }
+            else
+            {
+                /* Bits 4 and 5 are taken from the color select register */
+                PaletteMap[j] = (VgaAcRegisters[VGA_AC_COLOR_SEL_REG] << 4)
+                                | (VgaAcRegisters[j] & 0x0F);
+            }
+        }
+
         /* Loop through the scanlines */
         for (i = 0; i < CurrResolution.Y; i++)
         {
@@ -806,211 +1170,50 @@ static VOID VgaUpdateFramebuffer(VOID)
                 Address |= InterlaceHighBit;
             }
 
-            /* Loop through the pixels */
-            for (j = 0; j < CurrResolution.X; j++)
+            /* Apply horizontal pixel panning */
+            if (EightBit) Panning = (PixelShift >> 1) & 0x03;
+            else Panning = (PixelShift < 8) ? PixelShift : -1;
+
+            /* Find the part of the VGA memory shown on this scanline */
+            if (HighRes)
             {
-                BYTE PixelData = 0;
+                Start = Address;
+                End = Address + CurrResolution.X + Panning;
+            }
+            else
+            {
+                /* There are at least 4 pixels per character clock */
+                Start = WRAP_OFFSET(Address * AddressSize) * VGA_NUM_BANKS;
+                End = (WRAP_OFFSET((Address + (CurrResolution.X + 15) / 4) * AddressSize) + 1)
+                      * VGA_NUM_BANKS;
+            }
 
-                /* Apply horizontal pixel panning */
-                if (VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_8BIT)
-                {
-                    X = j + ((PixelShift >> 1) & 0x03);
-                }
-                else
+            /* Only convert the scanline again if it may have changed */
+            if (VgaFullRedraw || (Panning < 0) || VgaIsMemoryDirty(Start, End))
+            {
+                if (!HighRes && (Panning >= 0) && (ShiftMode == VGA_GC_MODE_SHIFT256) && EightBit)
                 {
-                    X = j + ((PixelShift < 8) ? PixelShift : -1);
+                    Pixels = VgaConvertPackedScanline(Address, Panning, AddressSize);
                 }
-
-                if (VgaSeqRegisters[SVGA_SEQ_EXT_MODE_REG] & SVGA_SEQ_EXT_MODE_HIGH_RES)
+                else if (!HighRes && (Panning >= 0) && (ShiftMode == 0) && !EightBit)
                 {
-                    // TODO: Check for high color modes
-
-                    /* 256 color mode */
-                    PixelData = VgaMemory[Address + X];
+                    Pixels = VgaConvertPlanarScanline(Address, Panning, AddressSize);
                 }
                 else
                 {
-                    /* Check the shifting mode */
-                    if (VgaGcRegisters[VGA_GC_MODE_REG] & VGA_GC_MODE_SHIFT256)
-                    {
-                        /* 4 bits shifted from each plane */
-
-                        /* Check if this is 16 or 256 color mode */
-                        if (VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_8BIT)
-                        {
-                            /* One byte per pixel */
-                            PixelData = VgaMemory[WRAP_OFFSET((Address + (X / VGA_NUM_BANKS)) * AddressSize)
-                                                  * VGA_NUM_BANKS + (X % VGA_NUM_BANKS)];
-                        }
-                        else
-                        {
-                            /* 4-bits per pixel */
-
-                            PixelData = VgaMemory[WRAP_OFFSET((Address + (X / (VGA_NUM_BANKS * 2))) * AddressSize)
-                                                  * VGA_NUM_BANKS + ((X / 2) % VGA_NUM_BANKS)];
-
-                            /* Check if we should use the highest 4 bits or lowest 4 */
-                            if ((X % 2) == 0)
-                            {
-                                /* Highest 4 */
-                                PixelData >>= 4;
-                            }
-                            else
-                            {
-                                /* Lowest 4 */
-                                PixelData &= 0x0F;
-                            }
-                        }
-                    }
-                    else if (VgaGcRegisters[VGA_GC_MODE_REG] & VGA_GC_MODE_SHIFTREG)
-                    {
-                        /* Check if this is 16 or 256 color mode */
-                        if (VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_8BIT)
-                        {
-                            // TODO: NOT IMPLEMENTED
-                            DPRINT1("8-bit interleaved mode is not implemented!\n");
-                        }
-                        else
-                        {
-                            /*
-                             * 2 bits shifted from plane 0 and 2 for the first 4 pixels,
-                             * then 2 bits shifted from plane 1 and 3 for the next 4
-                             */
-                            DWORD BankNumber = (X / 4) % 2;
-                            DWORD Offset = Address + (X / 8);
-                            BYTE LowPlaneData = VgaMemory[WRAP_OFFSET(Offset * AddressSize) * VGA_NUM_BANKS + BankNumber];
-                            BYTE HighPlaneData = VgaMemory[WRAP_OFFSET(Offset * AddressSize) * VGA_NUM_BANKS + (BankNumber + 2)];
-
-                            /* Extract the two bits from each plane */
-                            LowPlaneData  = (LowPlaneData  >> (6 - ((X % 4) * 2))) & 0x03;
-                            HighPlaneData = (HighPlaneData >> (6 - ((X % 4) * 2))) & 0x03;
-
-                            /* Combine them into the pixel */
-                            PixelData = LowPlaneData | (HighPlaneData << 2);
-                        }
-                    }
-                    else
-                    {
-                        /* 1 bit shifted from each plane */
-
-                        /* Check if this is 16 or 256 color mode */
-                        if (VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_8BIT)
-                        {
-                            /* 8 bits per pixel, 2 on each plane */
-
-                            for (k = 0; k < VGA_NUM_BANKS; k++)
-                            {
-                                /* The data is on plane k, 4 pixels per byte */
-                                BYTE PlaneData = VgaMemory[WRAP_OFFSET((Address + (X >> 2)) * AddressSize) * VGA_NUM_BANKS + k];
-
-                                /* The mask of the first bit in the pair */
-                                BYTE BitMask = 1 << (((3 - (X % VGA_NUM_BANKS)) * 2) + 1);
-
-                                /* Bits 0, 1, 2 and 3 come from the first bit of the pair */
-                                if (PlaneData & BitMask) PixelData |= 1 << k;
-
-                                /* Bits 4, 5, 6 and 7 come from the second bit of the pair */
-                                if (PlaneData & (BitMask >> 1)) PixelData |= 1 << (k + 4);
-                            }
-                        }
-                        else
-                        {
-                            /* 4 bits per pixel, 1 on each plane */
-
-                            for (k = 0; k < VGA_NUM_BANKS; k++)
-                            {
-                                BYTE PlaneData = VgaMemory[WRAP_OFFSET((Address + (X >> 3)) * AddressSize) * VGA_NUM_BANKS + k];
-
-                                /* If the bit on that plane is set, set it */
-                                if (PlaneData & (1 << (7 - (X % 8)))) PixelData |= 1 << k;
-                            }
-                        }
-                    }
-                }
-
-                if (!(VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_8BIT))
-                {
-                    /*
-                     * In 16 color mode, the value is an index to the AC registers
-                     * if external palette access is disabled, otherwise (in case
-                     * of palette loading) it is a blank pixel.
-                     */
-
-                    if (VgaAcPalDisable)
-                    {
-                        if (!(VgaAcRegisters[VGA_AC_CONTROL_REG] & VGA_AC_CONTROL_P54S))
-                        {
-                            /* Bits 4 and 5 are taken from the palette register */
-                            PixelData = ((VgaAcRegisters[VGA_AC_COLOR_SEL_REG] << 4) & 0xC0)
-                                        | (VgaAcRegisters[PixelData & 0x0F] & 0x3F);
-                        }
-                        else
-                        {
-                            /* Bits 4 and 5 are taken from the color select register */
-                            PixelData = (VgaAcRegisters[VGA_AC_COLOR_SEL_REG] << 4)
-                                        | (VgaAcRegisters[PixelData & 0x0F] & 0x0F);
-                        }
-                    }
-                    else
-                    {
-                        PixelData = 0;
-                    }
-                }
-
-                /* Take into account DoubleVision mode when checking for pixel updates */
-                if (DoubleWidth && DoubleHeight)
-                {
-                    /* Now check if the resulting pixel data has changed */
-                    if (GraphicsBuffer[(i * 2 * CurrResolution.X * 2) + (j * 2)] != PixelData)
-                    {
-                        /* Yes, write the new value */
-                        GraphicsBuffer[(i * 2 * CurrResolution.X * 2) + (j * 2)] = PixelData;
-                        GraphicsBuffer[(i * 2 * CurrResolution.X * 2) + (j * 2 + 1)] = PixelData;
-                        GraphicsBuffer[((i * 2 + 1) * CurrResolution.X * 2) + (j * 2)] = PixelData;
-                        GraphicsBuffer[((i * 2 + 1) * CurrResolution.X * 2) + (j * 2 + 1)] = PixelData;
-
-                        /* Mark the specified pixel as changed */
-                        VgaMarkForUpdate(i, j);
-                    }
+                    Pixels = VgaConvertScanline(Address, Panning, AddressSize);
                 }
-                else if (DoubleWidth && !DoubleHeight)
-                {
-                    /* Now check if the resulting pixel data has changed */
-                    if (GraphicsBuffer[(i * CurrResolution.X * 2) + (j * 2)] != PixelData)
-                    {
-                        /* Yes, write the new value */
-                        GraphicsBuffer[(i * CurrResolution.X * 2) + (j * 2)] = PixelData;
-                        GraphicsBuffer[(i * CurrResolution.X * 2) + (j * 2 + 1)] = PixelData;
 
-                        /* Mark the specified pixel as changed */
-                        VgaMarkForUpdate(i, j);
-                    }
-                }
-                else if (!DoubleWidth && DoubleHeight)
+                if (!EightBit)
                 {
-                    /* Now check if the resulting pixel data has changed */
-                    if (GraphicsBuffer[(i * 2 * CurrResolution.X) + j] != PixelData)
+                    for (j = 0; j < CurrResolution.X; j++)
                     {
-                        /* Yes, write the new value */
-                        GraphicsBuffer[(i * 2 * CurrResolution.X) + j] = PixelData;
-                        GraphicsBuffer[((i * 2 + 1) * CurrResolution.X) + j] = PixelData;
-
-                        /* Mark the specified pixel as changed */
-                        VgaMarkForUpdate(i, j);
+                        Pixels[j] = PaletteMap[Pixels[j] & 0x0F];
                     }
                 }
-                else // if (!DoubleWidth && !DoubleHeight)
-                {
-                    /* Now check if the resulting pixel data has changed */
-                    if (GraphicsBuffer[i * CurrResolution.X + j] != PixelData)
-                    {
-                        /* Yes, write the new value */
-                        GraphicsBuffer[i * CurrResolution.X + j] = PixelData;
 
-                        /* Mark the specified pixel as changed */
-                        VgaMarkForUpdate(i, j);
-                    }
-                }
+                /* Update the framebuffer with the pixels that changed */
+                VgaCommitScanline(GraphicsBuffer, i, Pixels);
             }
 
             if ((VgaGcRegisters[VGA_GC_MISC_REG] & VGA_GC_MISC_OE) && (i & 1))
@@ -1026,6 +1229,11 @@ static VOID VgaUpdateFramebuffer(VOID)
             }
         }
 
+        /* Everything that was modified is now up to date */
+        RtlZeroMemory(VgaDirtyPages, sizeof(VgaDirtyPages));
+        VgaMemoryDirty = FALSE;
+        VgaFullRedraw = FALSE;
+
         /*
          * Release the console framebuffer mutex
          * so that we allow for repainting.
@@ -1999,6 +2207,7 @@ BOOLEAN FASTCALL VgaWriteMemory(ULONG Address, PVOID Buffer, ULONG Size)
         for (i = 0; i < Size; i++)
         {
             VideoAddress = VgaTranslateAddress(Address + i);
+            VgaMarkMemoryDirty(VideoAddress * VGA_NUM_BANKS, VGA_NUM_BANKS);
 
             for (j = 0; j < VGA_NUM_BANKS; j++)
             {
@@ -2040,6 +2249,7 @@ BOOLEAN FASTCALL VgaWriteMemory(ULONG Address, PVOID Buffer, ULONG Size)
         /* Just copy to the video memory */
         VideoAddress = VgaTranslateAddress(Address);
         VideoMemory = &VgaMemory[VideoAddress + (Address & 3)];
+        VgaMarkMemoryDirty(VideoAddress + (Address & 3), Size);
 
         switch (Size)
         {
@@ -2074,6 +2284,7 @@ BOOLEAN FASTCALL VgaWriteMemory(ULONG Address, PVOID Buffer, ULONG Size)
 VOID VgaClearMemory(VOID)
 {
     RtlZeroMemory(VgaMemory, sizeof(VgaMemory));
+    VgaFullRedraw = TRUE;
 }
 
 VOID VgaWriteTextModeFont(UINT FontNumber, CONST UCHAR* FontData, UINT Height)
@@ -2095,6 +2306,8 @@ VOID VgaWriteTextModeFont(UINT FontNumber, CONST UCHAR* FontData, UINT Height)
             VgaMemory[(i * VGA_MAX_FONT_HEIGHT + j) * VGA_NUM_BANKS + VGA_FONT_BANK] = 0;
         }
     }
+
+    VgaMarkMemoryDirty(0, VGA_FONT_SIZE * VGA_NUM_BANKS);
 }
 
 BOOLEAN VgaInitialize(HANDLE TextHandle)
@@ -2117,6 +2330,9 @@ BOOLEAN VgaInitialize(HANDLE TextHandle)
     /* Clear the VGA memory */
     VgaClearMemory();
 
+    /* Prepare the planar to packed pixel conversion */
+    VgaInitializePlaneTable();
+
     /* Register the I/O Ports */
     RegisterIoPort(0x3CC, VgaReadPort,         NULL);   // VGA_MISC_READ
     RegisterIoPort(0x3C2, VgaReadPort, VgaWritePort);   // VGA_MISC_WRITE, VGA_INSTAT0_READ
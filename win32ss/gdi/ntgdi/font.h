@@ -24,9 +24,14 @@ typedef struct _FONT_ENTRY_COLL_MEM
 
 typedef struct _FONT_CACHE_ENTRY
 {
-    LIST_ENTRY ListEntry;
+    LIST_ENTRY ListEntry;       /* Global LRU list */
+    LIST_ENTRY HashEntry;       /* Hash bucket chain */
+    LIST_ENTRY FaceListEntry;   /* LRU list of its face */
+    ULONG Hash;
+    ULONG Serial;               /* Pinned while it matches the current run */
+    SIZE_T Size;                /* Bytes charged to the cache budget */
     int GlyphIndex;
-    FT_Face Face;
+    PSHARED_FACE SharedFace;
     FT_BitmapGlyph BitmapGlyph;
     int Height;
     FT_Render_Mode RenderMode;
@@ -86,10 +86,29 @@ static BOOL             g_RenderingEnabled = TRUE;
 #define ASSERT_FREETYPE_LOCK_NOT_HELD() \
     ASSERT(g_FreeTypeLock->Owner != KeGetCurrentThread())
 
-#define MAX_FONT_CACHE 256
+/*
+ * The glyph cache is hashed on face, glyph index, height, render mode and
+ * transformation. It is bounded by a memory budget, which can be set in KB
+ * with the GlyphCacheSize value of the GRE_Initialize key, and no face may
+ * use more than half of it.
+ */
+#define FONT_CACHE_DEFAULT_BUDGET   (512 * 1024)
+#define FONT_CACHE_MIN_BUDGET       (64 * 1024)
+#define FONT_CACHE_MAX_BUDGET       (64 * 1024 * 1024)
+#define FONT_CACHE_BYTES_PER_BUCKET 512
+#define FONT_CACHE_MIN_BUCKETS      64
+
+/* GreExtTextOutW looks strings up to this length without allocating */
+#define GLYPH_RUN_BUFFER            32
 
 static LIST_ENTRY g_FontCacheListHead;
+static PLIST_ENTRY g_FontCacheHashTable;
+static ULONG g_FontCacheHashMask;
 static UINT g_FontCacheNumEntries;
+static SIZE_T g_FontCacheSize;
+static SIZE_T g_FontCacheBudget;
+static ULONG g_FontCacheSerial;
+static BOOL g_FontCacheRunActive;
 
 static PWCHAR g_ElfScripts[32] =   /* These are in the order of the fsCsb[0] bits */
 {
@@ -191,6 +210,8 @@ SharedFace_Create(FT_Face Face, PSHARED_MEM Memory)
         Ptr->Memory = Memory;
         SharedFaceCache_Init(&Ptr->EnglishUS);
         SharedFaceCache_Init(&Ptr->UserLanguage);
+        InitializeListHead(&Ptr->GlyphCacheListHead);
+        Ptr->GlyphCacheSize = 0;
 
         SharedMem_AddRef(Memory);
         DPRINT("Creating SharedFace for %s\n", Face->family_name ? Face->family_name : "<NULL>");
@@ -229,30 +250,29 @@ RemoveCachedEntry(PFONT_CACHE_ENTRY Entry)
 
     FT_Done_Glyph((FT_Glyph)Entry->BitmapGlyph);
     RemoveEntryList(&Entry->ListEntry);
+    RemoveEntryList(&Entry->HashEntry);
+    RemoveEntryList(&Entry->FaceListEntry);
+    Entry->SharedFace->GlyphCacheSize -= Entry->Size;
+    g_FontCacheSize -= Entry->Size;
     ExFreePoolWithTag(Entry, TAG_FONT);
     g_FontCacheNumEntries--;
-    ASSERT(g_FontCacheNumEntries <= MAX_FONT_CACHE);
 }
 
 static void
-RemoveCacheEntries(FT_Face Face)
+RemoveCacheEntries(PSHARED_FACE SharedFace)
 {
-    PLIST_ENTRY CurrentEntry;
     PFONT_CACHE_ENTRY FontEntry;
 
     ASSERT_FREETYPE_LOCK_HELD();
 
-    CurrentEntry = g_FontCacheListHead.Flink;
-    while (CurrentEntry != &g_FontCacheListHead)
+    while (!IsListEmpty(&SharedFace->GlyphCacheListHead))
     {
-        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, ListEntry);
-        CurrentEntry = CurrentEntry->Flink;
-
-        if (FontEntry->Face == Face)
-        {
-            RemoveCachedEntry(FontEntry);
-        }
+        FontEntry = CONTAINING_RECORD(SharedFace->GlyphCacheListHead.Flink,
+                                      FONT_CACHE_ENTRY, FaceListEntry);
+        RemoveCachedEntry(FontEntry);
     }
+
+    ASSERT(SharedFace->GlyphCacheSize == 0);
 }
 
 static void SharedMem_Release(PSHARED_MEM Ptr)
@@ -295,7 +315,7 @@ SharedFace_Release(PSHARED_FACE Ptr)
     if (Ptr->RefCount == 0)
     {
         DPRINT("Releasing SharedFace for %s\n", Ptr->Face->family_name ? Ptr->Face->family_name : "<NULL>");
-        RemoveCacheEntries(Ptr->Face);
+        RemoveCacheEntries(Ptr);
         FT_Done_Face(Ptr->Face);
         SharedMem_Release(Ptr->Memory);
         SharedFaceCache_Release(&Ptr->EnglishUS);
@@ -450,14 +470,59 @@ IntLoadFontSubstList(PLIST_ENTRY pHead)
     return NT_SUCCESS(Status);
 }
 
+static BOOL
+InitFontCache(VOID)
+{
+    HKEY hKey;
+    DWORD dwValue;
+    ULONG Buckets, i;
+
+    g_FontCacheBudget = FONT_CACHE_DEFAULT_BUDGET;
+    if (NT_SUCCESS(RegOpenKey(L"\\Registry\\Machine\\Software\\Microsoft\\Windows NT\\CurrentVersion\\GRE_Initialize",
+                              &hKey)))
+    {
+        if (RegReadDWORD(hKey, L"GlyphCacheSize", &dwValue))
+        {
+            dwValue = min(max(dwValue, FONT_CACHE_MIN_BUDGET / 1024), FONT_CACHE_MAX_BUDGET / 1024);
+            g_FontCacheBudget = (SIZE_T)dwValue * 1024;
+        }
+        ZwClose(hKey);
+    }
+
+    /* Size the hash table after the budget, in a power of two */
+    Buckets = FONT_CACHE_MIN_BUCKETS;
+    while (Buckets < g_FontCacheBudget / FONT_CACHE_BYTES_PER_BUCKET)
+        Buckets <<= 1;
+
+    g_FontCacheHashTable = ExAllocatePoolWithTag(PagedPool, Buckets * sizeof(LIST_ENTRY), TAG_FONT);
+    if (g_FontCacheHashTable == NULL)
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < Buckets; i++)
+        InitializeListHead(&g_FontCacheHashTable[i]);
+
+    g_FontCacheHashMask = Buckets - 1;
+    InitializeListHead(&g_FontCacheListHead);
+    g_FontCacheNumEntries = 0;
+    g_FontCacheSize = 0;
+
+    DPRINT("Glyph cache budget %Iu bytes, %lu buckets\n", g_FontCacheBudget, Buckets);
+    return TRUE;
+}
+
 BOOL FASTCALL
 InitFontSupport(VOID)
 {
     ULONG ulError;
 
     InitializeListHead(&g_FontListHead);
-    InitializeListHead(&g_FontCacheListHead);
-    g_FontCacheNumEntries = 0;
+    if (!InitFontCache())
+    {
+        return FALSE;
+    }
+
     /* Fast Mutexes must be allocated from non paged pool */
     g_FontListLock = ExAllocatePoolWithTag(NonPagedPool, sizeof(FAST_MUTEX), TAG_INTERNAL_SYNC);
     if (g_FontListLock == NULL)
@@ -2616,42 +2681,199 @@ SameScaleMatrix(
             FLOATOBJ_Equal(&pmx1->efM22, &pmx2->efM22));
 }
 
-FT_BitmapGlyph APIENTRY
-ftGdiGlyphCacheGet(
-    FT_Face Face,
+static
+ULONG
+FontCache_KeyHash(
+    PSHARED_FACE SharedFace,
+    INT Height,
+    FT_Render_Mode RenderMode,
+    PMATRIX pmx)
+{
+    const ULONG *pulMatrix = (const ULONG *)&pmx->efM11;
+    ULONG Hash = 2166136261u, i;
+
+    Hash = (Hash ^ (ULONG)((ULONG_PTR)SharedFace >> 3)) * 16777619;
+    Hash = (Hash ^ (ULONG)Height) * 16777619;
+    Hash = (Hash ^ (ULONG)RenderMode) * 16777619;
+
+    /* efM11 to efM22 follow each other, the translation doesn't matter */
+    for (i = 0; i < 4 * sizeof(FLOATOBJ) / sizeof(ULONG); i++)
+        Hash = (Hash ^ pulMatrix[i]) * 16777619;
+
+    return Hash;
+}
+
+static __inline
+ULONG
+FontCache_GlyphHash(ULONG KeyHash, INT GlyphIndex)
+{
+    ULONG Hash = (KeyHash ^ (ULONG)GlyphIndex) * 0x9E3779B1;
+    return Hash ^ (Hash >> 16);
+}
+
+static __inline
+BOOL
+FontCache_IsPinned(PFONT_CACHE_ENTRY Entry, PFONT_CACHE_ENTRY Keep)
+{
+    return (Entry == Keep) ||
+           (g_FontCacheRunActive && Entry->Serial == g_FontCacheSerial);
+}
+
+static
+PFONT_CACHE_ENTRY
+FontCache_Find(
+    PSHARED_FACE SharedFace,
+    ULONG Hash,
     INT GlyphIndex,
     INT Height,
     FT_Render_Mode RenderMode,
     PMATRIX pmx)
 {
-    PLIST_ENTRY CurrentEntry;
+    PLIST_ENTRY BucketHead, CurrentEntry;
     PFONT_CACHE_ENTRY FontEntry;
 
     ASSERT_FREETYPE_LOCK_HELD();
 
-    CurrentEntry = g_FontCacheListHead.Flink;
-    while (CurrentEntry != &g_FontCacheListHead)
+    BucketHead = &g_FontCacheHashTable[Hash & g_FontCacheHashMask];
+    for (CurrentEntry = BucketHead->Flink;
+         CurrentEntry != BucketHead;
+         CurrentEntry = CurrentEntry->Flink)
     {
-        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, ListEntry);
-        if ((FontEntry->Face == Face) &&
+        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, HashEntry);
+        if ((FontEntry->Hash == Hash) &&
+            (FontEntry->SharedFace == SharedFace) &&
             (FontEntry->GlyphIndex == GlyphIndex) &&
             (FontEntry->Height == Height) &&
             (FontEntry->RenderMode == RenderMode) &&
             (SameScaleMatrix(&FontEntry->mxWorldToDevice, pmx)))
-            break;
-        CurrentEntry = CurrentEntry->Flink;
+        {
+            /* Most recently used ones come first */
+            RemoveEntryList(&FontEntry->ListEntry);
+            InsertHeadList(&g_FontCacheListHead, &FontEntry->ListEntry);
+            RemoveEntryList(&FontEntry->FaceListEntry);
+            InsertHeadList(&SharedFace->GlyphCacheListHead, &FontEntry->FaceListEntry);
+
+            if (g_FontCacheRunActive)
+                FontEntry->Serial = g_FontCacheSerial;
+
+            return FontEntry;
+        }
     }
 
-    if (CurrentEntry == &g_FontCacheListHead)
+    return NULL;
+}
+
+/* Evicts the least recently used entries until the face (if any) and the whole
+   cache fit their budget again. Keep and the glyphs of the current run survive */
+static
+VOID
+FontCache_Trim(
+    PSHARED_FACE SharedFace,
+    PFONT_CACHE_ENTRY Keep)
+{
+    PLIST_ENTRY CurrentEntry;
+    PFONT_CACHE_ENTRY FontEntry;
+
+    ASSERT_FREETYPE_LOCK_HELD();
+
+    if (SharedFace)
     {
-        return NULL;
+        CurrentEntry = SharedFace->GlyphCacheListHead.Blink;
+        while (SharedFace->GlyphCacheSize > g_FontCacheBudget / 2 &&
+               CurrentEntry != &SharedFace->GlyphCacheListHead)
+        {
+            FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, FaceListEntry);
+            CurrentEntry = CurrentEntry->Blink;
+
+            if (!FontCache_IsPinned(FontEntry, Keep))
+                RemoveCachedEntry(FontEntry);
+        }
     }
 
-    RemoveEntryList(CurrentEntry);
-    InsertHeadList(&g_FontCacheListHead, CurrentEntry);
+    CurrentEntry = g_FontCacheListHead.Blink;
+    while (g_FontCacheSize > g_FontCacheBudget &&
+           CurrentEntry != &g_FontCacheListHead)
+    {
+        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, ListEntry);
+        CurrentEntry = CurrentEntry->Blink;
+
+        if (!FontCache_IsPinned(FontEntry, Keep))
+            RemoveCachedEntry(FontEntry);
+    }
+}
+
+FT_BitmapGlyph APIENTRY
+ftGdiGlyphCacheGet(
+    PSHARED_FACE SharedFace,
+    INT GlyphIndex,
+    INT Height,
+    FT_Render_Mode RenderMode,
+    PMATRIX pmx)
+{
+    PFONT_CACHE_ENTRY FontEntry;
+    ULONG Hash;
+
+    Hash = FontCache_GlyphHash(FontCache_KeyHash(SharedFace, Height, RenderMode, pmx),
+                               GlyphIndex);
+
+    FontEntry = FontCache_Find(SharedFace, Hash, GlyphIndex, Height, RenderMode, pmx);
+    if (!FontEntry)
+        return NULL;
+
     return FontEntry->BitmapGlyph;
 }
 
+/*
+ * Looks a whole string up at once. Glyphs[i] gets NULL for the glyphs which
+ * aren't cached yet. The glyphs found, and the ones cached until
+ * ftGdiGlyphCacheEndRun is called, are not evicted in between.
+ */
+VOID APIENTRY
+ftGdiGlyphCacheGetRun(
+    PSHARED_FACE SharedFace,
+    INT Height,
+    FT_Render_Mode RenderMode,
+    PMATRIX pmx,
+    ULONG Count,
+    const INT *GlyphIndices,
+    FT_BitmapGlyph *Glyphs)
+{
+    PFONT_CACHE_ENTRY FontEntry;
+    ULONG KeyHash, i;
+
+    ASSERT_FREETYPE_LOCK_HELD();
+    ASSERT(!g_FontCacheRunActive);
+
+    g_FontCacheSerial++;
+    g_FontCacheRunActive = TRUE;
+
+    KeyHash = FontCache_KeyHash(SharedFace, Height, RenderMode, pmx);
+    for (i = 0; i < Count; i++)
+    {
+        FontEntry = FontCache_Find(SharedFace,
+                                   FontCache_GlyphHash(KeyHash, GlyphIndices[i]),
+                                   GlyphIndices[i],
+                                   Height,
+                                   RenderMode,
+                                   pmx);
+        Glyphs[i] = FontEntry ? FontEntry->BitmapGlyph : NULL;
+    }
+}
+
+VOID APIENTRY
+ftGdiGlyphCacheEndRun(VOID)
+{
+    ASSERT_FREETYPE_LOCK_HELD();
+
+    if (!g_FontCacheRunActive)
+        return;
+
+    g_FontCacheRunActive = FALSE;
+
+    /* Whatever the run pinned may go now */
+    FontCache_Trim(NULL, NULL);
+}
+
 /* no cache */
 FT_BitmapGlyph APIENTRY
 ftGdiGlyphSet(
@@ -2696,7 +2918,7 @@ ftGdiGlyphSet(
 
 FT_BitmapGlyph APIENTRY
 ftGdiGlyphCacheSet(
-    FT_Face Face,
+    PSHARED_FACE SharedFace,
     INT GlyphIndex,
     INT Height,
     PMATRIX pmx,
@@ -2749,18 +2971,25 @@ ftGdiGlyphCacheSet(
     BitmapGlyph->bitmap = AlignedBitmap;
 
     NewEntry->GlyphIndex = GlyphIndex;
-    NewEntry->Face = Face;
+    NewEntry->SharedFace = SharedFace;
     NewEntry->BitmapGlyph = BitmapGlyph;
     NewEntry->Height = Height;
     NewEntry->RenderMode = RenderMode;
     NewEntry->mxWorldToDevice = *pmx;
+    NewEntry->Serial = g_FontCacheSerial;
+    NewEntry->Hash = FontCache_GlyphHash(FontCache_KeyHash(SharedFace, Height, RenderMode, pmx),
+                                         GlyphIndex);
+    NewEntry->Size = sizeof(FONT_CACHE_ENTRY) + sizeof(FT_BitmapGlyphRec) +
+                     (SIZE_T)abs(BitmapGlyph->bitmap.pitch) * BitmapGlyph->bitmap.rows;
 
     InsertHeadList(&g_FontCacheListHead, &NewEntry->ListEntry);
-    if (++g_FontCacheNumEntries > MAX_FONT_CACHE)
-    {
-        NewEntry = CONTAINING_RECORD(g_FontCacheListHead.Blink, FONT_CACHE_ENTRY, ListEntry);
-        RemoveCachedEntry(NewEntry);
-    }
+    InsertHeadList(&g_FontCacheHashTable[NewEntry->Hash & g_FontCacheHashMask], &NewEntry->HashEntry);
+    InsertHeadList(&SharedFace->GlyphCacheListHead, &NewEntry->FaceListEntry);
+    SharedFace->GlyphCacheSize += NewEntry->Size;
+    g_FontCacheSize += NewEntry->Size;
+    g_FontCacheNumEntries++;
+
+    FontCache_Trim(SharedFace, NewEntry);
 
     return BitmapGlyph;
 }
@@ -3623,7 +3852,7 @@ TextIntGetTextExtentPoint(PDC dc,
         if (EmuBold || EmuItalic)
             realglyph = NULL;
         else
-            realglyph = ftGdiGlyphCacheGet(face, glyph_index, plf->lfHeight,
+            realglyph = ftGdiGlyphCacheGet(FontGDI->SharedFace, glyph_index, plf->lfHeight,
                                            RenderMode, pmxWorldToDevice);
 
         if (EmuBold || EmuItalic || !realglyph)
@@ -3646,7 +3875,7 @@ TextIntGetTextExtentPoint(PDC dc,
             }
             else
             {
-                realglyph = ftGdiGlyphCacheSet(face,
+                realglyph = ftGdiGlyphCacheSet(FontGDI->SharedFace,
                                                glyph_index,
                                                plf->lfHeight,
                                                pmxWorldToDevice,
@@ -5117,6 +5346,10 @@ GreExtTextOutW(
     BOOL EmuBold, EmuItalic;
     int thickness;
     BOOL bResult;
+    INT GlyphIndexBuffer[GLYPH_RUN_BUFFER];
+    FT_BitmapGlyph GlyphBuffer[GLYPH_RUN_BUFFER];
+    PINT GlyphIndices = NULL;
+    FT_BitmapGlyph *CachedGlyphs = NULL;
 
     /* Check if String is valid */
     if ((Count > 0xFFFF) || (Count > 0 && String == NULL))
@@ -5299,6 +5532,40 @@ GreExtTextOutW(
     use_kerning = FT_HAS_KERNING(face);
     previous = 0;
 
+    /*
+     * Look the whole string up in the glyph cache at once.
+     */
+    if (!EmuBold && !EmuItalic && Count > 0)
+    {
+        if ((ULONG)Count <= RTL_NUMBER_OF(GlyphBuffer))
+        {
+            CachedGlyphs = GlyphBuffer;
+            GlyphIndices = GlyphIndexBuffer;
+        }
+        else
+        {
+            CachedGlyphs = ExAllocatePoolWithTag(PagedPool,
+                                                 Count * (sizeof(FT_BitmapGlyph) + sizeof(INT)),
+                                                 TAG_FONT);
+            if (CachedGlyphs)
+                GlyphIndices = (PINT)(CachedGlyphs + Count);
+        }
+
+        if (CachedGlyphs)
+        {
+            for (i = 0; i < Count; i++)
+            {
+                if (fuOptions & ETO_GLYPH_INDEX)
+                    GlyphIndices[i] = String[i];
+                else
+                    GlyphIndices[i] = FT_Get_Char_Index(face, String[i]);
+            }
+
+            ftGdiGlyphCacheGetRun(FontGDI->SharedFace, plf->lfHeight, RenderMode,
+                                  pmxWorldToDevice, Count, GlyphIndices, CachedGlyphs);
+        }
+    }
+
     /*
      * Process the horizontal alignment and modify XStart accordingly.
      */
@@ -5326,15 +5593,19 @@ GreExtTextOutW(
 
         for (i = iStart; i < Count; i++)
         {
-            if (fuOptions & ETO_GLYPH_INDEX)
+            if (GlyphIndices)
+                glyph_index = GlyphIndices[i];
+            else if (fuOptions & ETO_GLYPH_INDEX)
                 glyph_index = *TempText;
             else
                 glyph_index = FT_Get_Char_Index(face, *TempText);
 
-            if (EmuBold || EmuItalic)
+            if (CachedGlyphs)
+                realglyph = CachedGlyphs[i];
+            else if (EmuBold || EmuItalic)
                 realglyph = NULL;
             else
-                realglyph = ftGdiGlyphCacheGet(face, glyph_index, plf->lfHeight,
+                realglyph = ftGdiGlyphCacheGet(FontGDI->SharedFace, glyph_index, plf->lfHeight,
                                                RenderMode, pmxWorldToDevice);
             if (!realglyph)
             {
@@ -5355,16 +5626,19 @@ GreExtTextOutW(
                 }
                 else
                 {
-                    realglyph = ftGdiGlyphCacheSet(face,
+                    realglyph = ftGdiGlyphCacheSet(FontGDI->SharedFace,
                                                    glyph_index,
                                                    plf->lfHeight,
                                                    pmxWorldToDevice,
                                                    glyph,
                                                    RenderMode);
+                    if (CachedGlyphs)
+                        CachedGlyphs[i] = realglyph;
                 }
                 if (!realglyph)
                 {
                     DPRINT1("Failed to render glyph! [index: %d]\n", glyph_index);
+                    ftGdiGlyphCacheEndRun();
                     IntUnLockFreeType();
                     goto Cleanup;
                 }
@@ -5440,6 +5714,7 @@ GreExtTextOutW(
             if (error)
             {
                 DPRINT1("Failed to load and render glyph! [index: %d]\n", glyph_index);
+                ftGdiGlyphCacheEndRun();
                 IntUnLockFreeType();
                 goto Cleanup;
             }
@@ -5453,6 +5728,7 @@ GreExtTextOutW(
             if (!realglyph)
             {
                 DPRINT1("Failed to render glyph! [index: %d]\n", glyph_index);
+                ftGdiGlyphCacheEndRun();
                 IntUnLockFreeType();
                 goto Cleanup;
             }
@@ -5549,15 +5825,19 @@ GreExtTextOutW(
     BackgroundLeft = (RealXStart + 32) >> 6;
     for (i = 0; i < Count; ++i)
     {
-        if (fuOptions & ETO_GLYPH_INDEX)
+        if (GlyphIndices)
+            glyph_index = GlyphIndices[i];
+        else if (fuOptions & ETO_GLYPH_INDEX)
             glyph_index = String[i];
         else
             glyph_index = FT_Get_Char_Index(face, String[i]);
 
-        if (EmuBold || EmuItalic)
+        if (CachedGlyphs)
+            realglyph = CachedGlyphs[i];
+        else if (EmuBold || EmuItalic)
             realglyph = NULL;
         else
-            realglyph = ftGdiGlyphCacheGet(face, glyph_index, plf->lfHeight,
+            realglyph = ftGdiGlyphCacheGet(FontGDI->SharedFace, glyph_index, plf->lfHeight,
                                            RenderMode, pmxWorldToDevice);
         if (!realglyph)
         {
@@ -5580,12 +5860,14 @@ GreExtTextOutW(
             }
             else
             {
-                realglyph = ftGdiGlyphCacheSet(face,
+                realglyph = ftGdiGlyphCacheSet(FontGDI->SharedFace,
                                                glyph_index,
                                                plf->lfHeight,
                                                pmxWorldToDevice,
                                                glyph,
                                                RenderMode);
+                if (CachedGlyphs)
+                    CachedGlyphs[i] = realglyph;
             }
             if (!realglyph)
             {
@@ -5802,6 +6084,7 @@ GreExtTextOutW(
         pdcattr->ptlCurrent.x = DestRect.right - dc->ptlDCOrig.x;
     }
 
+    ftGdiGlyphCacheEndRun();
     IntUnLockFreeType();
 
     EXLATEOBJ_vCleanup(&exloRGB2Dst);
@@ -5809,6 +6092,9 @@ GreExtTextOutW(
 
 Cleanup:
 
+    if (CachedGlyphs && CachedGlyphs != GlyphBuffer)
+        ExFreePoolWithTag(CachedGlyphs, TAG_FONT);
+
     DC_vFinishBlit(dc, NULL);
 
     if (TextObj != NULL)
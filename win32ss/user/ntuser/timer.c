@@ -14,7 +14,26 @@ DBG_DEFAULT_CHANNEL(UserTimer);
 /* GLOBALS *******************************************************************/
 
 static LIST_ENTRY TimersListHead;
-static LONG TimeLast = 0;
+static ULONG TimersCount = 0;
+
+/* Timers are looked up by window and id, and by callback */
+#define TIMER_HASH_SIZE   256
+#define TIMER_HASH(pWnd, nID) \
+  ((((ULONG_PTR)(pWnd) >> 4) ^ (ULONG_PTR)(nID)) % TIMER_HASH_SIZE)
+#define TIMER_PFN_HASH(pfn) \
+  (((ULONG_PTR)(pfn) >> 4) % TIMER_HASH_SIZE)
+
+static LIST_ENTRY TimersHashTable[TIMER_HASH_SIZE];
+static LIST_ENTRY TimerProcsHashTable[TIMER_HASH_SIZE];
+
+/* Running timers in a binary min-heap, the next one to expire first */
+#define TIMER_HEAP_INITIAL_SIZE 64
+#define TIMER_NOT_QUEUED        ((ULONG)-1)
+#define TIMER_DUE_BEFORE(a, b)  ((LONG)((a)->msDue - (b)->msDue) < 0)
+
+static PTIMER *TimerHeap = NULL;
+static ULONG TimerHeapCount = 0;
+static ULONG TimerHeapSize = 0;
 
 /* Windows 2000 has room for 32768 window-less timers */
 #define NUM_WINDOW_LESS_TIMERS   32768
@@ -46,6 +65,156 @@ ERESOURCE TimerLock;
 
 
 /* FUNCTIONS *****************************************************************/
+static
+LONG
+FASTCALL
+IntGetTimerTime(VOID)
+{
+  LARGE_INTEGER TickCount;
+
+  KeQueryTickCount(&TickCount);
+  return MsqCalculateMessageTime(&TickCount);
+}
+
+static
+VOID
+FASTCALL
+TimerHeapSet(ULONG Index, PTIMER pTmr)
+{
+  TimerHeap[Index] = pTmr;
+  pTmr->iHeap = Index;
+}
+
+static
+VOID
+FASTCALL
+TimerHeapSiftUp(ULONG Index)
+{
+  PTIMER pTmr = TimerHeap[Index];
+  ULONG Parent;
+
+  while (Index > 0)
+  {
+     Parent = (Index - 1) / 2;
+     if (!TIMER_DUE_BEFORE(pTmr, TimerHeap[Parent]))
+        break;
+     TimerHeapSet(Index, TimerHeap[Parent]);
+     Index = Parent;
+  }
+  TimerHeapSet(Index, pTmr);
+}
+
+static
+VOID
+FASTCALL
+TimerHeapSiftDown(ULONG Index)
+{
+  PTIMER pTmr = TimerHeap[Index];
+  ULONG Child;
+
+  for (;;)
+  {
+     Child = Index * 2 + 1;
+     if (Child >= TimerHeapCount)
+        break;
+     if ((Child + 1 < TimerHeapCount) &&
+         TIMER_DUE_BEFORE(TimerHeap[Child + 1], TimerHeap[Child]))
+        Child++;
+     if (!TIMER_DUE_BEFORE(TimerHeap[Child], pTmr))
+        break;
+     TimerHeapSet(Index, TimerHeap[Child]);
+     Index = Child;
+  }
+  TimerHeapSet(Index, pTmr);
+}
+
+//
+// Queue the timer for its due time, or move it if it is queued already.
+// The heap always has room for all timers, see CreateTimer.
+//
+static
+VOID
+FASTCALL
+QueueTimer(PTIMER pTmr)
+{
+  if (pTmr->iHeap == TIMER_NOT_QUEUED)
+  {
+     ASSERT(TimerHeapCount < TimerHeapSize);
+     TimerHeapSet(TimerHeapCount++, pTmr);
+  }
+  else
+  {
+     TimerHeapSiftDown(pTmr->iHeap);
+  }
+  TimerHeapSiftUp(pTmr->iHeap);
+}
+
+static
+VOID
+FASTCALL
+DequeueTimer(PTIMER pTmr)
+{
+  ULONG Index = pTmr->iHeap;
+  PTIMER pLast;
+
+  if (Index == TIMER_NOT_QUEUED)
+     return;
+
+  pTmr->iHeap = TIMER_NOT_QUEUED;
+  pLast = TimerHeap[--TimerHeapCount];
+  if (pLast != pTmr)
+  {
+     TimerHeapSet(Index, pLast);
+     TimerHeapSiftDown(Index);
+     TimerHeapSiftUp(pLast->iHeap);
+  }
+}
+
+//
+// Program the master timer for the next timer to expire.
+//
+static
+VOID
+FASTCALL
+IntSetMasterTimer(LONG Time)
+{
+  LARGE_INTEGER DueTime;
+  LONG Delay = USER_TIMER_MAXIMUM;
+
+  if (TimerHeapCount)
+  {
+     Delay = TimerHeap[0]->msDue - Time;
+     if (Delay < 1) Delay = 1;
+  }
+
+  ASSERT(MasterTimer != NULL);
+  DueTime.QuadPart = Int32x32To64(Delay, -10000);
+  KeSetTimer(MasterTimer, DueTime, NULL);
+}
+
+static
+BOOL
+FASTCALL
+GrowTimerHeap(VOID)
+{
+  PTIMER *NewHeap;
+  ULONG NewSize;
+
+  NewSize = TimerHeapSize ? TimerHeapSize * 2 : TIMER_HEAP_INITIAL_SIZE;
+  NewHeap = ExAllocatePoolWithTag(PagedPool, NewSize * sizeof(PTIMER), USERTAG_TIMER);
+  if (!NewHeap)
+     return FALSE;
+
+  if (TimerHeap)
+  {
+     RtlCopyMemory(NewHeap, TimerHeap, TimerHeapCount * sizeof(PTIMER));
+     ExFreePoolWithTag(TimerHeap, USERTAG_TIMER);
+  }
+  TimerHeap = NewHeap;
+  TimerHeapSize = NewSize;
+  return TRUE;
+}
+
 static
 PTIMER
 FASTCALL
@@ -54,11 +223,21 @@ CreateTimer(VOID)
   HANDLE Handle;
   PTIMER Ret = NULL;
 
+  if ((TimersCount >= TimerHeapSize) && !GrowTimerHeap())
+  {
+     EngSetLastError(ERROR_NOT_ENOUGH_MEMORY);
+     return NULL;
+  }
+
   Ret = UserCreateObject(gHandleTable, NULL, NULL, &Handle, TYPE_TIMER, sizeof(TIMER));
   if (Ret)
   {
      Ret->head.h = Handle;
+     Ret->iHeap = TIMER_NOT_QUEUED;
+     InitializeListHead(&Ret->ptmrHashList);
+     InitializeListHead(&Ret->ptmrPfnList);
      InsertTailList(&TimersListHead, &Ret->ptmrList);
+     TimersCount++;
   }
 
   return Ret;
@@ -72,8 +251,11 @@ RemoveTimer(PTIMER pTmr)
   BOOL Ret = FALSE;
   if (pTmr)
   {
-     /* Set the flag, it will be removed when ready */
      RemoveEntryList(&pTmr->ptmrList);
+     RemoveEntryList(&pTmr->ptmrHashList);
+     RemoveEntryList(&pTmr->ptmrPfnList);
+     DequeueTimer(pTmr);
+     TimersCount--;
      if ((pTmr->pWnd == NULL) && (!(pTmr->flags & TMRF_SYSTEM))) // System timers are reusable.
      {
         UINT_PTR IDEvent;
@@ -97,14 +279,15 @@ FindTimer(PWND Window,
           UINT_PTR nID,
           UINT flags)
 {
-  PLIST_ENTRY pLE;
+  PLIST_ENTRY pLE, ListHead;
   PTIMER pTmr, RetTmr = NULL;
 
   TimerEnterExclusive();
-  pLE = TimersListHead.Flink;
-  while (pLE != &TimersListHead)
+  ListHead = &TimersHashTable[TIMER_HASH(Window, nID)];
+  pLE = ListHead->Flink;
+  while (pLE != ListHead)
   {
-    pTmr = CONTAINING_RECORD(pLE, TIMER, ptmrList);
+    pTmr = CONTAINING_RECORD(pLE, TIMER, ptmrHashList);
 
     if ( pTmr->nID == nID &&
          pTmr->pWnd == Window &&
@@ -125,21 +308,19 @@ PTIMER
 FASTCALL
 FindSystemTimer(PMSG pMsg)
 {
-  PLIST_ENTRY pLE;
-  PTIMER pTmr = NULL;
+  PWND Window = NULL;
+  PTIMER pTmr;
 
-  TimerEnterExclusive();
-  pLE = TimersListHead.Flink;
-  while (pLE != &TimersListHead)
+  if (pMsg->hwnd)
   {
-    pTmr = CONTAINING_RECORD(pLE, TIMER, ptmrList);
-
-    if ( pMsg->lParam == (LPARAM)pTmr->pfn &&
-         (pTmr->flags & TMRF_SYSTEM) )
-       break;
-
-    pLE = pLE->Flink;
+     Window = ValidateHwndNoErr(pMsg->hwnd);
+     if (!Window) return NULL;
   }
+
+  TimerEnterExclusive();
+  pTmr = FindTimer(Window, pMsg->wParam, TMRF_SYSTEM);
+  if (pTmr && pMsg->lParam != (LPARAM)pTmr->pfn)
+     pTmr = NULL;
   TimerLeave();
 
   return pTmr;
@@ -150,15 +331,16 @@ FASTCALL
 ValidateTimerCallback(PTHREADINFO pti,
                       LPARAM lParam)
 {
-  PLIST_ENTRY pLE;
+  PLIST_ENTRY pLE, ListHead;
   BOOL Ret = FALSE;
   PTIMER pTmr;
 
   TimerEnterExclusive();
-  pLE = TimersListHead.Flink;
-  while (pLE != &TimersListHead)
+  ListHead = &TimerProcsHashTable[TIMER_PFN_HASH(lParam)];
+  pLE = ListHead->Flink;
+  while (pLE != ListHead)
   {
-    pTmr = CONTAINING_RECORD(pLE, TIMER, ptmrList);
+    pTmr = CONTAINING_RECORD(pLE, TIMER, ptmrPfnList);
     if ( (lParam == (LPARAM)pTmr->pfn) &&
         !(pTmr->flags & (TMRF_SYSTEM|TMRF_RIT)) &&
          (pTmr->pti->ppi == pti->ppi) )
@@ -182,8 +364,7 @@ IntSetTimer( PWND Window,
 {
   PTIMER pTmr;
   UINT Ret = IDEvent;
-  LARGE_INTEGER DueTime;
-  DueTime.QuadPart = (LONGLONG)(-97656); // 1024hz .9765625 ms set to 10.0 ms
+  LONG Time;
 
 #if 0
   /* Windows NT/2k/XP behaviour */
@@ -213,6 +394,7 @@ IntSetTimer( PWND Window,
   if ((Window) && (IDEvent == 0))
      Ret = 1;
 
+  TimerEnterExclusive();
   pTmr = FindTimer(Window, IDEvent, Type);
 
   if ((!pTmr) && (Window == NULL) && (!(Type & TMRF_SYSTEM)))
@@ -224,6 +406,7 @@ IntSetTimer( PWND Window,
       if (IDEvent == (UINT_PTR) -1)
       {
          IntUnlockWindowlessTimerBitmap();
+         TimerLeave();
          ERR("Unable to find a free window-less timer id\n");
          EngSetLastError(ERROR_NO_SYSTEM_RESOURCES);
          ASSERT(FALSE);
@@ -239,7 +422,11 @@ IntSetTimer( PWND Window,
   if (!pTmr)
   {
      pTmr = CreateTimer();
-     if (!pTmr) return 0;
+     if (!pTmr)
+     {
+        TimerLeave();
+        return 0;
+     }
 
      if (Window && (Type & TMRF_TIFROMWND))
         pTmr->pti = Window->head.pti->pEThread->Tcb.Win32Thread;
@@ -252,22 +439,31 @@ IntSetTimer( PWND Window,
      }
 
      pTmr->pWnd    = Window;
-     pTmr->cmsCountdown = Elapse;
      pTmr->cmsRate = Elapse;
      pTmr->pfn     = TimerFunc;
      pTmr->nID     = IDEvent;
-     pTmr->flags   = Type|TMRF_INIT;
+     pTmr->flags   = Type;
+
+     InsertHeadList(&TimersHashTable[TIMER_HASH(Window, IDEvent)], &pTmr->ptmrHashList);
+     InsertHeadList(&TimerProcsHashTable[TIMER_PFN_HASH(TimerFunc)], &pTmr->ptmrPfnList);
   }
   else
   {
-     pTmr->cmsCountdown = Elapse;
      pTmr->cmsRate = Elapse;
   }
 
-  ASSERT(MasterTimer != NULL);
-  // Start the timer thread!
-  if (TimersListHead.Flink == TimersListHead.Blink) // There is only one timer
-     KeSetTimer(MasterTimer, DueTime, NULL);
+  Time = IntGetTimerTime();
+  pTmr->msDue = Time + Elapse;
+
+  if (!(pTmr->flags & TMRF_WAITING))
+  {
+     QueueTimer(pTmr);
+
+     // Wake up the timer thread earlier if this timer is the next one due.
+     if (TimerHeap[0] == pTmr)
+        IntSetMasterTimer(Time);
+  }
+  TimerLeave();
 
   return Ret;
 }
@@ -444,75 +640,58 @@ VOID
 FASTCALL
 ProcessTimers(VOID)
 {
-  LARGE_INTEGER TickCount, DueTime;
   LONG Time;
-  PLIST_ENTRY pLE;
   PTIMER pTmr;
+  BOOL Fire;
   LONG TimerCount = 0;
 
   TimerEnterExclusive();
-  pLE = TimersListHead.Flink;
-  KeQueryTickCount(&TickCount);
-  Time = MsqCalculateMessageTime(&TickCount);
+  Time = IntGetTimerTime();
 
-  DueTime.QuadPart = (LONGLONG)(-97656); // 1024hz .9765625 ms set to 10.0 ms
-
-  while(pLE != &TimersListHead)
+  // Only the expired timers are looked at, the next one due first.
+  while (TimerHeapCount && ((LONG)(TimerHeap[0]->msDue - Time) <= 0))
   {
-    pTmr = CONTAINING_RECORD(pLE, TIMER, ptmrList);
+    pTmr = TimerHeap[0];
     TimerCount++;
-    if (pTmr->flags & TMRF_WAITING)
+
+    ASSERT(pTmr->pti);
+    Fire = (!(pTmr->flags & TMRF_READY)) && (!(pTmr->pti->TIF_flags & TIF_INCLEANUP));
+
+    // Requeue the timer before calling out, the callback may kill it.
+    if (Fire && (pTmr->flags & TMRF_ONESHOT))
     {
-       pLE = pTmr->ptmrList.Flink;
-       pTmr = CONTAINING_RECORD(pLE, TIMER, ptmrList);
-       continue;
+       pTmr->flags |= TMRF_WAITING;
+       DequeueTimer(pTmr);
+    }
+    else
+    {
+       pTmr->msDue = Time + pTmr->cmsRate;
+       TimerHeapSiftDown(0);
     }
 
-    if (pTmr->flags & TMRF_INIT)
+    if (!Fire)
+       continue;
+
+    if (pTmr->flags & TMRF_RIT)
     {
-       pTmr->flags &= ~TMRF_INIT; // Skip this run.
+       // Hard coded call here, inside raw input thread.
+       pTmr->pfn(NULL, WM_SYSTIMER, pTmr->nID, (LPARAM)pTmr);
     }
     else
     {
-       if (pTmr->cmsCountdown < 0)
-       {
-          ASSERT(pTmr->pti);
-          if ((!(pTmr->flags & TMRF_READY)) && (!(pTmr->pti->TIF_flags & TIF_INCLEANUP)))
-          {
-             if (pTmr->flags & TMRF_ONESHOT)
-                pTmr->flags |= TMRF_WAITING;
-
-             if (pTmr->flags & TMRF_RIT)
-             {
-                // Hard coded call here, inside raw input thread.
-                pTmr->pfn(NULL, WM_SYSTIMER, pTmr->nID, (LPARAM)pTmr);
-             }
-             else
-             {
-                pTmr->flags |= TMRF_READY; // Set timer ready to be ran.
-                // Set thread message queue for this timer.
-                if (pTmr->pti)
-                {  // Wakeup thread
-                   pTmr->pti->cTimersReady++;
-                   ASSERT(pTmr->pti->pEventQueueServer != NULL);
-                   MsqWakeQueue(pTmr->pti, QS_TIMER, TRUE);
-                }
-             }
-          }
-          pTmr->cmsCountdown = pTmr->cmsRate;
+       pTmr->flags |= TMRF_READY; // Set timer ready to be ran.
+       // Set thread message queue for this timer.
+       if (pTmr->pti)
+       {  // Wakeup thread
+          pTmr->pti->cTimersReady++;
+          ASSERT(pTmr->pti->pEventQueueServer != NULL);
+          MsqWakeQueue(pTmr->pti, QS_TIMER, TRUE);
        }
-       else
-          pTmr->cmsCountdown -= Time - TimeLast;
     }
-
-    pLE = pLE->Flink;
   }
 
-  // Restart the timer thread!
-  ASSERT(MasterTimer != NULL);
-  KeSetTimer(MasterTimer, DueTime, NULL);
-
-  TimeLast = Time;
+  // Restart the timer thread for the next timer due!
+  IntSetMasterTimer(Time);
 
   TimerLeave();
   TRACE("TimerCount = %d\n", TimerCount);
@@ -593,7 +772,7 @@ NTSTATUS
 NTAPI
 InitTimerImpl(VOID)
 {
-   ULONG BitmapBytes;
+   ULONG BitmapBytes, i;
 
    /* Allocate FAST_MUTEX from non paged pool */
    Mutex = ExAllocatePoolWithTag(NonPagedPool, sizeof(FAST_MUTEX), TAG_INTERNAL_SYNC);
@@ -620,6 +799,11 @@ InitTimerImpl(VOID)
 
    ExInitializeResourceLite(&TimerLock);
    InitializeListHead(&TimersListHead);
+   for (i = 0; i < TIMER_HASH_SIZE; i++)
+   {
+      InitializeListHead(&TimersHashTable[i]);
+      InitializeListHead(&TimerProcsHashTable[i]);
+   }
 
    return STATUS_SUCCESS;
 }
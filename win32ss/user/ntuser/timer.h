@@ -4,10 +4,13 @@ typedef struct _TIMER
 {
   HEAD           head;
   LIST_ENTRY     ptmrList;
+  LIST_ENTRY     ptmrHashList; // Hashed by window and id
+  LIST_ENTRY     ptmrPfnList;  // Hashed by callback
   PTHREADINFO    pti;
   PWND           pWnd;         // hWnd
   UINT_PTR       nID;          // Specifies a nonzero timer identifier.
-  INT            cmsCountdown; // uElapse
+  LONG           msDue;        // Message time of the next expiration
+  ULONG          iHeap;        // Index in the due time heap
   INT            cmsRate;      // uElapse
   FLONG          flags;
   TIMERPROC      pfn;          // lpTimerFunc
@@ -32,6 +32,7 @@
 #define CONGUI_MIN_HEIGHT     10
 #define CONGUI_UPDATE_TIME    0
 #define CONGUI_UPDATE_TIMER   1
+#define CONGUI_REPAINT_TIMER  2
 
 #define CURSOR_BLINK_TIME 500
 
@@ -1358,6 +1359,40 @@ OnTimer(PGUI_CONSOLE_DATA GuiData)
     LeaveCriticalSection(&Console->Lock);
 }
 
+static VOID
+OnRepaintTimer(PGUI_CONSOLE_DATA GuiData)
+{
+    PCONSRV_CONSOLE Console = GuiData->Console;
+    RECT RepaintRect;
+
+    KillTimer(GuiData->hWindow, CONGUI_REPAINT_TIMER);
+
+    if (!ConDrvValidateConsoleUnsafe((PCONSOLE)Console, CONSOLE_RUNNING, TRUE)) return;
+
+    /* Flush the repaints that were deferred to this frame (see GuiWriteStream) */
+    if (GuiData->RepaintPending)
+    {
+        if (GuiData->RepaintAll)
+        {
+            InvalidateRect(GuiData->hWindow, NULL, FALSE);
+        }
+        else
+        {
+            SmallRectToRect(GuiData, &RepaintRect, &GuiData->RepaintRegion);
+            InvalidateRect(GuiData->hWindow, &RepaintRect, FALSE);
+        }
+
+        GuiData->RepaintPending  = FALSE;
+        GuiData->LastRepaintTime = GetTickCount();
+
+        /* Let the update timer bring the cursor into view */
+        GuiData->ActiveBuffer->CursorBlinkOn = TRUE;
+        SetTimer(GuiData->hWindow, CONGUI_UPDATE_TIMER, CONGUI_UPDATE_TIME, NULL);
+    }
+
+    LeaveCriticalSection(&Console->Lock);
+}
+
 static BOOL
 OnClose(PGUI_CONSOLE_DATA GuiData)
 {
@@ -1392,7 +1427,10 @@ OnNcDestroy(HWND hWnd)
     if (GuiData)
     {
         if (GuiData->IsWindowVisible)
+        {
             KillTimer(hWnd, CONGUI_UPDATE_TIMER);
+            KillTimer(hWnd, CONGUI_REPAINT_TIMER);
+        }
 
         /* Free the terminal framebuffer */
         if (GuiData->hMemDC ) DeleteDC(GuiData->hMemDC);
@@ -2220,7 +2258,10 @@ ConWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
             break;
 
         case WM_TIMER:
-            OnTimer(GuiData);
+            if (wParam == CONGUI_REPAINT_TIMER)
+                OnRepaintTimer(GuiData);
+            else
+                OnTimer(GuiData);
             break;
 
         case WM_PALETTECHANGED:
@@ -53,6 +53,11 @@ typedef struct _GUI_CONSOLE_DATA
 
     POINT OldCursor;
 
+    BOOL  RepaintPending;       /* A repaint was deferred to the next frame       */
+    BOOL  RepaintAll;           /* The whole view must be repainted (it scrolled) */
+    SMALL_RECT RepaintRegion;   /* Screen buffer region to repaint otherwise      */
+    DWORD LastRepaintTime;      /* Tick count of the last repaint                 */
+
     LONG_PTR WndStyle;
     LONG_PTR WndStyleEx;
     BOOL IsWndMax;
@@ -23,6 +23,10 @@
 #define CONGUI_UPDATE_TIME    0
 #define CONGUI_UPDATE_TIMER   1
 
+/* Repaints are coalesced to at most one per frame */
+#define CONGUI_FRAME_TIME     16
+#define CONGUI_REPAINT_TIMER  2
+
 #define PM_CREATE_CONSOLE     (WM_APP + 1)
 #define PM_DESTROY_CONSOLE    (WM_APP + 2)
 
@@ -91,6 +95,57 @@ InvalidateCell(PGUI_CONSOLE_DATA GuiData,
     DrawRegion(GuiData, &CellRect);
 }
 
+static VOID
+UnionRepaintRegion(PGUI_CONSOLE_DATA GuiData,
+                   SMALL_RECT* Region)
+{
+    PSMALL_RECT RepaintRegion = &GuiData->RepaintRegion;
+
+    RepaintRegion->Left   = min(RepaintRegion->Left  , Region->Left  );
+    RepaintRegion->Top    = min(RepaintRegion->Top   , Region->Top   );
+    RepaintRegion->Right  = max(RepaintRegion->Right , Region->Right );
+    RepaintRegion->Bottom = max(RepaintRegion->Bottom, Region->Bottom);
+}
+
+/*
+ * Returns FALSE if the region may be repainted right away. Otherwise
+ * the last frame is too recent: the region is added to the pending
+ * repaint, which the repaint timer flushes (see OnRepaintTimer).
+ * Must be called with the console lock held.
+ */
+static BOOL
+DeferRepaint(PGUI_CONSOLE_DATA GuiData,
+             SMALL_RECT* Region,
+             BOOL Scrolled)
+{
+    DWORD Now, Elapsed;
+
+    if (!GuiData->RepaintPending)
+    {
+        Now = GetTickCount();
+        Elapsed = Now - GuiData->LastRepaintTime;
+        if (Elapsed >= CONGUI_FRAME_TIME)
+        {
+            GuiData->LastRepaintTime = Now;
+            return FALSE;
+        }
+
+        GuiData->RepaintPending = TRUE;
+        GuiData->RepaintAll     = FALSE;
+        GuiData->RepaintRegion  = *Region;
+        SetTimer(GuiData->hWindow, CONGUI_REPAINT_TIMER, CONGUI_FRAME_TIME - Elapsed, NULL);
+    }
+    else
+    {
+        UnionRepaintRegion(GuiData, Region);
+    }
+
+    /* Scrolling moves everything on the screen */
+    if (Scrolled) GuiData->RepaintAll = TRUE;
+
+    return TRUE;
+}
+
 
 /******************************************************************************
  *                        GUI Terminal Initialization                         *
@@ -631,6 +686,8 @@ GuiDrawRegion(IN OUT PFRONTEND This,
     /* Do nothing if the window is hidden */
     if (!GuiData->IsWindowVisible) return;
 
+    if (DeferRepaint(GuiData, Region, FALSE)) return;
+
     DrawRegion(GuiData, Region);
 }
 
@@ -656,6 +713,18 @@ GuiWriteStream(IN OUT PFRONTEND This,
     Buff = GuiData->ActiveBuffer;
     if (GetType(Buff) != TEXTMODE_BUFFER) return;
 
+    if (DeferRepaint(GuiData, Region, ScrolledLines != 0))
+    {
+        SMALL_RECT CursorRect = { CursorStartX, CursorStartY, CursorStartX, CursorStartY };
+
+        /* The cursor cells are repainted along with the rest */
+        UnionRepaintRegion(GuiData, &CursorRect);
+        CursorRect.Left = CursorRect.Right  = Buff->CursorPosition.X;
+        CursorRect.Top  = CursorRect.Bottom = Buff->CursorPosition.Y;
+        UnionRepaintRegion(GuiData, &CursorRect);
+        return;
+    }
+
     if (0 != ScrolledLines)
     {
         ScrollRect.left = 0;